@@ -13,7 +13,21 @@
 extern "C" {
 #endif
 
+#ifdef __NDS__
 #include <nds/ndstypes.h>
+#else
+// Host builds don't have libnds, so define the few types the library uses
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+#endif
 
 /// @defgroup libxm7_types libXM7 definitions and types.
 /// @{
@@ -25,7 +39,8 @@ extern "C" {
 /// `XM7_UnloadMOD()`) should be called anyway to free the already allocated
 /// memory when the error code is greater than `0x07` (
 /// XM7_ERR_UNSUPPORTED_PATTERN_HEADER, XM7_ERR_INCOMPLETE_PATTERN,
-/// XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER and XM7_ERR_NOT_ENOUGH_MEMORY)
+/// XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER, XM7_ERR_READ_ERROR and
+/// XM7_ERR_NOT_ENOUGH_MEMORY)
 typedef enum {
     /// No error
     XM7_NO_ERROR                           = 0x00,
@@ -41,6 +56,8 @@ typedef enum {
     XM7_ERR_INCOMPLETE_PATTERN             = 0x09,
     /// Unsupported instrument header
     XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER  = 0x10,
+    /// The stream ended before the end of the module (see XM7_LoadXMStream())
+    XM7_ERR_READ_ERROR                     = 0x20,
     /// Not enough memory to allocate internal player structures
     XM7_ERR_NOT_ENOUGH_MEMORY              = 0x100
 } XM7_Error;
@@ -78,6 +95,281 @@ typedef enum {
     XM7_REPLAY_STYLE_PT  = XM7_REPLAY_STYLE_MOD_PLAYER | XM7_REPLAY_ONTHEFLYSAMPLECHANGE_FLAG
 } XM7_ReplayStyles;
 
+/// Ways of driving the ticks of the engine (see XM7_SetTimerMode()).
+typedef enum {
+    /// Default. The engine uses the ARM7 timer 0 and its IRQ to run the ticks.
+    XM7_TIMER_MODE_TIMER0   = 0,
+    /// The engine doesn't touch timer 0. The ticks only happen when XM7_Tick()
+    /// or XM7_AdvanceTicks() are called.
+    XM7_TIMER_MODE_EXTERNAL = 1
+} XM7_TimerModes;
+
+/// Registers that appear in register write traces (see XM7_SetTrace()).
+typedef enum {
+    /// REG_SOUNDXCNT
+    XM7_TRACE_REG_CNT    = 0,
+    /// REG_SOUNDXSAD
+    XM7_TRACE_REG_SAD    = 1,
+    /// REG_SOUNDXTMR
+    XM7_TRACE_REG_TMR    = 2,
+    /// REG_SOUNDXPNT
+    XM7_TRACE_REG_PNT    = 3,
+    /// REG_SOUNDXLEN
+    XM7_TRACE_REG_LEN    = 4,
+    /// REG_SOUNDXVOL
+    XM7_TRACE_REG_VOL    = 5,
+    /// REG_SOUNDXPAN
+    XM7_TRACE_REG_PAN    = 6,
+    /// Timer 0 period (ticks of F/1024), 0 = stopped
+    XM7_TRACE_REG_TIMER0 = 7,
+    /// High 32 bits of the sample address, written right before SAD on hosts
+    /// with 64 bit pointers (never on the DS)
+    XM7_TRACE_REG_SADHIGH = 8
+} XM7_TraceRegisters;
+
+/// Channel number used in trace records of registers that aren't per channel.
+#define XM7_TRACE_NO_CHANNEL    0xFF
+
+/// One register write.
+typedef struct {
+    u32 Tick;           // number of the tick that made the write
+    u8 Channel;         // DS hardware channel (0..15), or XM7_TRACE_NO_CHANNEL
+    u8 Register;        // XM7_TraceRegisters
+    u16 Reserved;
+    u32 Value;
+} XM7_TraceRecord_Type;
+
+/// Register write trace.
+///
+/// The records are stored in a ring buffer: when it's full, the oldest records
+/// are overwritten. The `Count` most recent records (or `Capacity` of them, if
+/// `Count` is bigger) end just before `Records[Position]`.
+typedef struct {
+    XM7_TraceRecord_Type *Records;  // buffer provided by the user
+    u32 Capacity;                   // number of records in the buffer
+    u32 Position;                   // where the next record will be written
+    u32 Count;                      // number of records written so far
+    u32 Tick;                       // number of ticks run so far
+} XM7_Trace_Type;
+
+/// Events recorded by the tracepoints of the engine (see XM7_SetTracepoints()).
+typedef enum {
+    /// A note starts. A = note (0..95) | instrument << 8, B = frequency in Hz
+    /// (0 if the note has no sample and the channel gets silenced)
+    XM7_TRACEPOINT_NOTE     = 0,
+    /// The sample changes on the fly. A = note | instrument << 8, B = length
+    /// of the loop of the new sample (0 if the channel gets silenced)
+    XM7_TRACEPOINT_SAMPLE   = 1,
+    /// An envelope changes state. A = state | envelope << 8 (envelope: 0 =
+    /// volume, 1 = panning; state: 0 = off, 1 = attack, 2 = sustain,
+    /// 3 = release), B = envelope point
+    XM7_TRACEPOINT_ENVELOPE = 2,
+    /// Pattern break or position jump (Bxx, Dxx). A = new position, B = new row
+    XM7_TRACEPOINT_JUMP     = 3,
+    /// Pattern loop (E6x) jumps back. A = row, B = loop count
+    XM7_TRACEPOINT_LOOP     = 4,
+    /// The song ends and restarts. A = restart position
+    XM7_TRACEPOINT_RESTART  = 5,
+    /// The BPM changes. A = BPM, B = timer 0 period (0 with external ticks)
+    XM7_TRACEPOINT_BPM      = 6
+} XM7_TracepointEvents;
+
+/// One tracepoint event.
+typedef struct {
+    u32 Tick;           // number of the tick, as in XM7_TraceRecord_Type
+    u8 Event;           // XM7_TracepointEvents
+    u8 Channel;         // module channel, or XM7_TRACE_NO_CHANNEL
+    u16 A;
+    u32 B;
+} XM7_TracepointRecord_Type;
+
+/// Tracepoint ring buffer.
+///
+/// The engine fills each record before it increments `Written`, so the buffer
+/// can be read while the module plays without any locking (see
+/// XM7_ReadTracepoints()).
+/// Record number `n` is stored in `Records[n & (Capacity - 1)]`.
+typedef struct {
+    XM7_TracepointRecord_Type *Records; // buffer provided by the user
+    u32 Capacity;                       // number of records, a power of two
+    volatile u32 Written;               // number of records written so far
+    u32 Tick;                           // number of ticks run so far
+} XM7_Tracepoints_Type;
+
+/// Number of effect types counted in XM7_EffectStats_Type (0..9 and A..Z).
+#define XM7_EFFECT_TYPES    36
+
+/// How often the engine runs each effect (see XM7_SetEffectStats()).
+///
+/// The first three fields are used to read and reset the counters while the
+/// module plays, use XM7_SnapshotEffectStats() and XM7_ResetEffectStats()
+/// instead of accessing them directly.
+typedef struct {
+    volatile u32 Sequence;          // odd while a tick updates the counters
+    volatile u32 ResetRequests;     // number of resets requested
+    volatile u32 Resets;            // number of resets done by the engine
+    u32 Ticks;                      // number of ticks counted
+    u32 Effects[XM7_EFFECT_TYPES];  // effect column, by effect type
+    u32 ExtendedEffects[16];        // Exy effects, by x
+    u32 VolumeColumn[16];           // volume column, by high nibble
+    u32 FreqCalculations;           // frequency calculations (CalculateFreq)
+    u32 EnvelopeCalculations;       // volume and panning envelope interpolations
+} XM7_EffectStats_Type;
+
+/// What the engine leaves out when the ticks take too long (see
+/// XM7_SetOverrunControl()). Each level includes the ones before it.
+typedef enum {
+    /// Full quality
+    XM7_DEGRADE_NONE             = 0,
+    /// Panning envelopes keep moving, but their value isn't recalculated
+    XM7_DEGRADE_PANNING_ENVELOPE = 1,
+    /// Instrument autovibrato only updates the pitch every other tick
+    XM7_DEGRADE_AUTOVIBRATO      = 2,
+    /// Channels at volume 0 don't get their pitch updated until they're
+    /// audible again
+    XM7_DEGRADE_CULL_SILENT      = 3
+} XM7_DegradeLevels;
+
+/// Tick overrun detection and control (see XM7_SetOverrunControl()).
+///
+/// Times are in units of `Frequency` per second: ticks of timer 0 (F/1024) on
+/// the DS, nanoseconds on host builds. The first two fields are set by the
+/// user, the rest is updated by the engine.
+typedef struct {
+    u32 Budget;             // part of the tick period the ticks may use, in
+                            // 1/256 units (0 = the whole period)
+    u32 MaxLevel;           // highest XM7_DegradeLevels allowed
+    u32 Frequency;          // time units per second
+    u32 Ticks;              // number of ticks checked
+    u32 Overruns;           // ticks that ended after the next one was due
+    u32 OverBudget;         // ticks that used more than the budget
+    u32 Level;              // current XM7_DegradeLevels
+    u32 LevelChanges;       // number of times the level has changed
+    u32 TicksAtLevel[4];    // number of ticks run at each level
+    u32 WorstTime;          // time of the tick with the highest load...
+    u32 WorstPeriod;        // ...and the tick period at that time
+} XM7_OverrunControl_Type;
+
+/// Memory used by a loaded module, in bytes (see XM7_GetMemoryUsage()).
+typedef struct {
+    u32 Patterns;           // pattern arrays
+    u32 Instruments;        // instrument structures
+    u32 SampleHeaders;      // sample structures
+    u32 SampleData;         // sample data, including PingPongUnroll
+    u32 PingPongUnroll;     // data added to convert ping-pong loops
+    u32 File;               // rest of the file kept by a module loaded in place
+    u32 AllocatorOverhead;  // estimate of the heap overhead of the allocations
+    u32 Total;              // all of the above (PingPongUnroll only once)
+    u32 Allocations;        // number of heap allocations
+} XM7_MemoryUsage_Type;
+
+/// What a module file has and needs, read from its headers (see XM7_ProbeXM()).
+typedef struct {
+    char ModuleName[21];    // zero-terminated
+    char TrackerName[21];   // zero-terminated
+    u8 IsMOD;               // 1 for a MOD, 0 for an XM
+    u8 NumberofChannels;
+    u16 NumberofPatterns;
+    u8 NumberofInstruments;
+    u16 NumberofSamples;    // samples in all the instruments
+    u16 ModuleLength;       // number of positions in the order table
+    u16 RestartPoint;
+    u8 FreqTable;           // 1 = linear frequencies, 0 = Amiga periods
+    u8 DefaultTempo;
+    u8 DefaultBPM;
+    u32 FileSize;           // bytes of the file the loaders read
+    u32 ArenaSize;          // what XM7_GetArenaSizeXM() returns
+    XM7_MemoryUsage_Type Memory; // what XM7_GetMemoryUsage() returns after
+                                 // XM7_LoadXM() or XM7_LoadMOD()
+} XM7_ModuleInfo_Type;
+
+/// What XM7_LoadXMSelection() and XM7_LoadMODSelection() load.
+typedef enum {
+    /// The whole module
+    XM7_SELECT_ALL         = 0,
+    /// Only the instruments, to use the module as a bank of sounds
+    XM7_SELECT_INSTRUMENTS = 1,
+    /// What can be played from a set of positions
+    XM7_SELECT_POSITIONS   = 2
+} XM7_SelectionModes;
+
+/// Parts of a module to load (see XM7_LoadXMSelection()).
+typedef struct {
+    u32 Mode;                   // XM7_SelectionModes
+    u8 Positions[256 / 8];      // positions to play from with XM7_SELECT_POSITIONS,
+                                // position n is bit (n & 7) of Positions[n >> 3]
+} XM7_Selection_Type;
+
+/// Kinds of blocks allocated by the loaders (see XM7_SetAllocator()).
+typedef enum {
+    /// Pattern data (XM7_SingleNoteArray_Type)
+    XM7_ALLOC_PATTERN       = 0,
+    /// Instrument structures (XM7_Instrument_Type)
+    XM7_ALLOC_INSTRUMENT    = 1,
+    /// Sample structures (XM7_Sample_Type)
+    XM7_ALLOC_SAMPLE        = 2,
+    /// Sample data, played by the DS sound hardware
+    XM7_ALLOC_SAMPLE_DATA   = 3,
+    /// The whole module, when it's loaded into an arena (see XM7_LoadXMArena())
+    XM7_ALLOC_ARENA         = 4,
+    /// The file given to XM7_LoadXMInPlace(), only ever freed
+    XM7_ALLOC_FILE          = 5
+} XM7_AllocCategories;
+
+/// Source of a module for XM7_LoadXMStream() and XM7_LoadMODStream().
+///
+/// `Read` copies up to `size` bytes from the current position of the file to
+/// `buffer` and returns how many bytes it has copied: less than `size` only at
+/// the end of the file or after an error. `Seek` moves the position forward by
+/// `offset` bytes and returns 0 on success. It can be NULL, then the bytes to
+/// skip are read and thrown away. `User` is passed unchanged to both functions.
+typedef struct {
+    u32 (*Read)(void *buffer, u32 size, void *User);
+    int (*Seek)(u32 offset, void *User);
+    void *User;
+} XM7_Stream_Type;
+
+/// Number of XM7_AllocCategories.
+#define XM7_ALLOC_CATEGORIES    6
+
+/// Memory allocator used by the loaders instead of malloc() and free().
+///
+/// The blocks returned by `Allocate` must be aligned to 8 bytes, like the ones
+/// of malloc(). `Allocate` returns NULL when there isn't enough memory, and the
+/// loader fails with XM7_ERR_NOT_ENOUGH_MEMORY. `User` is passed unchanged to
+/// both functions.
+typedef struct {
+    void *(*Allocate)(u32 size, XM7_AllocCategories category, void *User);
+    void (*Free)(void *ptr, XM7_AllocCategories category, void *User);
+    void *User;
+} XM7_Allocator_Type;
+
+/// Number of buckets of the histogram of XM7_HandlerStats_Type.
+#define XM7_HANDLER_HISTOGRAM_BUCKETS   32
+
+/// Time spent running ticks (see XM7_SetHandlerStats()).
+///
+/// Times are in units of `Frequency` per second: ARM7 cycles (the bus clock)
+/// on the DS, nanoseconds on host builds. A row tick is the first tick of a
+/// row, the one that reads the pattern and triggers the notes. The means are
+/// left to the reader: `Total / Ticks`, `RowTotal / RowTicks` and so on.
+typedef struct {
+    u32 Frequency;          // time units per second
+    u32 Ticks;              // number of ticks measured
+    u32 Min;                // shortest tick
+    u32 Max;                // longest tick
+    u64 Total;              // time of all the ticks
+    u32 Last;               // time of the last tick
+    u32 RowTicks;           // number of row ticks
+    u32 RowMax;             // longest row tick
+    u32 MidRowMax;          // longest tick that wasn't a row tick
+    u64 RowTotal;           // time of the row ticks
+    u64 MidRowTotal;        // time of the other ticks
+    // Histogram[i] counts the ticks that took from 2^i to 2^(i+1)-1 units
+    // (ticks that took 0 units are counted in Histogram[0])
+    u32 Histogram[XM7_HANDLER_HISTOGRAM_BUCKETS];
+} XM7_HandlerStats_Type;
+
 typedef struct {
     u8 Note;            // 0 = no note; 1..96 = C-0...B-7; 97 = key off
     u8 Instrument;      // 0 or 1..128
@@ -119,6 +411,8 @@ typedef struct {
     s8 FineTune;        //  (finetune, in 128th of an half-tone)
 
     u8 Flags;           //  bit 0: it has a loop
+                        //  bit 3: it had a ping-pong loop, the loader added
+                        //         a reversed copy of it
                         //  bit 4: it's a 16 bit sample
 
 } XM7_Sample_Type;
@@ -273,6 +567,8 @@ typedef struct {
     s8 CurrentFinetuneOverride[16];         // this is the value for overriding finetune
     u8 CurrentFinetuneOverrideOn[16];       // the flag...
 
+    u32 CurrentRandomSeed;                  // state of the generator of the random waveforms (E4x/E7x)
+
     u8 Effect1xxMemory[16]; // the memory for the 1xx effect             [0x00..0xFF]
     u8 Effect2xxMemory[16]; // the memory for the 2xx effect             [0x00..0xFF]
     u8 Effect3xxMemory[16]; // the memory for the 3xx effect (and Mx)    [0x00..0xFF]
@@ -297,13 +593,49 @@ typedef struct {
     char ModuleName[20];
     char TrackerName[20];
 
+    // -
+
+    void *Arena;            // the block all the module is carved from (see XM7_LoadXMArena()), or NULL
+    u32 ArenaSize;          // its size in bytes
+    u8 ArenaOwned;          // 1 if the loader allocated it, 0 if it belongs to the caller
+
+    const XM7_Allocator_Type *Allocator;    // allocator of all the blocks above, NULL for malloc()
+
+    void *File;             // the file the sample data is in (see XM7_LoadXMInPlace()), or NULL
+    u32 FileSize;           // its size in bytes
+    u8 FileOwned;           // 1 if the module frees it, 0 if it belongs to the caller
+
 } XM7_ModuleManager_Type;
 
+/// State of a module being loaded a piece at a time (see XM7_LoadXMStart()).
+///
+/// `Done` and `Total` tell how far the load is, the other fields are only used
+/// by the loader.
+typedef struct {
+    u32 Done;               // bytes of the file loaded so far
+    u32 Total;              // bytes of the file to load
+
+    XM7_ModuleManager_Type *Module;
+    const u8 *Next;         // next byte of the file to load
+    u32 Offset;             // bytes of the current sample loaded so far
+    u16 Patterns;           // patterns and instruments in the file
+    u16 Instruments;
+    u16 Index;              // current instrument (MOD only)
+    u8 Sample;              // current sample of the instrument
+    u8 Stage;
+    u8 IsMOD;
+    u8 FLT8;
+    s16 Delta;              // last value of the delta decoding of the sample
+    XM7_Error Error;
+} XM7_Loader_Type;
+
 /// @}
 /// @defgroup libxm7_arm7 libXM7 ARM7 functions.
 /// @{
 
-#ifdef ARM7
+// The ARM7 part of the library is also available in host builds, where it
+// talks to the backend installed with XM7_SetBackend() (see libxm7_host.h).
+#if defined(ARM7) || !defined(__NDS__)
 
 /// Perform initialization of the library.
 ///
@@ -341,7 +673,120 @@ void XM7_PlayModuleFromPos(XM7_ModuleManager_Type *TheModule, u8 position);
 /// It abruptly interrupts every sample of the module being played.
 void XM7_StopModule(void);
 
-#endif // ARM7
+/// Select how the ticks of the engine are driven.
+///
+/// By default the engine programs the ARM7 timer 0 and runs one tick on each
+/// timer IRQ. With `XM7_TIMER_MODE_EXTERNAL` timer 0 is left alone and the
+/// ticks only happen when you call XM7_Tick() or XM7_AdvanceTicks(), so the
+/// engine can be driven from the VBlank IRQ, from your own scheduler or from a
+/// loop. It's up to you to keep the right pace: at the current BPM of the
+/// module (`CurrentBPM`) there are `CurrentBPM * 2 / 5` ticks per second (so
+/// a VBlank IRQ matches exactly 150 BPM).
+///
+/// The mode has to be set before calling XM7_PlayModule() and it can't be
+/// changed until the module has been stopped.
+///
+/// @param mode
+///     Timer mode.
+void XM7_SetTimerMode(XM7_TimerModes mode);
+
+/// Run one tick of the module being played.
+///
+/// It does nothing if no module is playing.
+void XM7_Tick(void);
+
+/// Run a number of ticks of the module being played, one after the other.
+///
+/// @param n
+///     Number of ticks.
+void XM7_AdvanceTicks(u32 n);
+
+/// Record all the writes to the sound and timer registers in a trace.
+///
+/// Every write gets recorded with the number of the tick that made it. The
+/// first tick is 1, writes made by XM7_PlayModule() get the number of the last
+/// tick run (0 at the start) and writes made by XM7_StopModule() get the number
+/// of the tick that would have come next. This is useful to measure the register
+/// traffic or to replay what happened somewhere else, even without the module.
+///
+/// The trace structure and its buffer must be initialized by the caller, and
+/// they must stay valid until tracing is disabled. On the DS they have to be in
+/// main RAM, and the ARM9 has to invalidate its data cache before reading them.
+///
+/// @param trace
+///     Trace to write to, or NULL to stop tracing.
+void XM7_SetTrace(XM7_Trace_Type *trace);
+
+/// Measure the time spent running each tick.
+///
+/// On the DS the time is read with cpuGetTiming(), so cpuStartTiming() must
+/// have been called on the ARM7 before enabling the statistics (it takes two
+/// timers: the one passed to it and the next one, and neither can be timer 0
+/// unless the engine runs in `XM7_TIMER_MODE_EXTERNAL`). On host builds the
+/// monotonic clock is used instead.
+///
+/// The structure must be cleared by the caller before passing it, and it can
+/// be cleared again at any time to restart the measurements. It must stay valid
+/// until the statistics are disabled. On the DS it has to be in main RAM, and
+/// the ARM9 has to invalidate its data cache before reading it.
+///
+/// @param stats
+///     Statistics to update, or NULL to stop measuring.
+void XM7_SetHandlerStats(XM7_HandlerStats_Type *stats);
+
+/// Record the decisions of the engine in a tracepoint ring buffer.
+///
+/// The tracepoints (note triggers, sample changes, envelope states, jumps,
+/// loops and BPM changes) are only compiled in when the library is built with
+/// `XM7_TRACEPOINTS` defined (`make arm7 XM7_TRACEPOINTS=1`; host builds always
+/// have them). Otherwise they cost nothing and this function does nothing.
+///
+/// The structure must be cleared and given a buffer by the caller, and it must
+/// stay valid until the tracepoints are disabled. On the DS it has to be in
+/// main RAM.
+///
+/// @param tracepoints
+///     Ring buffer to write to, or NULL to stop recording.
+void XM7_SetTracepoints(XM7_Tracepoints_Type *tracepoints);
+
+/// Count how many times each effect and volume column command runs, and how
+/// many frequency and envelope calculations the ticks need.
+///
+/// Every run of an effect counts, so an effect that works on every tick of a
+/// row counts once per tick. The structure must be cleared by the caller before
+/// passing it, and it must stay valid until the counters are disabled. On the
+/// DS it has to be in main RAM. Use XM7_SnapshotEffectStats() to read it and
+/// XM7_ResetEffectStats() to clear it while the module plays.
+///
+/// @param stats
+///     Counters to update, or NULL to stop counting.
+void XM7_SetEffectStats(XM7_EffectStats_Type *stats);
+
+/// Detect ticks that take longer than the tick period, and lower the quality
+/// of the replay to make the ticks shorter when that happens.
+///
+/// The time of a tick is measured from the moment timer 0 overflows, so it
+/// includes the time the IRQ waited for other IRQs. A tick is an overrun if
+/// timer 0 overflows again before it ends. When a tick uses more than `Budget`
+/// of the period (or overruns) the engine moves to the next degradation level,
+/// up to `MaxLevel`. After 64 ticks in a row that use less than half of the
+/// budget it moves back to the previous level. Timer 0 is never stopped or
+/// reprogrammed because of an overrun, so the tempo doesn't change: a late tick
+/// is followed right away by the next one.
+///
+/// On the DS this only works with `XM7_TIMER_MODE_TIMER0`. On host builds the
+/// time of each tick is compared with the tick period at the current BPM.
+///
+/// The structure must be cleared by the caller, who then sets `Budget` and
+/// `MaxLevel` (`MaxLevel` 0 only detects and counts the overruns). It must stay
+/// valid until the control is disabled. On the DS it has to be in main RAM.
+///
+/// @param control
+///     Overrun control structure, or NULL to disable it (and go back to full
+///     quality).
+void XM7_SetOverrunControl(XM7_OverrunControl_Type *control);
+
+#endif // defined(ARM7) || !defined(__NDS__)
 
 /// @}
 /// @defgroup libxm7_arm9 libXM7 ARM9 functions.
@@ -355,10 +800,10 @@ void XM7_StopModule(void);
 /// Both parameters are pointers; the first one should point to an already
 /// allocated structure where this function will load the XM module, whereas the
 /// second is the pointer to a copy in memory of a whole XM file. This function
-/// uses `malloc()` to allocate space for patterns, instruments and samples into
-/// the heap. Unlike the other functions, this function does return a value,
-/// which is 0 when the loading is successful and a different value when the
-/// loading has a different outcome.
+/// uses `malloc()` (or the allocator set with XM7_SetAllocator()) to allocate
+/// space for patterns, instruments and samples into the heap. Unlike the other
+/// functions, this function does return a value, which is 0 when the loading is
+/// successful and a different value when the loading has a different outcome.
 ///
 /// @param Module
 ///     Pointer to an allocated XM7_ModuleManager_Type structure.
@@ -382,10 +827,10 @@ void XM7_UnloadXM(XM7_ModuleManager_Type *Module);
 /// Both parameters are pointers; the first one should point to an already
 /// allocated structure where this function will load the module, whereas the
 /// second is the pointer to a copy in memory of a whole MOD file. This function
-/// uses `malloc()` to allocate space for patterns, instruments and samples into
-/// the heap. Unlike the other functions, this function does return a value,
-/// which is 0 when the loading is successful and a different value when the
-/// loading has a different outcome.
+/// uses `malloc()` (or the allocator set with XM7_SetAllocator()) to allocate
+/// space for patterns, instruments and samples into the heap. Unlike the other
+/// functions, this function does return a value, which is 0 when the loading is
+/// successful and a different value when the loading has a different outcome.
 ///
 /// @param Module
 ///     Pointer to an allocated XM7_ModuleManager_Type structure.
@@ -406,6 +851,322 @@ XM7_Error XM7_LoadMOD(XM7_ModuleManager_Type* Module, const void* MODModule_);
 ///     Pointer to an allocated XM7_ModuleManager_Type structure.
 void XM7_UnloadMOD(XM7_ModuleManager_Type *Module);
 
+/// Load an XM reading it from a stream instead of from a copy in RAM.
+///
+/// It works like XM7_LoadXM(), but the file is read in small pieces through
+/// the functions of `stream`, only moving forward. Headers and packed patterns
+/// go through a buffer of 512 bytes on the stack, and the data of each sample
+/// is read straight into its final buffer and delta-decoded there. So the
+/// memory needed to load a module is only the memory of the module itself,
+/// and it can be read from a file without loading the whole file first.
+///
+/// When the file isn't an XM (XM7_ERR_NOT_A_VALID_MODULE) some bytes have
+/// been read already, so the file has to be rewound before trying
+/// XM7_LoadMODStream().
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param stream
+///     Functions to read the file.
+///
+/// @return
+///     Error code. XM7_ERR_READ_ERROR if the file ends too early.
+XM7_Error XM7_LoadXMStream(XM7_ModuleManager_Type *Module, const XM7_Stream_Type *stream);
+
+/// Load a MOD reading it from a stream instead of from a copy in RAM.
+///
+/// See XM7_LoadXMStream().
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param stream
+///     Functions to read the file.
+///
+/// @return
+///     Error code. XM7_ERR_READ_ERROR if the file ends too early.
+XM7_Error XM7_LoadMODStream(XM7_ModuleManager_Type *Module, const XM7_Stream_Type *stream);
+
+/// Start loading an XM a piece at a time.
+///
+/// XM7_LoadXM() can stall the main loop for many frames with a big module. This
+/// only checks the headers of the file and loads the module header, then
+/// XM7_LoadStep() loads the patterns, instruments and sample data a piece at a
+/// time, so the game can keep running between the calls. `loader->Done` and
+/// `loader->Total` tell the progress, in bytes of the file.
+///
+/// The file must stay in RAM until the load is finished. The module can be
+/// unloaded with XM7_UnloadXM() at any time to give up the load.
+///
+/// @param loader
+///     State of the load, kept by the caller until the load is finished.
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param XMModule
+///     Pointer to the XM file in RAM.
+///
+/// @return
+///     Error code. Nothing has been allocated if it isn't 0.
+XM7_Error XM7_LoadXMStart(XM7_Loader_Type *loader, XM7_ModuleManager_Type *Module,
+                          const void *XMModule);
+
+/// Start loading a MOD a piece at a time.
+///
+/// See XM7_LoadXMStart().
+///
+/// @param loader
+///     State of the load, kept by the caller until the load is finished.
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param MODModule
+///     Pointer to the MOD file in RAM.
+///
+/// @return
+///     Error code. Nothing has been allocated if it isn't 0.
+XM7_Error XM7_LoadMODStart(XM7_Loader_Type *loader, XM7_ModuleManager_Type *Module,
+                           const void *MODModule);
+
+/// Load the next piece of a module started with XM7_LoadXMStart().
+///
+/// It loads at least `budget` bytes of the file (unless the file ends first),
+/// and stops as soon as possible after that. Sample data is split at any point,
+/// patterns and instrument headers are loaded whole, so a step can go over the
+/// budget by up to the size of a pattern. To keep within a time budget, call it
+/// with a small budget until the time is over.
+///
+/// The load is finished when `loader->Done` reaches `loader->Total`. Then the
+/// module is ready to play.
+///
+/// @param loader
+///     State of the load.
+/// @param budget
+///     Bytes of the file to load.
+///
+/// @return
+///     Error code (the same XM7_LoadXM() would return). If it's greater than
+///     `0x07` the module has to be unloaded.
+XM7_Error XM7_LoadStep(XM7_Loader_Type *loader, u32 budget);
+
+/// Load the rest of a module started with XM7_LoadXMStart().
+///
+/// @param loader
+///     State of the load.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_LoadFinish(XM7_Loader_Type *loader);
+
+/// Set the allocator used by the loaders of this thread.
+///
+/// By default the loaders use `malloc()` and `free()`. The allocator installed
+/// here gets the category of each block, so sample data can be put in its own
+/// pool or memory bank, or the memory of each kind can be tracked. Each module
+/// remembers the allocator it was loaded with, and XM7_UnloadXM() frees the
+/// blocks with it, so the structure has to stay valid until the modules loaded
+/// with it are unloaded.
+///
+/// @param allocator
+///     Allocator to use, or NULL to go back to `malloc()` and `free()`.
+void XM7_SetAllocator(const XM7_Allocator_Type *allocator);
+
+/// Get the size of the arena needed to load an XM with XM7_LoadXMArena().
+///
+/// It walks the headers of the file without allocating anything, and adds up
+/// the size of all the patterns, instruments, samples and sample data that the
+/// loader would create.
+///
+/// @param XMModule
+///     Pointer to the XM file in RAM.
+/// @param size
+///     Where the size in bytes is returned.
+///
+/// @return
+///     Error code (the same XM7_LoadXM() would return for a bad header).
+XM7_Error XM7_GetArenaSizeXM(const void *XMModule, u32 *size);
+
+/// Get the size of the arena needed to load a MOD with XM7_LoadMODArena().
+///
+/// @param MODModule
+///     Pointer to the MOD file in RAM.
+/// @param size
+///     Where the size in bytes is returned.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_GetArenaSizeMOD(const void *MODModule, u32 *size);
+
+/// Get the information of an XM and the memory needed to load it.
+///
+/// It walks the headers of the file like XM7_GetArenaSizeXM() does, without
+/// allocating anything, so it's fast enough to list a lot of modules in a menu.
+/// The memory figures are exact for the loaders: `Memory` is what
+/// XM7_GetMemoryUsage() reports after XM7_LoadXM() (with the same estimate of
+/// the heap overhead) and `ArenaSize` is the size XM7_LoadXMArena() needs.
+///
+/// @param XMModule
+///     Pointer to the XM file in RAM. Only the headers are read, but they are
+///     spread all over the file.
+/// @param info
+///     Where the information is returned.
+///
+/// @return
+///     Error code (the same XM7_LoadXM() would return for a bad header).
+XM7_Error XM7_ProbeXM(const void *XMModule, XM7_ModuleInfo_Type *info);
+
+/// Get the information of a MOD and the memory needed to load it.
+///
+/// @param MODModule
+///     Pointer to the MOD file in RAM.
+/// @param info
+///     Where the information is returned.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_ProbeMOD(const void *MODModule, XM7_ModuleInfo_Type *info);
+
+/// Load an XM carving all its memory from a single block.
+///
+/// It works like XM7_LoadXM(), but instead of one allocation for each pattern,
+/// instrument and sample, the size of the whole module is calculated first
+/// (see XM7_GetArenaSizeXM()) and everything is placed in one block. If
+/// `arena` is NULL the block is allocated with `malloc()` (or the allocator set
+/// with XM7_SetAllocator(), as XM7_ALLOC_ARENA), otherwise the block
+/// of the caller is used, and it has to be at least as big as the size
+/// returned by XM7_GetArenaSizeXM() plus 7 bytes if it isn't aligned to 8
+/// bytes. XM7_UnloadXM() then frees the block (only if it was allocated by the
+/// loader) without walking the module.
+///
+/// On the DS the data cache of the block is flushed once at the end, so the
+/// ARM7 can read the module right away.
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param XMModule
+///     Pointer to the XM file in RAM.
+/// @param arena
+///     Block to load the module into, or NULL to allocate it.
+/// @param size
+///     Size of the block in bytes (ignored if `arena` is NULL).
+///
+/// @return
+///     Error code. XM7_ERR_NOT_ENOUGH_MEMORY if the block is too small.
+XM7_Error XM7_LoadXMArena(XM7_ModuleManager_Type *Module, const void *XMModule,
+                          void *arena, u32 size);
+
+/// Load a MOD carving all its memory from a single block.
+///
+/// See XM7_LoadXMArena().
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param MODModule
+///     Pointer to the MOD file in RAM.
+/// @param arena
+///     Block to load the module into, or NULL to allocate it.
+/// @param size
+///     Size of the block in bytes (ignored if `arena` is NULL).
+///
+/// @return
+///     Error code. XM7_ERR_NOT_ENOUGH_MEMORY if the block is too small.
+XM7_Error XM7_LoadMODArena(XM7_ModuleManager_Type *Module, const void *MODModule,
+                           void *arena, u32 size);
+
+/// Load an XM reusing the buffer of the file for the sample data.
+///
+/// The module takes the buffer: the data of each sample is decoded inside it
+/// and moved back over the headers and patterns that have been read already,
+/// so the samples aren't copied and only the patterns and the small structures
+/// are allocated. A sample that doesn't fit in the space left (because of the
+/// data added to its ping-pong loop) gets a block of its own as usual.
+///
+/// The buffer is modified, and XM7_UnloadXM() frees it with `free()` (or with
+/// the allocator set with XM7_SetAllocator(), as XM7_ALLOC_FILE), so it must
+/// have been allocated that way. If the load fails with an error up to `0x07`
+/// the buffer hasn't been touched and it still belongs to the caller.
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param XMModule
+///     Pointer to the XM file in RAM.
+/// @param size
+///     Size of the buffer in bytes.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_LoadXMInPlace(XM7_ModuleManager_Type *Module, void *XMModule, u32 size);
+
+/// Load a MOD reusing the buffer of the file for the sample data.
+///
+/// See XM7_LoadXMInPlace().
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param MODModule
+///     Pointer to the MOD file in RAM.
+/// @param size
+///     Size of the buffer in bytes.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_LoadMODInPlace(XM7_ModuleManager_Type *Module, void *MODModule, u32 size);
+
+/// Load a MOD that plays its samples straight from the file.
+///
+/// MOD samples are plain 8-bit PCM, so when the file stays in memory (in RAM
+/// or in the memory mapped cartridge space) there's no need to copy them: the
+/// samples of the module point into the file, and only the patterns and the
+/// small structures are allocated. A sample that isn't aligned to 4 bytes in
+/// the file, as the DS sound hardware needs, is copied as usual.
+///
+/// The file is only read, never written, and it must stay where it is until
+/// the module is unloaded. XM7_UnloadXM() doesn't free it.
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param MODModule
+///     Pointer to the MOD file, aligned to 4 bytes.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_LoadMODResident(XM7_ModuleManager_Type *Module, const void *MODModule);
+
+/// Load only a part of an XM.
+///
+/// It works like XM7_LoadXM(), but it only allocates what the selection needs.
+/// With XM7_SELECT_INSTRUMENTS no pattern is loaded, to use the module as a bank
+/// of instruments. With XM7_SELECT_POSITIONS the song is followed from each of
+/// the selected positions, the same way the engine would play it (including
+/// Bxx and Dxx, and the jump to the restart point at the end of the song), and
+/// only the patterns it can reach and the instruments used in them are loaded.
+/// A pattern that isn't loaded has a NULL pointer and plays as empty lines, an
+/// instrument that isn't loaded is NULL like an empty one, and neither counts
+/// in XM7_GetMemoryUsage().
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param XMModule
+///     Pointer to the XM file in RAM.
+/// @param selection
+///     What to load.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_LoadXMSelection(XM7_ModuleManager_Type *Module, const void *XMModule,
+                              const XM7_Selection_Type *selection);
+
+/// Load only a part of a MOD (see XM7_LoadXMSelection()).
+///
+/// @param Module
+///     Pointer to an allocated XM7_ModuleManager_Type structure.
+/// @param MODModule
+///     Pointer to the MOD file in RAM.
+/// @param selection
+///     What to load.
+///
+/// @return
+///     Error code.
+XM7_Error XM7_LoadMODSelection(XM7_ModuleManager_Type *Module, const void *MODModule,
+                               const XM7_Selection_Type *selection);
+
 /// Setup the replay style of the module.
 ///
 /// This function sets some parameters that affect the way the module will be
@@ -443,6 +1204,95 @@ void XM7_SetReplayStyle(XM7_ModuleManager_Type* Module, XM7_ReplayStyles style);
 void XM7_SetPanningStyle(XM7_ModuleManager_Type* Module, XM7_PanningStyles style,
                          XM7_PanningDisplacementStyles displacement);
 
+/// Get how much memory a loaded module is using.
+///
+/// It adds up the size of all the blocks allocated by the loader, by type. The
+/// overhead of the heap can't be known exactly, so it's estimated for a
+/// dlmalloc-like allocator (like the ones of newlib and glibc): each block has a
+/// size field in front of it and is rounded up to twice the size of a pointer.
+/// For a module loaded into an arena (see XM7_LoadXMArena()) the overhead is
+/// the alignment padding of the blocks, plus the heap overhead of the arena if
+/// the loader allocated it. For a module loaded in place (see
+/// XM7_LoadXMInPlace()) the sample data in the file counts as sample data and
+/// the rest of the file as `File`, while the samples of a module played from a
+/// resident file (see XM7_LoadMODResident()) don't count at all.
+///
+/// @param Module
+///     Pointer to a loaded module.
+/// @param usage
+///     Where the memory usage is returned.
+void XM7_GetMemoryUsage(const XM7_ModuleManager_Type *Module, XM7_MemoryUsage_Type *usage);
+
+/// Get how much memory a pattern of a loaded module is using.
+///
+/// @param Module
+///     Pointer to a loaded module.
+/// @param pattern
+///     Number of the pattern.
+///
+/// @return
+///     Size in bytes, including the estimated heap overhead (0 if the pattern
+///     doesn't exist).
+u32 XM7_GetPatternMemoryUsage(const XM7_ModuleManager_Type *Module, u8 pattern);
+
+/// Get how much memory an instrument of a loaded module is using, including its
+/// samples.
+///
+/// @param Module
+///     Pointer to a loaded module.
+/// @param instrument
+///     Number of the instrument (0 to 127).
+///
+/// @return
+///     Size in bytes, including the estimated heap overhead (0 if the
+///     instrument doesn't exist).
+u32 XM7_GetInstrumentMemoryUsage(const XM7_ModuleManager_Type *Module, u8 instrument);
+
+/// Copy the new records of a tracepoint ring buffer (see XM7_SetTracepoints()).
+///
+/// It can be called while the module plays. `next` is the number of the first
+/// record that hasn't been read yet (start from 0) and it gets updated. If the
+/// engine has overwritten some records before they could be read, they are
+/// skipped and counted in `lost`.
+///
+/// @param tracepoints
+///     Ring buffer written by the engine.
+/// @param next
+///     Number of the next record to read.
+/// @param records
+///     Where the records are copied.
+/// @param max
+///     Maximum number of records to copy.
+/// @param lost
+///     Where the number of skipped records is returned (it can be NULL).
+///
+/// @return
+///     Number of records copied.
+u32 XM7_ReadTracepoints(const XM7_Tracepoints_Type *tracepoints, u32 *next,
+                        XM7_TracepointRecord_Type *records, u32 max, u32 *lost);
+
+/// Take a consistent copy of the effect counters (see XM7_SetEffectStats()).
+///
+/// It can be called while the module plays: the copy never contains half of a
+/// tick. A reset that has been requested but not done yet by the engine is
+/// already applied to the copy.
+///
+/// @param stats
+///     Counters updated by the engine.
+/// @param snapshot
+///     Where the copy is returned.
+void XM7_SnapshotEffectStats(const XM7_EffectStats_Type *stats,
+                             XM7_EffectStats_Type *snapshot);
+
+/// Clear the effect counters (see XM7_SetEffectStats()).
+///
+/// It can be called while the module plays. The engine clears the counters at
+/// the start of the next tick.
+///
+/// @param stats
+///     Counters updated by the engine.
+void XM7_ResetEffectStats(XM7_EffectStats_Type *stats);
+
 /// @}
 
 #ifdef __cplusplus
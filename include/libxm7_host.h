@@ -0,0 +1,371 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+/// @file libxm7_host.h
+///
+/// @brief Host (PC) build support of libXM7.
+///
+/// When libXM7 isn't built for the Nintendo DS the ARM7 part of the library
+/// can't write to the sound registers or use the ARM7 timer 0 IRQ. Instead, it
+/// hands every write to a backend, which can ignore it (the null backend),
+/// emulate the DS sound hardware, record it... This lets you run the engine on
+/// a PC to profile it, benchmark it or test it.
+
+#ifndef LIBXM7_HOST_H__
+#define LIBXM7_HOST_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libxm7.h>
+
+#ifdef __NDS__
+#error "libxm7_host.h is only meant to be used in host builds"
+#endif
+
+/// @defgroup libxm7_host libXM7 host build functions.
+/// @{
+
+// Values of REG_SOUNDXCNT, with the same names libnds uses for them. They are
+// passed to backends so that they can see exactly what the DS would see.
+#ifndef SOUNDXCNT_ENABLE
+#define SOUNDXCNT_ENABLE        (1U << 31)
+#define SOUNDXCNT_FORMAT_8BIT   (0U << 29)
+#define SOUNDXCNT_FORMAT_16BIT  (1U << 29)
+#define SOUNDXCNT_FORMAT_ADPCM  (2U << 29)
+#define SOUNDXCNT_FORMAT_PSG    (3U << 29)
+#define SOUNDXCNT_ONE_SHOT      (1U << 28)
+#define SOUNDXCNT_REPEAT        (1U << 27)
+#define SOUNDXCNT_PAN(n)        ((u32)(n) << 16)
+#define SOUNDXCNT_VOL_DIV(n)    ((u32)(n) << 8)
+#define SOUNDXCNT_VOL_MUL(n)    ((u32)(n))
+#endif
+
+/// Frequency of the DS system bus clock (Hz).
+#define XM7_BUS_CLOCK           33513982
+
+/// Frequency of the clock that drives the DS sound channel timers (Hz).
+#define XM7_SOUND_CLOCK         (XM7_BUS_CLOCK / 2)
+
+/// Frequency of the ARM7 timer 0 when the prescaler is F/1024 (Hz).
+#define XM7_TIMER_CLOCK         (XM7_BUS_CLOCK / 1024)
+
+/// Converts a sample rate into a REG_SOUNDXTMR value (like SOUNDXTMR_FREQ()).
+///
+/// It returns 0 (the slowest possible rate) for rates that aren't positive.
+#define XM7_SOUNDXTMR_FREQ(n)   ((u16)(((n) > 0) ? (-0x1000000 / (n)) : 0))
+
+/// Set of operations the ARM7 engine uses to drive the sound hardware.
+///
+/// All the channel numbers are DS hardware channels (the engine allocates them
+/// starting from 15 and going down). All the values are the ones the engine
+/// would write to the hardware registers.
+typedef struct {
+    /// Pointer passed as first argument to every operation.
+    void *Context;
+
+    /// Stop a channel (REG_SOUNDXCNT = 0).
+    void (*StopSound)(void *context, u8 channel);
+
+    /// Start a channel: set the registers and enable it.
+    ///
+    /// @param cnt REG_SOUNDXCNT (enable, one-shot/repeat, format, volume, pan)
+    /// @param sad REG_SOUNDXSAD (start of the sample data)
+    /// @param tmr REG_SOUNDXTMR
+    /// @param pnt REG_SOUNDXPNT (loop start, in words)
+    /// @param len REG_SOUNDXLEN (length after the loop start, in words)
+    void (*StartSound)(void *context, u8 channel, u32 cnt, const void *sad,
+                       u16 tmr, u16 pnt, u32 len);
+
+    /// Set the volume (REG_SOUNDXVOL) and panning (REG_SOUNDXPAN) of a channel.
+    void (*SetVolumeandPanning)(void *context, u8 channel, u8 vol, u8 pan);
+
+    /// Set the timer (REG_SOUNDXTMR) of a channel.
+    void (*PitchSound)(void *context, u8 channel, u16 tmr);
+
+    /// Change the sample of a channel while it's playing (SAD, PNT and LEN).
+    void (*ChangeSample)(void *context, u8 channel, const void *sad, u16 pnt, u32 len);
+
+    /// Program the ARM7 timer 0.
+    ///
+    /// @param period Timer 0 period, in ticks of XM7_TIMER_CLOCK. If it's 0
+    ///               the timer has to be stopped.
+    /// @param handler Function to call on every timer overflow (or NULL).
+    void (*SetTimer)(void *context, u16 period, void (*handler)(void));
+} XM7_Backend_Type;
+
+/// Backend that ignores all writes, but remembers the timer settings.
+///
+/// The engine costs the same with this backend than with any other backend, so
+/// it can be used to measure the time spent by the sequencer alone.
+typedef struct {
+    /// The operations of this backend.
+    XM7_Backend_Type Backend;
+
+    /// Last period programmed in timer 0 (0 if it's stopped).
+    u16 TimerPeriod;
+
+    /// Last handler set for timer 0.
+    void (*TimerHandler)(void);
+} XM7_NullBackend_Type;
+
+/// Initialize a null backend.
+///
+/// @param nb
+///     Backend to initialize.
+void XM7_NullBackend_Init(XM7_NullBackend_Type *nb);
+
+/// State of one channel of the emulated DS sound unit.
+typedef struct {
+    const void *Data;       ///< REG_SOUNDXSAD
+    u32 Cnt;                ///< REG_SOUNDXCNT (bit 31 is cleared when a one-shot sample ends)
+    u32 Length;             ///< REG_SOUNDXLEN (words)
+    u16 LoopStart;          ///< REG_SOUNDXPNT (words)
+    u16 Timer;              ///< REG_SOUNDXTMR
+
+    // sample change requested while playing, it's applied when the current
+    // sample reaches its end
+    const void *NextData;
+    u32 NextLength;
+    u16 NextLoopStart;
+    u8 HasNextSample;
+
+    u64 Position;           ///< Position in samples from Data (32.32 fixed point)
+    u64 Step;               ///< Samples to advance per output frame (32.32 fixed point)
+} XM7_SoundUnitChannel_Type;
+
+/// Backend that emulates the 16 channels of the DS sound unit.
+///
+/// It plays 8 and 16 bit PCM samples in one-shot or repeat mode, stepping them
+/// at the rate set by REG_SOUNDXTMR, without interpolation (like the DS does).
+/// The output is stereo 16 bit PCM at any sample rate.
+typedef struct {
+    /// The operations of this backend.
+    XM7_Backend_Type Backend;
+
+    /// The channels of the sound unit.
+    XM7_SoundUnitChannel_Type Channel[16];
+
+    /// Sample rate of the output (Hz).
+    u32 OutputRate;
+
+    /// Master volume (0..127, like REG_SOUNDCNT). Default 127.
+    u8 MasterVolume;
+
+    /// Last period programmed in timer 0 (0 if it's stopped).
+    u16 TimerPeriod;
+
+    /// Last handler set for timer 0.
+    void (*TimerHandler)(void);
+
+    /// Fraction of output frame carried from one timer period to the next.
+    u64 TimerRemainder;
+} XM7_SoundUnit_Type;
+
+/// Initialize an emulated sound unit with all its channels stopped.
+///
+/// @param su
+///     Sound unit to initialize.
+/// @param rate
+///     Sample rate of the output (Hz).
+void XM7_SoundUnit_Init(XM7_SoundUnit_Type *su, u32 rate);
+
+/// Mix all the channels of the sound unit.
+///
+/// It uses SSE2 or AVX2 when they are available.
+///
+/// @param su
+///     Sound unit.
+/// @param out
+///     Buffer for the output: `frames` pairs of left and right samples.
+/// @param frames
+///     Number of frames to mix.
+void XM7_SoundUnit_Mix(XM7_SoundUnit_Type *su, s16 *out, u32 frames);
+
+/// Advance all the channels of the sound unit like XM7_SoundUnit_Mix() would,
+/// without generating any output.
+///
+/// @param su
+///     Sound unit.
+/// @param frames
+///     Number of frames to skip.
+void XM7_SoundUnit_Skip(XM7_SoundUnit_Type *su, u32 frames);
+
+/// Get the number of output frames until the next timer 0 overflow.
+///
+/// Timer periods aren't a whole number of output frames, so the fraction left
+/// is carried to the next call. It returns 0 if the timer is stopped.
+///
+/// @param su
+///     Sound unit.
+///
+/// @return
+///     Number of frames of the next timer period.
+u32 XM7_SoundUnit_TickFrames(XM7_SoundUnit_Type *su);
+
+/// Shadow copy of the registers of one channel, used when replaying traces.
+typedef struct {
+    u32 Cnt;
+    u32 Sad;
+    u32 SadHigh;            ///< High 32 bits of the address (0 in DS traces)
+    u32 Len;
+    u16 Tmr;
+    u16 Pnt;
+    u8 Vol;
+    u8 Pan;
+} XM7_TraceChannel_Type;
+
+/// Replays a register write trace (see XM7_SetTrace()) into a backend.
+///
+/// The writes are turned back into backend operations: a write to CNT that
+/// enables a channel starts it, a write to TMR of a channel that is playing
+/// pitches it, the SAD, PNT and LEN writes of a channel that is playing change
+/// its sample, and so on.
+///
+/// Sample addresses in traces are just numbers (they may even come from a DS).
+/// If there is no ResolveAddress() function, or it returns NULL, samples are
+/// replaced by silence of the right length so that backends can still play
+/// them.
+typedef struct {
+    /// Backend that receives the operations.
+    const XM7_Backend_Type *Backend;
+
+    /// Optional function that converts a sample address into a pointer. The
+    /// address is the SAD value, with the high 32 bits of the pointer when the
+    /// trace comes from a host. `size` is the number of bytes the channel
+    /// reads from it.
+    const void *(*ResolveAddress)(void *context, u64 address, u32 size);
+    void *ResolveContext;
+
+    const XM7_TraceRecord_Type *Records;
+    u32 Count;
+    u32 Next;               ///< Index of the next record to replay
+
+    u32 Tick;               ///< Last tick replayed
+
+    XM7_TraceChannel_Type Channel[16];
+
+    void *Silence;          ///< Buffer of silence used when samples can't be resolved
+} XM7_TraceReplay_Type;
+
+/// Prepare the replay of a trace.
+///
+/// @param rp
+///     Replay to initialize.
+/// @param backend
+///     Backend that will receive the operations.
+/// @param records
+///     Records of the trace, oldest first.
+/// @param count
+///     Number of records.
+void XM7_TraceReplay_Init(XM7_TraceReplay_Type *rp, const XM7_Backend_Type *backend,
+                          const XM7_TraceRecord_Type *records, u32 count);
+
+/// Replay all the writes of the next tick of the trace.
+///
+/// Ticks are replayed one by one, even if they didn't write anything, so the
+/// caller can keep time (for example, mixing XM7_SoundUnit_TickFrames() frames
+/// after each call). The writes made before the first tick are replayed
+/// together with it.
+///
+/// @param rp
+///     Replay.
+///
+/// @return
+///     Number of the tick replayed, or 0 if the trace is over.
+u32 XM7_TraceReplay_Tick(XM7_TraceReplay_Type *rp);
+
+/// Free the memory used by a replay.
+///
+/// @param rp
+///     Replay.
+void XM7_TraceReplay_Free(XM7_TraceReplay_Type *rp);
+
+/// Set the backend used by the ARM7 engine.
+///
+/// The backend has to be set before calling XM7_PlayModule(), and it must stay
+/// valid until XM7_StopModule() has been called. Until a backend is set, all
+/// writes are discarded.
+///
+/// In host builds the state of the ARM7 engine (the module being played and the
+/// backend) is kept per thread. Each thread that calls XM7_Initialize() gets its
+/// own engine, so several modules can be played at the same time from different
+/// threads.
+///
+/// @param backend
+///     Backend to use, or NULL to discard all writes.
+void XM7_SetBackend(const XM7_Backend_Type *backend);
+
+/// Phases of the loaders, used by XM7_LoaderStats_Type.
+typedef enum {
+    /// Module, instrument and sample headers (and memory allocation).
+    XM7_LOAD_PHASE_HEADERS  = 0,
+    /// Unpacking of the patterns.
+    XM7_LOAD_PHASE_PATTERNS = 1,
+    /// Conversion of the MOD periods into notes.
+    XM7_LOAD_PHASE_PERIODS  = 2,
+    /// Copy of the sample data (with delta decoding in XMs).
+    XM7_LOAD_PHASE_SAMPLES  = 3,
+    /// Conversion of ping-pong loops into forward loops (when it isn't done
+    /// while the sample data is decoded).
+    XM7_LOAD_PHASE_PINGPONG = 4,
+
+    XM7_LOAD_PHASE_COUNT    = 5
+} XM7_LoadPhases;
+
+/// Statistics of the loads made by XM7_LoadXM() and XM7_LoadMOD().
+///
+/// All the fields are accumulated over all the loads, so clear the structure
+/// before using it.
+typedef struct {
+    /// Number of loads.
+    u32 Loads;
+    /// Number of memory allocations.
+    u32 Allocations;
+    /// Total size of the allocations (bytes).
+    u64 AllocatedBytes;
+    /// Time spent in each phase (ns), see XM7_LoadPhases.
+    u64 PhaseNs[XM7_LOAD_PHASE_COUNT];
+} XM7_LoaderStats_Type;
+
+/// Collect statistics of the loads made by the current thread.
+///
+/// Measuring the time of each phase has a small cost, so do it only when it's
+/// needed.
+///
+/// @param stats
+///     Structure where the statistics are accumulated, or NULL to stop.
+void XM7_SetLoaderStats(XM7_LoaderStats_Type *stats);
+
+/// Get the number of divisions by a variable made by the ARM7 engine.
+///
+/// The ARM7 has no divide instruction, so on the DS each one of these
+/// divisions is a call to a slow software routine. The count includes the ones
+/// made to calculate REG_SOUNDXTMR values. It's kept per thread, like the rest
+/// of the engine state, and it wraps around when it overflows.
+///
+/// @return
+///     Number of divisions made since the thread started.
+u32 XM7_GetDivisionCount(void);
+
+/// Multiply the tick times measured by the overrun control by a factor (see
+/// XM7_SetOverrunControl()).
+///
+/// A PC runs the ticks many times faster than the ARM7, so without this the
+/// overrun control would never see a tick over the budget. A factor around 100
+/// gives an idea of how the ticks would behave on the DS. The default is 1.
+/// It's kept per thread, like the rest of the engine state.
+///
+/// @param scale
+///     Factor (0 is the same as 1).
+void XM7_SetOverrunTimeScale(u32 scale);
+
+/// @}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBXM7_HOST_H__
@@ -3,19 +3,85 @@
 // Copyright (c) 2018 sverx
 
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef __NDS__
 #include <nds.h>
+#endif
 
 #include <libxm7.h>
 
 #include "libxm7_internal.h"
 
+#ifdef __NDS__
 // Let's make sure that we use the timer that libnds expects us to use
 static_assert(LIBNDS_DEFAULT_TIMER_MUSIC == 0);
+#else
+#include <time.h>
+
+#include <libxm7_host.h>
+
+#define SOUNDXTMR_FREQ(n) XM7_SOUNDXTMR_FREQ(n)
+#endif
+
+// on host builds every thread gets its own copy of the engine state, so that
+// each thread can play a different module
+#ifdef __NDS__
+#define XM7_ENGINE_STATE static
+#else
+#define XM7_ENGINE_STATE static _Thread_local
+#endif
 
 // these are the variables I need to make the module play!
-static XM7_ModuleManager_Type* XM7_TheModule;
+XM7_ENGINE_STATE XM7_ModuleManager_Type* XM7_TheModule;
+XM7_ENGINE_STATE XM7_TimerModes XM7_TimerMode;
+XM7_ENGINE_STATE XM7_Trace_Type *XM7_Trace;
+XM7_ENGINE_STATE XM7_HandlerStats_Type *XM7_HandlerStats;
+XM7_ENGINE_STATE XM7_EffectStats_Type *XM7_EffectStats;
+
+// overrun control (see XM7_SetOverrunControl())
+XM7_ENGINE_STATE XM7_OverrunControl_Type *XM7_OverrunControl;
+XM7_ENGINE_STATE u8 XM7_DegradeLevel;
+XM7_ENGINE_STATE u8 CalmTicks;          // ticks in a row well within the budget
+XM7_ENGINE_STATE u8 TickParity;
+XM7_ENGINE_STATE u16 SilentChannels;    // one bit per channel, at volume 0
+XM7_ENGINE_STATE u16 StalePitchChannels; // one bit per channel, pitch not updated
+#ifdef __NDS__
+static u16 Timer0Period;                // as programmed in timer 0
+#else
+XM7_ENGINE_STATE u32 OverrunTimeScale;  // to emulate a slower CPU
+#endif
+
+#define COUNT_EFFECT(counter) \
+    do { \
+        if (XM7_EffectStats != NULL) \
+            XM7_EffectStats->counter++; \
+    } while (0)
+
+// tracepoints only exist when they are enabled at build time, otherwise the
+// macro and its arguments vanish
+#ifdef XM7_TRACEPOINTS
+XM7_ENGINE_STATE XM7_Tracepoints_Type *XM7_Tracepoints;
+#define TRACEPOINT(event, channel, a, b)    Tracepoint(event, channel, a, b)
+#else
+#define TRACEPOINT(event, channel, a, b)    do { } while (0)
+#endif
+
+#ifndef __NDS__
+// on host builds all the writes to the hardware go to this backend
+XM7_ENGINE_STATE XM7_NullBackend_Type XM7_DefaultBackend;
+XM7_ENGINE_STATE const XM7_Backend_Type *XM7_Backend;
+
+// divisions by values that aren't constants. The ARM7 has no divide
+// instruction, so each one of them is a call to a software routine on the DS
+XM7_ENGINE_STATE u32 XM7_Divisions;
+#define COUNT_DIVISION()    (XM7_Divisions++)
+#else
+#define COUNT_DIVISION()
+#endif
 
 // calculated as
 // Period = 10*12*16*4 - Note*16*4 - FineTune/2;   (finetune = 0)
@@ -63,7 +129,7 @@ static u16 sinus[17] = {
     1019, 1024
 };
 
-static u16 VeryFineTunes[129];
+XM7_ENGINE_STATE u16 VeryFineTunes[129];
 // will be calculated from FineTunes[], interpolating (linear)...
 
 // u8 RealPanning[129]; // indexes [0..128], values from [0..0x80]
@@ -77,6 +143,14 @@ static u16 VeryFineTunes[129];
 #define ENVELOPE_SUSTAIN    2
 #define ENVELOPE_RELEASE    3
 
+// random numbers for the random vibrato/tremolo waveforms. The generator is
+// reset when the module starts, so a module always plays the same way.
+static u32 Random(void)
+{
+    XM7_TheModule->CurrentRandomSeed = XM7_TheModule->CurrentRandomSeed * 1103515245 + 12345;
+    return (XM7_TheModule->CurrentRandomSeed >> 16) & 0x7FFF;
+}
+
 static void CalculateVeryFineTunes(void)
 {
     for (int i = 0; i <= 128; i++)
@@ -164,11 +238,139 @@ static void CalculateRealPanningArray(u8 halfvalue) // halfvalue = 0..128
 }
 */
 
+#ifndef __NDS__
+u32 XM7_GetDivisionCount(void)
+{
+    return XM7_Divisions;
+}
+
+void XM7_SetOverrunTimeScale(u32 scale)
+{
+    OverrunTimeScale = scale;
+}
+
+void XM7_SetBackend(const XM7_Backend_Type *backend)
+{
+    // without a backend, writes get discarded
+    if (backend == NULL)
+    {
+        XM7_NullBackend_Init(&XM7_DefaultBackend);
+        backend = &XM7_DefaultBackend.Backend;
+    }
+
+    XM7_Backend = backend;
+}
+#endif
+
+void XM7_SetTrace(XM7_Trace_Type *trace)
+{
+    XM7_Trace = trace;
+}
+
+void XM7_SetHandlerStats(XM7_HandlerStats_Type *stats)
+{
+    XM7_HandlerStats = stats;
+}
+
+void XM7_SetEffectStats(XM7_EffectStats_Type *stats)
+{
+    XM7_EffectStats = stats;
+}
+
+// writes a value that another CPU (or thread) reads without locks, after all the
+// writes that come before it
+static void StoreRelease(volatile u32 *dst, u32 value)
+{
+#ifdef __NDS__
+    asm volatile("" ::: "memory");
+    *dst = value;
+#else
+    __atomic_store_n(dst, value, __ATOMIC_RELEASE);
+#endif
+}
+
+void XM7_SetOverrunControl(XM7_OverrunControl_Type *control)
+{
+    XM7_OverrunControl = control;
+    XM7_DegradeLevel = XM7_DEGRADE_NONE;
+    CalmTicks = 0;
+}
+
+void XM7_SetTracepoints(XM7_Tracepoints_Type *tracepoints)
+{
+#ifdef XM7_TRACEPOINTS
+    XM7_Tracepoints = tracepoints;
+#else
+    (void)tracepoints;
+#endif
+}
+
+#ifdef XM7_TRACEPOINTS
+static void Tracepoint(u8 event, u8 channel, u16 a, u32 b)
+{
+    XM7_Tracepoints_Type *tp = XM7_Tracepoints;
+
+    if (tp == NULL)
+        return;
+
+    u32 written = tp->Written;
+
+    XM7_TracepointRecord_Type *rec = &tp->Records[written & (tp->Capacity - 1)];
+    rec->Tick = tp->Tick;
+    rec->Event = event;
+    rec->Channel = channel;
+    rec->A = a;
+    rec->B = b;
+
+    // the record has to be complete before the reader can see it
+    StoreRelease(&tp->Written, written + 1);
+}
+#endif
+
+static void TraceWrite(u8 channel, u8 reg, u32 value)
+{
+    XM7_Trace_Type *trace = XM7_Trace;
+
+    if (trace == NULL)
+        return;
+
+    XM7_TraceRecord_Type *rec = &trace->Records[trace->Position];
+    rec->Tick = trace->Tick;
+    rec->Channel = channel;
+    rec->Register = reg;
+    rec->Reserved = 0;
+    rec->Value = value;
+
+    // it's a ring buffer, the oldest records get overwritten
+    trace->Position++;
+    if (trace->Position >= trace->Capacity)
+        trace->Position = 0;
+
+    trace->Count++;
+}
+
+// SAD only holds 32 bits, on hosts the rest of the address is traced too
+static void TraceWriteAddress(u8 channel, const void *address)
+{
+#if UINTPTR_MAX > 0xFFFFFFFF
+    TraceWrite(channel, XM7_TRACE_REG_SADHIGH, (u32)((uintptr_t)address >> 32));
+#endif
+    TraceWrite(channel, XM7_TRACE_REG_SAD, (u32)(uintptr_t)address);
+}
+
 static void XM7_lowlevel_stopSound(u8 channel)
 {
+    SilentChannels |= 1 << channel;
+
     // use channels starting from last!
     channel = 15 - channel;
+
+    TraceWrite(channel, XM7_TRACE_REG_CNT, 0);
+#ifdef __NDS__
     REG_SOUNDXCNT(channel) = 0;
+#else
+    XM7_Backend->StopSound(XM7_Backend->Context, channel);
+#endif
 }
 
 /*
@@ -190,32 +392,65 @@ static void XM7_lowlevel_resumeSound(u8 channel)
 static void XM7_lowlevel_startSound(int sampleRate, const void *data, u32 length,
                                     u8 channel, u8 vol, u8 pan, u8 format, u32 offset)
 {
+    SilentChannels |= 1 << channel;
+
     // use channels starting from last!
     channel = 15 - channel;
 
+    TraceWrite(channel, XM7_TRACE_REG_CNT, 0);
+#ifdef __NDS__
     REG_SOUNDXCNT(channel) = 0;
+#else
+    XM7_Backend->StopSound(XM7_Backend->Context, channel);
+#endif
     offset = format ? (offset * 2) : offset;
 
     // check if offset is still IN the sample (and len>0)
     if (length > offset)
     {
-        REG_SOUNDXTMR(channel) = SOUNDXTMR_FREQ(sampleRate);
+        u16 tmr = SOUNDXTMR_FREQ(sampleRate);
+        COUNT_DIVISION();
+
+        if (vol & 0x7f)
+            SilentChannels &= ~(1 << (15 - channel));
+
+        u32 cnt = SOUNDXCNT_ENABLE | SOUNDXCNT_ONE_SHOT
+                | SOUNDXCNT_VOL_MUL(vol) | SOUNDXCNT_PAN(pan)
+                | (format == 0 ? SOUNDXCNT_FORMAT_8BIT : SOUNDXCNT_FORMAT_16BIT);
+
+        TraceWrite(channel, XM7_TRACE_REG_TMR, tmr);
+        TraceWriteAddress(channel, (const u8 *)data + offset);
+        TraceWrite(channel, XM7_TRACE_REG_PNT, 0);
+        TraceWrite(channel, XM7_TRACE_REG_LEN, (length - offset) >> 2);
+        TraceWrite(channel, XM7_TRACE_REG_CNT, cnt);
+#ifdef __NDS__
+        REG_SOUNDXTMR(channel) = tmr;
         REG_SOUNDXSAD(channel) = ((u32)data) + offset;
         REG_SOUNDXPNT(channel) = 0;
         REG_SOUNDXLEN(channel) = (length - offset) >> 2;
-        REG_SOUNDXCNT(channel) = SOUNDXCNT_ENABLE | SOUNDXCNT_ONE_SHOT
-                | SOUNDXCNT_VOL_MUL(vol) | SOUNDXCNT_PAN(pan)
-                | (format == 0 ? SOUNDXCNT_FORMAT_8BIT : SOUNDXCNT_FORMAT_16BIT);
+        REG_SOUNDXCNT(channel) = cnt;
+#else
+        XM7_Backend->StartSound(XM7_Backend->Context, channel, cnt,
+                                (const u8 *)data + offset, tmr,
+                                0, (length - offset) >> 2);
+#endif
     }
 }
 
 static void XM7_lowlevel_startSoundwLoop(int sampleRate, const void *data, u32 looplength,
                                          u32 loopstart, u8 channel, u8 vol, u8 pan, u8 format, u32 offset)
 {
+    SilentChannels |= 1 << channel;
+
     // use channels starting from last!
     channel = 15 - channel;
 
+    TraceWrite(channel, XM7_TRACE_REG_CNT, 0);
+#ifdef __NDS__
     REG_SOUNDXCNT(channel) = 0;
+#else
+    XM7_Backend->StopSound(XM7_Backend->Context, channel);
+#endif
     offset = format ? (offset * 2) : offset;
 
     // check if offset is still IN the sample (and len>0)
@@ -226,23 +461,53 @@ static void XM7_lowlevel_startSoundwLoop(int sampleRate, const void *data, u32 l
         if (offset > loopstart)
             offset = (format == 0 ? loopstart : (loopstart >> 1));
 
-        REG_SOUNDXTMR(channel) = SOUNDXTMR_FREQ(sampleRate);
+        u16 tmr = SOUNDXTMR_FREQ(sampleRate);
+        COUNT_DIVISION();
+
+        if (vol & 0x7f)
+            SilentChannels &= ~(1 << (15 - channel));
+
+        u32 cnt = SOUNDXCNT_ENABLE
+                | SOUNDXCNT_REPEAT | SOUNDXCNT_VOL_MUL(vol) | SOUNDXCNT_PAN(pan)
+                | (format ? SOUNDXCNT_FORMAT_16BIT : SOUNDXCNT_FORMAT_8BIT);
+
+        TraceWrite(channel, XM7_TRACE_REG_TMR, tmr);
+        TraceWriteAddress(channel, (const u8 *)data + offset);
+        TraceWrite(channel, XM7_TRACE_REG_PNT, (loopstart - offset) >> 2);
+        TraceWrite(channel, XM7_TRACE_REG_LEN, looplength >> 2);
+        TraceWrite(channel, XM7_TRACE_REG_CNT, cnt);
+#ifdef __NDS__
+        REG_SOUNDXTMR(channel) = tmr;
         REG_SOUNDXSAD(channel) = ((u32)data) + offset;
         REG_SOUNDXPNT(channel) = (loopstart - offset) >> 2;
         REG_SOUNDXLEN(channel) = looplength >> 2;
-        REG_SOUNDXCNT(channel) = SOUNDXCNT_ENABLE
-                | SOUNDXCNT_REPEAT | SOUNDXCNT_VOL_MUL(vol) | SOUNDXCNT_PAN(pan)
-                | (format ? SOUNDXCNT_FORMAT_16BIT : SOUNDXCNT_FORMAT_8BIT);
+        REG_SOUNDXCNT(channel) = cnt;
+#else
+        XM7_Backend->StartSound(XM7_Backend->Context, channel, cnt,
+                                (const u8 *)data + offset, tmr,
+                                (loopstart - offset) >> 2, looplength >> 2);
+#endif
     }
 }
 
 static void XM7_lowlevel_setVolumeandPanning(u8 channel, u8 vol, u8 pan)
 {
+    if (vol & 0x7f)
+        SilentChannels &= ~(1 << channel);
+    else
+        SilentChannels |= 1 << channel;
+
     // use channels starting from last!
     channel = 15 - channel;
 
+    TraceWrite(channel, XM7_TRACE_REG_VOL, vol & 0x7f);
+    TraceWrite(channel, XM7_TRACE_REG_PAN, pan & 0x7f);
+#ifdef __NDS__
     REG_SOUNDXVOL(channel) = vol & 0x7f;
     REG_SOUNDXPAN(channel) = pan & 0x7f;
+#else
+    XM7_Backend->SetVolumeandPanning(XM7_Backend->Context, channel, vol & 0x7f, pan & 0x7f);
+#endif
 }
 
 static void XM7_lowlevel_pitchSound (int sampleRate, u8 channel)
@@ -250,7 +515,15 @@ static void XM7_lowlevel_pitchSound (int sampleRate, u8 channel)
     // use channels starting from last!
     channel = 15 - channel;
 
-    REG_SOUNDXTMR(channel) = SOUNDXTMR_FREQ(sampleRate);
+    u16 tmr = SOUNDXTMR_FREQ(sampleRate);
+    COUNT_DIVISION();
+
+    TraceWrite(channel, XM7_TRACE_REG_TMR, tmr);
+#ifdef __NDS__
+    REG_SOUNDXTMR(channel) = tmr;
+#else
+    XM7_Backend->PitchSound(XM7_Backend->Context, channel, tmr);
+#endif
 }
 
 // define this to access the high byte of REG_SOUNDXCNT
@@ -265,15 +538,26 @@ static void XM7_lowlevel_changeSample(const void *data, u32 looplength, u32 loop
     // use channels starting from last!
     channel = 15 - channel;
 
+    TraceWriteAddress(channel, data);
+    TraceWrite(channel, XM7_TRACE_REG_PNT, loopstart >> 2);
+    TraceWrite(channel, XM7_TRACE_REG_LEN, looplength >> 2);
+#ifdef __NDS__
     REG_SOUNDXSAD(channel) = (u32)data;
     REG_SOUNDXPNT(channel) = loopstart >> 2;
     REG_SOUNDXLEN(channel) = looplength >> 2;
+#else
+    XM7_Backend->ChangeSample(XM7_Backend->Context, channel, data, loopstart >> 2, looplength >> 2);
+#endif
     // BETA: sets sound_repeat even if it's not
     // BETA2: doesn't change that because MOD support only 8 bits samples
     // SOUNDXCNT_HIGHERBYTE(channel) = (SOUNDXCNT_ENABLE | SOUNDXCNT_REPEAT |
     //      (format ? SOUNDXCNT_FORMAT_16BIT : SOUNDXCNT_FORMAT_8BIT)) >> SOUNDXCNT_SHIFTBITS;
 }
 
+#ifndef __NDS__
+static void Timer0Handler(void);
+#endif
+
 static void SetTimerSpeedBPM(u8 BPM)
 {
     // calculate the main timer freq
@@ -281,13 +565,30 @@ static void SetTimerSpeedBPM(u8 BPM)
     // = 1.963.710 clicks/minute , then divided by 6 because there are 6 ticks/line
     //   then divided by 4 because BPM is on 4/4th,
 
+    // when ticks are driven from outside the timer isn't ours
+    if (XM7_TimerMode == XM7_TIMER_MODE_EXTERNAL)
+    {
+        TRACEPOINT(XM7_TRACEPOINT_BPM, XM7_TRACE_NO_CHANNEL, BPM, 0);
+        return;
+    }
+
     // set the timer
     u16 timer = 1963710 / (BPM * 24);
+    COUNT_DIVISION();
+
+    TRACEPOINT(XM7_TRACEPOINT_BPM, XM7_TRACE_NO_CHANNEL, BPM, timer);
+
+    TraceWrite(XM7_TRACE_NO_CHANNEL, XM7_TRACE_REG_TIMER0, timer);
+#ifdef __NDS__
+    Timer0Period = timer;
     TIMER0_DATA = -timer;
 
     // start/restart it!
     TIMER0_CR &= ~TIMER_ENABLE;
     TIMER0_CR |= TIMER_ENABLE;
+#else
+    XM7_Backend->SetTimer(XM7_Backend->Context, timer, Timer0Handler);
+#endif
 }
 
 static u8 CalculateFinalVolume(u8 samplevol, u8 envelopevol, u16 fadeoutvol)
@@ -472,6 +773,8 @@ static void CalculateEnvelopeVolume(u8 chn, u8 instrument)
     u16 i, j, x1 = 0, x2 = 0, y1 = 0, y2 = 0;
     XM7_Instrument_Type *CurrInstr = XM7_TheModule->Instrument[instrument - 1];
 
+    COUNT_EFFECT(EnvelopeCalculations);
+
     // calculate volume for point X
     j = CurrInstr->NumberofVolumeEnvelopePoints - 1;
     for (i = 0; i < CurrInstr->NumberofVolumeEnvelopePoints; )
@@ -504,6 +807,7 @@ static void CalculateEnvelopeVolume(u8 chn, u8 instrument)
     else
     {
         // the points are different, interpolation needed!
+        COUNT_DIVISION();
         XM7_TheModule->CurrentSampleVolumeEnvelope[chn] = y1 +
                 (y2 - y1) * (XM7_TheModule->CurrentSampleVolumeEnvelopePoint[chn]-x1) / (x2 - x1);
     }
@@ -514,6 +818,8 @@ static void CalculateEnvelopePanning(u8 chn, u8 instrument)
     u16 i, j, x1 = 0, x2 = 0, y1 = 0, y2 = 0;
     XM7_Instrument_Type *CurrInstr = XM7_TheModule->Instrument[instrument - 1];
 
+    COUNT_EFFECT(EnvelopeCalculations);
+
     // calculate Panning for point X
     j = CurrInstr->NumberofPanningEnvelopePoints - 1;
     for (i = 0; i < CurrInstr->NumberofPanningEnvelopePoints; )
@@ -546,6 +852,7 @@ static void CalculateEnvelopePanning(u8 chn, u8 instrument)
     else
     {
         // the points are different, interpolation needed!
+        COUNT_DIVISION();
         XM7_TheModule->CurrentSamplePanningEnvelope[chn] = y1 +
                 (y2 - y1) * (XM7_TheModule->CurrentSamplePanningEnvelopePoint[chn] - x1) / (x2 - x1);
     }
@@ -566,6 +873,7 @@ static void StartEnvelope(u8 chn, u8 startpoint)
 
         XM7_TheModule->CurrentSampleVolumeEnvelopePoint[chn] = startpoint;
         XM7_TheModule->CurrentSampleVolumeEnvelopeState[chn] = ENVELOPE_ATTACK;
+        TRACEPOINT(XM7_TRACEPOINT_ENVELOPE, chn, ENVELOPE_ATTACK, startpoint);
         CalculateEnvelopeVolume(chn, XM7_TheModule->CurrentChannelLastInstrument[chn]);
     }
     else
@@ -589,6 +897,7 @@ static void StartEnvelope(u8 chn, u8 startpoint)
         // panning envelope is ACTIVE: set the variables
         XM7_TheModule->CurrentSamplePanningEnvelopeState[chn] = ENVELOPE_ATTACK;
         XM7_TheModule->CurrentSamplePanningEnvelopePoint[chn] = 0;
+        TRACEPOINT(XM7_TRACEPOINT_ENVELOPE, chn, (1 << 8) | ENVELOPE_ATTACK, 0);
         CalculateEnvelopePanning(chn, XM7_TheModule->CurrentChannelLastInstrument[chn]);
     }
     else
@@ -620,7 +929,11 @@ static void ElaborateEnvelope(u8 chn, u8 instrument)
         {
             // VOLUME SUSTAIN POINT is active, check if we reached that!
             if (XM7_TheModule->CurrentSampleVolumeEnvelopePoint[chn] == CurrInstr->VolumeEnvelopePoint[VSP].x)
+            {
                 XM7_TheModule->CurrentSampleVolumeEnvelopeState[chn] = ENVELOPE_SUSTAIN;
+                TRACEPOINT(XM7_TRACEPOINT_ENVELOPE, chn, ENVELOPE_SUSTAIN,
+                           XM7_TheModule->CurrentSampleVolumeEnvelopePoint[chn]);
+            }
         }
     } // end "if ATTACK"
 
@@ -694,7 +1007,11 @@ static void ElaborateEnvelope(u8 chn, u8 instrument)
         {
             // PANNING SUSTAIN POINT is active, check if we reached that!
             if (XM7_TheModule->CurrentSamplePanningEnvelopePoint[chn] == CurrInstr->PanningEnvelopePoint[PSP].x)
+            {
                 XM7_TheModule->CurrentSamplePanningEnvelopeState[chn] = ENVELOPE_SUSTAIN;
+                TRACEPOINT(XM7_TRACEPOINT_ENVELOPE, chn, (1 << 8) | ENVELOPE_SUSTAIN,
+                           XM7_TheModule->CurrentSamplePanningEnvelopePoint[chn]);
+            }
         }
     } // end "if ATTACK"
 
@@ -731,8 +1048,10 @@ static void ElaborateEnvelope(u8 chn, u8 instrument)
                 XM7_TheModule->CurrentSamplePanningEnvelopePoint[chn] = CurrInstr->PanningEnvelopePoint[NPEP].x;
             }
 
-            // we've still got to calculate Panning
-            CalculateEnvelopePanning(chn, instrument);
+            // we've still got to calculate Panning (unless the ticks are
+            // running late, then the point moves on but the value is kept)
+            if (XM7_DegradeLevel < XM7_DEGRADE_PANNING_ENVELOPE)
+                CalculateEnvelopePanning(chn, instrument);
         }
     } // end "we aren't in SUSTAIN"
 }
@@ -787,6 +1106,8 @@ static u16 DecodeVolumeColumn(u8 chn, u8 volcmd, u8 curtick, u8 EDxInAction)
 
     u8 tmpvalue = volcmd & 0x0f;                                            // 1..0x0f
 
+    COUNT_EFFECT(VolumeColumn[volcmd >> 4]);
+
     switch (volcmd)
     {
         case 0x10 ... 0x50:
@@ -1047,6 +1368,11 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
     u16 resvalue = 0xffff;
     u8 tmpvalue;
 
+    if (effcmd < XM7_EFFECT_TYPES)
+        COUNT_EFFECT(Effects[effcmd]);
+    if (effcmd == 0xe)
+        COUNT_EFFECT(ExtendedEffects[effpar >> 4]);
+
     switch (effcmd)
     {
 
@@ -1342,9 +1668,9 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
                         if ((tmpvalue != 3) && (tmpvalue < 7))                      // 0,1,2,x,4,5,6,x
                             XM7_TheModule->CurrentVibratoType[chn]=tmpvalue;
                         else if (tmpvalue == 3)
-                            XM7_TheModule->CurrentVibratoType[chn]=rand() % 3;      // set to 0,1,2
+                            XM7_TheModule->CurrentVibratoType[chn]=Random() % 3;      // set to 0,1,2
                         else if (tmpvalue == 7)
-                            XM7_TheModule->CurrentVibratoType[chn]=rand() % 3 + 4;  // set to 4,5,6
+                            XM7_TheModule->CurrentVibratoType[chn]=Random() % 3 + 4;  // set to 4,5,6
                     }
                     break;
 
@@ -1395,9 +1721,9 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
                         if ((tmpvalue != 3) && (tmpvalue < 7))                          // 0,1,2,x,4,5,6,x
                             XM7_TheModule->CurrentTremoloType[chn] = tmpvalue;
                         else if (tmpvalue == 3)
-                            XM7_TheModule->CurrentTremoloType[chn] = rand() % 3;        // set to 0,1,2
+                            XM7_TheModule->CurrentTremoloType[chn] = Random() % 3;      // set to 0,1,2
                         else if (tmpvalue == 7)
-                            XM7_TheModule->CurrentTremoloType[chn] = rand() % 3 + 4;    // set to 4,5,6
+                            XM7_TheModule->CurrentTremoloType[chn] = Random() % 3 + 4;  // set to 4,5,6
                     }
                     break;
 
@@ -1413,6 +1739,7 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
                     if (curtick != 0)
                     {
                         // gives back 1 if retrig needed
+                        COUNT_DIVISION();
                         if ((curtick % tmpvalue) == 0)
                             resvalue = 0xe91;
                         else
@@ -1523,7 +1850,9 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
         case 0x15:                  // Lxx
             // "Set envelope position"
             // "Makes the currently playing note jump to tick xx on the volume envelope timeline."
-            if (curtick == 0) // is it right on tick == 0?
+            // is it right on tick == 0? (and is there an instrument on this channel?)
+            if ((curtick == 0) && (XM7_TheModule->CurrentChannelLastInstrument[chn] != 0) &&
+                (XM7_TheModule->Instrument[XM7_TheModule->CurrentChannelLastInstrument[chn] - 1] != NULL))
             {
                 // does that instrument has an envelope?
                 if (XM7_TheModule->Instrument[XM7_TheModule->CurrentChannelLastInstrument[chn] - 1]->VolumeType & 0x01)
@@ -1584,6 +1913,7 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
                 if (tmpvalue != 0)
                 {
                     // check if retrig wanted
+                    COUNT_DIVISION();
                     if ((curtick % tmpvalue) == 0)
                         resvalue = 0x1b01;  // gives back 1 if retrig needed
                 }
@@ -1610,6 +1940,7 @@ static u16 DecodeEffectsColumn(u8 chn, u8 effcmd, u8 effpar, u8 curtick, u16 add
                 effpar = XM7_TheModule->EffectTxyMemory[chn];
                 XM7_TheModule->CurrentTremorMuting[chn] =
                         (XM7_TheModule->CurrentTremorPoint[chn] > (effpar >> 4)) ? 1 : 0; // 1 = muting
+                COUNT_DIVISION();
                 XM7_TheModule->CurrentTremorPoint[chn] =
                         (XM7_TheModule->CurrentTremorPoint[chn] + 1) % ((effpar >> 4) + (effpar & 0x0f) + 2); // tick % (x+y+2)
             }
@@ -1681,6 +2012,8 @@ static int CalculateFreq(u8 mode, u8 note, s16 relativenote, s16 finetune, s32 p
 {
     int freq = 0;
 
+    COUNT_EFFECT(FreqCalculations);
+
     if (mode != 0)
     {
         //
@@ -1731,7 +2064,16 @@ static int CalculateFreq(u8 mode, u8 note, s16 relativenote, s16 finetune, s32 p
 
         newnote = note + relativenote;  // add the sample' relative note
         octave = newnote / 12;          // div
-        note = newnote % 12;            // mod
+        newnote %= 12;                  // mod
+
+        // notes below C-0 have to round down to the previous octave, or they
+        // would read outside of SampleFrequency[]
+        if (newnote < 0)
+        {
+            newnote += 12;
+            octave--;
+        }
+        note = newnote;
 
         octave = BASEOCTAVE - octave;
         freq = SampleFrequency [note];
@@ -1771,11 +2113,22 @@ static int CalculateFreq(u8 mode, u8 note, s16 relativenote, s16 finetune, s32 p
 
         // instrument 'auto'vibrato pitching
         if (autovibratopitch != 0)              // if note is auto-vibrato pitched
+        {
             finetune += autovibratopitch / 8;   // autovibratopitch pitch is in x/128
 
+            // keep it inside VeryFineTunes[]
+            if (finetune > 128)
+                finetune = 128;
+            else if (finetune < -128)
+                finetune = -128;
+        }
+
         // calculate period and then frequency
         int period = GetAmigaPeriod(note) + periodpitch;
-        freq = AMIGAMAGICNUMBER / period;
+        // a portamento can take the period down to zero: the division by zero
+        // gives 0 on the ARM7, but it would crash host builds
+        freq = (period != 0) ? AMIGAMAGICNUMBER / period : 0;
+        COUNT_DIVISION();
 
         // now fix freq with the sample's relative note
         if (relativenote > 0)
@@ -1796,6 +2149,7 @@ static int CalculateFreq(u8 mode, u8 note, s16 relativenote, s16 finetune, s32 p
             while (relativenote > 0)
             {
                 freq = (freq << FINETUNEPRECISION) / FineTunes[16];
+                COUNT_DIVISION();
                 relativenote--;
             }
         }
@@ -1811,6 +2165,7 @@ static int CalculateFreq(u8 mode, u8 note, s16 relativenote, s16 finetune, s32 p
         else
         {
             freq = (freq << FINETUNEPRECISION) / VeryFineTunes[-finetune];
+            COUNT_DIVISION();
         }
     }
 
@@ -1929,6 +2284,8 @@ static void PlayNote(u8 chn, u16 sample_offset)
 
         // ***************************** READY TO PLAY SAMPLE !!! *******************************************
 
+        TRACEPOINT(XM7_TRACEPOINT_NOTE, chn, (instrument << 8) | note, freq);
+
         // check if the sample has a loop or not
         if ((sample_ptr->Flags & 0x01) == 0)
         {
@@ -1947,6 +2304,7 @@ static void PlayNote(u8 chn, u16 sample_offset)
     else
     {
         // it's NULL: play nothing! (stop this channel)
+        TRACEPOINT(XM7_TRACEPOINT_NOTE, chn, (instrument << 8) | note, 0);
         XM7_lowlevel_startSound(0, NULL, 0, chn, 0, 0, 0, 0);
     }
 }
@@ -1957,6 +2315,9 @@ static void ChangeSample(u8 chn)
     u8 instrument = XM7_TheModule->CurrentChannelLastInstrument[chn];
     XM7_Sample_Type *sample_ptr = GetSamplePointer(note,instrument);
 
+    TRACEPOINT(XM7_TRACEPOINT_SAMPLE, chn, (instrument << 8) | note,
+               (sample_ptr != NULL) ? sample_ptr->LoopLength : 0);
+
     if (sample_ptr != NULL)
     {
         XM7_lowlevel_changeSample(sample_ptr->SampleData, sample_ptr->LoopLength,
@@ -1968,9 +2329,19 @@ static void ChangeSample(u8 chn)
     }
 }
 
-static void Timer0Handler(void)
+// what a pattern that wasn't loaded is made of
+static XM7_SingleNote_Type EmptyLine[16];
+
+static void RunTick(void)
 {
-    // this gets called each time Timer 0 'overflows'
+    if (XM7_Trace != NULL)
+        XM7_Trace->Tick++;
+
+#ifdef XM7_TRACEPOINTS
+    if (XM7_Tracepoints != NULL)
+        XM7_Tracepoints->Tick++;
+#endif
+
     XM7_SingleNoteArray_Type *CurrNoteLine;
     XM7_SingleNote_Type *CurrNote = NULL;
 
@@ -2009,6 +2380,13 @@ static void Timer0Handler(void)
     u8 RequestedLoops = 0;
     u8 CurrentLoopEffChannel = 0;
 
+    // the line to play. A pattern that wasn't loaded (see XM7_LoadXMSelection())
+    // plays as empty lines
+    if (XM7_TheModule->Pattern[XM7_TheModule->CurrentPatternNumber] != NULL)
+        CurrNoteLine = (XM7_SingleNoteArray_Type *)&(XM7_TheModule->Pattern[XM7_TheModule->CurrentPatternNumber]->Noteblock[XM7_TheModule->CurrentLine * (XM7_TheModule->NumberofChannels)]);
+    else
+        CurrNoteLine = (XM7_SingleNoteArray_Type *)EmptyLine;
+
     // for every channel
     for (chn = 0; chn < XM7_TheModule->NumberofChannels; chn++)
     {
@@ -2031,7 +2409,6 @@ static void Timer0Handler(void)
         ArpeggioValue = 0;
 
         // read the line and do what's written
-        CurrNoteLine = (XM7_SingleNoteArray_Type *)&(XM7_TheModule->Pattern[XM7_TheModule->CurrentPatternNumber]->Noteblock[XM7_TheModule->CurrentLine * (XM7_TheModule->NumberofChannels)]);
         CurrNote = &(CurrNoteLine->Noteblock[chn]);
 
         // decode effects that could apply NOW!
@@ -2154,10 +2531,16 @@ static void Timer0Handler(void)
             {
                 // volume envelope should go to RELEASE state
                 XM7_TheModule->CurrentSampleVolumeEnvelopeState[chn] = ENVELOPE_RELEASE;
+                TRACEPOINT(XM7_TRACEPOINT_ENVELOPE, chn, ENVELOPE_RELEASE,
+                           XM7_TheModule->CurrentSampleVolumeEnvelopePoint[chn]);
 
                 // maybe there's also a PANNING envelope
                 if (XM7_TheModule->CurrentSamplePanningEnvelopeState[chn] != ENVELOPE_NONE)
+                {
                     XM7_TheModule->CurrentSamplePanningEnvelopeState[chn] = ENVELOPE_RELEASE;
+                    TRACEPOINT(XM7_TRACEPOINT_ENVELOPE, chn, (1 << 8) | ENVELOPE_RELEASE,
+                               XM7_TheModule->CurrentSamplePanningEnvelopePoint[chn]);
+                }
             }
             else
             {
@@ -2281,7 +2664,9 @@ static void Timer0Handler(void)
                     if (XM7_TheModule->CurrentAutoVibratoSweep[chn] > 0x10000)
                         XM7_TheModule->CurrentAutoVibratoSweep[chn] = 0x10000;
 
-                    ShouldPitchNote = YES;
+                    // when the ticks are running late, every other tick is enough
+                    if ((XM7_DegradeLevel < XM7_DEGRADE_AUTOVIBRATO) || TickParity)
+                        ShouldPitchNote = YES;
                 }
             }
         }
@@ -2422,6 +2807,7 @@ static void Timer0Handler(void)
         if (ShouldTriggerNote)
         {
             PlayNote(chn,SampleStartOffset);
+            StalePitchChannels &= ~(1 << chn);
         }
         else
         {
@@ -2431,10 +2817,26 @@ static void Timer0Handler(void)
             // ****************************************************************************
             if (ShouldChangeVolume)
                 ApplyVolumeandPanning(chn);
+
+            // the pitch of a silent channel can wait until it's audible again
+            if (SilentChannels & (1 << chn))
+            {
+                if (ShouldPitchNote && (XM7_DegradeLevel >= XM7_DEGRADE_CULL_SILENT))
+                {
+                    StalePitchChannels |= 1 << chn;
+                    ShouldPitchNote = NO;
+                }
+            }
+            else if (StalePitchChannels & (1 << chn))
+            {
+                ShouldPitchNote = YES;
+            }
+
             if (ShouldPitchNote)
             {
                 PitchNote(chn, ArpeggioValue, XM7_TheModule->CurrentSamplePortamento[chn],
                           XM7_TheModule->CurrentVibratoValue[chn]);
+                StalePitchChannels &= ~(1 << chn);
             }
         }
 
@@ -2489,6 +2891,9 @@ static void Timer0Handler(void)
             {
                 XM7_TheModule->CurrentLine = XM7_TheModule->CurrentLoopBegin[CurrentLoopEffChannel];
                 XM7_TheModule->CurrentLoopCounter[CurrentLoopEffChannel]++;
+
+                TRACEPOINT(XM7_TRACEPOINT_LOOP, CurrentLoopEffChannel, XM7_TheModule->CurrentLine,
+                           XM7_TheModule->CurrentLoopCounter[CurrentLoopEffChannel]);
             }
             else
             {
@@ -2511,9 +2916,17 @@ static void Timer0Handler(void)
                 else
                     XM7_TheModule->CurrentSongPosition++;
 
+                if (BreakThisPattern || (NextPatternPosition >= 0))
+                    TRACEPOINT(XM7_TRACEPOINT_JUMP, XM7_TRACE_NO_CHANNEL,
+                               XM7_TheModule->CurrentSongPosition, XM7_TheModule->CurrentLine);
+
                 // check if song is finished... it is, we've got to restart!
                 if ((XM7_TheModule->CurrentSongPosition) >= (XM7_TheModule->ModuleLength))
+                {
                     XM7_TheModule->CurrentSongPosition = XM7_TheModule->RestartPoint;
+                    TRACEPOINT(XM7_TRACEPOINT_RESTART, XM7_TRACE_NO_CHANNEL,
+                               XM7_TheModule->RestartPoint, 0);
+                }
 
                 // set new currentpatternnumber!
                 XM7_TheModule->CurrentPatternNumber = XM7_TheModule->PatternOrder[XM7_TheModule->CurrentSongPosition];
@@ -2527,6 +2940,214 @@ static void Timer0Handler(void)
     }
 }
 
+// the clock used to measure the ticks (see XM7_SetHandlerStats())
+#ifdef __NDS__
+#define HANDLER_CLOCK_FREQUENCY BUS_CLOCK
+
+static u32 HandlerClock(void)
+{
+    return cpuGetTiming();
+}
+#else
+#define HANDLER_CLOCK_FREQUENCY 1000000000
+
+static u32 HandlerClock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32)ts.tv_sec * 1000000000u + (u32)ts.tv_nsec;
+}
+#endif
+
+static void AccountTick(XM7_HandlerStats_Type *stats, u32 time, int rowtick)
+{
+    stats->Frequency = HANDLER_CLOCK_FREQUENCY;
+
+    if ((stats->Ticks == 0) || (time < stats->Min))
+        stats->Min = time;
+    if (time > stats->Max)
+        stats->Max = time;
+    stats->Ticks++;
+    stats->Total += time;
+    stats->Last = time;
+
+    if (rowtick)
+    {
+        stats->RowTicks++;
+        stats->RowTotal += time;
+        if (time > stats->RowMax)
+            stats->RowMax = time;
+    }
+    else
+    {
+        stats->MidRowTotal += time;
+        if (time > stats->MidRowMax)
+            stats->MidRowMax = time;
+    }
+
+    // bucket = position of the highest bit set
+    u32 bucket = 0;
+    while ((time >> bucket) > 1)
+        bucket++;
+    stats->Histogram[bucket]++;
+}
+
+static void BeginEffectStats(XM7_EffectStats_Type *effects)
+{
+    // odd sequence: the counters are being updated
+    StoreRelease(&effects->Sequence, effects->Sequence + 1);
+
+    u32 requests = effects->ResetRequests;
+    if (effects->Resets != requests)
+    {
+        memset(&effects->Ticks, 0,
+               sizeof(XM7_EffectStats_Type) - offsetof(XM7_EffectStats_Type, Ticks));
+        effects->Resets = requests;
+    }
+
+    effects->Ticks++;
+}
+
+static void EndEffectStats(XM7_EffectStats_Type *effects)
+{
+    // even sequence: the counters can be read
+    StoreRelease(&effects->Sequence, effects->Sequence + 1);
+}
+
+// the time of a tick for the overrun control, see XM7_OverrunControl_Type
+#ifdef __NDS__
+#define OVERRUN_CLOCK_FREQUENCY (BUS_CLOCK / 1024)
+#else
+#define OVERRUN_CLOCK_FREQUENCY 1000000000
+#endif
+
+static void ControlOverrun(XM7_OverrunControl_Type *control, u32 time, u32 period, int overrun)
+{
+    control->Frequency = OVERRUN_CLOCK_FREQUENCY;
+    control->Ticks++;
+    control->TicksAtLevel[XM7_DegradeLevel]++;
+
+    if ((u64)time * control->WorstPeriod >= (u64)control->WorstTime * period)
+    {
+        control->WorstTime = time;
+        control->WorstPeriod = period;
+    }
+
+    u32 budget = (control->Budget == 0) ? 256 : control->Budget;
+    u64 used = (u64)time * 256;
+    u64 allowed = (u64)period * budget;
+
+    u8 level = XM7_DegradeLevel;
+    u8 maxlevel = (control->MaxLevel > XM7_DEGRADE_CULL_SILENT) ?
+                        XM7_DEGRADE_CULL_SILENT : control->MaxLevel;
+
+    if (overrun)
+        control->Overruns++;
+
+    if (overrun || (used > allowed))
+    {
+        control->OverBudget++;
+        CalmTicks = 0;
+        if (level < maxlevel)
+            level++;
+    }
+    else if (used * 2 < allowed)
+    {
+        // go back to better quality only when things have been calm for a while
+        CalmTicks++;
+        if ((CalmTicks >= 64) && (level > XM7_DEGRADE_NONE))
+        {
+            level--;
+            CalmTicks = 0;
+        }
+    }
+    else
+    {
+        CalmTicks = 0;
+    }
+
+    // the user may have lowered the limit
+    if (level > maxlevel)
+        level = maxlevel;
+
+    if (level != XM7_DegradeLevel)
+    {
+        XM7_DegradeLevel = level;
+        control->LevelChanges++;
+    }
+
+    control->Level = level;
+}
+
+static void Timer0Handler(void)
+{
+    // this gets called each time Timer 0 'overflows'
+
+    XM7_HandlerStats_Type *stats = XM7_HandlerStats;
+    XM7_EffectStats_Type *effects = XM7_EffectStats;
+    XM7_OverrunControl_Type *control = XM7_OverrunControl;
+
+#ifndef __NDS__
+    u32 controlstart = 0;
+    u32 controlperiod = 0;
+    if (control != NULL)
+    {
+        controlstart = HandlerClock();
+        if (XM7_TheModule->CurrentBPM != 0)
+            controlperiod = 2500000000u / XM7_TheModule->CurrentBPM;
+    }
+#endif
+
+    TickParity ^= 1;
+
+    if (effects != NULL)
+        BeginEffectStats(effects);
+
+    if (stats == NULL)
+    {
+        RunTick();
+    }
+    else
+    {
+        // the wrap around of the clock doesn't matter, ticks are much shorter
+        int rowtick = (XM7_TheModule->CurrentTick == 0)
+                      && (XM7_TheModule->CurrentAdditionalTick == 0);
+        u32 start = HandlerClock();
+
+        RunTick();
+
+        AccountTick(stats, HandlerClock() - start, rowtick);
+    }
+
+    if (effects != NULL)
+        EndEffectStats(effects);
+
+    if (control != NULL)
+    {
+#ifdef __NDS__
+        // timer 0 counts up from -period, the time is measured since it
+        // overflowed. If it has overflowed again, its IRQ is pending.
+        if ((XM7_TimerMode == XM7_TIMER_MODE_TIMER0) && (Timer0Period != 0))
+        {
+            u32 time = (u16)(TIMER0_DATA + Timer0Period);
+            int overrun = (REG_IF & IRQ_TIMER0) != 0;
+            if (overrun)
+                time += Timer0Period;
+
+            ControlOverrun(control, time, Timer0Period, overrun);
+        }
+#else
+        u64 time = HandlerClock() - controlstart;
+        if (OverrunTimeScale > 1)
+            time *= OverrunTimeScale;
+        if (time > UINT32_MAX)
+            time = UINT32_MAX;
+
+        ControlOverrun(control, time, controlperiod, time > controlperiod);
+#endif
+    }
+}
+
 void XM7_PlayModuleFromPos(XM7_ModuleManager_Type* TheModule, u8 position)
 {
     XM7_TheModule = TheModule;
@@ -2544,6 +3165,10 @@ void XM7_PlayModuleFromPos(XM7_ModuleManager_Type* TheModule, u8 position)
     XM7_TheModule->CurrentLine = 0;
     XM7_TheModule->CurrentTick = 0;
 
+    // nothing has been played yet
+    SilentChannels = 0xFFFF;
+    StalePitchChannels = 0;
+
     // other...
     XM7_TheModule->CurrentDelayLines = 0;
     XM7_TheModule->CurrentDelayTick = 0;
@@ -2608,14 +3233,22 @@ void XM7_PlayModuleFromPos(XM7_ModuleManager_Type* TheModule, u8 position)
     // the silence sample
     XM7_TheModule->Silence = 0x00000000;
 
+    // the random waveforms
+    XM7_TheModule->CurrentRandomSeed = 1;
+
     // ... GO!
 
-    // 1st: set up the IRQ handler for the timer 0 and enable the IRQ.
-    irqSet(IRQ_TIMER0, Timer0Handler);
-    irqEnable(IRQ_TIMER0);
+#ifdef __NDS__
+    if (XM7_TimerMode == XM7_TIMER_MODE_TIMER0)
+    {
+        // 1st: set up the IRQ handler for the timer 0 and enable the IRQ.
+        irqSet(IRQ_TIMER0, Timer0Handler);
+        irqEnable(IRQ_TIMER0);
 
-    // then set the timer and make it start!
-    TIMER0_CR = TIMER_DIV_1024 | TIMER_IRQ_REQ;
+        // then set the timer and make it start!
+        TIMER0_CR = TIMER_DIV_1024 | TIMER_IRQ_REQ;
+    }
+#endif
     SetTimerSpeedBPM(XM7_TheModule->DefaultBPM);
 
     // set engine state
@@ -2630,8 +3263,20 @@ void XM7_PlayModule(XM7_ModuleManager_Type* TheModule)
 void XM7_StopModule(void)
 {
     // will deactivate the timer IRQ (and stop the channels)
-    TIMER0_CR = 0;
-    irqDisable(IRQ_TIMER0);
+    // the writes of the stop go with the tick that would have come next
+    if (XM7_Trace != NULL)
+        XM7_Trace->Tick++;
+
+    if (XM7_TimerMode == XM7_TIMER_MODE_TIMER0)
+    {
+        TraceWrite(XM7_TRACE_NO_CHANNEL, XM7_TRACE_REG_TIMER0, 0);
+#ifdef __NDS__
+        TIMER0_CR = 0;
+        irqDisable(IRQ_TIMER0);
+#else
+        XM7_Backend->SetTimer(XM7_Backend->Context, 0, NULL);
+#endif
+    }
 
     for (u8 i = 0; i < XM7_TheModule->NumberofChannels; i++)
         XM7_lowlevel_stopSound(i);
@@ -2663,9 +3308,37 @@ void XM7_ResumeModule(void)
 }
 */
 
+void XM7_SetTimerMode(XM7_TimerModes mode)
+{
+    XM7_TimerMode = mode;
+}
+
+void XM7_Tick(void)
+{
+    // nothing to do if there isn't a module playing
+    if ((XM7_TheModule == NULL) || (XM7_TheModule->State != XM7_STATE_PLAYING))
+        return;
+
+    Timer0Handler();
+}
+
+void XM7_AdvanceTicks(u32 n)
+{
+    while (n > 0)
+    {
+        XM7_Tick();
+        n--;
+    }
+}
+
 void XM7_Initialize(void)
 {
     CalculateVeryFineTunes();
+#ifndef __NDS__
+    // don't replace the backend if it has been set before this call
+    if (XM7_Backend == NULL)
+        XM7_SetBackend(NULL);
+#endif
     // CalculateRealPanningArray(45); //  (35% of 128 = 44,8)
 }
 
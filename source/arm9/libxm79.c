@@ -2,15 +2,206 @@
 //
 // Copyright (c) 2018 sverx
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __NDS__
 #include <nds.h>
+#else
+#include <time.h>
+#endif
 
 #include <libxm7.h>
 
 #include "libxm7_internal.h"
 
+#ifndef __NDS__
+#include <libxm7_host.h>
+
+// statistics of the loads made by this thread (see XM7_SetLoaderStats())
+static _Thread_local XM7_LoaderStats_Type *XM7_LoaderStats;
+static _Thread_local int CurrentPhase;
+static _Thread_local u64 CurrentPhaseStart;
+
+static u64 PhaseTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void XM7_SetLoaderStats(XM7_LoaderStats_Type *stats)
+{
+    XM7_LoaderStats = stats;
+}
+#endif
+
+// the time spent by the loaders in each phase is only measured in host builds
+static void SwitchPhase(int phase)
+{
+#ifndef __NDS__
+    if (XM7_LoaderStats == NULL)
+        return;
+
+    u64 now = PhaseTimeNs();
+
+    XM7_LoaderStats->PhaseNs[CurrentPhase] += now - CurrentPhaseStart;
+
+    CurrentPhase = phase;
+    CurrentPhaseStart = now;
+#else
+    (void)phase;
+#endif
+}
+
+// starts measuring again a load that was stopped (see XM7_LoadStep())
+static void ResumeLoad(void)
+{
+#ifndef __NDS__
+    if (XM7_LoaderStats == NULL)
+        return;
+
+    CurrentPhase = XM7_LOAD_PHASE_HEADERS;
+    CurrentPhaseStart = PhaseTimeNs();
+#endif
+}
+
+static void BeginLoad(void)
+{
+#ifndef __NDS__
+    if (XM7_LoaderStats != NULL)
+        XM7_LoaderStats->Loads++;
+#endif
+
+    ResumeLoad();
+}
+
+static void EndLoad(void)
+{
+#ifndef __NDS__
+    SwitchPhase(CurrentPhase);
+#endif
+}
+
+#ifdef __NDS__
+#define XM7_LOADER_STATE static
+#else
+#define XM7_LOADER_STATE static _Thread_local
+#endif
+
+// the arena the blocks of the module being loaded are carved from, if any (see
+// XM7_LoadXMArena())
+XM7_LOADER_STATE u8 *ArenaNext;
+XM7_LOADER_STATE u32 ArenaLeft;
+
+// the allocator of the loads made by this thread, NULL for malloc()
+XM7_LOADER_STATE const XM7_Allocator_Type *LoaderAllocator;
+
+// where the data of the next sample can go in the file being loaded in place,
+// if any (see XM7_LoadXMInPlace())
+XM7_LOADER_STATE u8 *InPlaceNext;
+
+// 1 if the samples can be played from the file being loaded (see
+// XM7_LoadMODResident())
+XM7_LOADER_STATE u8 ResidentSamples;
+
+// the patterns and instruments to load, one bit each, when only a part of the
+// module is loaded (see XM7_LoadXMSelection())
+typedef struct {
+    const XM7_Selection_Type *Selection;
+    u8 Patterns[256 / 8];
+    u8 Instruments[256 / 8];       // the loader keeps the number in a u8
+} Selected_Type;
+
+XM7_LOADER_STATE Selected_Type *LoaderSelected;
+
+#define BitTest(bits, n)    ((bits)[(n) >> 3] & (1 << ((n) & 7)))
+#define BitSet(bits, n)     ((bits)[(n) >> 3] |= (1 << ((n) & 7)))
+
+void XM7_SetAllocator(const XM7_Allocator_Type *allocator)
+{
+    LoaderAllocator = allocator;
+}
+
+// blocks carved from an arena are aligned to 8 bytes: the DS sound hardware
+// needs 4, and host builds have 8-byte pointers in the instruments
+#define ARENA_ALIGN             8
+#define ArenaBlockSize(size)    (((size) + ARENA_ALIGN - 1) & ~(u32)(ARENA_ALIGN - 1))
+
+// Size of a heap block of a dlmalloc-like allocator: the requested size plus a
+// size field, rounded up to twice the size of a pointer
+static u32 HeapBlockSize(u32 size)
+{
+    const u32 align = 2 * sizeof(size_t);
+
+    u32 block = (size + sizeof(size_t) + align - 1) & ~(align - 1);
+
+    return (block < 2 * align) ? 2 * align : block;
+}
+
+static void *Allocate(size_t size, XM7_AllocCategories category)
+{
+    if (ArenaNext != NULL)
+    {
+        u32 block = ArenaBlockSize(size);
+        if (block > ArenaLeft)
+            return NULL;
+
+        void *ptr = ArenaNext;
+        ArenaNext += block;
+        ArenaLeft -= block;
+        return ptr;
+    }
+
+#ifndef __NDS__
+    if (XM7_LoaderStats != NULL)
+    {
+        XM7_LoaderStats->Allocations++;
+        XM7_LoaderStats->AllocatedBytes += size;
+    }
+#endif
+
+    if (LoaderAllocator != NULL)
+        return LoaderAllocator->Allocate(size, category, LoaderAllocator->User);
+
+    return malloc(size);
+}
+
+static void FreeBlock(const XM7_Allocator_Type *allocator, void *ptr, XM7_AllocCategories category)
+{
+    if (allocator != NULL)
+        allocator->Free(ptr, category, allocator->User);
+    else
+        free(ptr);
+}
+
+static void Release(void *ptr, XM7_AllocCategories category)
+{
+    // blocks of an arena are only freed all together
+    if (ArenaNext == NULL)
+        FreeBlock(LoaderAllocator, ptr, category);
+}
+
+// checks if a block is inside the file kept by a module loaded in place
+static int InFile(const XM7_ModuleManager_Type *Module, const void *ptr)
+{
+    const u8 *file = Module->File;
+
+    return (file != NULL) && ((const u8 *)ptr >= file) &&
+           ((const u8 *)ptr < file + Module->FileSize);
+}
+
+// sets the fields of a module that tell how its memory has to be freed
+static void PrepareModule(XM7_ModuleManager_Type *Module)
+{
+    Module->Arena = NULL;
+    Module->Allocator = LoaderAllocator;
+    Module->File = NULL;
+    Module->FileOwned = 0;
+}
+
 // MOD octave 0 difference
 #define AMIGABASEOCTAVE 2
 // AmigaPeriods for MOD "Octave ZERO"
@@ -125,25 +316,23 @@ static u8 IdentifyMOD(char c1, char c2, char c3, char c4)
     return 0;
 }
 
+static XM7_SingleNoteArray_Type* AllocateNewPattern(u16 len, u8 chn)
+{
+    // allocates a new pattern with LEN lines and CNH channels, without clearing
+    // it: the caller has to write every note
+
+    return Allocate(sizeof(XM7_SingleNote_Type) * len * chn, XM7_ALLOC_PATTERN);
+}
+
 static XM7_SingleNoteArray_Type* PrepareNewPattern(u16 len, u8 chn)
 {
     // prepares a new EMPTY pattern with LEN lines and CNH channels
 
-    u16 cnt = len * chn;
-    XM7_SingleNoteArray_Type *ptr = malloc(sizeof(XM7_SingleNote_Type) * cnt);
+    XM7_SingleNoteArray_Type *ptr = AllocateNewPattern(len, chn);
 
     // check if memory has been allocated before using it
     if (ptr != NULL)
-    {
-        for (u16 i = 0; i < cnt; i++)
-        {
-            ptr->Noteblock[i].Note = 0x00;
-            ptr->Noteblock[i].Instrument = 0x00;
-            ptr->Noteblock[i].Volume = 0x00;
-            ptr->Noteblock[i].EffectType = 0x00;
-            ptr->Noteblock[i].EffectParam = 0x00;
-        }
-    }
+        memset(ptr, 0, sizeof(XM7_SingleNote_Type) * len * chn);
 
     return ptr;
 }
@@ -152,7 +341,7 @@ static XM7_Instrument_Type* PrepareNewInstrument(void)
 {
     // prepares a new EMPTY instrument
 
-    XM7_Instrument_Type *ptr = malloc(sizeof (XM7_Instrument_Type));
+    XM7_Instrument_Type *ptr = Allocate(sizeof (XM7_Instrument_Type), XM7_ALLOC_INSTRUMENT);
 
     // check if memory has been allocated before using it
     if (ptr != NULL)
@@ -169,13 +358,8 @@ static XM7_Instrument_Type* PrepareNewInstrument(void)
     return ptr;
 }
 
-static XM7_Sample_Type *PrepareNewSample(u32 len, u32 looplen, u8 flags)
+static u32 SampleDataSize(u32 len, u32 looplen, u8 flags)
 {
-    // prepares a new EMPTY sample
-
-    XM7_SampleData_Type *data_ptr;
-    XM7_Sample_Type *ptr;
-
     u32 malloclen = len;
 
     if ((flags & 0x03) == 0x02)
@@ -198,12 +382,24 @@ static XM7_Sample_Type *PrepareNewSample(u32 len, u32 looplen, u8 flags)
         malloclen += looplen; // adds the portion that gets reverted
     }
 
-    ptr = malloc(sizeof(XM7_Sample_Type));
+    return malloclen;
+}
+
+static XM7_Sample_Type *PrepareNewSample(u32 len, u32 looplen, u8 flags)
+{
+    // prepares a new EMPTY sample
+
+    XM7_SampleData_Type *data_ptr;
+    XM7_Sample_Type *ptr;
+
+    u32 malloclen = SampleDataSize(len, looplen, flags);
+
+    ptr = Allocate(sizeof(XM7_Sample_Type), XM7_ALLOC_SAMPLE);
 
     // check if memory has been allocated before using it
     if (ptr != NULL)
     {
-        data_ptr = malloc(sizeof(u8) * malloclen);
+        data_ptr = Allocate(sizeof(u8) * malloclen, XM7_ALLOC_SAMPLE_DATA);
 
         // check if SAMPLE memory has been allocated before using it
         if (data_ptr != NULL)
@@ -219,7 +415,7 @@ static XM7_Sample_Type *PrepareNewSample(u32 len, u32 looplen, u8 flags)
         else
         {
             // SAMPLE memory not allocated, REMOVE the parent
-            free(ptr);
+            Release(ptr, XM7_ALLOC_SAMPLE);
             ptr = NULL;
         }
     }
@@ -227,36 +423,61 @@ static XM7_Sample_Type *PrepareNewSample(u32 len, u32 looplen, u8 flags)
     return ptr;
 }
 
-// returns 0 if OK, an error otherwise
-XM7_Error XM7_LoadXM(XM7_ModuleManager_Type *Module, const void *XMModule_)
+// prepares a new sample like PrepareNewSample(), but when loading in place its
+// data goes in the file, over what has been read already, and when the file is
+// resident it's the data in the file itself. `source` is where the data of the
+// sample is in the file and `used` how many bytes of it are read, so they
+// aren't overwritten before being decoded
+static XM7_Sample_Type *PrepareNewSampleInPlace(u32 len, u32 looplen, u8 flags,
+                                                const u8 *source, u32 used)
 {
-    const XM7_XMModuleHeader_Type *XMModule = XMModule_;
+    u8 *data = NULL;
 
-    // reset these values
-    Module->NumberofPatterns = 0;
-    Module->NumberofInstruments = 0;
+    // the DS sound hardware needs the data aligned to 4 bytes
+    if (InPlaceNext != NULL)
+        data = InPlaceNext + (-(uintptr_t)InPlaceNext & 3);
+    else if (ResidentSamples && (((uintptr_t)source & 3) == 0))
+        data = (u8 *)source; // only read from now on
+
+    if (data != NULL)
+    {
+        u32 size = SampleDataSize(len, looplen, flags);
+
+        if ((size > 0) && (data <= source) && (data + size <= source + used))
+        {
+            XM7_Sample_Type *ptr = Allocate(sizeof(XM7_Sample_Type), XM7_ALLOC_SAMPLE);
+            if (ptr != NULL)
+            {
+                ptr->SampleData = (XM7_SampleData_Type *)data;
+                ptr->Length = len;
+                memset(ptr->Name, 0, 22);
+
+                if (InPlaceNext != NULL)
+                    InPlaceNext = data + size;
+            }
+
+            return ptr;
+        }
+    }
+
+    return PrepareNewSample(len, looplen, flags);
+}
 
+// checks the header of an XM and copies the info the module needs from it
+static XM7_Error ReadXMModuleHeader(XM7_ModuleManager_Type *Module, const XM7_XMModuleHeader_Type *XMModule)
+{
     // check the ID text and the 0x1a
     if ((memcmp(XMModule->FixedText, "Extended Module: ", 17) != 0) ||
         (XMModule->FixedChar != 0x1a))
-    {
-        Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_A_VALID_MODULE;
         return XM7_ERR_NOT_A_VALID_MODULE;
-    }
 
     // check the version of the module
     if ((XMModule->Version != 0x103) && (XMModule->Version != 0x104))
-    {
-        Module->State = XM7_STATE_ERROR | XM7_ERR_UNKNOWN_MODULE_VERSION;
         return XM7_ERR_UNKNOWN_MODULE_VERSION;
-    }
 
     // check how may channels are in the module
     if (XMModule->NumberofChannels > 16)
-    {
-        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
         return XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
-    }
 
     // load all the needed info from the header
     Module->ModuleLength = XMModule->SongLength;
@@ -272,473 +493,2239 @@ XM7_Error XM7_LoadXM(XM7_ModuleManager_Type *Module, const void *XMModule_)
     memcpy(Module->TrackerName, XMModule->TrackerName, 20); // char[20]
     memcpy(Module->PatternOrder, XMModule->PatternOrder, XMModule->HeaderSize - 20); // u8[]
 
-    // the MODULE header is finished!
+    return 0;
+}
 
-    // BETA TEST
-    // return (0);
+// copies the info of an instrument from its header(s)
+static void ReadXMInstrumentHeader(XM7_Instrument_Type *CurrentInstrumentPtr,
+                                   const XM7_XMInstrument1stHeader_Type *XMInstrument1Header)
+{
+    // load the info from the header
+    CurrentInstrumentPtr->NumberofSamples = XMInstrument1Header->NumberofSamples;
+    memcpy(CurrentInstrumentPtr->Name, XMInstrument1Header->Name, 22); // char[22]
 
-    // now working on the patterns
-    u16 CurrentPattern;
-    XM7_XMPatternHeader_Type *XMPatternHeader =
-            (XM7_XMPatternHeader_Type *)&(XMModule->PatternOrder[XMModule->HeaderSize - 20]);
+    // the 2nd part is only used when there are samples
+    if (XMInstrument1Header->NumberofSamples == 0)
+        return;
 
-    // BETA TEST
-    // Module->NumberofPatterns=1;
+    // get the 2nd part of the header
+    const XM7_XMInstrument2ndHeader_Type *XMInstrument2Header =
+            (const XM7_XMInstrument2ndHeader_Type *)&(XMInstrument1Header->NextHeaderPart[0]);
 
-    for (CurrentPattern = 0; CurrentPattern < (Module->NumberofPatterns); CurrentPattern++)
+    // 2009! HNY!
+    // check the length of the instrument header before proceed!
+
+    if (XMInstrument1Header->InstrumentHeaderLength >= 33 + 96)
     {
-        // check if the PATTERN header is ok
-        if ((XMPatternHeader->HeaderLength != 9) || (XMPatternHeader->PackingType != 0))
-        {
-            Module->NumberofPatterns = CurrentPattern;
-            Module->NumberofInstruments = 0;
-            Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
-            return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
-        }
+        // copy the 96 notes' sample numbers
+        memcpy (CurrentInstrumentPtr->SampleforNote, XMInstrument2Header->SampleforNotes, 96); // u8[96]
+    }
+    else
+    {
+        // fill with 0 all the samples numbers
+        memset(CurrentInstrumentPtr->SampleforNote, 0, 96);
+    }
 
-        // check if the PATTERN lenght is ok
-        if ((XMPatternHeader->NumberofLinesinThisPattern < 1) ||
-            (XMPatternHeader->NumberofLinesinThisPattern > 256))
-        {
-            Module->NumberofPatterns = CurrentPattern;
-            Module->NumberofInstruments = 0;
-            Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
-            return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
-        }
+    //if (XMInstrument1Header->InstrumentHeaderLength >= 33 + 96 + 123)
+    if (XMInstrument1Header->InstrumentHeaderLength >= 33 + 96 + 123 - 22)
+    {
+        // read all the data about Volume&Envelope points (the 22 'reserved' bytes can be absent)
+        memcpy((u8 *)CurrentInstrumentPtr->VolumeEnvelopePoint,
+               (const u8 *)XMInstrument2Header->VolumeEnvelopePoints, 48); // 12x2x2=u8[48]
+        memcpy((u8 *)CurrentInstrumentPtr->PanningEnvelopePoint,
+               (const u8 *)XMInstrument2Header->PanningEnvelopePoints, 48); // 12x2x2=u8[48]
+
+        CurrentInstrumentPtr->NumberofVolumeEnvelopePoints = XMInstrument2Header->NumberofVolumePoints;
+        CurrentInstrumentPtr->NumberofPanningEnvelopePoints = XMInstrument2Header->NumberofPanningPoints;
+
+        CurrentInstrumentPtr->VolumeSustainPoint = XMInstrument2Header->VolumeSustainPoint;
+        CurrentInstrumentPtr->VolumeLoopStartPoint = XMInstrument2Header->VolumeLoopStartPoint;
+        CurrentInstrumentPtr->VolumeLoopEndPoint = XMInstrument2Header->VolumeLoopEndPoint;
+
+        CurrentInstrumentPtr->PanningSustainPoint = XMInstrument2Header->PanningSustainPoint;
+        CurrentInstrumentPtr->PanningLoopStartPoint = XMInstrument2Header->PanningLoopStartPoint;
+        CurrentInstrumentPtr->PanningLoopEndPoint = XMInstrument2Header->PanningLoopEndPoint;
+
+        CurrentInstrumentPtr->VolumeType = XMInstrument2Header->VolumeType; // bit 0: On; 1: Sustain; 2: Loop
+        CurrentInstrumentPtr->PanningType = XMInstrument2Header->PanningType; // bit 0: On; 1: Sustain; 2: Loop
+
+        // Instrument Vibrato
+        CurrentInstrumentPtr->VibratoType = XMInstrument2Header->VibratoType;
+        CurrentInstrumentPtr->VibratoSweep = 0x10000 / (XMInstrument2Header->VibratoSweep + 1);
+        CurrentInstrumentPtr->VibratoDepth = XMInstrument2Header->VibratoDepth;
+        CurrentInstrumentPtr->VibratoRate = XMInstrument2Header->VibratoRate;
+
+        // envelope volume fadeout
+        CurrentInstrumentPtr->VolumeFadeout = XMInstrument2Header->VolumeFadeOut;
+    }
+    else
+    {
+        // there are NO envelopes in the file...
+        CurrentInstrumentPtr->VolumeType = 0;
+        CurrentInstrumentPtr->PanningType = 0;
+        CurrentInstrumentPtr->NumberofVolumeEnvelopePoints = 0;
+        CurrentInstrumentPtr->NumberofPanningEnvelopePoints = 0;
+        // if there's no vibrato in the file...
+        CurrentInstrumentPtr->VibratoType = 0;
+        CurrentInstrumentPtr->VibratoSweep = 0;
+        CurrentInstrumentPtr->VibratoDepth = 0;
+        CurrentInstrumentPtr->VibratoRate = 0;
+        // if there's no fadeout in the file...
+        CurrentInstrumentPtr->VolumeFadeout = 0;
+    }
+}
 
-        // pattern is ok! Get the length
-        Module->PatternLength[CurrentPattern]=XMPatternHeader->NumberofLinesinThisPattern;
+// copies the info of a sample from its header
+static void ReadXMSampleHeader(XM7_Sample_Type *CurrentSamplePtr, const XM7_XMSampleHeader_Type *XMSampleHeader)
+{
+    // read all the data
+    CurrentSamplePtr->LoopStart  = XMSampleHeader->LoopStart;
+    CurrentSamplePtr->LoopLength = XMSampleHeader->LoopLength;
+    CurrentSamplePtr->Volume     = XMSampleHeader->Volume;
+    CurrentSamplePtr->FineTune   = XMSampleHeader->FineTune;
+    CurrentSamplePtr->Flags      = XMSampleHeader->Type & ~0x08; // bit 3 is ours
+
+    // if loop type is 0x03 it becomes 'forward', because XMs shouldn't support 0x03 loops...
+    if ((CurrentSamplePtr->Flags & 0x0F) == 0x03)
+        CurrentSamplePtr->Flags = (CurrentSamplePtr->Flags & 0xF0) | 0x01;
+
+    // end
+    CurrentSamplePtr->Panning      = XMSampleHeader->Panning;
+    CurrentSamplePtr->RelativeNote = XMSampleHeader->RelativeNote;
+    memcpy(CurrentSamplePtr->Name, XMSampleHeader->Name, 22); // char[22]
+}
 
-        // Prepare an empty pattern for the data
-        Module->Pattern[CurrentPattern] =
-                PrepareNewPattern(Module->PatternLength[CurrentPattern], Module->NumberofChannels);
+// the deltas are decoded a word at a time where the source and the destination
+// are aligned the same way, and host builds decode 16 bytes at a time with the
+// vector extensions of the compiler
+#if !defined(__NDS__) && defined(__has_builtin)
+#if __has_builtin(__builtin_shufflevector)
+#define DELTA_VECTORS
+typedef u8 DeltaVector8_Type __attribute__((vector_size(16)));
+typedef u16 DeltaVector16_Type __attribute__((vector_size(16)));
+#endif
+#endif
+
+// Delta-decodes `size` bytes of 8 bit sample data, returns the last value
+static u8 DeltaDecode8(u8 *dst, const u8 *src, u32 size, u8 old)
+{
+    u32 i = 0;
 
-        if (Module->Pattern[CurrentPattern] == NULL)
-        {
-            Module->NumberofPatterns=CurrentPattern;
-            Module->NumberofInstruments = 0;
-            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
-            return XM7_ERR_NOT_ENOUGH_MEMORY;
-        }
+#ifdef DELTA_VECTORS
+    const DeltaVector8_Type zero = { 0 };
+    DeltaVector8_Type last = zero + old;
+
+    for ( ; i + 16 <= size; i += 16)
+    {
+        DeltaVector8_Type v;
+        memcpy(&v, &src[i], 16);
+
+        // prefix sums of the 16 deltas: add the vector shifted by 1, 2, 4, 8
+        v += __builtin_shufflevector(zero, v, 0, 16, 17, 18, 19, 20, 21, 22,
+                                     23, 24, 25, 26, 27, 28, 29, 30);
+        v += __builtin_shufflevector(zero, v, 0, 0, 16, 17, 18, 19, 20, 21,
+                                     22, 23, 24, 25, 26, 27, 28, 29);
+        v += __builtin_shufflevector(zero, v, 0, 0, 0, 0, 16, 17, 18, 19,
+                                     20, 21, 22, 23, 24, 25, 26, 27);
+        v += __builtin_shufflevector(zero, v, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     16, 17, 18, 19, 20, 21, 22, 23);
+        v += last;
+
+        memcpy(&dst[i], &v, 16);
+
+        // the last value goes to all the elements, for the next 16 bytes
+        last = __builtin_shufflevector(v, v, 15, 15, 15, 15, 15, 15, 15, 15,
+                                       15, 15, 15, 15, 15, 15, 15, 15);
+    }
 
-        // decode the PackedData
-        u16 i = 0;
-        u16 wholenote = 0;
-        u8 firstbyte;
+    old = last[0];
+#endif
 
-        XM7_SingleNoteArray_Type *thispattern = Module->Pattern[CurrentPattern];
+    // a word at a time (on the DS only if both are aligned the same way)
+    if ((((uintptr_t)&dst[i] ^ (uintptr_t)&src[i]) & 3) == 0)
+    {
+        for ( ; (i < size) && ((uintptr_t)&dst[i] & 3); i++)
+            dst[i] = old += src[i];
 
-        while (i < (XMPatternHeader->PackedPatterndataLength))
+        for ( ; i + 4 <= size; i += 4)
         {
-            firstbyte = XMPatternHeader->PatternData[i];
+            u32 w;
+            memcpy(&w, __builtin_assume_aligned(&src[i], 4), 4);
 
-            if (firstbyte & 0x80)
-            {
-                // it's compressed: skip to the next byte
-                i++;
-            }
-            else
-            {
-                // if "it's NOT compressed" then there are 5 bytes, simulate it's compressed with 5 bytes following
-                firstbyte = 0x1F;
-            }
+            u32 a = old + w;
+            u32 b = a + (w >> 8);
+            u32 c = b + (w >> 16);
+            u32 d = c + (w >> 24);
+            w = (a & 0xFF) | ((b & 0xFF) << 8) | ((c & 0xFF) << 16) | (d << 24);
 
-            // if next is a NOTE:
-            if (firstbyte & 0x01)
-            {
-                // read the note
-                thispattern->Noteblock[wholenote].Note = XMPatternHeader->PatternData[i];
-                i++;
-            }
+            memcpy(__builtin_assume_aligned(&dst[i], 4), &w, 4);
+            old = d;
+        }
+    }
 
-            // if next is a INSTRUMENT:
-            if (firstbyte & 0x02)
-            {
-                // read the instrument
-                thispattern->Noteblock[wholenote].Instrument = XMPatternHeader->PatternData[i];
-                i++;
-            }
+    for ( ; i < size; i++)
+        dst[i] = old += src[i];
 
-            // if next is a VOLUME:
-            if (firstbyte & 0x04)
-            {
-                // read the volume
-                thispattern->Noteblock[wholenote].Volume = XMPatternHeader->PatternData[i];
-                i++;
-            }
+    return old;
+}
 
-            // if next is an EFFECT TYPE:
-            if (firstbyte & 0x08)
-            {
-                // read the effect type
-                thispattern->Noteblock[wholenote].EffectType = XMPatternHeader->PatternData[i];
-                i++;
-            }
+// Delta-decodes `count` samples of 16 bit sample data, returns the last value
+// (the data in the file isn't always aligned to 2 bytes)
+static u16 DeltaDecode16(u16 *dst, const XM7_SampleData16_Type *src, u32 count, u16 old)
+{
+    u32 i = 0;
 
-            // if next is an EFFECT PARAM:
-            if (firstbyte & 0x10)
-            {
-                // read the effect param
-                thispattern->Noteblock[wholenote].EffectParam = XMPatternHeader->PatternData[i];
-                i++;
-            }
+#ifdef DELTA_VECTORS
+    const DeltaVector16_Type zero = { 0 };
+    DeltaVector16_Type last = zero + old;
+
+    for ( ; i + 8 <= count; i += 8)
+    {
+        DeltaVector16_Type v;
+        memcpy(&v, &src->Data[i], 16);
 
-            wholenote++;  // get ready for the next note
+        // prefix sums of the 8 deltas: add the vector shifted by 1, 2, 4
+        v += __builtin_shufflevector(zero, v, 0, 8, 9, 10, 11, 12, 13, 14);
+        v += __builtin_shufflevector(zero, v, 0, 0, 8, 9, 10, 11, 12, 13);
+        v += __builtin_shufflevector(zero, v, 0, 0, 0, 0, 8, 9, 10, 11);
+        v += last;
 
-        } // end of patterndata
+        memcpy(&dst[i], &v, 16);
 
-        // if the pattern contains data...
-        if (XMPatternHeader->PackedPatterndataLength > 0)
+        // the last value goes to all the elements, for the next 8 samples
+        last = __builtin_shufflevector(v, v, 7, 7, 7, 7, 7, 7, 7, 7);
+    }
+
+    old = last[0];
+#endif
+
+    // two samples at a time (on the DS only if both are aligned the same way)
+    if ((((uintptr_t)&dst[i] ^ (uintptr_t)&src->Data[i]) & 3) == 0)
+    {
+        if ((i < count) && ((uintptr_t)&dst[i] & 3))
         {
-            // ... check if the pattern contained all the notes it should!
-            if (wholenote != (Module->PatternLength[CurrentPattern] * Module->NumberofChannels))
-            {
-                Module->NumberofPatterns=CurrentPattern + 1;
-                Module->NumberofInstruments = 0;
-                Module->State = XM7_STATE_ERROR | XM7_ERR_INCOMPLETE_PATTERN;
-                return XM7_ERR_INCOMPLETE_PATTERN;
-            }
+            dst[i] = old += src->Data[i];
+            i++;
         }
 
-        // get ready for next pattern!
-        XMPatternHeader = (XM7_XMPatternHeader_Type*) &(XMPatternHeader->PatternData[i]);
+        for ( ; i + 2 <= count; i += 2)
+        {
+            u32 w;
+            memcpy(&w, __builtin_assume_aligned(&src->Data[i], 4), 4);
 
-    }  // end 'pattern' for
+            u32 lo = old + w;
+            u32 hi = lo + (w >> 16);
+            w = (lo & 0xFFFF) | (hi << 16);
 
-    // BETA TEST
-    // return (0);
+            memcpy(__builtin_assume_aligned(&dst[i], 4), &w, 4);
+            old = hi;
+        }
+    }
 
-    // patterns are finished
+    for ( ; i < count; i++)
+        dst[i] = old += src->Data[i];
 
-    // set all the instrumen pointer to NULL
-    u16 CurrentInstrument;
-    for (CurrentInstrument = 0; CurrentInstrument < 128; CurrentInstrument++)
-        Module->Instrument[CurrentInstrument] = NULL;
+    return old;
+}
 
-    // let's load the instruments!
-    XM7_XMInstrument1stHeader_Type *XMInstrument1Header =
-            (XM7_XMInstrument1stHeader_Type *)XMPatternHeader;
+// Delta-decodes `size` bytes of the data of a sample from the file, starting
+// from byte `offset` of the sample (SampleData can be the same buffer as the
+// destination). `old` is the last value decoded, so a sample can be decoded in
+// pieces: it must start at 0, and for 16 bit samples `offset` and `size` must
+// be even.
+static void DeltaDecodeXMSample(XM7_Sample_Type *CurrentSamplePtr, u32 offset, const void *SampleData,
+                                u32 size, s16 *old)
+{
+    u8 *dst = (u8 *)&CurrentSamplePtr->SampleData->Data[offset];
 
-    // BETA TEST
-    // Module->NumberofInstruments=1;
+    // check if sample is 8 or 16 bit first!
+    // (samples in XM files are stored as delta value, nobody knows why...)
+    if ((CurrentSamplePtr->Flags & 0x10) == 0)
+        *old = (s8)DeltaDecode8(dst, SampleData, size, *old);
+    else
+        *old = (s16)DeltaDecode16((u16 *)dst, SampleData, size >> 1, *old);
+}
 
-    for (CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+// Copies backward the decoded samples from `first` to `last` (excluded) of a
+// ping-pong loop after its end. These are samples, not bytes, and only the ones
+// in the loop (not counting its last one, which isn't duplicated) are copied
+static void MirrorXMPingPong(XM7_Sample_Type *CurrentSamplePtr, u32 first, u32 last)
+{
+    if ((CurrentSamplePtr->Flags & 0x10) == 0)
     {
-        // check if the INSTRUMENT header is ok  (I'm unsure of the header length...)
-        // NOTE: I've found some XM with HeaderLength!=0x107 and Type!=0 (Type=80) so I'm trashing the following check...
-        //       ... then found also type=anything which has meaning so really don't trust this 'Type' field
-        /*
-        if ((XMInstrument1Header->HeaderLength != 0x107) && (XMInstrument1Header->Type != 0))
-        {
-            Module->State = STATE_ERROR | ERR_UNSUPPORTED_INSTRUMENT_HEADER;
-            return ERR_UNSUPPORTED_INSTRUMENT_HEADER;
-        }
-        */
+        XM7_SampleData_Type *CurrentSampleDataPtr = (XM7_SampleData_Type *)CurrentSamplePtr->SampleData;
+        u32 end = CurrentSamplePtr->Length * 2;
 
-        // check if the INSTRUMENT lenght is ok  (max 16 samples!) (and can be ZERO!)
-        if (XMInstrument1Header->NumberofSamples > 16)
+#ifdef DELTA_VECTORS
+        for ( ; first + 16 <= last; first += 16)
         {
-            Module->NumberofInstruments = CurrentInstrument;
-            Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
-            return XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+            // reversing the halfwords and then the bytes in them is cheaper
+            // than reversing the 16 bytes at once
+            DeltaVector16_Type v;
+            memcpy(&v, &CurrentSampleDataPtr->Data[first], 16);
+            v = __builtin_shufflevector(v, v, 7, 6, 5, 4, 3, 2, 1, 0);
+            v = (v << 8) | (v >> 8);
+            memcpy(&CurrentSampleDataPtr->Data[end - first - 15], &v, 16);
         }
+#endif
 
-        // allocate the new instrument
-        Module->Instrument[CurrentInstrument] = PrepareNewInstrument();
-        if (Module->Instrument[CurrentInstrument] == NULL)
+        for (u32 k = first; k < last; k++)
+            CurrentSampleDataPtr->Data[end - k] = CurrentSampleDataPtr->Data[k];
+    }
+    else
+    {
+        XM7_SampleData16_Type *CurrentSampleData16Ptr = (XM7_SampleData16_Type *)CurrentSamplePtr->SampleData;
+        u32 end = (CurrentSamplePtr->Length >> 1) * 2;
+
+#ifdef DELTA_VECTORS
+        for ( ; first + 8 <= last; first += 8)
         {
-            Module->NumberofInstruments=CurrentInstrument;
-            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
-            return XM7_ERR_NOT_ENOUGH_MEMORY;
+            DeltaVector16_Type v;
+            memcpy(&v, &CurrentSampleData16Ptr->Data[first], 16);
+            v = __builtin_shufflevector(v, v, 7, 6, 5, 4, 3, 2, 1, 0);
+            memcpy(&CurrentSampleData16Ptr->Data[end - first - 7], &v, 16);
         }
+#endif
 
-        XM7_Instrument_Type *CurrentInstrumentPtr = Module->Instrument[CurrentInstrument];
+        for (u32 k = first; k < last; k++)
+            CurrentSampleData16Ptr->Data[end - k] = CurrentSampleData16Ptr->Data[k];
+    }
+}
 
-        // load the info from the header
-        CurrentInstrumentPtr->NumberofSamples = XMInstrument1Header->NumberofSamples;
-        memcpy(CurrentInstrumentPtr->Name, XMInstrument1Header->Name, 22); // char[22]
+// Changes a sample with a ping-pong loop that has been copied backward into
+// one with a normal loop
+static void FinishXMPingPong(XM7_Sample_Type *CurrentSamplePtr)
+{
+    // the loop turns around on the sample right after the end, which isn't
+    // copied from anywhere: it's the same as the last one
+    if ((CurrentSamplePtr->Flags & 0x10) == 0)
+    {
+        XM7_SampleData_Type *CurrentSampleDataPtr = (XM7_SampleData_Type *)CurrentSamplePtr->SampleData;
+        u32 length = CurrentSamplePtr->Length;
 
-        if (XMInstrument1Header->NumberofSamples > 0)
-        {
-            // get the 2nd part of the header
-            XM7_XMInstrument2ndHeader_Type *XMInstrument2Header =
-                    (XM7_XMInstrument2ndHeader_Type *)&(XMInstrument1Header->NextHeaderPart[0]);
+        if ((CurrentSamplePtr->LoopLength > 0) && (length > 0))
+            CurrentSampleDataPtr->Data[length] = CurrentSampleDataPtr->Data[length - 1];
+    }
+    else
+    {
+        XM7_SampleData16_Type *CurrentSampleData16Ptr = (XM7_SampleData16_Type *)CurrentSamplePtr->SampleData;
+        u32 length = CurrentSamplePtr->Length >> 1;
 
-            // 2009! HNY!
-            // check the length of the instrument header before proceed!
+        if (((CurrentSamplePtr->LoopLength >> 1) > 0) && (length > 0))
+            CurrentSampleData16Ptr->Data[length] = CurrentSampleData16Ptr->Data[length - 1];
+    }
 
-            if (XMInstrument1Header->InstrumentHeaderLength >= 33 + 96)
-            {
-                // copy the 96 notes' sample numbers
-                memcpy (CurrentInstrumentPtr->SampleforNote, XMInstrument2Header->SampleforNotes, 96); // u8[96]
-            }
-            else
-            {
-                // fill with 0 all the samples numbers
-                memset(CurrentInstrumentPtr->SampleforNote, 0, 96);
-            }
+    // and change it to a 'normal' loop (preserving 16 bit flag)
+    // and remember that it was a ping-pong loop
+    CurrentSamplePtr->Flags = (CurrentSamplePtr->Flags & 0xF0) | 0x08 | 0x01;
 
-            //if (XMInstrument1Header->InstrumentHeaderLength >= 33 + 96 + 123)
-            if (XMInstrument1Header->InstrumentHeaderLength >= 33 + 96 + 123 - 22)
-            {
-                // read all the data about Volume&Envelope points (the 22 'reserved' bytes can be absent)
-                memcpy((u8 *)CurrentInstrumentPtr->VolumeEnvelopePoint,
-                       (u8 *)XMInstrument2Header->VolumeEnvelopePoints, 48); // 12x2x2=u8[48]
-                memcpy((u8 *)CurrentInstrumentPtr->PanningEnvelopePoint,
-                       (u8 *)XMInstrument2Header->PanningEnvelopePoints, 48); // 12x2x2=u8[48]
-
-                CurrentInstrumentPtr->NumberofVolumeEnvelopePoints = XMInstrument2Header->NumberofVolumePoints;
-                CurrentInstrumentPtr->NumberofPanningEnvelopePoints = XMInstrument2Header->NumberofPanningPoints;
-
-                CurrentInstrumentPtr->VolumeSustainPoint = XMInstrument2Header->VolumeSustainPoint;
-                CurrentInstrumentPtr->VolumeLoopStartPoint = XMInstrument2Header->VolumeLoopStartPoint;
-                CurrentInstrumentPtr->VolumeLoopEndPoint = XMInstrument2Header->VolumeLoopEndPoint;
-
-                CurrentInstrumentPtr->PanningSustainPoint = XMInstrument2Header->PanningSustainPoint;
-                CurrentInstrumentPtr->PanningLoopStartPoint = XMInstrument2Header->PanningLoopStartPoint;
-                CurrentInstrumentPtr->PanningLoopEndPoint = XMInstrument2Header->PanningLoopEndPoint;
-
-                CurrentInstrumentPtr->VolumeType = XMInstrument2Header->VolumeType; // bit 0: On; 1: Sustain; 2: Loop
-                CurrentInstrumentPtr->PanningType = XMInstrument2Header->PanningType; // bit 0: On; 1: Sustain; 2: Loop
-
-                // Instrument Vibrato
-                CurrentInstrumentPtr->VibratoType = XMInstrument2Header->VibratoType;
-                CurrentInstrumentPtr->VibratoSweep = 0x10000 / (XMInstrument2Header->VibratoSweep + 1);
-                CurrentInstrumentPtr->VibratoDepth = XMInstrument2Header->VibratoDepth;
-                CurrentInstrumentPtr->VibratoRate = XMInstrument2Header->VibratoRate;
-
-                // envelope volume fadeout
-                CurrentInstrumentPtr->VolumeFadeout = XMInstrument2Header->VolumeFadeOut;
-            }
-            else
-            {
-                // there are NO envelopes in the file...
-                CurrentInstrumentPtr->VolumeType = 0;
-                CurrentInstrumentPtr->PanningType = 0;
-                CurrentInstrumentPtr->NumberofVolumeEnvelopePoints = 0;
-                CurrentInstrumentPtr->NumberofPanningEnvelopePoints = 0;
-                // if there's no vibrato in the file...
-                CurrentInstrumentPtr->VibratoType = 0;
-                CurrentInstrumentPtr->VibratoSweep = 0;
-                CurrentInstrumentPtr->VibratoDepth = 0;
-                CurrentInstrumentPtr->VibratoRate = 0;
-                // if there's no fadeout in the file...
-                CurrentInstrumentPtr->VolumeFadeout = 0;
-            }
+    // the lenght of the sample must be changed (it's in bytes)
+    // CurrentSamplePtr->Length += (CurrentSamplePtr->LoopLength - 2);
+    CurrentSamplePtr->Length += CurrentSamplePtr->LoopLength;
 
-            // InstrumentHeader (2nd part) is finished!
-            XM7_XMSampleHeader_Type *XMSampleHeader =
-                    (XM7_XMSampleHeader_Type *)((u8 *)&XMInstrument1Header->InstrumentHeaderLength +
-                                                XMInstrument1Header->InstrumentHeaderLength);
+    // of course also LoopLength has to be changed! (it's in bytes)
+    CurrentSamplePtr->LoopLength += CurrentSamplePtr->LoopLength;
+}
 
-            u8 CurrentSample;
+// Unrolls the ping-pong loop of a decoded sample, if it has one
+static void UnrollXMPingPong(XM7_Sample_Type *CurrentSamplePtr)
+{
+    // since DS has got no support for ping/pong loop, we should duplicate the loop backward
+    if ((CurrentSamplePtr->Flags & 0x03) != 0x02)
+        return;
 
-            // read all the sample headers
-            for (CurrentSample = 0; CurrentSample < CurrentInstrumentPtr->NumberofSamples; CurrentSample++)
-            {
-                // allocate the new Sample
-                CurrentInstrumentPtr->Sample[CurrentSample] =
-                    PrepareNewSample(XMSampleHeader->Length, XMSampleHeader->LoopLength, XMSampleHeader->Type);
+    SwitchPhase(XM7_LOAD_PHASE_PINGPONG);
 
-                if (CurrentInstrumentPtr->Sample[CurrentSample] == NULL)
+    u32 j;
+    if ((CurrentSamplePtr->Flags & 0x10) == 0)
+    {
+        XM7_SampleData_Type *CurrentSampleDataPtr = (XM7_SampleData_Type *)CurrentSamplePtr->SampleData;
+
+        /*
+        for (j = 0; j < (CurrentSamplePtr->LoopLength - 2); j++)
+        {
+            CurrentSampleDataPtr->Data[CurrentSamplePtr->Length+j] =
+                    CurrentSampleDataPtr->Data[(CurrentSamplePtr->Length - 1) - j];
+        }
+        */
+
+        for (j = 0; j < CurrentSamplePtr->LoopLength; j++)
+        {
+            CurrentSampleDataPtr->Data[CurrentSamplePtr->Length + j] =
+                    CurrentSampleDataPtr->Data[CurrentSamplePtr->Length - j];
+        }
+    }
+    else
+    {
+        XM7_SampleData16_Type *CurrentSampleData16Ptr = (XM7_SampleData16_Type *)CurrentSamplePtr->SampleData;
+
+        /*
+        // -2 because we won't duplicate 1st and last
+        for (j = 0; j < ((CurrentSamplePtr->LoopLength >> 1) - 2); j++)
+        {
+            CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) + j] =
+                    CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) - (j + 1)];
+        }
+        */
+
+        for (j = 0; j < (CurrentSamplePtr->LoopLength >> 1); j++)
+        {
+            CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) + j] =
+                    CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) - j];
+        }
+    }
+
+    FinishXMPingPong(CurrentSamplePtr);
+
+    SwitchPhase(XM7_LOAD_PHASE_SAMPLES);
+}
+
+// Number of bytes of the file used by the data of a sample (16 bit samples
+// only use whole samples)
+static u32 XMSampleDataUsed(const XM7_Sample_Type *CurrentSamplePtr)
+{
+    if (CurrentSamplePtr->Flags & 0x10)
+        return CurrentSamplePtr->Length & ~1;
+
+    return CurrentSamplePtr->Length;
+}
+
+// the loop of a ping-pong sample is copied backward after decoding each piece
+// of this size, while it's still in the cache
+#define PINGPONG_PIECE  1024
+
+// Delta-decodes the data of a sample from the file (SampleData can be the same
+// buffer as the destination) and unrolls its ping-pong loop. Returns the
+// number of bytes of the file that have been used.
+static u32 DecodeXMSampleData(XM7_Sample_Type *CurrentSamplePtr, const void *SampleData)
+{
+    u32 used = XMSampleDataUsed(CurrentSamplePtr);
+    u32 size = SampleDataSize(CurrentSamplePtr->Length, CurrentSamplePtr->LoopLength,
+                              CurrentSamplePtr->Flags);
+    const u8 *src = SampleData;
+    const u8 *dst = (const u8 *)CurrentSamplePtr->SampleData->Data;
+    s16 old = 0;
+
+    // the loop is copied backward in the same pass, unless it could overwrite
+    // data of the file not read yet (when loading in place) or the loop is
+    // longer than the sample
+    u32 shift = (CurrentSamplePtr->Flags & 0x10) ? 1 : 0;
+    u32 length = CurrentSamplePtr->Length >> shift;
+    u32 looplength = CurrentSamplePtr->LoopLength >> shift;
+
+    if (((CurrentSamplePtr->Flags & 0x03) != 0x02) || (looplength > length) ||
+        ((src > dst) && (src < dst + size)))
+    {
+        DeltaDecodeXMSample(CurrentSamplePtr, 0, SampleData, used, &old);
+        UnrollXMPingPong(CurrentSamplePtr);
+        return used;
+    }
+
+    // the samples before the loop (and its first one, that isn't copied)
+    u32 decoded = (length - looplength + 1) << shift;
+    if (decoded > used)
+        decoded = used;
+
+    DeltaDecodeXMSample(CurrentSamplePtr, 0, src, decoded, &old);
+
+    // the rest of the loop, a piece at a time
+    while (decoded < used)
+    {
+        u32 piece = used - decoded;
+        if (piece > PINGPONG_PIECE)
+            piece = PINGPONG_PIECE;
+
+        DeltaDecodeXMSample(CurrentSamplePtr, decoded, &src[decoded], piece, &old);
+        MirrorXMPingPong(CurrentSamplePtr, decoded >> shift, (decoded + piece) >> shift);
+
+        decoded += piece;
+    }
+
+    FinishXMPingPong(CurrentSamplePtr);
+
+    return used;
+}
+
+// Number of bytes of a packed note of an XM pattern, from its first byte
+static u32 XMNoteSize(u8 firstbyte)
+{
+    // if "it's NOT compressed" then there are 5 bytes
+    if ((firstbyte & 0x80) == 0)
+        return 5;
+
+    u32 size = 1;
+    for (int bit = 0; bit < 5; bit++)
+        size += (firstbyte >> bit) & 1;
+
+    return size;
+}
+
+// decodes a packed note of an XM pattern, returns the number of bytes used
+static inline u32 DecodeXMNote(XM7_SingleNote_Type *note, const u8 *PatternData)
+{
+    u32 i = 0;
+    u8 firstbyte = PatternData[i];
+
+    // an empty note: the pattern has been cleared already
+    if (firstbyte == 0x80)
+        return 1;
+
+    if (firstbyte & 0x80)
+    {
+        // it's compressed: skip to the next byte
+        i++;
+    }
+    else
+    {
+        // if "it's NOT compressed" then there are 5 bytes, simulate it's compressed with 5 bytes following
+        firstbyte = 0x1F;
+    }
+
+    // if next is a NOTE:
+    if (firstbyte & 0x01)
+    {
+        // read the note
+        note->Note = PatternData[i];
+        i++;
+    }
+
+    // if next is a INSTRUMENT:
+    if (firstbyte & 0x02)
+    {
+        // read the instrument
+        note->Instrument = PatternData[i];
+        i++;
+    }
+
+    // if next is a VOLUME:
+    if (firstbyte & 0x04)
+    {
+        // read the volume
+        note->Volume = PatternData[i];
+        i++;
+    }
+
+    // if next is an EFFECT TYPE:
+    if (firstbyte & 0x08)
+    {
+        // read the effect type
+        note->EffectType = PatternData[i];
+        i++;
+    }
+
+    // if next is an EFFECT PARAM:
+    if (firstbyte & 0x10)
+    {
+        // read the effect param
+        note->EffectParam = PatternData[i];
+        i++;
+    }
+
+    return i;
+}
+
+// Loads a pattern of an XM. Returns 0 if OK, an error otherwise (with the
+// State of the module set)
+static XM7_Error LoadXMPattern(XM7_ModuleManager_Type *Module, u16 CurrentPattern,
+                               const XM7_XMPatternHeader_Type *XMPatternHeader)
+{
+    // check if the PATTERN header is ok
+    if ((XMPatternHeader->HeaderLength != 9) || (XMPatternHeader->PackingType != 0))
+    {
+        Module->NumberofPatterns = CurrentPattern;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+        return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+    }
+
+    // check if the PATTERN lenght is ok
+    if ((XMPatternHeader->NumberofLinesinThisPattern < 1) ||
+        (XMPatternHeader->NumberofLinesinThisPattern > 256))
+    {
+        Module->NumberofPatterns = CurrentPattern;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+        return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+    }
+
+    // pattern is ok! Get the length
+    Module->PatternLength[CurrentPattern]=XMPatternHeader->NumberofLinesinThisPattern;
+
+    u32 notes = Module->PatternLength[CurrentPattern] * Module->NumberofChannels;
+    u32 packedlength = XMPatternHeader->PackedPatterndataLength;
+
+    // Prepare an empty pattern for the data
+    Module->Pattern[CurrentPattern] =
+            PrepareNewPattern(Module->PatternLength[CurrentPattern], Module->NumberofChannels);
+
+    if (Module->Pattern[CurrentPattern] == NULL)
+    {
+        Module->NumberofPatterns=CurrentPattern;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+        return XM7_ERR_NOT_ENOUGH_MEMORY;
+    }
+
+    // decode the PackedData
+    u32 i = 0;
+    u32 wholenote = 0;
+
+    XM7_SingleNoteArray_Type *thispattern = Module->Pattern[CurrentPattern];
+    const u8 *PatternData = XMPatternHeader->PatternData;
+
+    // never write past the end of the pattern, even if there's more data
+    while ((i < packedlength) && (wholenote < notes))
+    {
+        i += DecodeXMNote(&thispattern->Noteblock[wholenote], &PatternData[i]);
+
+        wholenote++;  // get ready for the next note
+
+    } // end of patterndata
+
+    // if the pattern contains data, check if it contained all the notes it
+    // should (and nothing more)
+    if ((packedlength > 0) && ((wholenote != notes) || (i < packedlength)))
+    {
+        Module->NumberofPatterns=CurrentPattern + 1;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_INCOMPLETE_PATTERN;
+        return XM7_ERR_INCOMPLETE_PATTERN;
+    }
+
+    return 0;
+}
+
+// Loads the headers of an instrument of an XM and prepares its samples. The
+// data of the samples (or the next instrument, if there are no samples) is
+// returned in SampleData. Returns 0 if OK, an error otherwise (with the State
+// of the module set)
+static XM7_Error LoadXMInstrumentHeaders(XM7_ModuleManager_Type *Module, u16 CurrentInstrument,
+                                         const XM7_XMInstrument1stHeader_Type *XMInstrument1Header,
+                                         const u8 **SampleData)
+{
+    // check if the INSTRUMENT header is ok  (I'm unsure of the header length...)
+    // NOTE: I've found some XM with HeaderLength!=0x107 and Type!=0 (Type=80) so I'm trashing the following check...
+    //       ... then found also type=anything which has meaning so really don't trust this 'Type' field
+    /*
+    if ((XMInstrument1Header->HeaderLength != 0x107) && (XMInstrument1Header->Type != 0))
+    {
+        Module->State = STATE_ERROR | ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+        return ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+    }
+    */
+
+    // check if the INSTRUMENT lenght is ok  (max 16 samples!) (and can be ZERO!)
+    if (XMInstrument1Header->NumberofSamples > 16)
+    {
+        Module->NumberofInstruments = CurrentInstrument;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+        return XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+    }
+
+    // allocate the new instrument
+    Module->Instrument[CurrentInstrument] = PrepareNewInstrument();
+    if (Module->Instrument[CurrentInstrument] == NULL)
+    {
+        Module->NumberofInstruments=CurrentInstrument;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+        return XM7_ERR_NOT_ENOUGH_MEMORY;
+    }
+
+    XM7_Instrument_Type *CurrentInstrumentPtr = Module->Instrument[CurrentInstrument];
+
+    ReadXMInstrumentHeader(CurrentInstrumentPtr, XMInstrument1Header);
+
+    if (XMInstrument1Header->NumberofSamples == 0)
+    {
+        // if (samples == 0)
+        // should be like this...
+        // XMInstrument1Header = (XMInstrument1stHeader_Type *)&(XMInstrument1Header->NextHeaderPart[0]);
+
+        // ...but it seems like THERE IS the 2nd header too even when NO samples...
+        // get the 2nd part of the header
+
+        // NOTE: I've found some XM with instruments with 0 samples so I trash the following 2 lines
+        /*
+        XMInstrument2ndHeader_Type *XMInstrument2Header =
+                (XMInstrument2ndHeader_Type *)&(XMInstrument1Header->NextHeaderPart[0]);
+        XMInstrument1Header = (XMInstrument1stHeader_Type *)&(XMInstrument2Header->NextDataPart[0]);
+        */
+
+        *SampleData = &(XMInstrument1Header->NextHeaderPart[XMInstrument1Header->InstrumentHeaderLength -
+                                                            sizeof(XM7_XMInstrument1stHeader_Type) + 1]);
+        return 0;
+    }
+
+    // InstrumentHeader (2nd part) is finished!
+    const XM7_XMSampleHeader_Type *XMSampleHeader =
+            (const XM7_XMSampleHeader_Type *)((const u8 *)&XMInstrument1Header->InstrumentHeaderLength +
+                                              XMInstrument1Header->InstrumentHeaderLength);
+
+    // where the data of each sample is, after all the sample headers
+    const u8 *SampleSource = (const u8 *)XMSampleHeader +
+            CurrentInstrumentPtr->NumberofSamples * offsetof(XM7_XMSampleHeader_Type, NextHeader);
+
+    // read all the sample headers
+    for (u8 CurrentSample = 0; CurrentSample < CurrentInstrumentPtr->NumberofSamples; CurrentSample++)
+    {
+        u32 used = XMSampleHeader->Length;
+        if (XMSampleHeader->Type & 0x10)
+            used &= ~1; // 16 bit samples use whole samples only
+
+        // allocate the new Sample
+        CurrentInstrumentPtr->Sample[CurrentSample] =
+            PrepareNewSampleInPlace(XMSampleHeader->Length, XMSampleHeader->LoopLength,
+                                    XMSampleHeader->Type, SampleSource, used);
+        SampleSource += used;
+
+        if (CurrentInstrumentPtr->Sample[CurrentSample] == NULL)
+        {
+            Module->NumberofInstruments = CurrentInstrument + 1;
+            CurrentInstrumentPtr->NumberofSamples=CurrentSample;
+            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+            return XM7_ERR_NOT_ENOUGH_MEMORY;
+        }
+
+        ReadXMSampleHeader(CurrentInstrumentPtr->Sample[CurrentSample], XMSampleHeader);
+
+        // point to the next sample header (or the 1st byte after all the headers...)
+        XMSampleHeader = (const XM7_XMSampleHeader_Type *)&(XMSampleHeader->NextHeader[0]);
+    }
+
+    // the 1st byte after the header(s)...
+    *SampleData = (const u8 *)XMSampleHeader;
+    return 0;
+}
+
+// Skips an instrument of an XM that isn't loaded. The next instrument is
+// returned in Next. Returns 0 if OK, an error otherwise (with the State of the
+// module set)
+static XM7_Error SkipXMInstrument(XM7_ModuleManager_Type *Module, u16 CurrentInstrument,
+                                  const XM7_XMInstrument1stHeader_Type *XMInstrument1Header,
+                                  const u8 **Next)
+{
+    if (XMInstrument1Header->NumberofSamples > 16)
+    {
+        Module->NumberofInstruments = CurrentInstrument;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+        return XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+    }
+
+    Module->Instrument[CurrentInstrument] = NULL;
+
+    if (XMInstrument1Header->NumberofSamples == 0)
+    {
+        *Next = &(XMInstrument1Header->NextHeaderPart[XMInstrument1Header->InstrumentHeaderLength -
+                                                      sizeof(XM7_XMInstrument1stHeader_Type) + 1]);
+        return 0;
+    }
+
+    const XM7_XMSampleHeader_Type *XMSampleHeader =
+            (const XM7_XMSampleHeader_Type *)((const u8 *)&XMInstrument1Header->InstrumentHeaderLength +
+                                              XMInstrument1Header->InstrumentHeaderLength);
+    u32 datalen = 0;
+
+    for (int j = 0; j < XMInstrument1Header->NumberofSamples; j++)
+    {
+        // 16 bit samples are read one whole sample at a time
+        if (XMSampleHeader->Type & 0x10)
+            datalen += XMSampleHeader->Length & ~1;
+        else
+            datalen += XMSampleHeader->Length;
+
+        XMSampleHeader = (const XM7_XMSampleHeader_Type *)&(XMSampleHeader->NextHeader[0]);
+    }
+
+    *Next = (const u8 *)XMSampleHeader + datalen;
+    return 0;
+}
+
+// Follows the song from a set of positions, to find what can be played. Each
+// position is followed from the first line of its pattern, and from any other
+// line if a Dxx can get there, the same way the engine plays the song.
+typedef struct SongFlow {
+    const XM7_ModuleManager_Type *Module;
+    Selected_Type *Selected;
+    u8 Reached[2][256 / 8];         // positions reached from line 0 or another one
+    u8 Followed[2][256 / 8];        // positions whose pattern has been followed
+    void (*FollowPattern)(struct SongFlow *flow, u32 position, int fromline);
+    const void *Patterns;           // the patterns in the file
+    int FLT8Flag;
+} SongFlow_Type;
+
+static void ReachPosition(SongFlow_Type *flow, u32 position, int fromline)
+{
+    // at the end of the song the engine goes back to the restart point
+    if (position >= flow->Module->ModuleLength)
+        position = flow->Module->RestartPoint;
+
+    if (position < 256)
+        BitSet(flow->Reached[fromline], position);
+}
+
+// Follows a line of the pattern at a position. Returns 1 if the pattern ends
+// after this line
+static int FollowLine(SongFlow_Type *flow, u32 position, const XM7_SingleNote_Type *line)
+{
+    const XM7_ModuleManager_Type *Module = flow->Module;
+    int jump = 0, breakto0 = 0, breaktoline = 0;
+
+    for (int chn = 0; chn < Module->NumberofChannels; chn++)
+    {
+        if ((line[chn].Instrument > 0) && (line[chn].Instrument <= 128))
+            BitSet(flow->Selected->Instruments, line[chn].Instrument - 1);
+
+        if (line[chn].EffectType == 0x0b)
+        {
+            jump = 1;
+        }
+        else if (line[chn].EffectType == 0x0d)
+        {
+            // the line of the next pattern, in decimal (see the engine)
+            if ((line[chn].EffectParam >> 4) * 10 + (line[chn].EffectParam & 0x0f))
+                breaktoline = 1;
+            else
+                breakto0 = 1;
+        }
+    }
+
+    if (!jump && !breakto0 && !breaktoline)
+        return 0;
+
+    // if there's more than one Bxx or Dxx, all of them are followed
+    if (!breaktoline)
+        breakto0 = 1;
+
+    for (int fromline = 0; fromline < 2; fromline++)
+    {
+        if ((fromline == 0) ? !breakto0 : !breaktoline)
+            continue;
+
+        if (!jump)
+            ReachPosition(flow, position + 1, fromline);
+
+        for (int chn = 0; jump && (chn < Module->NumberofChannels); chn++)
+        {
+            if (line[chn].EffectType != 0x0b)
+                continue;
+
+            // a Bxx past the end of the song goes to the next position
+            if (line[chn].EffectParam < Module->ModuleLength)
+                ReachPosition(flow, line[chn].EffectParam, fromline);
+            else
+                ReachPosition(flow, position + 1, fromline);
+        }
+    }
+
+    return 1;
+}
+
+static void FollowXMPattern(SongFlow_Type *flow, u32 position, int fromline)
+{
+    const XM7_XMPatternHeader_Type *const *XMPatternHeaders = flow->Patterns;
+    const XM7_XMPatternHeader_Type *XMPatternHeader =
+            XMPatternHeaders[flow->Module->PatternOrder[position]];
+
+    u32 packedlength = XMPatternHeader->PackedPatterndataLength;
+    u32 i = 0;
+
+    for (u32 row = 0; row < XMPatternHeader->NumberofLinesinThisPattern; row++)
+    {
+        XM7_SingleNote_Type line[16];
+        memset(line, 0, sizeof(line));
+
+        for (int chn = 0; (chn < flow->Module->NumberofChannels) && (i < packedlength); chn++)
+            i += DecodeXMNote(&line[chn], &XMPatternHeader->PatternData[i]);
+
+        // from the first line, the pattern always ends at the first Bxx or
+        // Dxx, while from another line it could end at any of them
+        if (FollowLine(flow, position, line) && (fromline == 0))
+            return;
+    }
+
+    ReachPosition(flow, position + 1, 0);
+}
+
+static void FollowMODPattern(SongFlow_Type *flow, u32 position, int fromline)
+{
+    u8 channels = flow->Module->NumberofChannels;
+    const XM7_MODPattern_Type *MODPattern = (const XM7_MODPattern_Type *)
+            &((const XM7_MODPattern_Type *)flow->Patterns)->SingleNote[flow->Module->PatternOrder[position] *
+                                                                       64 * channels];
+
+    for (int row = 0; row < 64; row++)
+    {
+        XM7_SingleNote_Type line[16];
+
+        for (int chn = 0; chn < channels; chn++)
+        {
+            int curs;
+            if (flow->FLT8Flag)
+                curs = row * 4 + chn + ((chn < 4) ? 0 : 256 - 4);
+            else
+                curs = row * channels + chn;
+
+            line[chn].Instrument = (MODPattern->SingleNote[curs].Instr_EffType >> 4)
+                                 | (MODPattern->SingleNote[curs].PeriodH & 0x10);
+            line[chn].EffectType = MODPattern->SingleNote[curs].Instr_EffType & 0x0F;
+            line[chn].EffectParam = MODPattern->SingleNote[curs].EffParam;
+        }
+
+        if (FollowLine(flow, position, line) && (fromline == 0))
+            return;
+    }
+
+    ReachPosition(flow, position + 1, 0);
+}
+
+// finds the patterns and instruments to load for the selection of the loader
+static void SelectSong(SongFlow_Type *flow)
+{
+    const XM7_ModuleManager_Type *Module = flow->Module;
+    Selected_Type *selected = flow->Selected;
+
+    memset(selected->Patterns, 0, sizeof(selected->Patterns));
+    memset(selected->Instruments, 0, sizeof(selected->Instruments));
+
+    switch (selected->Selection->Mode)
+    {
+        case XM7_SELECT_INSTRUMENTS:
+            memset(selected->Instruments, 0xff, sizeof(selected->Instruments));
+            return;
+
+        case XM7_SELECT_POSITIONS:
+            break;
+
+        default:
+            memset(selected->Patterns, 0xff, sizeof(selected->Patterns));
+            memset(selected->Instruments, 0xff, sizeof(selected->Instruments));
+            return;
+    }
+
+    memset(flow->Reached, 0, sizeof(flow->Reached));
+    memset(flow->Followed, 0, sizeof(flow->Followed));
+
+    // the engine plays a position past the end of the song from the start
+    for (u32 position = 0; position < 256; position++)
+    {
+        if (BitTest(selected->Selection->Positions, position))
+            BitSet(flow->Reached[0], (position < Module->ModuleLength) ? position : 0);
+    }
+
+    int changed;
+    do
+    {
+        changed = 0;
+
+        for (u32 position = 0; position < 256; position++)
+        {
+            for (int fromline = 0; fromline < 2; fromline++)
+            {
+                if (!BitTest(flow->Reached[fromline], position) ||
+                    BitTest(flow->Followed[fromline], position))
+                    continue;
+
+                BitSet(flow->Followed[fromline], position);
+                changed = 1;
+
+                // there's nothing to play in a pattern that isn't in the file,
+                // but the song still goes on to the next position
+                u8 pattern = Module->PatternOrder[position];
+                if (pattern >= Module->NumberofPatterns)
                 {
-                    Module->NumberofInstruments = CurrentInstrument + 1;
-                    CurrentInstrumentPtr->NumberofSamples=CurrentSample;
-                    Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
-                    return XM7_ERR_NOT_ENOUGH_MEMORY;
+                    ReachPosition(flow, position + 1, 0);
+                    continue;
                 }
 
-                XM7_Sample_Type *CurrentSamplePtr = CurrentInstrumentPtr->Sample[CurrentSample];
+                BitSet(selected->Patterns, pattern);
+                flow->FollowPattern(flow, position, fromline);
+            }
+        }
+    } while (changed);
+}
+
+// checks the pattern headers of an XM, and selects what to load from it
+static XM7_Error SelectXM(XM7_ModuleManager_Type *Module, const XM7_XMModuleHeader_Type *XMModule)
+{
+    const XM7_XMPatternHeader_Type *XMPatternHeaders[256];
+
+    if (Module->NumberofPatterns > 256)
+        return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+
+    const XM7_XMPatternHeader_Type *XMPatternHeader =
+            (const XM7_XMPatternHeader_Type *)&(XMModule->PatternOrder[XMModule->HeaderSize - 20]);
+
+    for (int i = 0; i < Module->NumberofPatterns; i++)
+    {
+        if ((XMPatternHeader->HeaderLength != 9) || (XMPatternHeader->PackingType != 0) ||
+            (XMPatternHeader->NumberofLinesinThisPattern < 1) ||
+            (XMPatternHeader->NumberofLinesinThisPattern > 256))
+            return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+
+        XMPatternHeaders[i] = XMPatternHeader;
+
+        XMPatternHeader = (const XM7_XMPatternHeader_Type *)
+                &(XMPatternHeader->PatternData[XMPatternHeader->PackedPatterndataLength]);
+    }
+
+    SongFlow_Type flow;
+    flow.Module = Module;
+    flow.Selected = LoaderSelected;
+    flow.FollowPattern = FollowXMPattern;
+    flow.Patterns = XMPatternHeaders;
+    flow.FLT8Flag = 0;
+
+    SelectSong(&flow);
+
+    return 0;
+}
+
+// returns 0 if OK, an error otherwise
+static XM7_Error LoadXM(XM7_ModuleManager_Type *Module, const void *XMModule_)
+{
+    const XM7_XMModuleHeader_Type *XMModule = XMModule_;
+
+    // reset these values
+    Module->NumberofPatterns = 0;
+    Module->NumberofInstruments = 0;
+
+    XM7_Error ret = ReadXMModuleHeader(Module, XMModule);
+    if (ret != 0)
+    {
+        Module->State = XM7_STATE_ERROR | ret;
+        return ret;
+    }
+
+    // the MODULE header is finished!
+
+    // only what is selected gets loaded (see XM7_LoadXMSelection())
+    if (LoaderSelected != NULL)
+    {
+        ret = SelectXM(Module, XMModule);
+        if (ret != 0)
+        {
+            Module->NumberofPatterns = 0;
+            Module->NumberofInstruments = 0;
+            Module->State = XM7_STATE_ERROR | ret;
+            return ret;
+        }
+    }
+
+    // BETA TEST
+    // return (0);
+
+    // now working on the patterns
+    SwitchPhase(XM7_LOAD_PHASE_PATTERNS);
+
+    u16 CurrentPattern;
+    XM7_XMPatternHeader_Type *XMPatternHeader =
+            (XM7_XMPatternHeader_Type *)&(XMModule->PatternOrder[XMModule->HeaderSize - 20]);
+
+    // BETA TEST
+    // Module->NumberofPatterns=1;
+
+    for (CurrentPattern = 0; CurrentPattern < (Module->NumberofPatterns); CurrentPattern++)
+    {
+        if ((LoaderSelected != NULL) && !BitTest(LoaderSelected->Patterns, CurrentPattern))
+        {
+            // the header has been checked already, only the length is needed
+            Module->PatternLength[CurrentPattern] = XMPatternHeader->NumberofLinesinThisPattern;
+            Module->Pattern[CurrentPattern] = NULL;
+        }
+        else
+        {
+            ret = LoadXMPattern(Module, CurrentPattern, XMPatternHeader);
+            if (ret != 0)
+                return ret;
+        }
+
+        // get ready for next pattern!
+        XMPatternHeader = (XM7_XMPatternHeader_Type *)
+                &(XMPatternHeader->PatternData[XMPatternHeader->PackedPatterndataLength]);
+    }  // end 'pattern' for
+
+    // BETA TEST
+    // return (0);
+
+    // patterns are finished
+    SwitchPhase(XM7_LOAD_PHASE_HEADERS);
+
+    // set all the instrumen pointer to NULL
+    u16 CurrentInstrument;
+    for (CurrentInstrument = 0; CurrentInstrument < 128; CurrentInstrument++)
+        Module->Instrument[CurrentInstrument] = NULL;
+
+    // let's load the instruments!
+    XM7_XMInstrument1stHeader_Type *XMInstrument1Header =
+            (XM7_XMInstrument1stHeader_Type *)XMPatternHeader;
+
+    // BETA TEST
+    // Module->NumberofInstruments=1;
+
+    for (CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+    {
+        const u8 *SampleData;
+
+        if ((LoaderSelected != NULL) && !BitTest(LoaderSelected->Instruments, CurrentInstrument))
+        {
+            ret = SkipXMInstrument(Module, CurrentInstrument, XMInstrument1Header, &SampleData);
+            if (ret != 0)
+                return ret;
+
+            XMInstrument1Header = (XM7_XMInstrument1stHeader_Type *)SampleData;
+            continue;
+        }
+
+        ret = LoadXMInstrumentHeaders(Module, CurrentInstrument, XMInstrument1Header, &SampleData);
+        if (ret != 0)
+            return ret;
+
+        XM7_Instrument_Type *CurrentInstrumentPtr = Module->Instrument[CurrentInstrument];
+
+        // read all the sample data
+        SwitchPhase(XM7_LOAD_PHASE_SAMPLES);
+
+        for (u8 CurrentSample = 0; CurrentSample < CurrentInstrumentPtr->NumberofSamples; CurrentSample++)
+        {
+            // read the sample, finally! (and prepare for the next one)
+            SampleData += DecodeXMSampleData(CurrentInstrumentPtr->Sample[CurrentSample], SampleData);
+        } // finished reading all the samples
+
+        SwitchPhase(XM7_LOAD_PHASE_HEADERS);
+
+        // prepare for the next instrument (the next byte after the last sample
+        XMInstrument1Header = (XM7_XMInstrument1stHeader_Type*)SampleData;
+    } // end "for Instruments"
+
+    // Set standard panning
+    Module->AmigaPanningEmulation = XM7_PANNING_TYPE_NORMAL;
+    Module->AmigaPanningDisplacement = 0x00;
+
+    // Replay style FT2 for XM
+    Module->ReplayStyle = XM7_REPLAY_STYLE_FT2;
+
+    // set State
+    Module->State = XM7_STATE_READY;
+
+    // end OK!
+    return 0;
+}
+
+XM7_Error XM7_LoadXM(XM7_ModuleManager_Type *Module, const void *XMModule)
+{
+    PrepareModule(Module);
+
+    BeginLoad();
+    XM7_Error ret = LoadXM(Module, XMModule);
+    EndLoad();
+
+    return ret;
+}
+
+XM7_Error XM7_LoadXMSelection(XM7_ModuleManager_Type *Module, const void *XMModule,
+                              const XM7_Selection_Type *selection)
+{
+    Selected_Type selected;
+    selected.Selection = selection;
+
+    PrepareModule(Module);
+
+    BeginLoad();
+    LoaderSelected = &selected;
+    XM7_Error ret = LoadXM(Module, XMModule);
+    LoaderSelected = NULL;
+    EndLoad();
+
+    return ret;
+}
+
+// Loads the header of a MOD and prepares the instruments and the space for
+// their samples. Returns 0 if OK, an error otherwise
+static XM7_Error LoadMODHeader(XM7_ModuleManager_Type* Module, const XM7_MODModuleHeader_Type* MODModule,
+                               int *FLT8Flag_)
+{
+    int FLT8Flag;
+
+    // file format ID check
+    Module->NumberofChannels = IdentifyMOD(MODModule->FileFormat[0], MODModule->FileFormat[1],
+                                           MODModule->FileFormat[2], MODModule->FileFormat[3]);
+
+    FLT8Flag = Module->NumberofChannels >> 7;
+    Module->NumberofChannels &= 0x3f;
+
+    // if MOD has not been identified:
+    if (Module->NumberofChannels == 0)
+    {
+        Module->NumberofInstruments = 0;
+        Module->NumberofPatterns = 0;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_A_VALID_MODULE;
+        return XM7_ERR_NOT_A_VALID_MODULE;
+    }
+
+    // if MOD has too many channels:
+    if (Module->NumberofChannels > 16)
+    {
+        Module->NumberofInstruments = 0;
+        Module->NumberofPatterns = 0;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
+        return XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
+    }
+
+    // set these values, constants in a MOD file
+    Module->NumberofInstruments = 31;   // 31 instrums, default
+    Module->FreqTable    = 0;           // AMIGA Freq. Table ( ==0 !)
+    Module->DefaultTempo = 6;           // Spd=6, default
+    Module->DefaultBPM   = 125;         // BPM=125, default
+    memcpy(Module->TrackerName, "**** MOD Module ****", 20); // char[20]
+
+    // load all the needed info from the header
+    Module->ModuleLength = MODModule->SongLength;
+    Module->RestartPoint = (MODModule->RestartPosition>=127)?0:MODModule->RestartPosition;
+    memcpy (Module->PatternOrder, MODModule->PatternOrder, 128);   // u8[128]
+    memcpy (Module->ModuleName,MODModule->MODModuleName,20);      // char[20]
+
+    // calculate how many patterns are there in the module (in a safe way)
+    Module->NumberofPatterns=0;
+    for (int i = 0; i < 128; i++)
+    {
+        // divide by 2 if it's FLT8
+        if (FLT8Flag)
+            Module->PatternOrder[i] >>= 1;
+
+        if (Module->PatternOrder[i] > Module->NumberofPatterns)
+            Module->NumberofPatterns = Module->PatternOrder[i];
+    }
+
+    // higher number+1
+    Module->NumberofPatterns++;
+    // the MODULE header is finished!
+
+    // only what is selected gets loaded (see XM7_LoadMODSelection())
+    if (LoaderSelected != NULL)
+    {
+        SongFlow_Type flow;
+        flow.Module = Module;
+        flow.Selected = LoaderSelected;
+        flow.FollowPattern = FollowMODPattern;
+        flow.Patterns = &MODModule->NextDataPart;
+        flow.FLT8Flag = FLT8Flag;
+
+        SelectSong(&flow);
+    }
+
+    // where the data of each sample is in the file, after all the patterns. It's
+    // only an offset until it's needed: a MOD read from a stream isn't in RAM
+    // past its header
+    u32 SampleOffset = Module->NumberofPatterns * 64 * Module->NumberofChannels *
+            sizeof(XM7_MODSingleNote_Type);
+
+    // now working on the instrument headers (instruments are always 31)
+    int CurrentInstrument;
+    for (CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+    {
+        // check if I need to allocate this instrument (or is it empty?)
+        // NOTE: if len==1 then IT'S EMPTY (!!!)
+        if ((LoaderSelected != NULL) && !BitTest(LoaderSelected->Instruments, CurrentInstrument) &&
+            (SwapBytes(MODModule->Instrument[CurrentInstrument].Length) > 1))
+        {
+            // it isn't selected (see XM7_LoadMODSelection())
+            Module->Instrument[CurrentInstrument] = NULL;
+            SampleOffset += SwapBytes(MODModule->Instrument[CurrentInstrument].Length) * 2;
+        }
+        else if (SwapBytes(MODModule->Instrument[CurrentInstrument].Length) > 1)
+        {
+            // allocate the new instrument
+            Module->Instrument[CurrentInstrument] = PrepareNewInstrument();
+            if (Module->Instrument[CurrentInstrument] == NULL)
+            {
+                Module->NumberofInstruments=CurrentInstrument;
+                Module->NumberofPatterns = 0;
+                Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+                return XM7_ERR_NOT_ENOUGH_MEMORY;
+            }
+
+            XM7_Instrument_Type *CurrentInstrumentPtr = Module->Instrument[CurrentInstrument];
+
+            // load the info from the header
+            CurrentInstrumentPtr->NumberofSamples = 1;
+            memcpy(CurrentInstrumentPtr->Name, MODModule->Instrument[CurrentInstrument].Name, 22); // char[22]
+
+            // no multisample, it's a MOD
+            memset(CurrentInstrumentPtr->SampleforNote, 0, 96);
+
+            // NO envelopes in a MOD
+            CurrentInstrumentPtr->VolumeType = 0;
+            CurrentInstrumentPtr->PanningType = 0;
+            CurrentInstrumentPtr->NumberofVolumeEnvelopePoints = 0;
+            CurrentInstrumentPtr->NumberofPanningEnvelopePoints = 0;
+
+            // NO auto vibrato in a MOD
+            CurrentInstrumentPtr->VibratoType = 0;
+            CurrentInstrumentPtr->VibratoSweep = 0;
+            CurrentInstrumentPtr->VibratoDepth = 0;
+            CurrentInstrumentPtr->VibratoRate = 0;
+
+            // NO fadeout in a MOD
+            CurrentInstrumentPtr->VolumeFadeout = 0;
+
+            // allocate space for the (only) sample
+            // (the data in the file is only used when the samples stay there)
+            u32 used = SwapBytes(MODModule->Instrument[CurrentInstrument].Length) * 2;
+            const u8 *SampleSource = NULL;
+            if ((InPlaceNext != NULL) || ResidentSamples)
+                SampleSource = (const u8 *)&MODModule->NextDataPart + SampleOffset;
+
+            CurrentInstrumentPtr->Sample[0] =
+                    PrepareNewSampleInPlace(used, SwapBytes(MODModule->Instrument[CurrentInstrument].LoopLength) * 2,
+                                            0, SampleSource, used);
+            SampleOffset += used;
+
+            if (CurrentInstrumentPtr->Sample[0] == NULL)
+            {
+                // so that the module can be unloaded
+                CurrentInstrumentPtr->NumberofSamples = 0;
+                Module->NumberofInstruments = CurrentInstrument + 1;
+                Module->NumberofPatterns = 0;
+                Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+                return XM7_ERR_NOT_ENOUGH_MEMORY;
+            }
+
+            XM7_Sample_Type *CurrentSamplePtr = CurrentInstrumentPtr->Sample[0];
+
+            // read all the data
+            CurrentSamplePtr->Length = SwapBytes(MODModule->Instrument[CurrentInstrument].Length) * 2;
+            u8 TmpFineTune = MODModule->Instrument[CurrentInstrument].FineTune & 0x0F;
+
+            // signed nibble (-8 ... + 7)  ->  signed byte*16 (-128 ... +127)
+            if (TmpFineTune <= 7)
+                CurrentSamplePtr->FineTune = TmpFineTune * 16;
+            else
+                CurrentSamplePtr->FineTune = -(16 - TmpFineTune) * 16;
+
+            CurrentSamplePtr->Volume = MODModule->Instrument[CurrentInstrument].Volume;
+            CurrentSamplePtr->LoopStart = SwapBytes(MODModule->Instrument[CurrentInstrument].LoopStart) * 2;
+            CurrentSamplePtr->LoopLength = SwapBytes(MODModule->Instrument[CurrentInstrument].LoopLength) * 2;
+
+            // stupid MOD bug PATCH: if LoopLength is 2 then there's really NO loop.
+            if (CurrentSamplePtr->LoopLength == 2)
+                CurrentSamplePtr->LoopLength = 0;
+
+            CurrentSamplePtr->Flags = (CurrentSamplePtr->LoopLength > 0) ? 1 : 0; // 8 bit, forward loop
+
+            CurrentSamplePtr->Panning = 0x80; // default: center (there's no pan in mod samples)
+            CurrentSamplePtr->RelativeNote = 0; // there's no such thing in MOD
+
+            // copy instrument name in sample name
+            memcpy(CurrentSamplePtr->Name, CurrentInstrumentPtr->Name, 22); // char[22]
+        }
+        else
+        {
+            // there's no sample in this instrument, so NULL the instrument
+            Module->Instrument[CurrentInstrument] = NULL;
+        }
+    }
+    // instrument headers and sample space preparation finished.
+
+    *FLT8Flag_ = FLT8Flag;
+    return 0;
+}
+
+// Loads a pattern of a MOD. Returns 0 if OK, an error otherwise (with the
+// State of the module set)
+static XM7_Error LoadMODPattern(XM7_ModuleManager_Type *Module, int CurrentPattern,
+                                const XM7_MODPattern_Type *MODPattern, int FLT8Flag)
+{
+    // Set pattern length (always 64 in MOD)
+    Module->PatternLength[CurrentPattern] = 64;
+
+    // Prepare a pattern for the data (all of its notes get written below)
+    Module->Pattern[CurrentPattern] =
+            AllocateNewPattern(Module->PatternLength[CurrentPattern], Module->NumberofChannels);
+
+    if (Module->Pattern[CurrentPattern] == NULL)
+    {
+        Module->NumberofPatterns=CurrentPattern;
+        Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+        return XM7_ERR_NOT_ENOUGH_MEMORY;
+    }
+
+    XM7_SingleNoteArray_Type *thispattern=Module->Pattern[CurrentPattern];
+
+    // decode the pattern
+    int row, chn, period, curs, curr;
+    for (row = 0; row < Module->PatternLength[CurrentPattern]; row++)
+    {
+        for (chn = 0; chn < Module->NumberofChannels; chn++)
+        {
+            curr = row * Module->NumberofChannels + chn;
+            if (FLT8Flag)
+                curs = row * 4 + chn + ((chn < 4) ? 0 : 256 - 4);
+            else
+                curs = curr;
+
+            period = MODPattern->SingleNote[curs].PeriodL + ((MODPattern->SingleNote[curs].PeriodH & 0x0F) * 256);
+            if (period != 0)
+            {
+                // only the conversion of the period counts as the periods
+                // phase (this costs nothing in DS builds)
+                SwitchPhase(XM7_LOAD_PHASE_PERIODS);
+                thispattern->Noteblock[curr].Note = 1 + FindClosestNoteToAmigaPeriod(period);
+                SwitchPhase(XM7_LOAD_PHASE_PATTERNS);
+            }
+            else
+            {
+                thispattern->Noteblock[curr].Note = 0;
+            }
+
+            thispattern->Noteblock[curr].Instrument = (MODPattern->SingleNote[curs].Instr_EffType >> 4)
+                                                    | (MODPattern->SingleNote[curs].PeriodH & 0x10);
+            thispattern->Noteblock[curr].Volume = 0; // there's no such info here
+            thispattern->Noteblock[curr].EffectType = MODPattern->SingleNote[curs].Instr_EffType & 0x0F;
+            thispattern->Noteblock[curr].EffectParam = MODPattern->SingleNote[curs].EffParam;
+        }
+    }
+
+    return 0;
+}
+
+static XM7_Error LoadMOD(XM7_ModuleManager_Type* Module, const void* MODModule_)
+{
+    // returns 0 if OK, an error otherwise
+
+    const XM7_MODModuleHeader_Type* MODModule = MODModule_;
+
+    int FLT8Flag;
+
+    XM7_Error ret = LoadMODHeader(Module, MODModule, &FLT8Flag);
+    if (ret != 0)
+        return ret;
+
+    // now working on the patterns
+    SwitchPhase(XM7_LOAD_PHASE_PATTERNS);
+
+    int CurrentPattern;
+    XM7_MODPattern_Type *MODPattern = (XM7_MODPattern_Type *)&(MODModule->NextDataPart);
+
+    for (CurrentPattern = 0; CurrentPattern < Module->NumberofPatterns; CurrentPattern++)
+    {
+        if ((LoaderSelected != NULL) && !BitTest(LoaderSelected->Patterns, CurrentPattern))
+        {
+            Module->PatternLength[CurrentPattern] = 64;
+            Module->Pattern[CurrentPattern] = NULL;
+        }
+        else
+        {
+            ret = LoadMODPattern(Module, CurrentPattern, MODPattern, FLT8Flag);
+            if (ret != 0)
+                return ret;
+        }
+
+        // prepare for next pattern
+        MODPattern = (XM7_MODPattern_Type *)&(MODPattern->SingleNote[64 * Module->NumberofChannels]);
+    } // end 'pattern' for
+
+    // done working with patterns
+    // now loading samples
+    SwitchPhase(XM7_LOAD_PHASE_SAMPLES);
+
+    u8 *DataBlock = (u8 *)MODPattern;
+
+    int CurrentInstrument;
+    for (CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+    {
+        // check if this instrument is present
+        if (Module->Instrument[CurrentInstrument] != NULL)
+        {
+            XM7_Sample_Type *CurrentSamplePtr = Module->Instrument[CurrentInstrument]->Sample[0];
+
+            // copy LEN bytes from MOD to SampleData memory (they can overlap
+            // when loading in place, or be the same for a resident file)
+            if ((u8 *)CurrentSamplePtr->SampleData != DataBlock)
+                memmove (CurrentSamplePtr->SampleData, DataBlock, CurrentSamplePtr->Length);
+
+            // prepare for reading next sample
+            DataBlock = (u8 *)&(DataBlock[CurrentSamplePtr->Length]);
+        }
+        else if (SwapBytes(MODModule->Instrument[CurrentInstrument].Length) > 1)
+        {
+            // the sample of an instrument that isn't selected
+            DataBlock += SwapBytes(MODModule->Instrument[CurrentInstrument].Length) * 2;
+        }
+    }
+
+    // samples read.
+
+    // Set standard panning for MOD
+    Module->AmigaPanningEmulation = XM7_PANNING_TYPE_AMIGA;
+    // Module->AmigaPanningDisplacement = 0x00; // (AmigaPanning, complete separation)
+    Module->AmigaPanningDisplacement = XM7_DEFAULT_PANNING_DISPLACEMENT;
+
+    // Replay style MOD Player (w hack!)
+    Module->ReplayStyle = XM7_REPLAY_STYLE_PT;
+
+    // set State
+    Module->State = XM7_STATE_READY;
+
+    // end OK!
+    return 0;
+}
+
+XM7_Error XM7_LoadMOD(XM7_ModuleManager_Type *Module, const void *MODModule)
+{
+    PrepareModule(Module);
+
+    BeginLoad();
+    XM7_Error ret = LoadMOD(Module, MODModule);
+    EndLoad();
+
+    return ret;
+}
+
+XM7_Error XM7_LoadMODSelection(XM7_ModuleManager_Type *Module, const void *MODModule,
+                               const XM7_Selection_Type *selection)
+{
+    Selected_Type selected;
+    selected.Selection = selection;
+
+    PrepareModule(Module);
+
+    BeginLoad();
+    LoaderSelected = &selected;
+    XM7_Error ret = LoadMOD(Module, MODModule);
+    LoaderSelected = NULL;
+    EndLoad();
+
+    return ret;
+}
+
+// adds a block the loader would allocate to the info of a module: to the size
+// of the arena, and to the memory usage of a normal load
+static void ProbeBlock(XM7_ModuleInfo_Type *info, u32 *category, u32 size)
+{
+    info->ArenaSize += ArenaBlockSize(size);
+
+    *category += size;
+    info->Memory.AllocatorOverhead += HeapBlockSize(size) - size;
+    info->Memory.Allocations++;
+}
+
+static void ProbeTotal(XM7_ModuleInfo_Type *info)
+{
+    XM7_MemoryUsage_Type *usage = &info->Memory;
+
+    usage->Total = usage->Patterns + usage->Instruments + usage->SampleHeaders
+                 + usage->SampleData + usage->AllocatorOverhead;
+}
+
+// walks the headers of an XM like LoadXM() does, without allocating anything,
+// and fills info with what the module would have, the blocks the loader would
+// allocate and the number of bytes of the file it would read
+static XM7_Error ProbeXM(const void *XMModule_, XM7_ModuleInfo_Type *info)
+{
+    const XM7_XMModuleHeader_Type *XMModule = XMModule_;
+
+    if ((memcmp(XMModule->FixedText, "Extended Module: ", 17) != 0) ||
+        (XMModule->FixedChar != 0x1a))
+        return XM7_ERR_NOT_A_VALID_MODULE;
+
+    if ((XMModule->Version != 0x103) && (XMModule->Version != 0x104))
+        return XM7_ERR_UNKNOWN_MODULE_VERSION;
+
+    if (XMModule->NumberofChannels > 16)
+        return XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
+
+    memset(info, 0, sizeof(XM7_ModuleInfo_Type));
+
+    // the same as ReadXMModuleHeader()
+    memcpy(info->ModuleName, XMModule->XMModuleName, 20);
+    memcpy(info->TrackerName, XMModule->TrackerName, 20);
+    info->NumberofChannels = XMModule->NumberofChannels;
+    info->NumberofPatterns = XMModule->NumberofPatterns;
+    info->NumberofInstruments = XMModule->NumberofInstruments;
+    info->ModuleLength = XMModule->SongLength;
+    info->RestartPoint = XMModule->RestartPosition;
+    info->FreqTable = XMModule->XMModuleFlags;
+    info->DefaultTempo = XMModule->DefaultTempo;
+    info->DefaultBPM = XMModule->DefaultBPM;
+
+    const XM7_XMPatternHeader_Type *XMPatternHeader =
+            (const XM7_XMPatternHeader_Type *)&(XMModule->PatternOrder[XMModule->HeaderSize - 20]);
+
+    for (int i = 0; i < XMModule->NumberofPatterns; i++)
+    {
+        if ((XMPatternHeader->HeaderLength != 9) || (XMPatternHeader->PackingType != 0) ||
+            (XMPatternHeader->NumberofLinesinThisPattern < 1) ||
+            (XMPatternHeader->NumberofLinesinThisPattern > 256))
+            return XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+
+        ProbeBlock(info, &info->Memory.Patterns, sizeof(XM7_SingleNote_Type) *
+                   XMPatternHeader->NumberofLinesinThisPattern * XMModule->NumberofChannels);
+
+        XMPatternHeader = (const XM7_XMPatternHeader_Type *)
+                &(XMPatternHeader->PatternData[XMPatternHeader->PackedPatterndataLength]);
+    }
+
+    const XM7_XMInstrument1stHeader_Type *XMInstrument1Header =
+            (const XM7_XMInstrument1stHeader_Type *)XMPatternHeader;
+
+    // the loader keeps the number of instruments in a u8
+    for (int i = 0; i < info->NumberofInstruments; i++)
+    {
+        if (XMInstrument1Header->NumberofSamples > 16)
+            return XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+
+        ProbeBlock(info, &info->Memory.Instruments, sizeof(XM7_Instrument_Type));
+
+        if (XMInstrument1Header->NumberofSamples == 0)
+        {
+            XMInstrument1Header = (const XM7_XMInstrument1stHeader_Type *)
+                &(XMInstrument1Header->NextHeaderPart[XMInstrument1Header->InstrumentHeaderLength -
+                                                      sizeof(XM7_XMInstrument1stHeader_Type) + 1]);
+            continue;
+        }
+
+        const XM7_XMSampleHeader_Type *XMSampleHeader =
+                (const XM7_XMSampleHeader_Type *)((const u8 *)&XMInstrument1Header->InstrumentHeaderLength +
+                                                  XMInstrument1Header->InstrumentHeaderLength);
+        u32 datalen = 0;
+
+        for (int j = 0; j < XMInstrument1Header->NumberofSamples; j++)
+        {
+            ProbeBlock(info, &info->Memory.SampleHeaders, sizeof(XM7_Sample_Type));
+            ProbeBlock(info, &info->Memory.SampleData,
+                       SampleDataSize(XMSampleHeader->Length, XMSampleHeader->LoopLength,
+                                      XMSampleHeader->Type));
+
+            if ((XMSampleHeader->Type & 0x03) == 0x02)
+                info->Memory.PingPongUnroll += XMSampleHeader->LoopLength;
+
+            // 16 bit samples are read one whole sample at a time
+            if (XMSampleHeader->Type & 0x10)
+                datalen += XMSampleHeader->Length & ~1;
+            else
+                datalen += XMSampleHeader->Length;
+
+            XMSampleHeader = (const XM7_XMSampleHeader_Type *)&(XMSampleHeader->NextHeader[0]);
+        }
+
+        info->NumberofSamples += XMInstrument1Header->NumberofSamples;
+
+        XMInstrument1Header = (const XM7_XMInstrument1stHeader_Type *)((const u8 *)XMSampleHeader + datalen);
+    }
+
+    info->FileSize = (const u8 *)XMInstrument1Header - (const u8 *)XMModule;
+    ProbeTotal(info);
+
+    return 0;
+}
+
+// same for a MOD, like LoadMOD() does
+static XM7_Error ProbeMOD(const void *MODModule_, XM7_ModuleInfo_Type *info)
+{
+    const XM7_MODModuleHeader_Type *MODModule = MODModule_;
+
+    u8 channels = IdentifyMOD(MODModule->FileFormat[0], MODModule->FileFormat[1],
+                              MODModule->FileFormat[2], MODModule->FileFormat[3]);
+    int FLT8Flag = channels >> 7;
+    channels &= 0x3f;
+
+    if (channels == 0)
+        return XM7_ERR_NOT_A_VALID_MODULE;
+
+    if (channels > 16)
+        return XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
+
+    memset(info, 0, sizeof(XM7_ModuleInfo_Type));
+
+    // the same as LoadMODHeader()
+    memcpy(info->ModuleName, MODModule->MODModuleName, 20);
+    memcpy(info->TrackerName, "**** MOD Module ****", 20);
+    info->IsMOD = 1;
+    info->NumberofChannels = channels;
+    info->NumberofInstruments = 31;
+    info->ModuleLength = MODModule->SongLength;
+    info->RestartPoint = (MODModule->RestartPosition >= 127) ? 0 : MODModule->RestartPosition;
+    info->FreqTable = 0;
+    info->DefaultTempo = 6;
+    info->DefaultBPM = 125;
+
+    int patterns = 0;
+    for (int i = 0; i < 128; i++)
+    {
+        int pattern = FLT8Flag ? MODModule->PatternOrder[i] >> 1 : MODModule->PatternOrder[i];
+        if (pattern > patterns)
+            patterns = pattern;
+    }
+    patterns++;
+
+    info->NumberofPatterns = patterns;
+    for (int i = 0; i < patterns; i++)
+        ProbeBlock(info, &info->Memory.Patterns, sizeof(XM7_SingleNote_Type) * 64 * channels);
+
+    u32 read = offsetof(XM7_MODModuleHeader_Type, NextDataPart) +
+               patterns * 64 * channels * sizeof(XM7_MODSingleNote_Type);
+
+    for (int i = 0; i < 31; i++)
+    {
+        u32 len = SwapBytes(MODModule->Instrument[i].Length) * 2;
+        if (len > 2)
+        {
+            ProbeBlock(info, &info->Memory.Instruments, sizeof(XM7_Instrument_Type));
+            ProbeBlock(info, &info->Memory.SampleHeaders, sizeof(XM7_Sample_Type));
+            ProbeBlock(info, &info->Memory.SampleData, SampleDataSize(len, 0, 0));
+            info->NumberofSamples++;
+            read += len;
+        }
+    }
+
+    info->FileSize = read;
+    ProbeTotal(info);
+
+    return 0;
+}
+
+// the size of the arena needed by a module, and the number of bytes of the
+// file the loader would read in filesize, if it isn't NULL
+static XM7_Error ArenaSizeXM(const void *XMModule, u32 *size, u32 *filesize)
+{
+    XM7_ModuleInfo_Type info;
+
+    XM7_Error ret = ProbeXM(XMModule, &info);
+    if (ret != 0)
+        return ret;
+
+    *size = info.ArenaSize;
+    if (filesize != NULL)
+        *filesize = info.FileSize;
+    return 0;
+}
+
+static XM7_Error ArenaSizeMOD(const void *MODModule, u32 *size, u32 *filesize)
+{
+    XM7_ModuleInfo_Type info;
+
+    XM7_Error ret = ProbeMOD(MODModule, &info);
+    if (ret != 0)
+        return ret;
+
+    *size = info.ArenaSize;
+    if (filesize != NULL)
+        *filesize = info.FileSize;
+    return 0;
+}
+
+XM7_Error XM7_ProbeXM(const void *XMModule, XM7_ModuleInfo_Type *info)
+{
+    return ProbeXM(XMModule, info);
+}
+
+XM7_Error XM7_ProbeMOD(const void *MODModule, XM7_ModuleInfo_Type *info)
+{
+    return ProbeMOD(MODModule, info);
+}
+
+XM7_Error XM7_GetArenaSizeXM(const void *XMModule, u32 *size)
+{
+    return ArenaSizeXM(XMModule, size, NULL);
+}
+
+XM7_Error XM7_GetArenaSizeMOD(const void *MODModule, u32 *size)
+{
+    return ArenaSizeMOD(MODModule, size, NULL);
+}
+
+typedef XM7_Error (*ArenaSizeFunction)(const void *file, u32 *size, u32 *filesize);
+typedef XM7_Error (*LoadFunction)(XM7_ModuleManager_Type *Module, const void *file);
+
+static XM7_Error LoadArena(XM7_ModuleManager_Type *Module, const void *file, void *arena, u32 size,
+                           ArenaSizeFunction getsize, LoadFunction load)
+{
+    PrepareModule(Module);
+
+    BeginLoad();
+
+    u32 needed;
+    XM7_Error ret = getsize(file, &needed, NULL);
+    u8 owned = 0;
+
+    if (ret == 0)
+    {
+        if (arena == NULL)
+        {
+            // allocators return blocks aligned to 8 bytes, like malloc()
+            size = (needed > 0) ? needed : ARENA_ALIGN;
+            arena = Allocate(size, XM7_ALLOC_ARENA);
+            owned = 1;
+
+            if (arena == NULL)
+                ret = XM7_ERR_NOT_ENOUGH_MEMORY;
+        }
+        else
+        {
+            // skip the unaligned start of the block of the caller
+            u32 skip = -(uintptr_t)arena & (ARENA_ALIGN - 1);
+
+            if ((size < skip) || (size - skip < needed))
+                ret = XM7_ERR_NOT_ENOUGH_MEMORY;
+        }
+    }
+
+    if (ret != 0)
+    {
+        // nothing has been allocated
+        Module->NumberofPatterns = 0;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | ret;
+        EndLoad();
+        return ret;
+    }
+
+    Module->Arena = arena;
+    Module->ArenaSize = size;
+    Module->ArenaOwned = owned;
+
+    u32 skip = -(uintptr_t)arena & (ARENA_ALIGN - 1);
+    ArenaNext = (u8 *)arena + skip;
+    ArenaLeft = size - skip;
+
+    ret = load(Module, file);
+
+    ArenaNext = NULL;
+    ArenaLeft = 0;
+
+#ifdef __NDS__
+    // the whole module is here, the ARM7 can read it after a single flush
+    DC_FlushRange(arena, size);
+#endif
+
+    EndLoad();
+
+    return ret;
+}
+
+XM7_Error XM7_LoadXMArena(XM7_ModuleManager_Type *Module, const void *XMModule,
+                          void *arena, u32 size)
+{
+    return LoadArena(Module, XMModule, arena, size, ArenaSizeXM, LoadXM);
+}
+
+XM7_Error XM7_LoadMODArena(XM7_ModuleManager_Type *Module, const void *MODModule,
+                           void *arena, u32 size)
+{
+    return LoadArena(Module, MODModule, arena, size, ArenaSizeMOD, LoadMOD);
+}
+
+static XM7_Error LoadInPlace(XM7_ModuleManager_Type *Module, void *file, u32 size, LoadFunction load)
+{
+    PrepareModule(Module);
+
+    BeginLoad();
+
+    InPlaceNext = file;
+    XM7_Error ret = load(Module, file);
+    InPlaceNext = NULL;
+
+    // the errors up to 0x07 are found before any sample is read, then the
+    // file hasn't been touched and it still belongs to the caller
+    if ((ret == 0) || (ret > 0x07))
+    {
+        Module->File = file;
+        Module->FileSize = size;
+        Module->FileOwned = 1;
+
+#ifdef __NDS__
+        // the samples have been written in the file
+        DC_FlushRange(file, size);
+#endif
+    }
+
+    EndLoad();
+
+    return ret;
+}
+
+XM7_Error XM7_LoadXMInPlace(XM7_ModuleManager_Type *Module, void *XMModule, u32 size)
+{
+    return LoadInPlace(Module, XMModule, size, LoadXM);
+}
+
+XM7_Error XM7_LoadMODInPlace(XM7_ModuleManager_Type *Module, void *MODModule, u32 size)
+{
+    return LoadInPlace(Module, MODModule, size, LoadMOD);
+}
+
+XM7_Error XM7_LoadMODResident(XM7_ModuleManager_Type *Module, const void *MODModule)
+{
+    PrepareModule(Module);
+
+    BeginLoad();
+
+    ResidentSamples = 1;
+    XM7_Error ret = LoadMOD(Module, MODModule);
+    ResidentSamples = 0;
+
+    if ((ret == 0) || (ret > 0x07))
+    {
+        // the samples are in the part of the file that has been read
+        u32 size;
+        ArenaSizeMOD(MODModule, &size, &Module->FileSize);
+
+        Module->File = (void *)MODModule;
+    }
+
+    EndLoad();
+
+    return ret;
+}
+
+// the pieces of the file read by the stream loaders go through this buffer
+#define STREAM_CHUNK    512
+
+typedef struct {
+    const XM7_Stream_Type *Stream;
+    u32 Position;           // of the next byte in Buffer
+    u32 Filled;             // number of bytes in Buffer
+    u8 Buffer[STREAM_CHUNK];
+} StreamReader;
+
+static void StreamInit(StreamReader *reader, const XM7_Stream_Type *stream)
+{
+    reader->Stream = stream;
+    reader->Position = 0;
+    reader->Filled = 0;
+}
+
+static int StreamFill(StreamReader *reader)
+{
+    reader->Filled = reader->Stream->Read(reader->Buffer, STREAM_CHUNK, reader->Stream->User);
+    reader->Position = 0;
+
+    return reader->Filled > 0;
+}
+
+// copies the next bytes of the file, returns 0 if the file ends before
+static int StreamRead(StreamReader *reader, void *dst, u32 size)
+{
+    u8 *out = dst;
+
+    u32 buffered = reader->Filled - reader->Position;
+    u32 n = (size < buffered) ? size : buffered;
+
+    memcpy(out, &reader->Buffer[reader->Position], n);
+    reader->Position += n;
+    out += n;
+    size -= n;
+
+    if (size == 0)
+        return 1;
+
+    // big pieces (the sample data) go straight to their place
+    if (size >= STREAM_CHUNK)
+        return reader->Stream->Read(out, size, reader->Stream->User) == size;
+
+    if (!StreamFill(reader) || (reader->Filled < size))
+        return 0;
+
+    memcpy(out, reader->Buffer, size);
+    reader->Position = size;
+
+    return 1;
+}
+
+// skips the next bytes of the file, returns 0 if the file ends before
+static int StreamSkip(StreamReader *reader, u32 size)
+{
+    u32 buffered = reader->Filled - reader->Position;
+
+    if (size <= buffered)
+    {
+        reader->Position += size;
+        return 1;
+    }
+
+    size -= buffered;
+    reader->Position = reader->Filled;
 
-                // read all the data
-                CurrentSamplePtr->LoopStart  = XMSampleHeader->LoopStart;
-                CurrentSamplePtr->LoopLength = XMSampleHeader->LoopLength;
-                CurrentSamplePtr->Volume     = XMSampleHeader->Volume;
-                CurrentSamplePtr->FineTune   = XMSampleHeader->FineTune;
-                CurrentSamplePtr->Flags      = XMSampleHeader->Type;
+    if (reader->Stream->Seek != NULL)
+        return reader->Stream->Seek(size, reader->Stream->User) == 0;
 
-                // if loop type is 0x03 it becomes 'forward', because XMs shouldn't support 0x03 loops...
-                if ((CurrentSamplePtr->Flags & 0x0F) == 0x03)
-                    CurrentSamplePtr->Flags = (CurrentSamplePtr->Flags & 0xF0) | 0x01;
+    while (size > 0)
+    {
+        if (!StreamFill(reader))
+            return 0;
 
-                // end
-                CurrentSamplePtr->Panning      = XMSampleHeader->Panning;
-                CurrentSamplePtr->RelativeNote = XMSampleHeader->RelativeNote;
-                memcpy(CurrentSamplePtr->Name, XMSampleHeader->Name, 22); // char[22]
+        u32 n = (size < reader->Filled) ? size : reader->Filled;
+        reader->Position = n;
+        size -= n;
+    }
 
-                // point to the next sample header (or the 1st byte after all the headers...)
-                XMSampleHeader = (XM7_XMSampleHeader_Type *)&(XMSampleHeader->NextHeader[0]);
-            }
+    return 1;
+}
 
-            // the 1st byte after the header(s)... (both for the 8 and the 16 bit samples...)
-            XM7_SampleData_Type *SampleData = (XM7_SampleData_Type *)XMSampleHeader;
-            XM7_SampleData16_Type *SampleData16 = (XM7_SampleData16_Type *)XMSampleHeader;
+// Makes sure that at least `size` bytes (at most STREAM_CHUNK) are in the
+// buffer, unless the file ends. Returns the number of bytes in the buffer.
+static u32 StreamPeek(StreamReader *reader, u32 size)
+{
+    u32 buffered = reader->Filled - reader->Position;
 
-            // read all the sample data
-            for (CurrentSample = 0; CurrentSample < CurrentInstrumentPtr->NumberofSamples; CurrentSample++)
-            {
-                // get a pointer to the data space
-                XM7_Sample_Type *CurrentSamplePtr = CurrentInstrumentPtr->Sample[CurrentSample];
-                XM7_SampleData_Type *CurrentSampleDataPtr = (XM7_SampleData_Type *)CurrentSamplePtr->SampleData;
-                XM7_SampleData16_Type *CurrentSampleData16Ptr = (XM7_SampleData16_Type *)CurrentSamplePtr->SampleData;
+    if (buffered >= size)
+        return buffered;
 
-                // read the sample, finally!
+    memmove(reader->Buffer, &reader->Buffer[reader->Position], buffered);
+    reader->Filled = buffered + reader->Stream->Read(&reader->Buffer[buffered], STREAM_CHUNK - buffered,
+                                                     reader->Stream->User);
+    reader->Position = 0;
 
-                // check if sample is 8 or 16 bit first!
-                u32 i, j;
-                if ((CurrentSamplePtr->Flags & 0x10) == 0)
-                {
-                    // it's an 8 bit sample
-                    s8 old=0;
-                    for (i = 0; i < CurrentSamplePtr->Length; i++)
-                    {
-                        // samples in XM files are stored as delta value (nobody knows why...)
-                        old += SampleData->Data[i];
-                        CurrentSampleDataPtr->Data[i] = old;
-                    }
-
-                    // ping-pong loop conversion START
-                    // since DS has got no support for ping/pong loop, we should duplicate the loop backward
-                    if ((CurrentSamplePtr->Flags & 0x03) == 0x02)
-                    {
-                        /*
-                        for (j = 0; j < (CurrentSamplePtr->LoopLength - 2); j++)
-                        {
-                            CurrentSampleDataPtr->Data[CurrentSamplePtr->Length+j] =
-                                    CurrentSampleDataPtr->Data[(CurrentSamplePtr->Length - 1) - j];
-                        }
-                        */
-
-                        for (j = 0; j < CurrentSamplePtr->LoopLength; j++)
-                        {
-                            CurrentSampleDataPtr->Data[CurrentSamplePtr->Length + j] =
-                                    CurrentSampleDataPtr->Data[CurrentSamplePtr->Length - j];
-                        }
-
-                        // and change it to a 'normal' loop (preserving 16 bit flag)
-                        CurrentSamplePtr->Flags = (CurrentSamplePtr->Flags & 0xF0) | 0x01;
-
-                        // the lenght of the sample must be changed
-                        // CurrentSamplePtr->Length += (CurrentSamplePtr->LoopLength - 2);
-                        CurrentSamplePtr->Length += CurrentSamplePtr->LoopLength;
-
-                        // of course also LoopLength has to be changed!
-                        CurrentSamplePtr->LoopLength += CurrentSamplePtr->LoopLength;
-                    }
-                    // ping-pong loop conversion FINISHED
-
-                    // prepare for the next sample (both pointers!)
-                    SampleData = (XM7_SampleData_Type *)&(SampleData->Data[i]);
-                    SampleData16 = (XM7_SampleData16_Type *)SampleData;
-                }
-                else
-                {
-                    // it's a 16 bit sample
-                    s16 old16 = 0;
-                    for (i = 0; i < CurrentSamplePtr->Length >> 1; i++) // lenght is in bytes anyway
-                    {
-                        old16 += SampleData16->Data[i];
-                        CurrentSampleData16Ptr->Data[i] = old16;
-                    }
-
-                    // ping-pong loop conversion START
-                    // since DS has got no support for ping/pong loop, we should duplicate the loop backward
-                    if ((CurrentSamplePtr->Flags & 0x03) == 0x02)
-                    {
-                        /*
-                        // -2 because we won't duplicate 1st and last
-                        for (j = 0; j < ((CurrentSamplePtr->LoopLength >> 1) - 2); j++)
-                        {
-                            CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) + j] =
-                                    CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) - (j + 1)];
-                        }
-                        */
-
-                        for (j = 0; j < (CurrentSamplePtr->LoopLength >> 1); j++)
-                        {
-                            CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) + j] =
-                                    CurrentSampleData16Ptr->Data[(CurrentSamplePtr->Length >> 1) - j];
-                        }
-
-                        // and change it to a 'normal' loop (preserving 16 bit flag)
-                        CurrentSamplePtr->Flags = (CurrentSamplePtr->Flags & 0xF0) | 0x01;
-
-                        // the lenght of the sample must be changed (it's in bytes)
-                        // CurrentSamplePtr->Length += (CurrentSamplePtr->LoopLength - 4);
-                        CurrentSamplePtr->Length += CurrentSamplePtr->LoopLength;
-
-                        // of course also LoopLength has to be changed! (it's in bytes)
-                        // CurrentSamplePtr->LoopLength += (CurrentSamplePtr->LoopLength - 4);
-                        CurrentSamplePtr->LoopLength += CurrentSamplePtr->LoopLength;
-                    }
-                    // ping-pong loop conversion FINISHED
-
-                    // prepare for the next sample (both pointers!)
-                    SampleData16 = (XM7_SampleData16_Type *)&(SampleData16->Data[i]);
-                    SampleData = (XM7_SampleData_Type *)SampleData16;
-                }
+    return reader->Filled;
+}
+
+// decodes the packed data of an XM pattern while it's read, like LoadXM() does
+static XM7_Error ReadXMPatternStream(StreamReader *reader, XM7_SingleNoteArray_Type *thispattern,
+                                     u16 packedlength, u32 notes)
+{
+    u16 i = 0;
+    u32 wholenote = 0;
+
+    while (i < packedlength)
+    {
+        if (wholenote == notes)
+            return XM7_ERR_INCOMPLETE_PATTERN;
 
-            } // finished reading all the samples
+        // a packed note is 6 bytes at most
+        u32 buffered = StreamPeek(reader, 6);
+        if ((buffered == 0) || (buffered < XMNoteSize(reader->Buffer[reader->Position])))
+            return XM7_ERR_READ_ERROR;
 
-            // prepare for the next instrument (the next byte after the last sample
-            XMInstrument1Header = (XM7_XMInstrument1stHeader_Type*)SampleData;
+        u32 used = DecodeXMNote(&thispattern->Noteblock[wholenote], &reader->Buffer[reader->Position]);
+        reader->Position += used;
+        i += used;
 
-            // end if  (samples>0)
+        wholenote++;  // get ready for the next note
+    }
+
+    // if the pattern contains data, it must contain all the notes it should
+    if ((packedlength > 0) && (wholenote != notes))
+        return XM7_ERR_INCOMPLETE_PATTERN;
+
+    return 0;
+}
+
+static XM7_Error LoadXMStream(XM7_ModuleManager_Type *Module, StreamReader *reader)
+{
+    XM7_XMModuleHeader_Type XMModule;
+
+    Module->NumberofPatterns = 0;
+    Module->NumberofInstruments = 0;
+
+    // the fixed part of the header, up to the pattern order table
+    XM7_Error ret = XM7_ERR_NOT_A_VALID_MODULE;
+    u32 fixed = offsetof(XM7_XMModuleHeader_Type, PatternOrder);
+
+    if (StreamRead(reader, &XMModule, fixed) && (XMModule.HeaderSize >= fixed - 60))
+    {
+        // the rest of the header is the order table (with room for 256 entries)
+        u32 order = XMModule.HeaderSize - (fixed - 60);
+        u32 keep = (order < 256) ? order : 256;
+
+        memset(XMModule.PatternOrder, 0, sizeof(XMModule.PatternOrder));
+        if (!StreamRead(reader, XMModule.PatternOrder, keep) || !StreamSkip(reader, order - keep))
+        {
+            ret = XM7_ERR_READ_ERROR;
         }
         else
         {
-            // if (samples == 0)
-            // should be like this...
-            // XMInstrument1Header = (XMInstrument1stHeader_Type *)&(XMInstrument1Header->NextHeaderPart[0]);
+            XMModule.HeaderSize = keep + (fixed - 60);
+            ret = ReadXMModuleHeader(Module, &XMModule);
+        }
+    }
 
-            // ...but it seems like THERE IS the 2nd header too even when NO samples...
-            // get the 2nd part of the header
+    if (ret != 0)
+    {
+        Module->NumberofPatterns = 0;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | ret;
+        return ret;
+    }
 
-            // NOTE: I've found some XM with instruments with 0 samples so I trash the following 2 lines
-            /*
-            XMInstrument2ndHeader_Type *XMInstrument2Header =
-                    (XMInstrument2ndHeader_Type *)&(XMInstrument1Header->NextHeaderPart[0]);
-            XMInstrument1Header = (XMInstrument1stHeader_Type *)&(XMInstrument2Header->NextDataPart[0]);
-            */
+    SwitchPhase(XM7_LOAD_PHASE_PATTERNS);
 
-            XMInstrument1Header = (XM7_XMInstrument1stHeader_Type *)
-                &(XMInstrument1Header->NextHeaderPart[XMInstrument1Header->InstrumentHeaderLength -
-                                                      sizeof(XM7_XMInstrument1stHeader_Type) + 1]);
+    for (int CurrentPattern = 0; CurrentPattern < Module->NumberofPatterns; CurrentPattern++)
+    {
+        XM7_XMPatternHeader_Type XMPatternHeader;
 
+        if (!StreamRead(reader, &XMPatternHeader, offsetof(XM7_XMPatternHeader_Type, PatternData)))
+            ret = XM7_ERR_READ_ERROR;
+        else if ((XMPatternHeader.HeaderLength != 9) || (XMPatternHeader.PackingType != 0) ||
+                 (XMPatternHeader.NumberofLinesinThisPattern < 1) ||
+                 (XMPatternHeader.NumberofLinesinThisPattern > 256))
+            ret = XM7_ERR_UNSUPPORTED_PATTERN_HEADER;
+
+        if (ret != 0)
+        {
+            Module->NumberofPatterns = CurrentPattern;
+            Module->NumberofInstruments = 0;
+            Module->State = XM7_STATE_ERROR | ret;
+            return ret;
         }
-    } // end "for Instruments"
 
-    // Set standard panning
+        Module->PatternLength[CurrentPattern] = XMPatternHeader.NumberofLinesinThisPattern;
+        Module->Pattern[CurrentPattern] =
+                PrepareNewPattern(Module->PatternLength[CurrentPattern], Module->NumberofChannels);
+
+        if (Module->Pattern[CurrentPattern] == NULL)
+        {
+            Module->NumberofPatterns = CurrentPattern;
+            Module->NumberofInstruments = 0;
+            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+            return XM7_ERR_NOT_ENOUGH_MEMORY;
+        }
+
+        ret = ReadXMPatternStream(reader, Module->Pattern[CurrentPattern],
+                                  XMPatternHeader.PackedPatterndataLength,
+                                  Module->PatternLength[CurrentPattern] * Module->NumberofChannels);
+        if (ret != 0)
+        {
+            Module->NumberofPatterns = CurrentPattern + 1;
+            Module->NumberofInstruments = 0;
+            Module->State = XM7_STATE_ERROR | ret;
+            return ret;
+        }
+    }
+
+    SwitchPhase(XM7_LOAD_PHASE_HEADERS);
+
+    for (int i = 0; i < 128; i++)
+        Module->Instrument[i] = NULL;
+
+    for (int CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+    {
+        // room for both parts of the header, the rest of it is skipped
+        union {
+            XM7_XMInstrument1stHeader_Type Header;
+            u8 Bytes[offsetof(XM7_XMInstrument1stHeader_Type, NextHeaderPart) +
+                     offsetof(XM7_XMInstrument2ndHeader_Type, NextDataPart)];
+        } XMInstrument;
+
+        XM7_XMInstrument1stHeader_Type *XMInstrument1Header = &XMInstrument.Header;
+        u32 first = offsetof(XM7_XMInstrument1stHeader_Type, NextHeaderPart);
+
+        memset(&XMInstrument, 0, sizeof(XMInstrument));
+
+        if (!StreamRead(reader, XMInstrument1Header, first))
+            ret = XM7_ERR_READ_ERROR;
+        else if ((XMInstrument1Header->NumberofSamples > 16) ||
+                 (XMInstrument1Header->InstrumentHeaderLength < first))
+            ret = XM7_ERR_UNSUPPORTED_INSTRUMENT_HEADER;
+
+        if (ret == 0)
+        {
+            u32 rest = XMInstrument1Header->InstrumentHeaderLength - first;
+            u32 keep = (rest < sizeof(XMInstrument) - first) ? rest : sizeof(XMInstrument) - first;
+
+            if (!StreamRead(reader, XMInstrument1Header->NextHeaderPart, keep) ||
+                !StreamSkip(reader, rest - keep))
+                ret = XM7_ERR_READ_ERROR;
+        }
+
+        if (ret != 0)
+        {
+            Module->NumberofInstruments = CurrentInstrument;
+            Module->State = XM7_STATE_ERROR | ret;
+            return ret;
+        }
+
+        Module->Instrument[CurrentInstrument] = PrepareNewInstrument();
+        if (Module->Instrument[CurrentInstrument] == NULL)
+        {
+            Module->NumberofInstruments = CurrentInstrument;
+            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+            return XM7_ERR_NOT_ENOUGH_MEMORY;
+        }
+
+        XM7_Instrument_Type *CurrentInstrumentPtr = Module->Instrument[CurrentInstrument];
+
+        ReadXMInstrumentHeader(CurrentInstrumentPtr, XMInstrument1Header);
+
+        u8 CurrentSample;
+
+        for (CurrentSample = 0; CurrentSample < CurrentInstrumentPtr->NumberofSamples; CurrentSample++)
+        {
+            XM7_XMSampleHeader_Type XMSampleHeader;
+
+            if (!StreamRead(reader, &XMSampleHeader, offsetof(XM7_XMSampleHeader_Type, NextHeader)))
+            {
+                ret = XM7_ERR_READ_ERROR;
+            }
+            else
+            {
+                CurrentInstrumentPtr->Sample[CurrentSample] =
+                    PrepareNewSample(XMSampleHeader.Length, XMSampleHeader.LoopLength, XMSampleHeader.Type);
+
+                if (CurrentInstrumentPtr->Sample[CurrentSample] == NULL)
+                    ret = XM7_ERR_NOT_ENOUGH_MEMORY;
+            }
+
+            if (ret != 0)
+            {
+                Module->NumberofInstruments = CurrentInstrument + 1;
+                CurrentInstrumentPtr->NumberofSamples = CurrentSample;
+                Module->State = XM7_STATE_ERROR | ret;
+                return ret;
+            }
+
+            ReadXMSampleHeader(CurrentInstrumentPtr->Sample[CurrentSample], &XMSampleHeader);
+        }
+
+        SwitchPhase(XM7_LOAD_PHASE_SAMPLES);
+
+        for (CurrentSample = 0; CurrentSample < CurrentInstrumentPtr->NumberofSamples; CurrentSample++)
+        {
+            XM7_Sample_Type *CurrentSamplePtr = CurrentInstrumentPtr->Sample[CurrentSample];
+
+            // the deltas are read in the buffer of the sample and decoded there
+            u32 size = CurrentSamplePtr->Length;
+            if (CurrentSamplePtr->Flags & 0x10)
+                size &= ~1;
+
+            if (!StreamRead(reader, CurrentSamplePtr->SampleData, size))
+            {
+                Module->NumberofInstruments = CurrentInstrument + 1;
+                Module->State = XM7_STATE_ERROR | XM7_ERR_READ_ERROR;
+                return XM7_ERR_READ_ERROR;
+            }
+
+            DecodeXMSampleData(CurrentSamplePtr, CurrentSamplePtr->SampleData);
+        }
+
+        SwitchPhase(XM7_LOAD_PHASE_HEADERS);
+    }
+
     Module->AmigaPanningEmulation = XM7_PANNING_TYPE_NORMAL;
     Module->AmigaPanningDisplacement = 0x00;
-
-    // Replay style FT2 for XM
     Module->ReplayStyle = XM7_REPLAY_STYLE_FT2;
-
-    // set State
     Module->State = XM7_STATE_READY;
 
-    // end OK!
     return 0;
 }
 
-XM7_Error XM7_LoadMOD(XM7_ModuleManager_Type* Module, const void* MODModule_)
+// the notes of a MOD are converted while they're read, one at a time
+static void ConvertMODNote(XM7_SingleNote_Type *note, const XM7_MODSingleNote_Type *MODNote)
 {
-    // returns 0 if OK, an error otherwise
+    int period = MODNote->PeriodL + ((MODNote->PeriodH & 0x0F) * 256);
 
-    const XM7_MODModuleHeader_Type* MODModule = MODModule_;
+    note->Note = (period != 0) ? 1 + FindClosestNoteToAmigaPeriod(period) : 0;
+    note->Instrument = (MODNote->Instr_EffType >> 4) | (MODNote->PeriodH & 0x10);
+    note->Volume = 0; // there's no such info here
+    note->EffectType = MODNote->Instr_EffType & 0x0F;
+    note->EffectParam = MODNote->EffParam;
+}
 
+static XM7_Error LoadMODStream(XM7_ModuleManager_Type *Module, StreamReader *reader)
+{
+    XM7_MODModuleHeader_Type MODModule;
     int FLT8Flag;
 
-    // file format ID check
-    Module->NumberofChannels = IdentifyMOD(MODModule->FileFormat[0], MODModule->FileFormat[1],
-                                           MODModule->FileFormat[2], MODModule->FileFormat[3]);
-
-    FLT8Flag = Module->NumberofChannels >> 7;
-    Module->NumberofChannels &= 0x3f;
-
-    // if MOD has not been identified:
-    if (Module->NumberofChannels == 0)
+    if (!StreamRead(reader, &MODModule, offsetof(XM7_MODModuleHeader_Type, NextDataPart)))
     {
         Module->NumberofInstruments = 0;
         Module->NumberofPatterns = 0;
@@ -746,218 +2733,401 @@ XM7_Error XM7_LoadMOD(XM7_ModuleManager_Type* Module, const void* MODModule_)
         return XM7_ERR_NOT_A_VALID_MODULE;
     }
 
-    // if MOD has too many channels:
-    if (Module->NumberofChannels > 16)
+    XM7_Error ret = LoadMODHeader(Module, &MODModule, &FLT8Flag);
+    if (ret != 0)
+        return ret;
+
+    SwitchPhase(XM7_LOAD_PHASE_PATTERNS);
+
+    for (int CurrentPattern = 0; CurrentPattern < Module->NumberofPatterns; CurrentPattern++)
     {
-        Module->NumberofInstruments = 0;
-        Module->NumberofPatterns = 0;
-        Module->State = XM7_STATE_ERROR | XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
-        return XM7_ERR_UNSUPPORTED_NUMBER_OF_CHANNELS;
+        Module->PatternLength[CurrentPattern] = 64;
+        Module->Pattern[CurrentPattern] =
+                PrepareNewPattern(Module->PatternLength[CurrentPattern], Module->NumberofChannels);
+
+        if (Module->Pattern[CurrentPattern] == NULL)
+        {
+            Module->NumberofPatterns = CurrentPattern;
+            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
+            return XM7_ERR_NOT_ENOUGH_MEMORY;
+        }
+
+        XM7_SingleNoteArray_Type *thispattern = Module->Pattern[CurrentPattern];
+        int notes = 64 * Module->NumberofChannels;
+
+        // in the file order: FLT8 patterns are two 4 channels patterns in a row
+        for (int curs = 0; curs < notes; curs++)
+        {
+            XM7_MODSingleNote_Type MODNote;
+            int curr = curs;
+
+            if (FLT8Flag)
+                curr = ((curs & 255) >> 2) * 8 + (curs & 3) + ((curs < 256) ? 0 : 4);
+
+            if (!StreamRead(reader, &MODNote, sizeof(MODNote)))
+            {
+                Module->NumberofPatterns = CurrentPattern + 1;
+                Module->State = XM7_STATE_ERROR | XM7_ERR_READ_ERROR;
+                return XM7_ERR_READ_ERROR;
+            }
+
+            ConvertMODNote(&thispattern->Noteblock[curr], &MODNote);
+        }
     }
 
-    // set these values, constants in a MOD file
-    Module->NumberofInstruments = 31;   // 31 instrums, default
-    Module->FreqTable    = 0;           // AMIGA Freq. Table ( ==0 !)
-    Module->DefaultTempo = 6;           // Spd=6, default
-    Module->DefaultBPM   = 125;         // BPM=125, default
-    memcpy(Module->TrackerName, "**** MOD Module ****", 20); // char[20]
+    SwitchPhase(XM7_LOAD_PHASE_SAMPLES);
 
-    // load all the needed info from the header
-    Module->ModuleLength = MODModule->SongLength;
-    Module->RestartPoint = (MODModule->RestartPosition>=127)?0:MODModule->RestartPosition;
-    memcpy (Module->PatternOrder, MODModule->PatternOrder, 128);   // u8[128]
-    memcpy (Module->ModuleName,MODModule->MODModuleName,20);      // char[20]
+    for (int CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+    {
+        if (Module->Instrument[CurrentInstrument] == NULL)
+            continue;
+
+        XM7_Sample_Type *CurrentSamplePtr = Module->Instrument[CurrentInstrument]->Sample[0];
+
+        if (!StreamRead(reader, CurrentSamplePtr->SampleData, CurrentSamplePtr->Length))
+        {
+            Module->State = XM7_STATE_ERROR | XM7_ERR_READ_ERROR;
+            return XM7_ERR_READ_ERROR;
+        }
+    }
+
+    Module->AmigaPanningEmulation = XM7_PANNING_TYPE_AMIGA;
+    Module->AmigaPanningDisplacement = XM7_DEFAULT_PANNING_DISPLACEMENT;
+    Module->ReplayStyle = XM7_REPLAY_STYLE_PT;
+    Module->State = XM7_STATE_READY;
+
+    return 0;
+}
+
+XM7_Error XM7_LoadXMStream(XM7_ModuleManager_Type *Module, const XM7_Stream_Type *stream)
+{
+    StreamReader reader;
+    StreamInit(&reader, stream);
+
+    PrepareModule(Module);
+
+    BeginLoad();
+    XM7_Error ret = LoadXMStream(Module, &reader);
+    EndLoad();
+
+    return ret;
+}
+
+XM7_Error XM7_LoadMODStream(XM7_ModuleManager_Type *Module, const XM7_Stream_Type *stream)
+{
+    StreamReader reader;
+    StreamInit(&reader, stream);
+
+    PrepareModule(Module);
+
+    BeginLoad();
+    XM7_Error ret = LoadMODStream(Module, &reader);
+    EndLoad();
+
+    return ret;
+}
+
+// stages of an incremental load
+#define LOADER_PATTERNS     0
+#define LOADER_INSTRUMENT   1   // headers of the next instrument (XM only)
+#define LOADER_SAMPLES      2
+#define LOADER_DONE         3
+
+static XM7_Error LoadStart(XM7_Loader_Type *loader, XM7_ModuleManager_Type *Module, const void *file,
+                           int IsMOD)
+{
+    memset(loader, 0, sizeof(XM7_Loader_Type));
+    loader->Module = Module;
+    loader->IsMOD = IsMOD;
+
+    PrepareModule(Module);
+    Module->NumberofPatterns = 0;
+    Module->NumberofInstruments = 0;
+    Module->State = XM7_STATE_EMPTY;
 
-    // calculate how many patterns are there in the module (in a safe way)
-    Module->NumberofPatterns=0;
     for (int i = 0; i < 128; i++)
+        Module->Instrument[i] = NULL;
+
+    BeginLoad();
+
+    // the whole file is checked first, so the load can't fail halfway because
+    // of a bad header
+    u32 size;
+    XM7_Error ret = IsMOD ? ArenaSizeMOD(file, &size, &loader->Total)
+                          : ArenaSizeXM(file, &size, &loader->Total);
+
+    if ((ret == 0) && IsMOD)
+    {
+        int FLT8Flag;
+
+        // the instruments and the space for their samples are prepared here
+        ret = LoadMODHeader(Module, file, &FLT8Flag);
+        if (ret == 0)
+        {
+            loader->FLT8 = FLT8Flag;
+            loader->Patterns = Module->NumberofPatterns;
+            loader->Instruments = Module->NumberofInstruments;
+            loader->Next = (const u8 *)&((const XM7_MODModuleHeader_Type *)file)->NextDataPart;
+        }
+        else
+        {
+            // LoadMODHeader() can fail after allocating some instruments,
+            // they're freed so that nothing is left allocated after an error
+            XM7_UnloadXM(Module);
+        }
+    }
+    else if (ret == 0)
+    {
+        const XM7_XMModuleHeader_Type *XMModule = file;
+
+        ret = ReadXMModuleHeader(Module, XMModule);
+        loader->Patterns = Module->NumberofPatterns;
+        loader->Instruments = (u8)Module->NumberofInstruments; // the module keeps it in a u8
+        loader->Next = &XMModule->PatternOrder[XMModule->HeaderSize - 20];
+    }
+
+    if (ret != 0)
+    {
+        Module->NumberofPatterns = 0;
+        Module->NumberofInstruments = 0;
+        Module->State = XM7_STATE_ERROR | ret;
+        loader->Error = ret;
+        loader->Stage = LOADER_DONE;
+        EndLoad();
+        return ret;
+    }
+
+    // the module only counts what has been loaded, so it can be unloaded at
+    // any time
+    Module->NumberofPatterns = 0;
+    if (!IsMOD)
+        Module->NumberofInstruments = 0;
+
+    loader->Done = loader->Next - (const u8 *)file;
+    loader->Stage = LOADER_PATTERNS;
+
+    EndLoad();
+
+    return 0;
+}
+
+XM7_Error XM7_LoadXMStart(XM7_Loader_Type *loader, XM7_ModuleManager_Type *Module, const void *XMModule)
+{
+    return LoadStart(loader, Module, XMModule, 0);
+}
+
+XM7_Error XM7_LoadMODStart(XM7_Loader_Type *loader, XM7_ModuleManager_Type *Module, const void *MODModule)
+{
+    return LoadStart(loader, Module, MODModule, 1);
+}
+
+// moves on to the next instrument with samples to load, or ends the load
+static void LoaderNextInstrument(XM7_Loader_Type *loader)
+{
+    XM7_ModuleManager_Type *Module = loader->Module;
+
+    loader->Sample = 0;
+    loader->Offset = 0;
+    loader->Delta = 0;
+
+    if (loader->IsMOD)
+    {
+        while ((loader->Index < Module->NumberofInstruments) && (Module->Instrument[loader->Index] == NULL))
+            loader->Index++;
+
+        if (loader->Index < Module->NumberofInstruments)
+        {
+            loader->Stage = LOADER_SAMPLES;
+            return;
+        }
+
+        Module->AmigaPanningEmulation = XM7_PANNING_TYPE_AMIGA;
+        Module->AmigaPanningDisplacement = XM7_DEFAULT_PANNING_DISPLACEMENT;
+        Module->ReplayStyle = XM7_REPLAY_STYLE_PT;
+    }
+    else
     {
-        // divide by 2 if it's FLT8
-        if (FLT8Flag)
-            Module->PatternOrder[i] >>= 1;
+        if (Module->NumberofInstruments < loader->Instruments)
+        {
+            loader->Stage = LOADER_INSTRUMENT;
+            return;
+        }
 
-        if (Module->PatternOrder[i] > Module->NumberofPatterns)
-            Module->NumberofPatterns = Module->PatternOrder[i];
+        Module->AmigaPanningEmulation = XM7_PANNING_TYPE_NORMAL;
+        Module->AmigaPanningDisplacement = 0x00;
+        Module->ReplayStyle = XM7_REPLAY_STYLE_FT2;
     }
 
-    // higher number+1
-    Module->NumberofPatterns++;
-    // the MODULE header is finished!
+    Module->State = XM7_STATE_READY;
+    loader->Stage = LOADER_DONE;
+}
 
-    // now working on the instrument headers (instruments are always 31)
-    int CurrentInstrument;
-    for (CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+static XM7_Error LoaderPattern(XM7_Loader_Type *loader)
+{
+    XM7_ModuleManager_Type *Module = loader->Module;
+    u16 CurrentPattern = Module->NumberofPatterns;
+    XM7_Error ret = 0;
+    u32 used;
+
+    if (CurrentPattern < loader->Patterns)
     {
-        // check if I need to allocate this instrument (or is it empty?)
-        // NOTE: if len==1 then IT'S EMPTY (!!!)
-        if (SwapBytes(MODModule->Instrument[CurrentInstrument].Length) > 1)
-        {
-            // allocate the new instrument
-            Module->Instrument[CurrentInstrument] = PrepareNewInstrument();
-            if (Module->Instrument[CurrentInstrument] == NULL)
-            {
-                Module->NumberofInstruments=CurrentInstrument;
-                Module->NumberofPatterns = 0;
-                Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
-                return XM7_ERR_NOT_ENOUGH_MEMORY;
-            }
+        SwitchPhase(XM7_LOAD_PHASE_PATTERNS);
 
-            XM7_Instrument_Type *CurrentInstrumentPtr = Module->Instrument[CurrentInstrument];
+        Module->NumberofPatterns = CurrentPattern + 1;
 
-            // load the info from the header
-            CurrentInstrumentPtr->NumberofSamples = 1;
-            memcpy(CurrentInstrumentPtr->Name, MODModule->Instrument[CurrentInstrument].Name, 22); // char[22]
+        if (loader->IsMOD)
+        {
+            ret = LoadMODPattern(Module, CurrentPattern, (const XM7_MODPattern_Type *)loader->Next,
+                                 loader->FLT8);
+            used = 64 * Module->NumberofChannels * sizeof(XM7_MODSingleNote_Type);
+        }
+        else
+        {
+            const XM7_XMPatternHeader_Type *XMPatternHeader = (const XM7_XMPatternHeader_Type *)loader->Next;
 
-            // no multisample, it's a MOD
-            memset(CurrentInstrumentPtr->SampleforNote, 0, 96);
+            ret = LoadXMPattern(Module, CurrentPattern, XMPatternHeader);
+            used = offsetof(XM7_XMPatternHeader_Type, PatternData) + XMPatternHeader->PackedPatterndataLength;
+        }
 
-            // NO envelopes in a MOD
-            CurrentInstrumentPtr->VolumeType = 0;
-            CurrentInstrumentPtr->PanningType = 0;
-            CurrentInstrumentPtr->NumberofVolumeEnvelopePoints = 0;
-            CurrentInstrumentPtr->NumberofPanningEnvelopePoints = 0;
+        SwitchPhase(XM7_LOAD_PHASE_HEADERS);
 
-            // NO auto vibrato in a MOD
-            CurrentInstrumentPtr->VibratoType = 0;
-            CurrentInstrumentPtr->VibratoSweep = 0;
-            CurrentInstrumentPtr->VibratoDepth = 0;
-            CurrentInstrumentPtr->VibratoRate = 0;
+        if (ret != 0)
+            return ret;
 
-            // NO fadeout in a MOD
-            CurrentInstrumentPtr->VolumeFadeout = 0;
+        loader->Next += used;
+        loader->Done += used;
+    }
 
-            // allocate space for the (only) sample
-            CurrentInstrumentPtr->Sample[0] =
-                    PrepareNewSample(SwapBytes(MODModule->Instrument[CurrentInstrument].Length) * 2,
-                                     SwapBytes(MODModule->Instrument[CurrentInstrument].LoopLength) * 2, 0);
+    if (Module->NumberofPatterns == loader->Patterns)
+        LoaderNextInstrument(loader);
 
-            if (CurrentInstrumentPtr->Sample[0] == NULL)
-            {
-                Module->NumberofInstruments = CurrentInstrument + 1;
-                Module->NumberofPatterns = 0;
-                Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
-                return XM7_ERR_NOT_ENOUGH_MEMORY;
-            }
+    return 0;
+}
 
-            XM7_Sample_Type *CurrentSamplePtr = CurrentInstrumentPtr->Sample[0];
+static XM7_Error LoaderInstrument(XM7_Loader_Type *loader)
+{
+    XM7_ModuleManager_Type *Module = loader->Module;
+    u16 CurrentInstrument = Module->NumberofInstruments;
+    const u8 *SampleData;
 
-            // read all the data
-            CurrentSamplePtr->Length = SwapBytes(MODModule->Instrument[CurrentInstrument].Length) * 2;
-            u8 TmpFineTune = MODModule->Instrument[CurrentInstrument].FineTune & 0x0F;
+    Module->NumberofInstruments = CurrentInstrument + 1;
 
-            // signed nibble (-8 ... + 7)  ->  signed byte*16 (-128 ... +127)
-            if (TmpFineTune <= 7)
-                CurrentSamplePtr->FineTune = TmpFineTune * 16;
-            else
-                CurrentSamplePtr->FineTune = -(16 - TmpFineTune) * 16;
+    XM7_Error ret = LoadXMInstrumentHeaders(Module, CurrentInstrument,
+                                            (const XM7_XMInstrument1stHeader_Type *)loader->Next,
+                                            &SampleData);
+    if (ret != 0)
+        return ret;
 
-            CurrentSamplePtr->Volume = MODModule->Instrument[CurrentInstrument].Volume;
-            CurrentSamplePtr->LoopStart = SwapBytes(MODModule->Instrument[CurrentInstrument].LoopStart) * 2;
-            CurrentSamplePtr->LoopLength = SwapBytes(MODModule->Instrument[CurrentInstrument].LoopLength) * 2;
+    loader->Done += SampleData - loader->Next;
+    loader->Next = SampleData;
 
-            // stupid MOD bug PATCH: if LoopLength is 2 then there's really NO loop.
-            if (CurrentSamplePtr->LoopLength == 2)
-                CurrentSamplePtr->LoopLength = 0;
+    if (Module->Instrument[CurrentInstrument]->NumberofSamples > 0)
+    {
+        loader->Sample = 0;
+        loader->Offset = 0;
+        loader->Delta = 0;
+        loader->Stage = LOADER_SAMPLES;
+    }
+    else
+    {
+        LoaderNextInstrument(loader);
+    }
 
-            CurrentSamplePtr->Flags = (CurrentSamplePtr->LoopLength > 0) ? 1 : 0; // 8 bit, forward loop
+    return 0;
+}
 
-            CurrentSamplePtr->Panning = 0x80; // default: center (there's no pan in mod samples)
-            CurrentSamplePtr->RelativeNote = 0; // there's no such thing in MOD
+// loads the data of the current sample up to the end of the budget
+static void LoaderSampleData(XM7_Loader_Type *loader, u32 target)
+{
+    XM7_ModuleManager_Type *Module = loader->Module;
+    XM7_Instrument_Type *CurrentInstrumentPtr =
+            Module->Instrument[loader->IsMOD ? loader->Index : Module->NumberofInstruments - 1];
+    XM7_Sample_Type *CurrentSamplePtr = CurrentInstrumentPtr->Sample[loader->Sample];
 
-            // copy instrument name in sample name
-            memcpy(CurrentSamplePtr->Name, CurrentInstrumentPtr->Name, 22); // char[22]
-        }
-        else
-        {
-            // there's no sample in this instrument, so NULL the instrument
-            Module->Instrument[CurrentInstrument] = NULL;
-        }
+    u32 used = loader->IsMOD ? CurrentSamplePtr->Length : XMSampleDataUsed(CurrentSamplePtr);
+    u32 size = used - loader->Offset;
+    u32 left = (loader->Done < target) ? target - loader->Done : 1;
+
+    if (size > left)
+    {
+        // 16 bit samples are split between whole samples
+        size = left;
+        if (CurrentSamplePtr->Flags & 0x10)
+            size = (size > 1) ? size & ~1 : 2;
     }
-    // instrument headers and sample space preparation finished.
 
-    // now working on the patterns
-    int CurrentPattern;
-    XM7_MODPattern_Type *MODPattern = (XM7_MODPattern_Type *)&(MODModule->NextDataPart);
+    SwitchPhase(XM7_LOAD_PHASE_SAMPLES);
 
-    for (CurrentPattern = 0; CurrentPattern < Module->NumberofPatterns; CurrentPattern++)
-    {
-        // Set pattern length (always 64 in MOD)
-        Module->PatternLength[CurrentPattern] = 64;
+    if (loader->IsMOD)
+        memcpy(&CurrentSamplePtr->SampleData->Data[loader->Offset], loader->Next, size);
+    else
+        DeltaDecodeXMSample(CurrentSamplePtr, loader->Offset, loader->Next, size, &loader->Delta);
 
-        // Prepare an empty pattern for the data
-        Module->Pattern[CurrentPattern] =
-                PrepareNewPattern(Module->PatternLength[CurrentPattern], Module->NumberofChannels);
+    loader->Next += size;
+    loader->Done += size;
+    loader->Offset += size;
 
-        if (Module->Pattern[CurrentPattern] == NULL)
-        {
-            Module->NumberofPatterns=CurrentPattern;
-            Module->State = XM7_STATE_ERROR | XM7_ERR_NOT_ENOUGH_MEMORY;
-            return XM7_ERR_NOT_ENOUGH_MEMORY;
-        }
+    if (loader->Offset == used)
+    {
+        if (!loader->IsMOD)
+            UnrollXMPingPong(CurrentSamplePtr);
 
-        XM7_SingleNoteArray_Type *thispattern=Module->Pattern[CurrentPattern];
+        loader->Offset = 0;
+        loader->Delta = 0;
+        loader->Sample++;
 
-        // decode the pattern
-        int row, chn, period, curs, curr = 0;
-        for (row = 0; row < Module->PatternLength[CurrentPattern]; row++)
+        if (loader->Sample == CurrentInstrumentPtr->NumberofSamples)
         {
-            for (chn = 0; chn < Module->NumberofChannels; chn++)
-            {
-                curr = row * Module->NumberofChannels + chn;
-                if (FLT8Flag)
-                    curs = row * 4 + chn + ((chn < 4) ? 0 : 256 - 4);
-                else
-                    curs = curr;
-
-                period = MODPattern->SingleNote[curs].PeriodL + ((MODPattern->SingleNote[curs].PeriodH & 0x0F) * 256);
-                thispattern->Noteblock[curr].Note = (period != 0) ? 1 + FindClosestNoteToAmigaPeriod(period) : 0;
-                thispattern->Noteblock[curr].Instrument = (MODPattern->SingleNote[curs].Instr_EffType >> 4)
-                                                        | (MODPattern->SingleNote[curs].PeriodH & 0x10);
-                thispattern->Noteblock[curr].Volume = 0; // there's no such info here
-                thispattern->Noteblock[curr].EffectType = MODPattern->SingleNote[curs].Instr_EffType & 0x0F;
-                thispattern->Noteblock[curr].EffectParam = MODPattern->SingleNote[curs].EffParam;
-            }
+            loader->Index++;
+            LoaderNextInstrument(loader);
         }
+    }
 
-        // prepare for next pattern
-        MODPattern = (XM7_MODPattern_Type *)&(MODPattern->SingleNote[curr + 1]);
-    } // end 'pattern' for
+    SwitchPhase(XM7_LOAD_PHASE_HEADERS);
+}
 
-    // done working with patterns
-    // now loading samples
+XM7_Error XM7_LoadStep(XM7_Loader_Type *loader, u32 budget)
+{
+    if (loader->Stage == LOADER_DONE)
+        return loader->Error;
 
-    u8 *DataBlock = (u8 *)MODPattern;
+    ResumeLoad();
 
-    for (CurrentInstrument = 0; CurrentInstrument < Module->NumberofInstruments; CurrentInstrument++)
+    u32 target = (budget < loader->Total - loader->Done) ? loader->Done + budget : loader->Total;
+    XM7_Error ret = 0;
+
+    // at least one piece is loaded, even with no budget
+    do
     {
-        // check if this instrument is present
-        if (Module->Instrument[CurrentInstrument] != NULL)
+        switch (loader->Stage)
         {
-            XM7_Sample_Type *CurrentSamplePtr = Module->Instrument[CurrentInstrument]->Sample[0];
-
-            // memcpy LEN bytes from MOD to SampleData memory
-            memcpy (CurrentSamplePtr->SampleData, DataBlock, CurrentSamplePtr->Length);
-
-            // prepare for reading next sample
-            DataBlock = (u8 *)&(DataBlock[CurrentSamplePtr->Length]);
+            case LOADER_PATTERNS:
+                ret = LoaderPattern(loader);
+                break;
+            case LOADER_INSTRUMENT:
+                ret = LoaderInstrument(loader);
+                break;
+            case LOADER_SAMPLES:
+                LoaderSampleData(loader, target);
+                break;
         }
     }
+    while ((ret == 0) && (loader->Stage != LOADER_DONE) && (loader->Done < target));
 
-    // samples read.
-
-    // Set standard panning for MOD
-    Module->AmigaPanningEmulation = XM7_PANNING_TYPE_AMIGA;
-    // Module->AmigaPanningDisplacement = 0x00; // (AmigaPanning, complete separation)
-    Module->AmigaPanningDisplacement = XM7_DEFAULT_PANNING_DISPLACEMENT;
+    if (ret != 0)
+    {
+        loader->Error = ret;
+        loader->Stage = LOADER_DONE;
+    }
 
-    // Replay style MOD Player (w hack!)
-    Module->ReplayStyle = XM7_REPLAY_STYLE_PT;
+    EndLoad();
 
-    // set State
-    Module->State = XM7_STATE_READY;
+    return ret;
+}
 
-    // end OK!
-    return 0;
+XM7_Error XM7_LoadFinish(XM7_Loader_Type *loader)
+{
+    return XM7_LoadStep(loader, loader->Total - loader->Done);
 }
 
 void XM7_UnloadXM(XM7_ModuleManager_Type *Module)
@@ -966,6 +3136,17 @@ void XM7_UnloadXM(XM7_ModuleManager_Type *Module)
     XM7_Instrument_Type *CurrentInstrumentPtr;
     XM7_Sample_Type *CurrentSamplePtr;
 
+    // a module loaded into an arena goes away all at once
+    if (Module->Arena != NULL)
+    {
+        if (Module->ArenaOwned)
+            FreeBlock(Module->Allocator, Module->Arena, XM7_ALLOC_ARENA);
+
+        Module->Arena = NULL;
+        Module->State = XM7_STATE_EMPTY;
+        return;
+    }
+
     // instruments, from last to first
     for (i = (Module->NumberofInstruments - 1); i >= 0; i--)
     {
@@ -979,20 +3160,30 @@ void XM7_UnloadXM(XM7_ModuleManager_Type *Module)
         {
             CurrentSamplePtr = CurrentInstrumentPtr->Sample[j];
 
-            // remove sample data
-            free(CurrentSamplePtr->SampleData);
+            // remove sample data (unless it's in the file)
+            if (!InFile(Module, CurrentSamplePtr->SampleData))
+                FreeBlock(Module->Allocator, CurrentSamplePtr->SampleData, XM7_ALLOC_SAMPLE_DATA);
 
             // remove sample info
-            free(CurrentSamplePtr);
+            FreeBlock(Module->Allocator, CurrentSamplePtr, XM7_ALLOC_SAMPLE);
         }
 
         // remove instrument
-        free(CurrentInstrumentPtr);
+        FreeBlock(Module->Allocator, CurrentInstrumentPtr, XM7_ALLOC_INSTRUMENT);
     }
 
-    // remove patterns
+    // remove patterns (the ones that were loaded)
     for (i = (Module->NumberofPatterns - 1); i >= 0; i--)
-        free(Module->Pattern[i]);
+    {
+        if (Module->Pattern[i] != NULL)
+            FreeBlock(Module->Allocator, Module->Pattern[i], XM7_ALLOC_PATTERN);
+    }
+
+    // remove the file of a module loaded in place
+    if ((Module->File != NULL) && Module->FileOwned)
+        FreeBlock(Module->Allocator, Module->File, XM7_ALLOC_FILE);
+
+    Module->File = NULL;
 
     // set State
     Module->State = XM7_STATE_EMPTY;
@@ -1014,3 +3205,234 @@ void XM7_SetPanningStyle(XM7_ModuleManager_Type *Module, XM7_PanningStyles style
     Module->AmigaPanningEmulation = style;
     Module->AmigaPanningDisplacement = displacement;
 }
+
+// the blocks of a module loaded into an arena only have the alignment padding
+static u32 BlockSize(const XM7_ModuleManager_Type *Module, u32 size)
+{
+    if (Module->Arena != NULL)
+        return ArenaBlockSize(size);
+
+    return HeapBlockSize(size);
+}
+
+static u32 PatternSize(const XM7_ModuleManager_Type *Module, u8 pattern)
+{
+    return sizeof(XM7_SingleNote_Type) * Module->PatternLength[pattern] * Module->NumberofChannels;
+}
+
+// accounts one allocation
+static void AddBlock(const XM7_ModuleManager_Type *Module, XM7_MemoryUsage_Type *usage,
+                     u32 *category, u32 size)
+{
+    *category += size;
+    usage->AllocatorOverhead += BlockSize(Module, size) - size;
+
+    if (Module->Arena == NULL)
+        usage->Allocations++;
+}
+
+// returns how much of the sample data is in the file of a module loaded in place
+static u32 AddInstrument(const XM7_ModuleManager_Type *Module, XM7_MemoryUsage_Type *usage,
+                         const XM7_Instrument_Type *instr)
+{
+    u32 infile = 0;
+
+    AddBlock(Module, usage, &usage->Instruments, sizeof(XM7_Instrument_Type));
+
+    for (int i = 0; i < instr->NumberofSamples; i++)
+    {
+        const XM7_Sample_Type *smp = instr->Sample[i];
+
+        AddBlock(Module, usage, &usage->SampleHeaders, sizeof(XM7_Sample_Type));
+
+        if (InFile(Module, smp->SampleData))
+        {
+            // the data in a resident file doesn't belong to the module
+            if (Module->FileOwned)
+            {
+                usage->SampleData += smp->Length;
+                infile += smp->Length;
+            }
+        }
+        else
+        {
+            AddBlock(Module, usage, &usage->SampleData, smp->Length);
+        }
+
+        // the loop got doubled to unroll it
+        if (smp->Flags & 0x08)
+            usage->PingPongUnroll += smp->LoopLength / 2;
+    }
+
+    return infile;
+}
+
+void XM7_GetMemoryUsage(const XM7_ModuleManager_Type *Module, XM7_MemoryUsage_Type *usage)
+{
+    memset(usage, 0, sizeof(XM7_MemoryUsage_Type));
+
+    for (int i = 0; i < Module->NumberofPatterns; i++)
+    {
+        if (Module->Pattern[i] != NULL)
+            AddBlock(Module, usage, &usage->Patterns, PatternSize(Module, i));
+    }
+
+    u32 infile = 0;
+
+    for (int i = 0; i < Module->NumberofInstruments; i++)
+    {
+        if (Module->Instrument[i] != NULL)
+            infile += AddInstrument(Module, usage, Module->Instrument[i]);
+    }
+
+    // the file kept by a module loaded in place is a single heap block, with
+    // some of the sample data in it
+    if ((Module->File != NULL) && Module->FileOwned)
+    {
+        usage->File = Module->FileSize - infile;
+        usage->AllocatorOverhead += HeapBlockSize(Module->FileSize) - Module->FileSize;
+        usage->Allocations++;
+    }
+
+    // the arena itself is a single heap block, if the loader allocated it
+    if ((Module->Arena != NULL) && Module->ArenaOwned)
+    {
+        usage->AllocatorOverhead += HeapBlockSize(Module->ArenaSize) - Module->ArenaSize;
+        usage->Allocations = 1;
+    }
+
+    usage->Total = usage->Patterns + usage->Instruments + usage->SampleHeaders
+                 + usage->SampleData + usage->File + usage->AllocatorOverhead;
+}
+
+u32 XM7_GetPatternMemoryUsage(const XM7_ModuleManager_Type *Module, u8 pattern)
+{
+    if ((pattern >= Module->NumberofPatterns) || (Module->Pattern[pattern] == NULL))
+        return 0;
+
+    return BlockSize(Module, PatternSize(Module, pattern));
+}
+
+u32 XM7_GetInstrumentMemoryUsage(const XM7_ModuleManager_Type *Module, u8 instrument)
+{
+    if ((instrument >= Module->NumberofInstruments) || (Module->Instrument[instrument] == NULL))
+        return 0;
+
+    XM7_MemoryUsage_Type usage;
+    memset(&usage, 0, sizeof(usage));
+
+    AddInstrument(Module, &usage, Module->Instrument[instrument]);
+
+    return usage.Instruments + usage.SampleHeaders + usage.SampleData + usage.AllocatorOverhead;
+}
+
+// the records are written by the ARM7, so on the DS they are read through the
+// uncached mirror of main RAM
+#ifdef __NDS__
+#define UNCACHED(p) ((__typeof__(p))memUncached((void *)(p)))
+#else
+#define UNCACHED(p) (p)
+#endif
+
+static u32 TracepointsWritten(const XM7_Tracepoints_Type *tracepoints)
+{
+#ifdef __NDS__
+    return tracepoints->Written;
+#else
+    // on host builds the engine can be running on another thread
+    return __atomic_load_n(&tracepoints->Written, __ATOMIC_ACQUIRE);
+#endif
+}
+
+u32 XM7_ReadTracepoints(const XM7_Tracepoints_Type *tracepoints, u32 *next,
+                        XM7_TracepointRecord_Type *records, u32 max, u32 *lost)
+{
+    tracepoints = UNCACHED(tracepoints);
+
+    const XM7_TracepointRecord_Type *ring = UNCACHED(tracepoints->Records);
+    u32 mask = tracepoints->Capacity - 1;
+
+    u32 written = TracepointsWritten(tracepoints);
+    u32 first = *next;
+    u32 skipped = 0;
+
+    // the oldest records have been overwritten already
+    if (written - first > mask + 1)
+    {
+        skipped = written - (mask + 1) - first;
+        first = written - (mask + 1);
+    }
+
+    u32 count = written - first;
+    if (count > max)
+        count = max;
+
+    for (u32 i = 0; i < count; i++)
+        records[i] = ring[(first + i) & mask];
+
+    // the engine may have overwritten some of them in the meantime, including
+    // the one that it could be writing right now
+    u32 unsafe = TracepointsWritten(tracepoints) + 1 - (mask + 1) - first;
+    if ((s32)unsafe > 0)
+    {
+        if (unsafe > count)
+            unsafe = count;
+
+        memmove(records, records + unsafe, (count - unsafe) * sizeof(*records));
+        count -= unsafe;
+        skipped += unsafe;
+        first += unsafe;
+    }
+
+    *next = first + count;
+
+    if (lost != NULL)
+        *lost = skipped;
+
+    return count;
+}
+
+static u32 EffectStatsSequence(const XM7_EffectStats_Type *stats)
+{
+#ifdef __NDS__
+    return stats->Sequence;
+#else
+    return __atomic_load_n(&stats->Sequence, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void XM7_SnapshotEffectStats(const XM7_EffectStats_Type *stats,
+                             XM7_EffectStats_Type *snapshot)
+{
+    stats = UNCACHED(stats);
+
+    // retry until the copy doesn't overlap with a tick
+    for (;;)
+    {
+        u32 sequence = EffectStatsSequence(stats);
+        if (sequence & 1)
+            continue;
+
+        memcpy(snapshot, (const void *)stats, sizeof(XM7_EffectStats_Type));
+
+#ifndef __NDS__
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+        if (EffectStatsSequence(stats) == sequence)
+            break;
+    }
+
+    // a reset that the engine hasn't done yet
+    if (snapshot->Resets != snapshot->ResetRequests)
+    {
+        memset(&snapshot->Ticks, 0,
+               sizeof(XM7_EffectStats_Type) - offsetof(XM7_EffectStats_Type, Ticks));
+        snapshot->Resets = snapshot->ResetRequests;
+    }
+}
+
+void XM7_ResetEffectStats(XM7_EffectStats_Type *stats)
+{
+    stats = UNCACHED(stats);
+    stats->ResetRequests++;
+}
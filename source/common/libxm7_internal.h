@@ -9,7 +9,7 @@
 extern "C" {
 #endif
 
-#include <nds/ndstypes.h>
+#include <libxm7.h>
 
 // Status bits defines:
 #define XM7_STATE_EMPTY                         0x0000
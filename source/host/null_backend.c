@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <stddef.h>
+
+#include <libxm7_host.h>
+
+static void NullStopSound(void *context, u8 channel)
+{
+    (void)context;
+    (void)channel;
+}
+
+static void NullStartSound(void *context, u8 channel, u32 cnt, const void *sad,
+                           u16 tmr, u16 pnt, u32 len)
+{
+    (void)context;
+    (void)channel;
+    (void)cnt;
+    (void)sad;
+    (void)tmr;
+    (void)pnt;
+    (void)len;
+}
+
+static void NullSetVolumeandPanning(void *context, u8 channel, u8 vol, u8 pan)
+{
+    (void)context;
+    (void)channel;
+    (void)vol;
+    (void)pan;
+}
+
+static void NullPitchSound(void *context, u8 channel, u16 tmr)
+{
+    (void)context;
+    (void)channel;
+    (void)tmr;
+}
+
+static void NullChangeSample(void *context, u8 channel, const void *sad, u16 pnt, u32 len)
+{
+    (void)context;
+    (void)channel;
+    (void)sad;
+    (void)pnt;
+    (void)len;
+}
+
+static void NullSetTimer(void *context, u16 period, void (*handler)(void))
+{
+    XM7_NullBackend_Type *nb = context;
+
+    // the only thing worth remembering
+    nb->TimerPeriod = period;
+    nb->TimerHandler = handler;
+}
+
+void XM7_NullBackend_Init(XM7_NullBackend_Type *nb)
+{
+    nb->Backend.Context = nb;
+    nb->Backend.StopSound = NullStopSound;
+    nb->Backend.StartSound = NullStartSound;
+    nb->Backend.SetVolumeandPanning = NullSetVolumeandPanning;
+    nb->Backend.PitchSound = NullPitchSound;
+    nb->Backend.ChangeSample = NullChangeSample;
+    nb->Backend.SetTimer = NullSetTimer;
+
+    nb->TimerPeriod = 0;
+    nb->TimerHandler = NULL;
+}
@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SOUNDUNIT_X86
+#endif
+
+#include <libxm7_host.h>
+
+// channels are mixed in blocks of this many frames
+#define MIX_BLOCK_FRAMES    256
+
+// functions used by the mixer, picked at runtime depending on the CPU
+typedef void (*MixChannelFn)(s32 *accl, s32 *accr, const s16 *smp, u32 frames, s16 voll, s16 volr);
+typedef void (*PackOutputFn)(s16 *out, const s32 *accl, const s32 *accr, u32 frames);
+
+static MixChannelFn MixChannel;
+static PackOutputFn PackOutput;
+
+// sound units can be initialized by several threads at once
+static pthread_once_t MixerOnce = PTHREAD_ONCE_INIT;
+
+// -----------------------------------------------------------------------------
+// Channel playback
+// -----------------------------------------------------------------------------
+
+static u8 IsPlaying(const XM7_SoundUnitChannel_Type *ch)
+{
+    // ADPCM and PSG aren't used by libXM7, they are played as silence
+    return (ch->Cnt & SOUNDXCNT_ENABLE) && ((ch->Cnt & SOUNDXCNT_FORMAT_PSG) <= SOUNDXCNT_FORMAT_16BIT);
+}
+
+static u32 BytesPerSample(const XM7_SoundUnitChannel_Type *ch)
+{
+    return ((ch->Cnt & SOUNDXCNT_FORMAT_PSG) == SOUNDXCNT_FORMAT_16BIT) ? 2 : 1;
+}
+
+// end of the sample, in samples (32.32 fixed point)
+static u64 SampleEnd(const XM7_SoundUnitChannel_Type *ch)
+{
+    return ((u64)(ch->LoopStart + ch->Length) * 4 / BytesPerSample(ch)) << 32;
+}
+
+// start of the loop, in samples (32.32 fixed point)
+static u64 SampleLoopStart(const XM7_SoundUnitChannel_Type *ch)
+{
+    return ((u64)ch->LoopStart * 4 / BytesPerSample(ch)) << 32;
+}
+
+static void UpdateStep(const XM7_SoundUnit_Type *su, XM7_SoundUnitChannel_Type *ch)
+{
+    // the channel timer counts up from REG_SOUNDXTMR at XM7_SOUND_CLOCK and
+    // moves to the next sample when it overflows
+    ch->Step = ((u64)XM7_SOUND_CLOCK << 32) / ((u64)(0x10000 - ch->Timer) * su->OutputRate);
+}
+
+// called when the position has reached the end of the sample
+static void ReachEnd(XM7_SoundUnitChannel_Type *ch)
+{
+    u64 end = SampleEnd(ch);
+
+    if (ch->HasNextSample)
+    {
+        // the new sample is played from the beginning of its loop
+        u64 over = ch->Position - end;
+
+        ch->Data = ch->NextData;
+        ch->LoopStart = ch->NextLoopStart;
+        ch->Length = ch->NextLength;
+        ch->HasNextSample = 0;
+
+        ch->Position = SampleLoopStart(ch) + over;
+        return;
+    }
+
+    u64 loopstart = SampleLoopStart(ch);
+
+    if (((ch->Cnt & SOUNDXCNT_REPEAT) == 0) || (end <= loopstart))
+    {
+        // one-shot sample (or a loop that can't be played): stop the channel
+        ch->Cnt &= ~SOUNDXCNT_ENABLE;
+        return;
+    }
+
+    ch->Position = loopstart + (ch->Position - end) % (end - loopstart);
+}
+
+// returns the number of frames that can be played before reaching the end
+static u64 FramesToEnd(const XM7_SoundUnitChannel_Type *ch)
+{
+    return (SampleEnd(ch) - ch->Position + ch->Step - 1) / ch->Step;
+}
+
+static void SkipChannel(XM7_SoundUnitChannel_Type *ch, u32 frames)
+{
+    if ((frames > 0) && IsPlaying(ch) && !ch->HasNextSample && (ch->Cnt & SOUNDXCNT_REPEAT))
+    {
+        u64 end = SampleEnd(ch);
+        u64 loopstart = SampleLoopStart(ch);
+
+        if (end > loopstart)
+        {
+            // Short loops would take many iterations below. FetchChannel()
+            // wraps the position before reading each frame, but not after the
+            // last one, so do the same here.
+            u64 last = ch->Position + ch->Step * (frames - 1);
+            if (last >= end)
+                last = loopstart + (last - end) % (end - loopstart);
+
+            ch->Position = last + ch->Step;
+            return;
+        }
+    }
+
+    while ((frames > 0) && IsPlaying(ch))
+    {
+        if (ch->Position >= SampleEnd(ch))
+        {
+            ReachEnd(ch);
+            continue;
+        }
+
+        u64 run = FramesToEnd(ch);
+        if (run > frames)
+            run = frames;
+
+        // exactly what FetchChannel() would do one frame at a time
+        ch->Position += ch->Step * run;
+        frames -= run;
+    }
+}
+
+// reads the samples the channel plays in the next frames (as 16 bit samples)
+static void FetchChannel(XM7_SoundUnitChannel_Type *ch, s16 *smp, u32 frames)
+{
+    u32 i = 0;
+
+    while (i < frames)
+    {
+        if (!IsPlaying(ch))
+        {
+            memset(&smp[i], 0, (frames - i) * sizeof(s16));
+            return;
+        }
+
+        if (ch->Position >= SampleEnd(ch))
+        {
+            ReachEnd(ch);
+            continue;
+        }
+
+        u64 run = FramesToEnd(ch);
+        if (run > frames - i)
+            run = frames - i;
+
+        u64 pos = ch->Position;
+        u64 step = ch->Step;
+
+        if (BytesPerSample(ch) == 2)
+        {
+            const s16 *data = ch->Data;
+            for (u32 j = 0; j < run; j++, pos += step)
+                smp[i++] = data[pos >> 32];
+        }
+        else
+        {
+            const s8 *data = ch->Data;
+            for (u32 j = 0; j < run; j++, pos += step)
+                smp[i++] = data[pos >> 32] * 256;
+        }
+
+        ch->Position = pos;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Mixer inner loops
+// -----------------------------------------------------------------------------
+
+// all versions give exactly the same results
+
+static void MixChannelScalar(s32 *accl, s32 *accr, const s16 *smp, u32 frames, s16 voll, s16 volr)
+{
+    for (u32 i = 0; i < frames; i++)
+    {
+        accl[i] += (smp[i] * voll) >> 7;
+        accr[i] += (smp[i] * volr) >> 7;
+    }
+}
+
+static s16 Saturate(s32 value)
+{
+    if (value > 32767)
+        return 32767;
+    if (value < -32768)
+        return -32768;
+    return value;
+}
+
+static void PackOutputScalar(s16 *out, const s32 *accl, const s32 *accr, u32 frames)
+{
+    for (u32 i = 0; i < frames; i++)
+    {
+        out[i * 2] = Saturate(accl[i] >> 7);
+        out[i * 2 + 1] = Saturate(accr[i] >> 7);
+    }
+}
+
+#ifdef SOUNDUNIT_X86
+
+__attribute__((target("sse2")))
+static void MixChannelSSE2(s32 *accl, s32 *accr, const s16 *smp, u32 frames, s16 voll, s16 volr)
+{
+    const __m128i vl = _mm_set1_epi16(voll);
+    const __m128i vr = _mm_set1_epi16(volr);
+    u32 i = 0;
+
+    for ( ; i + 8 <= frames; i += 8)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)&smp[i]);
+
+        // 16x16 -> 32 bit products from the low and high halves
+        __m128i lo = _mm_mullo_epi16(s, vl);
+        __m128i hi = _mm_mulhi_epi16(s, vl);
+        __m128i l0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 7);
+        __m128i l1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 7);
+
+        lo = _mm_mullo_epi16(s, vr);
+        hi = _mm_mulhi_epi16(s, vr);
+        __m128i r0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 7);
+        __m128i r1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 7);
+
+        __m128i *al = (__m128i *)&accl[i];
+        __m128i *ar = (__m128i *)&accr[i];
+        _mm_storeu_si128(al, _mm_add_epi32(_mm_loadu_si128(al), l0));
+        _mm_storeu_si128(al + 1, _mm_add_epi32(_mm_loadu_si128(al + 1), l1));
+        _mm_storeu_si128(ar, _mm_add_epi32(_mm_loadu_si128(ar), r0));
+        _mm_storeu_si128(ar + 1, _mm_add_epi32(_mm_loadu_si128(ar + 1), r1));
+    }
+
+    MixChannelScalar(&accl[i], &accr[i], &smp[i], frames - i, voll, volr);
+}
+
+__attribute__((target("sse2")))
+static void PackOutputSSE2(s16 *out, const s32 *accl, const s32 *accr, u32 frames)
+{
+    u32 i = 0;
+
+    for ( ; i + 8 <= frames; i += 8)
+    {
+        const __m128i *al = (const __m128i *)&accl[i];
+        const __m128i *ar = (const __m128i *)&accr[i];
+
+        // saturate to 16 bit, then interleave left and right
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128(al), 7),
+                                    _mm_srai_epi32(_mm_loadu_si128(al + 1), 7));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128(ar), 7),
+                                    _mm_srai_epi32(_mm_loadu_si128(ar + 1), 7));
+
+        _mm_storeu_si128((__m128i *)&out[i * 2], _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i *)&out[i * 2 + 8], _mm_unpackhi_epi16(l, r));
+    }
+
+    PackOutputScalar(&out[i * 2], &accl[i], &accr[i], frames - i);
+}
+
+__attribute__((target("avx2")))
+static void MixChannelAVX2(s32 *accl, s32 *accr, const s16 *smp, u32 frames, s16 voll, s16 volr)
+{
+    const __m256i vl = _mm256_set1_epi32(voll);
+    const __m256i vr = _mm256_set1_epi32(volr);
+    u32 i = 0;
+
+    for ( ; i + 8 <= frames; i += 8)
+    {
+        __m256i s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&smp[i]));
+
+        __m256i *al = (__m256i *)&accl[i];
+        __m256i *ar = (__m256i *)&accr[i];
+        _mm256_storeu_si256(al, _mm256_add_epi32(_mm256_loadu_si256(al),
+                                                 _mm256_srai_epi32(_mm256_mullo_epi32(s, vl), 7)));
+        _mm256_storeu_si256(ar, _mm256_add_epi32(_mm256_loadu_si256(ar),
+                                                 _mm256_srai_epi32(_mm256_mullo_epi32(s, vr), 7)));
+    }
+
+    MixChannelScalar(&accl[i], &accr[i], &smp[i], frames - i, voll, volr);
+}
+
+__attribute__((target("avx2")))
+static void PackOutputAVX2(s16 *out, const s32 *accl, const s32 *accr, u32 frames)
+{
+    u32 i = 0;
+
+    for ( ; i + 16 <= frames; i += 16)
+    {
+        const __m256i *al = (const __m256i *)&accl[i];
+        const __m256i *ar = (const __m256i *)&accr[i];
+
+        // packs and unpacks work on each 128 bit lane: after packing, lane 0
+        // has frames 0-3 and 8-11 and lane 1 has frames 4-7 and 12-15, so the
+        // unpacks leave the frames in order
+        __m256i l = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_loadu_si256(al), 7),
+                                       _mm256_srai_epi32(_mm256_loadu_si256(al + 1), 7));
+        __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_loadu_si256(ar), 7),
+                                       _mm256_srai_epi32(_mm256_loadu_si256(ar + 1), 7));
+        _mm256_storeu_si256((__m256i *)&out[i * 2], _mm256_unpacklo_epi16(l, r)); // 0-7
+        _mm256_storeu_si256((__m256i *)&out[i * 2 + 16], _mm256_unpackhi_epi16(l, r)); // 8-15
+    }
+
+    PackOutputSSE2(&out[i * 2], &accl[i], &accr[i], frames - i);
+}
+
+#endif // SOUNDUNIT_X86
+
+static void SelectMixer(void)
+{
+    MixChannel = MixChannelScalar;
+    PackOutput = PackOutputScalar;
+
+#ifdef SOUNDUNIT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        MixChannel = MixChannelAVX2;
+        PackOutput = PackOutputAVX2;
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        MixChannel = MixChannelSSE2;
+        PackOutput = PackOutputSSE2;
+    }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Backend operations
+// -----------------------------------------------------------------------------
+
+static void SoundUnitStopSound(void *context, u8 channel)
+{
+    XM7_SoundUnit_Type *su = context;
+    XM7_SoundUnitChannel_Type *ch = &su->Channel[channel];
+
+    ch->Cnt = 0;
+    ch->HasNextSample = 0;
+}
+
+static void SoundUnitStartSound(void *context, u8 channel, u32 cnt, const void *sad,
+                                u16 tmr, u16 pnt, u32 len)
+{
+    XM7_SoundUnit_Type *su = context;
+    XM7_SoundUnitChannel_Type *ch = &su->Channel[channel];
+
+    ch->Data = sad;
+    ch->Timer = tmr;
+    ch->LoopStart = pnt;
+    ch->Length = len;
+    ch->Cnt = cnt;
+    ch->HasNextSample = 0;
+    ch->Position = 0;
+
+    UpdateStep(su, ch);
+}
+
+static void SoundUnitSetVolumeandPanning(void *context, u8 channel, u8 vol, u8 pan)
+{
+    XM7_SoundUnit_Type *su = context;
+    XM7_SoundUnitChannel_Type *ch = &su->Channel[channel];
+
+    ch->Cnt = (ch->Cnt & ~(SOUNDXCNT_PAN(0xFF) | SOUNDXCNT_VOL_MUL(0xFF)))
+            | SOUNDXCNT_PAN(pan) | SOUNDXCNT_VOL_MUL(vol);
+}
+
+static void SoundUnitPitchSound(void *context, u8 channel, u16 tmr)
+{
+    XM7_SoundUnit_Type *su = context;
+    XM7_SoundUnitChannel_Type *ch = &su->Channel[channel];
+
+    ch->Timer = tmr;
+    UpdateStep(su, ch);
+}
+
+static void SoundUnitChangeSample(void *context, u8 channel, const void *sad, u16 pnt, u32 len)
+{
+    XM7_SoundUnit_Type *su = context;
+    XM7_SoundUnitChannel_Type *ch = &su->Channel[channel];
+
+    if (IsPlaying(ch))
+    {
+        // the current sample keeps playing until it reaches its end
+        ch->NextData = sad;
+        ch->NextLoopStart = pnt;
+        ch->NextLength = len;
+        ch->HasNextSample = 1;
+    }
+    else
+    {
+        ch->Data = sad;
+        ch->LoopStart = pnt;
+        ch->Length = len;
+    }
+}
+
+static void SoundUnitSetTimer(void *context, u16 period, void (*handler)(void))
+{
+    XM7_SoundUnit_Type *su = context;
+
+    su->TimerPeriod = period;
+    su->TimerHandler = handler;
+
+    if (period == 0)
+        su->TimerRemainder = 0;
+}
+
+// -----------------------------------------------------------------------------
+// Public functions
+// -----------------------------------------------------------------------------
+
+void XM7_SoundUnit_Init(XM7_SoundUnit_Type *su, u32 rate)
+{
+    pthread_once(&MixerOnce, SelectMixer);
+
+    memset(su, 0, sizeof(XM7_SoundUnit_Type));
+
+    su->Backend.Context = su;
+    su->Backend.StopSound = SoundUnitStopSound;
+    su->Backend.StartSound = SoundUnitStartSound;
+    su->Backend.SetVolumeandPanning = SoundUnitSetVolumeandPanning;
+    su->Backend.PitchSound = SoundUnitPitchSound;
+    su->Backend.ChangeSample = SoundUnitChangeSample;
+    su->Backend.SetTimer = SoundUnitSetTimer;
+
+    su->OutputRate = rate;
+    su->MasterVolume = 127;
+}
+
+void XM7_SoundUnit_Mix(XM7_SoundUnit_Type *su, s16 *out, u32 frames)
+{
+    _Alignas(32) s32 accl[MIX_BLOCK_FRAMES];
+    _Alignas(32) s32 accr[MIX_BLOCK_FRAMES];
+    _Alignas(32) s16 smp[MIX_BLOCK_FRAMES];
+
+    while (frames > 0)
+    {
+        u32 block = (frames > MIX_BLOCK_FRAMES) ? MIX_BLOCK_FRAMES : frames;
+
+        memset(accl, 0, block * sizeof(s32));
+        memset(accr, 0, block * sizeof(s32));
+
+        for (int i = 0; i < 16; i++)
+        {
+            XM7_SoundUnitChannel_Type *ch = &su->Channel[i];
+
+            if (!IsPlaying(ch))
+                continue;
+
+            u32 vol = ch->Cnt & 0x7F;
+            u32 pan = (ch->Cnt >> 16) & 0x7F;
+            u32 div = (ch->Cnt >> 8) & 0x03;
+
+            // the volume divider is 1, 2, 4 or 16
+            u32 shift = (div == 3) ? 4 : div;
+            s16 voll = ((vol * (128 - pan) * su->MasterVolume) >> 7) >> shift;
+            s16 volr = ((vol * pan * su->MasterVolume) >> 7) >> shift;
+
+            if ((voll == 0) && (volr == 0))
+            {
+                // silent channels only need to move forward
+                SkipChannel(ch, block);
+                continue;
+            }
+
+            FetchChannel(ch, smp, block);
+            MixChannel(accl, accr, smp, block, voll, volr);
+        }
+
+        PackOutput(out, accl, accr, block);
+
+        out += block * 2;
+        frames -= block;
+    }
+}
+
+void XM7_SoundUnit_Skip(XM7_SoundUnit_Type *su, u32 frames)
+{
+    for (int i = 0; i < 16; i++)
+        SkipChannel(&su->Channel[i], frames);
+}
+
+u32 XM7_SoundUnit_TickFrames(XM7_SoundUnit_Type *su)
+{
+    if (su->TimerPeriod == 0)
+        return 0;
+
+    // timer 0 runs at XM7_BUS_CLOCK / 1024
+    u64 total = (u64)su->TimerPeriod * 1024 * su->OutputRate + su->TimerRemainder;
+
+    su->TimerRemainder = total % XM7_BUS_CLOCK;
+    return total / XM7_BUS_CLOCK;
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7_host.h>
+
+void XM7_TraceReplay_Init(XM7_TraceReplay_Type *rp, const XM7_Backend_Type *backend,
+                          const XM7_TraceRecord_Type *records, u32 count)
+{
+    memset(rp, 0, sizeof(XM7_TraceReplay_Type));
+
+    rp->Backend = backend;
+    rp->Records = records;
+    rp->Count = count;
+}
+
+// biggest sample the registers can describe: PNT is 16 bit and LEN is 22 bit,
+// both in words
+#define MAX_SAMPLE_SIZE     ((0x10000 + 0x400000) * 4)
+
+static const void *SampleAddress(XM7_TraceReplay_Type *rp, const XM7_TraceChannel_Type *ch)
+{
+    if (rp->ResolveAddress != NULL)
+    {
+        u64 address = ((u64)ch->SadHigh << 32) | ch->Sad;
+        const void *data = rp->ResolveAddress(rp->ResolveContext, address, ((u32)ch->Pnt + ch->Len) * 4);
+        if (data != NULL)
+            return data;
+    }
+
+    // The backend may keep using the buffer until the end of the replay, so it
+    // can't be resized. It's big, but the OS only gives it pages when they are
+    // read.
+    if (rp->Silence == NULL)
+        rp->Silence = calloc(1, MAX_SAMPLE_SIZE);
+
+    return rp->Silence;
+}
+
+static void Replay(XM7_TraceReplay_Type *rp, const XM7_TraceRecord_Type *rec)
+{
+    const XM7_Backend_Type *be = rp->Backend;
+
+    if (rec->Register == XM7_TRACE_REG_TIMER0)
+    {
+        // the replay is driven by the trace, there's no handler to call
+        be->SetTimer(be->Context, rec->Value, NULL);
+        return;
+    }
+
+    if (rec->Channel > 15)
+        return;
+
+    XM7_TraceChannel_Type *ch = &rp->Channel[rec->Channel];
+    u8 playing = (ch->Cnt & SOUNDXCNT_ENABLE) != 0;
+
+    switch (rec->Register)
+    {
+        case XM7_TRACE_REG_CNT:
+            ch->Cnt = rec->Value;
+            ch->Vol = ch->Cnt & 0x7F;
+            ch->Pan = (ch->Cnt >> 16) & 0x7F;
+
+            if (ch->Cnt & SOUNDXCNT_ENABLE)
+            {
+                const void *sad = SampleAddress(rp, ch);
+                if (sad != NULL)
+                    be->StartSound(be->Context, rec->Channel, ch->Cnt, sad, ch->Tmr, ch->Pnt, ch->Len);
+            }
+            else
+            {
+                be->StopSound(be->Context, rec->Channel);
+            }
+            break;
+
+        case XM7_TRACE_REG_SAD:
+            ch->Sad = rec->Value;
+            break;
+
+        case XM7_TRACE_REG_SADHIGH:
+            ch->SadHigh = rec->Value;
+            break;
+
+        case XM7_TRACE_REG_TMR:
+            ch->Tmr = rec->Value;
+            if (playing)
+                be->PitchSound(be->Context, rec->Channel, ch->Tmr);
+            break;
+
+        case XM7_TRACE_REG_PNT:
+            ch->Pnt = rec->Value;
+            break;
+
+        case XM7_TRACE_REG_LEN:
+            // the engine always writes SAD, PNT and LEN in this order
+            ch->Len = rec->Value;
+            if (playing)
+            {
+                const void *sad = SampleAddress(rp, ch);
+                if (sad != NULL)
+                    be->ChangeSample(be->Context, rec->Channel, sad, ch->Pnt, ch->Len);
+            }
+            break;
+
+        case XM7_TRACE_REG_VOL:
+        case XM7_TRACE_REG_PAN:
+            if (rec->Register == XM7_TRACE_REG_VOL)
+                ch->Vol = rec->Value;
+            else
+                ch->Pan = rec->Value;
+
+            ch->Cnt = (ch->Cnt & ~(SOUNDXCNT_PAN(0xFF) | SOUNDXCNT_VOL_MUL(0xFF)))
+                    | SOUNDXCNT_PAN(ch->Pan) | SOUNDXCNT_VOL_MUL(ch->Vol);
+
+            // the engine always writes VOL and PAN together, do it after PAN
+            if (rec->Register == XM7_TRACE_REG_PAN)
+                be->SetVolumeandPanning(be->Context, rec->Channel, ch->Vol, ch->Pan);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void ReplayUntil(XM7_TraceReplay_Type *rp, u32 tick)
+{
+    while ((rp->Next < rp->Count) && (rp->Records[rp->Next].Tick <= tick))
+    {
+        Replay(rp, &rp->Records[rp->Next]);
+        rp->Next++;
+    }
+}
+
+u32 XM7_TraceReplay_Tick(XM7_TraceReplay_Type *rp)
+{
+    if (rp->Next >= rp->Count)
+        return 0;
+
+    if (rp->Next == 0)
+    {
+        // the trace may start anywhere if the ring buffer was full
+        rp->Tick = rp->Records[0].Tick;
+
+        // the writes made before the first tick go with it
+        if (rp->Tick == 0)
+        {
+            ReplayUntil(rp, 0);
+            rp->Tick = 1;
+        }
+    }
+    else
+    {
+        // ticks without writes are replayed too, they just do nothing
+        rp->Tick++;
+    }
+
+    ReplayUntil(rp, rp->Tick);
+
+    return rp->Tick;
+}
+
+void XM7_TraceReplay_Free(XM7_TraceReplay_Type *rp)
+{
+    free(rp->Silence);
+    rp->Silence = NULL;
+}
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "file_list.h"
+
+void FileList_Init(FileList *list)
+{
+    memset(list, 0, sizeof(FileList));
+}
+
+static int IsModuleName(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL)
+        return 0;
+
+    return (strcasecmp(ext, ".xm") == 0) || (strcasecmp(ext, ".mod") == 0);
+}
+
+static int Append(FileList *list, const char *path, size_t size)
+{
+    if (list->Count == list->Capacity)
+    {
+        size_t capacity = (list->Capacity > 0) ? list->Capacity * 2 : 64;
+
+        char **newpath = realloc(list->Path, capacity * sizeof(char *));
+        if (newpath == NULL)
+            return -1;
+        list->Path = newpath;
+
+        size_t *newsize = realloc(list->Size, capacity * sizeof(size_t));
+        if (newsize == NULL)
+            return -1;
+        list->Size = newsize;
+
+        list->Capacity = capacity;
+    }
+
+    list->Path[list->Count] = strdup(path);
+    if (list->Path[list->Count] == NULL)
+        return -1;
+
+    list->Size[list->Count] = size;
+    list->Count++;
+
+    return 0;
+}
+
+static int AddDirectory(FileList *list, const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+
+    int ret = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        size_t len = strlen(path) + strlen(entry->d_name) + 2;
+        char *child = malloc(len);
+        if (child == NULL)
+        {
+            ret = -1;
+            break;
+        }
+        snprintf(child, len, "%s/%s", path, entry->d_name);
+
+        struct stat st;
+        if (stat(child, &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+                ret = AddDirectory(list, child);
+            else if (S_ISREG(st.st_mode) && IsModuleName(entry->d_name))
+                ret = Append(list, child, st.st_size);
+        }
+
+        free(child);
+
+        if (ret != 0)
+            break;
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+int FileList_Add(FileList *list, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return -1;
+
+    if (S_ISDIR(st.st_mode))
+        return AddDirectory(list, path);
+
+    // files given explicitly are added whatever their name is
+    return Append(list, path, st.st_size);
+}
+
+void FileList_Free(FileList *list)
+{
+    for (size_t i = 0; i < list->Count; i++)
+        free(list->Path[i]);
+
+    free(list->Path);
+    free(list->Size);
+
+    memset(list, 0, sizeof(FileList));
+}
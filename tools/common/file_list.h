@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_FILE_LIST_H__
+#define TOOLS_FILE_LIST_H__
+
+#include <stddef.h>
+
+// List of module files, with their sizes
+typedef struct {
+    char **Path;
+    size_t *Size;
+    size_t Count;
+    size_t Capacity;
+} FileList;
+
+void FileList_Init(FileList *list);
+
+// Adds a file, or all the .xm and .mod files found in a directory and its
+// subdirectories. Returns 0 on success, -1 if the path can't be read.
+int FileList_Add(FileList *list, const char *path);
+
+void FileList_Free(FileList *list);
+
+#endif // TOOLS_FILE_LIST_H__
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "libxm7_internal.h"
+#include "module_file.h"
+
+// biggest file that is read, far more than any module needs
+#define MAX_FILE_SIZE   (256 * 1024 * 1024)
+
+void *ModuleFile_ReadData(const char *path, size_t *size)
+{
+    // only regular files have a size (opening a pipe would even wait for
+    // someone to write to it), and it must not be bigger than a module could be
+    struct stat st;
+    if ((stat(path, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size > MAX_FILE_SIZE))
+        return NULL;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+
+    long filesize = st.st_size;
+
+    // the loaders don't know the size of the file, so add some padding in
+    // case the file is truncated
+    void *data = (filesize > 0) ? calloc(1, filesize + 4096) : NULL;
+    if (data == NULL)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    if (fread(data, 1, filesize, f) != (size_t)filesize)
+    {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+
+    fclose(f);
+
+    *size = filesize;
+    return data;
+}
+
+int ModuleFile_Load(ModuleFile *mf, const char *path)
+{
+    memset(mf, 0, sizeof(ModuleFile));
+
+    size_t size;
+    void *data = ModuleFile_ReadData(path, &size);
+    if (data == NULL)
+        return -1;
+
+    return ModuleFile_LoadData(mf, data, size);
+}
+
+int ModuleFile_LoadData(ModuleFile *mf, void *data, size_t size)
+{
+    mf->Data = data;
+    mf->Size = size;
+
+    return ModuleFile_LoadModule(&mf->Module, data);
+}
+
+int ModuleFile_LoadModule(XM7_ModuleManager_Type *module, const void *data)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    int ret = XM7_LoadXM(module, data);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+    {
+        // not an XM, let's see if it's a MOD
+        ret = XM7_LoadMOD(module, data);
+    }
+
+    return ret;
+}
+
+int ModuleFile_LoadModuleSelection(XM7_ModuleManager_Type *module, const void *data,
+                                   const XM7_Selection_Type *selection)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    int ret = XM7_LoadXMSelection(module, data, selection);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+        ret = XM7_LoadMODSelection(module, data, selection);
+
+    return ret;
+}
+
+int ModuleFile_LoadModuleInPlace(XM7_ModuleManager_Type *module, void *data, size_t size)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    // the buffer isn't touched when the file isn't an XM
+    int ret = XM7_LoadXMInPlace(module, data, size);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+        ret = XM7_LoadMODInPlace(module, data, size);
+
+    return ret;
+}
+
+void ModuleFile_UnloadModule(XM7_ModuleManager_Type *module)
+{
+    u16 state = module->State;
+
+    // the module has to be unloaded even after some errors
+    if (state & XM7_STATE_ERROR)
+    {
+        if ((state & ~XM7_STATE_ERROR) > 0x07)
+            XM7_UnloadXM(module);
+    }
+    else if (state & XM7_STATE_READY)
+    {
+        XM7_UnloadXM(module);
+    }
+}
+
+void ModuleFile_Free(ModuleFile *mf)
+{
+    ModuleFile_UnloadModule(&mf->Module);
+
+    free(mf->Data);
+    mf->Data = NULL;
+}
+
+unsigned long long TimeNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
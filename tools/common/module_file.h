@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_MODULE_FILE_H__
+#define TOOLS_MODULE_FILE_H__
+
+#include <stddef.h>
+
+#include <libxm7.h>
+
+// A module file loaded in RAM and the module loaded from it
+typedef struct {
+    void *Data;
+    size_t Size;
+    XM7_ModuleManager_Type Module;
+} ModuleFile;
+
+// Reads the whole file in RAM and loads it as XM or, if it isn't an XM, as
+// MOD. Returns the libXM7 error code, or -1 if the file can't be read. The
+// module and the file data are freed by ModuleFile_Free() in all cases.
+int ModuleFile_Load(ModuleFile *mf, const char *path);
+
+// Same as ModuleFile_Load(), but the module is in a buffer allocated with
+// malloc() with some zeroed padding at the end. The buffer is then owned by
+// the ModuleFile.
+int ModuleFile_LoadData(ModuleFile *mf, void *data, size_t size);
+
+void ModuleFile_Free(ModuleFile *mf);
+
+// Reads a whole file in a buffer allocated with malloc(), with some zeroed
+// padding at the end. Returns NULL on error.
+void *ModuleFile_ReadData(const char *path, size_t *size);
+
+// Loads a module from a file in RAM (as XM or MOD), and unloads it. The module
+// has to be unloaded after errors too.
+int ModuleFile_LoadModule(XM7_ModuleManager_Type *module, const void *data);
+void ModuleFile_UnloadModule(XM7_ModuleManager_Type *module);
+
+// Same as ModuleFile_LoadModule(), but only the selected parts of the module
+// are loaded (see XM7_LoadXMSelection())
+int ModuleFile_LoadModuleSelection(XM7_ModuleManager_Type *module, const void *data,
+                                   const XM7_Selection_Type *selection);
+
+// Same as ModuleFile_LoadModule(), but with XM7_LoadXMInPlace(): the module
+// takes the buffer, unless module->File is NULL after the load.
+int ModuleFile_LoadModuleInPlace(XM7_ModuleManager_Type *module, void *data, size_t size);
+
+// Returns the current value of the monotonic clock in nanoseconds
+unsigned long long TimeNowNs(void);
+
+#endif // TOOLS_MODULE_FILE_H__
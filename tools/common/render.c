@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <string.h>
+
+#include "render.h"
+
+static int InPatternLoop(const XM7_ModuleManager_Type *module)
+{
+    // the loop counters are only non-zero while E6x is repeating rows
+    for (int i = 0; i < 16; i++)
+    {
+        if (module->CurrentLoopCounter[i] != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+void Renderer_Start(Renderer *r, XM7_ModuleManager_Type *module, u32 rate)
+{
+    memset(r, 0, sizeof(Renderer));
+
+    r->Module = module;
+
+    XM7_SoundUnit_Init(&r->Unit, rate);
+    XM7_SetBackend(&r->Unit.Backend);
+
+    // the length of each tick comes from the period of the emulated timer 0
+    XM7_Initialize();
+    XM7_SetTimerMode(XM7_TIMER_MODE_TIMER0);
+    XM7_PlayModule(module);
+}
+
+u32 Renderer_Tick(Renderer *r)
+{
+    XM7_ModuleManager_Type *module = r->Module;
+
+    if (r->Ended || (r->Unit.TimerHandler == NULL))
+        return 0;
+
+    // check the row when the engine is about to start it
+    if ((module->CurrentTick == 0) && (module->CurrentAdditionalTick == 0) &&
+        !InPatternLoop(module))
+    {
+        u8 pos = module->CurrentSongPosition;
+        u8 line = module->CurrentLine;
+        u8 bit = 1 << (line & 7);
+
+        if (r->VisitedRows[pos][line / 8] & bit)
+        {
+            r->Ended = 1;
+            r->EndPosition = pos;
+            r->EndLine = line;
+            return 0;
+        }
+
+        r->VisitedRows[pos][line / 8] |= bit;
+    }
+
+    XM7_Tick();
+
+    u32 frames = XM7_SoundUnit_TickFrames(&r->Unit);
+
+    r->Ticks++;
+    r->Frames += frames;
+
+    return frames;
+}
+
+void Renderer_Stop(Renderer *r)
+{
+    // this also stops the timer, so Renderer_Tick() won't run the engine again
+    XM7_StopModule();
+    (void)r;
+}
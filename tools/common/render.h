@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_RENDER_H__
+#define TOOLS_RENDER_H__
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+// Plays a module on an emulated sound unit, one tick at a time, and detects
+// when the song ends. Modules never really end: when the last position of the
+// order list is over they restart from RestartPoint, and Bxx can jump back to
+// any position. The song is considered over as soon as it reaches a row it has
+// already played (rows repeated by pattern loops E6x don't count).
+typedef struct {
+    XM7_SoundUnit_Type Unit;
+    XM7_ModuleManager_Type *Module;
+
+    // one bit for each row of each position of the order list
+    u8 VisitedRows[256][256 / 8];
+
+    int Ended;
+    u8 EndPosition;             // position and row the song went back to
+    u8 EndLine;
+
+    unsigned long Ticks;
+    unsigned long long Frames;
+} Renderer;
+
+// Starts playing the module. It sets the sound unit as the engine backend.
+void Renderer_Start(Renderer *r, XM7_ModuleManager_Type *module, u32 rate);
+
+// Runs one tick of the engine. Returns the number of frames that have to be
+// mixed before the next tick, or 0 if the song has ended.
+u32 Renderer_Tick(Renderer *r);
+
+void Renderer_Stop(Renderer *r);
+
+#endif // TOOLS_RENDER_H__
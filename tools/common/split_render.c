@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "module_file.h"
+#include "render.h"
+#include "split_render.h"
+#include "work_queue.h"
+
+typedef struct {
+    unsigned long StartTick;
+    unsigned long EndTick;
+    unsigned long long StartFrame;
+    unsigned long long EndFrame;
+    int Error;
+} Segment;
+
+typedef struct {
+    SplitRender *Render;
+    Segment *Segments;
+    const char *Path;
+    u32 Rate;
+    pthread_mutex_t Lock;
+} SplitJob;
+
+// CPU time used by the calling thread, so that the pre-roll time is right even
+// if there are more workers than CPUs
+static unsigned long long ThreadTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void RenderSegment(void *arg, int worker, size_t job)
+{
+    SplitJob *sj = arg;
+    Segment *seg = &sj->Segments[job];
+
+    (void)worker;
+
+    ModuleFile mf;
+    seg->Error = ModuleFile_Load(&mf, sj->Path);
+
+    Renderer *r = malloc(sizeof(Renderer));
+    if ((seg->Error != 0) || (r == NULL))
+    {
+        if (seg->Error == 0)
+            seg->Error = -1;
+        free(r);
+        ModuleFile_Free(&mf);
+        return;
+    }
+
+    unsigned long long start = ThreadTimeNs();
+
+    Renderer_Start(r, &mf.Module, sj->Rate);
+
+    // silent pre-roll up to the start of the segment
+    unsigned long tick = 0;
+    for ( ; tick < seg->StartTick; tick++)
+        XM7_SoundUnit_Skip(&r->Unit, Renderer_Tick(r));
+
+    unsigned long long preroll = ThreadTimeNs() - start;
+
+    s16 *out = sj->Render->Samples + seg->StartFrame * 2;
+    for ( ; tick < seg->EndTick; tick++)
+    {
+        u32 frames = Renderer_Tick(r);
+        XM7_SoundUnit_Mix(&r->Unit, out, frames);
+        out += frames * 2;
+    }
+
+    // the segment has to end exactly where the next one starts
+    if (r->Frames != seg->EndFrame)
+        seg->Error = -1;
+
+    Renderer_Stop(r);
+    free(r);
+    ModuleFile_Free(&mf);
+
+    pthread_mutex_lock(&sj->Lock);
+    sj->Render->PrerollNs += preroll;
+    pthread_mutex_unlock(&sj->Lock);
+}
+
+int SplitRender_Run(SplitRender *sr, const char *path, u32 rate,
+                    unsigned long maxseconds, int workers)
+{
+    memset(sr, 0, sizeof(SplitRender));
+
+    if (workers < 1)
+        workers = 1;
+
+    // First, play the whole song without mixing to find out its length and
+    // where each order position starts.
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, path);
+
+    Renderer *r = malloc(sizeof(Renderer));
+    size_t capacity = 256;
+    unsigned long *cuttick = malloc(capacity * sizeof(unsigned long));
+    unsigned long long *cutframe = malloc(capacity * sizeof(unsigned long long));
+    Segment *segments = calloc(workers, sizeof(Segment));
+
+    if ((ret == 0) && ((r == NULL) || (cuttick == NULL) || (cutframe == NULL) || (segments == NULL)))
+        ret = -1;
+
+    if (ret != 0)
+        goto end;
+
+    Renderer_Start(r, &mf.Module, rate);
+
+    size_t cuts = 0;
+    int lastposition = -1;
+    unsigned long ticks = 0;
+
+    while (r->Frames < (unsigned long long)maxseconds * rate)
+    {
+        if (mf.Module.CurrentSongPosition != lastposition)
+        {
+            lastposition = mf.Module.CurrentSongPosition;
+
+            if (cuts == capacity)
+            {
+                capacity *= 2;
+                unsigned long *newtick = realloc(cuttick, capacity * sizeof(unsigned long));
+                if (newtick != NULL)
+                    cuttick = newtick;
+                unsigned long long *newframe = realloc(cutframe, capacity * sizeof(unsigned long long));
+                if (newframe != NULL)
+                    cutframe = newframe;
+                if ((newtick == NULL) || (newframe == NULL))
+                {
+                    ret = -1;
+                    break;
+                }
+            }
+
+            cuttick[cuts] = ticks;
+            cutframe[cuts] = r->Frames;
+            cuts++;
+        }
+
+        if (Renderer_Tick(r) == 0)
+            break;
+
+        ticks++;
+    }
+
+    Renderer_Stop(r);
+
+    if (ret != 0)
+        goto end;
+
+    sr->Frames = r->Frames;
+    sr->Ended = r->Ended;
+    sr->EndPosition = r->EndPosition;
+    sr->EndLine = r->EndLine;
+
+    sr->Samples = malloc(sr->Frames * 4 + 4);
+    if (sr->Samples == NULL)
+    {
+        ret = -1;
+        goto end;
+    }
+
+    // Cut the song at the first position that starts after each 1/workers of
+    // its length.
+    int count = 0;
+    for (size_t i = 0; (i < cuts) && (count < workers); i++)
+    {
+        if ((count > 0) && (cutframe[i] < sr->Frames * count / workers))
+            continue;
+
+        segments[count].StartTick = cuttick[i];
+        segments[count].StartFrame = cutframe[i];
+        if (count > 0)
+        {
+            segments[count - 1].EndTick = cuttick[i];
+            segments[count - 1].EndFrame = cutframe[i];
+        }
+        count++;
+    }
+
+    // nothing to render
+    if (count == 0)
+        goto end;
+
+    segments[count - 1].EndTick = ticks;
+    segments[count - 1].EndFrame = sr->Frames;
+
+    sr->Segments = count;
+
+    SplitJob sj = {
+        .Render = sr,
+        .Segments = segments,
+        .Path = path,
+        .Rate = rate,
+    };
+    pthread_mutex_init(&sj.Lock, NULL);
+
+    if (WorkQueue_Run(count, NULL, workers, RenderSegment, &sj, NULL) != 0)
+        ret = -1;
+
+    pthread_mutex_destroy(&sj.Lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (segments[i].Error != 0)
+            ret = segments[i].Error;
+    }
+
+end:
+    free(segments);
+    free(cutframe);
+    free(cuttick);
+    free(r);
+    ModuleFile_Free(&mf);
+
+    return ret;
+}
+
+void SplitRender_Free(SplitRender *sr)
+{
+    free(sr->Samples);
+    sr->Samples = NULL;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_SPLIT_RENDER_H__
+#define TOOLS_SPLIT_RENDER_H__
+
+#include <libxm7.h>
+
+// Renders a module on several threads. The song is cut at order positions in
+// segments of about the same length, and each segment is rendered by a worker
+// with its own copy of the module. Before rendering its segment, each worker
+// plays the song from the start without mixing anything (which is very fast)
+// so that the engine and the sound unit are in exactly the same state as they
+// would be in a serial render. The output is identical to a serial render.
+typedef struct {
+    s16 *Samples;               // interleaved stereo
+    unsigned long long Frames;
+
+    int Ended;                  // same meaning as in Renderer
+    u8 EndPosition;
+    u8 EndLine;
+
+    int Segments;
+    unsigned long long PrerollNs;   // CPU time spent by the workers in the pre-roll
+} SplitRender;
+
+// Returns the libXM7 error code if the module can't be loaded, -1 on any other
+// error, 0 on success.
+int SplitRender_Run(SplitRender *sr, const char *path, u32 rate,
+                    unsigned long maxseconds, int workers);
+
+void SplitRender_Free(SplitRender *sr);
+
+#endif // TOOLS_SPLIT_RENDER_H__
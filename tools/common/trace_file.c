@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace_file.h"
+
+#define TRACE_MAGIC         "XM7TRACE"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   16
+#define TRACE_RECORD_SIZE   12
+
+static void Put32(u8 *p, u32 value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static u32 Get32(const u8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static int WriteHeader(TraceWriter *tw)
+{
+    u8 header[TRACE_HEADER_SIZE];
+
+    memcpy(&header[0], TRACE_MAGIC, 8);
+    Put32(&header[8], TRACE_VERSION);
+    Put32(&header[12], tw->Count);
+
+    if (fseek(tw->File, 0, SEEK_SET) != 0)
+        return -1;
+
+    return (fwrite(header, sizeof(header), 1, tw->File) == 1) ? 0 : -1;
+}
+
+int TraceWriter_Open(TraceWriter *tw, const char *path)
+{
+    tw->Count = 0;
+
+    tw->File = fopen(path, "wb");
+    if (tw->File == NULL)
+        return -1;
+
+    return WriteHeader(tw);
+}
+
+int TraceWriter_Write(TraceWriter *tw, const XM7_TraceRecord_Type *records, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        const XM7_TraceRecord_Type *rec = &records[i];
+        u8 buffer[TRACE_RECORD_SIZE];
+
+        Put32(&buffer[0], rec->Tick);
+        buffer[4] = rec->Channel;
+        buffer[5] = rec->Register;
+        buffer[6] = 0;
+        buffer[7] = 0;
+        Put32(&buffer[8], rec->Value);
+
+        if (fwrite(buffer, sizeof(buffer), 1, tw->File) != 1)
+            return -1;
+    }
+
+    tw->Count += count;
+    return 0;
+}
+
+int TraceWriter_Close(TraceWriter *tw)
+{
+    int ret = WriteHeader(tw);
+
+    if (fclose(tw->File) != 0)
+        ret = -1;
+
+    tw->File = NULL;
+    return ret;
+}
+
+int TraceFile_Read(const char *path, XM7_TraceRecord_Type **records, u32 *count)
+{
+    *records = NULL;
+    *count = 0;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+
+    u8 header[TRACE_HEADER_SIZE];
+    if ((fread(header, sizeof(header), 1, f) != 1) ||
+        (memcmp(header, TRACE_MAGIC, 8) != 0) || (Get32(&header[8]) != TRACE_VERSION))
+    {
+        fclose(f);
+        return -1;
+    }
+
+    u32 n = Get32(&header[12]);
+    XM7_TraceRecord_Type *recs = malloc(((size_t)n + 1) * sizeof(XM7_TraceRecord_Type));
+    if (recs == NULL)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    for (u32 i = 0; i < n; i++)
+    {
+        u8 buffer[TRACE_RECORD_SIZE];
+
+        if (fread(buffer, sizeof(buffer), 1, f) != 1)
+        {
+            free(recs);
+            fclose(f);
+            return -1;
+        }
+
+        recs[i].Tick = Get32(&buffer[0]);
+        recs[i].Channel = buffer[4];
+        recs[i].Register = buffer[5];
+        recs[i].Reserved = 0;
+        recs[i].Value = Get32(&buffer[8]);
+    }
+
+    fclose(f);
+
+    *records = recs;
+    *count = n;
+    return 0;
+}
@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_TRACE_FILE_H__
+#define TOOLS_TRACE_FILE_H__
+
+#include <stdio.h>
+
+#include <libxm7.h>
+
+// Trace files have a 16 byte header ("XM7TRACE", version, number of records)
+// followed by the records, 12 bytes each. Everything is little endian, so a
+// trace dumped from a DS can be read directly.
+
+typedef struct {
+    FILE *File;
+    u32 Count;
+} TraceWriter;
+
+// Returns 0 on success
+int TraceWriter_Open(TraceWriter *tw, const char *path);
+int TraceWriter_Write(TraceWriter *tw, const XM7_TraceRecord_Type *records, u32 count);
+int TraceWriter_Close(TraceWriter *tw);
+
+// Reads a whole trace file. Returns 0 on success, and the records have to be
+// freed with free().
+int TraceFile_Read(const char *path, XM7_TraceRecord_Type **records, u32 *count);
+
+#endif // TOOLS_TRACE_FILE_H__
@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <string.h>
+
+#include "wav_file.h"
+
+static void Put16(u8 *p, u16 value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void Put32(u8 *p, u32 value)
+{
+    Put16(p, value & 0xFFFF);
+    Put16(p + 2, value >> 16);
+}
+
+static int WriteHeader(WavFile *wav)
+{
+    u8 header[44];
+
+    // sizes bigger than 4 GB can't be stored, just clamp them
+    unsigned long long bytes = wav->Frames * 4;
+    if (bytes > 0xFFFFFFFFULL - 36)
+        bytes = 0xFFFFFFFFULL - 36;
+
+    memcpy(&header[0], "RIFF", 4);
+    Put32(&header[4], 36 + bytes);
+    memcpy(&header[8], "WAVE", 4);
+
+    memcpy(&header[12], "fmt ", 4);
+    Put32(&header[16], 16);
+    Put16(&header[20], 1);                  // PCM
+    Put16(&header[22], 2);                  // stereo
+    Put32(&header[24], wav->Rate);
+    Put32(&header[28], wav->Rate * 4);      // bytes per second
+    Put16(&header[32], 4);                  // bytes per frame
+    Put16(&header[34], 16);                 // bits per sample
+
+    memcpy(&header[36], "data", 4);
+    Put32(&header[40], bytes);
+
+    if (fseek(wav->File, 0, SEEK_SET) != 0)
+        return -1;
+
+    return (fwrite(header, sizeof(header), 1, wav->File) == 1) ? 0 : -1;
+}
+
+int WavFile_Open(WavFile *wav, const char *path, u32 rate)
+{
+    wav->Rate = rate;
+    wav->Frames = 0;
+
+    wav->File = fopen(path, "wb");
+    if (wav->File == NULL)
+        return -1;
+
+    return WriteHeader(wav);
+}
+
+int WavFile_Write(WavFile *wav, const s16 *frames, u32 count)
+{
+    u8 buffer[1024 * 4];
+
+    // WAV files are little endian, whatever the host is
+    while (count > 0)
+    {
+        u32 n = (count > 1024) ? 1024 : count;
+
+        for (u32 i = 0; i < n * 2; i++)
+            Put16(&buffer[i * 2], frames[i]);
+
+        if (fwrite(buffer, 4, n, wav->File) != n)
+            return -1;
+
+        wav->Frames += n;
+        frames += n * 2;
+        count -= n;
+    }
+
+    return 0;
+}
+
+int WavFile_Close(WavFile *wav)
+{
+    int ret = WriteHeader(wav);
+
+    if (fclose(wav->File) != 0)
+        ret = -1;
+
+    wav->File = NULL;
+    return ret;
+}
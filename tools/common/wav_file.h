@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_WAV_FILE_H__
+#define TOOLS_WAV_FILE_H__
+
+#include <stdio.h>
+
+#include <libxm7.h>
+
+// 16 bit stereo WAV file
+typedef struct {
+    FILE *File;
+    u32 Rate;
+    unsigned long long Frames;
+} WavFile;
+
+// Creates the file and writes a placeholder header. Returns 0 on success.
+int WavFile_Open(WavFile *wav, const char *path, u32 rate);
+
+// Writes interleaved stereo frames. Returns 0 on success.
+int WavFile_Write(WavFile *wav, const s16 *frames, u32 count);
+
+// Fixes the header with the final size and closes the file. Returns 0 on
+// success.
+int WavFile_Close(WavFile *wav);
+
+#endif // TOOLS_WAV_FILE_H__
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "work_queue.h"
+
+// Jobs of one worker. The owner takes them from Head, thieves from Tail.
+typedef struct {
+    pthread_mutex_t Lock;
+    size_t *Job;
+    size_t Head;
+    size_t Tail;
+} Deque;
+
+typedef struct WorkQueue WorkQueue;
+
+typedef struct {
+    WorkQueue *Queue;
+    int Index;
+    size_t Steals;
+} Worker;
+
+struct WorkQueue {
+    Deque *Deques;
+    Worker *Workers;
+    int NumWorkers;
+    WorkQueue_JobFn Run;
+    void *Arg;
+};
+
+static int PopFront(Deque *d, size_t *job)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&d->Lock);
+    if (d->Head < d->Tail)
+    {
+        *job = d->Job[d->Head++];
+        ret = 1;
+    }
+    pthread_mutex_unlock(&d->Lock);
+
+    return ret;
+}
+
+static int PopBack(Deque *d, size_t *job)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&d->Lock);
+    if (d->Head < d->Tail)
+    {
+        *job = d->Job[--d->Tail];
+        ret = 1;
+    }
+    pthread_mutex_unlock(&d->Lock);
+
+    return ret;
+}
+
+static void *WorkerThread(void *arg)
+{
+    Worker *w = arg;
+    WorkQueue *q = w->Queue;
+    size_t job;
+
+    while (1)
+    {
+        if (PopFront(&q->Deques[w->Index], &job))
+        {
+            q->Run(q->Arg, w->Index, job);
+            continue;
+        }
+
+        // no jobs are ever added, so if all the queues are empty we're done
+        int stolen = 0;
+        for (int i = 1; i < q->NumWorkers; i++)
+        {
+            int victim = (w->Index + i) % q->NumWorkers;
+            if (PopBack(&q->Deques[victim], &job))
+            {
+                stolen = 1;
+                break;
+            }
+        }
+
+        if (!stolen)
+            break;
+
+        w->Steals++;
+        q->Run(q->Arg, w->Index, job);
+    }
+
+    return NULL;
+}
+
+int WorkQueue_Run(size_t count, const size_t *order, int workers,
+                  WorkQueue_JobFn run, void *arg, size_t *steals)
+{
+    if (workers < 1)
+        workers = 1;
+
+    WorkQueue q = {
+        .Deques = calloc(workers, sizeof(Deque)),
+        .Workers = calloc(workers, sizeof(Worker)),
+        .NumWorkers = workers,
+        .Run = run,
+        .Arg = arg,
+    };
+    size_t *jobs = malloc((count + 1) * sizeof(size_t));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+
+    int ret = -1;
+
+    if ((q.Deques == NULL) || (q.Workers == NULL) || (jobs == NULL) || (threads == NULL))
+        goto end;
+
+    // deal the jobs round robin, each worker gets a slice of the array
+    size_t start = 0;
+    for (int w = 0; w < workers; w++)
+    {
+        Deque *d = &q.Deques[w];
+
+        pthread_mutex_init(&d->Lock, NULL);
+        d->Job = &jobs[start];
+        d->Head = 0;
+        d->Tail = 0;
+
+        for (size_t i = w; i < count; i += workers)
+            d->Job[d->Tail++] = (order != NULL) ? order[i] : i;
+
+        start += d->Tail;
+
+        q.Workers[w].Queue = &q;
+        q.Workers[w].Index = w;
+    }
+
+    int created = 0;
+    for ( ; created < workers; created++)
+    {
+        if (pthread_create(&threads[created], NULL, WorkerThread, &q.Workers[created]) != 0)
+            break;
+    }
+
+    // if some thread couldn't be created the others steal its jobs
+    for (int w = 0; w < created; w++)
+        pthread_join(threads[w], NULL);
+
+    if (created > 0)
+        ret = 0;
+
+    if (steals != NULL)
+    {
+        for (int w = 0; w < workers; w++)
+            steals[w] = q.Workers[w].Steals;
+    }
+
+    for (int w = 0; w < workers; w++)
+        pthread_mutex_destroy(&q.Deques[w].Lock);
+
+end:
+    free(threads);
+    free(jobs);
+    free(q.Workers);
+    free(q.Deques);
+
+    return ret;
+}
+
+int WorkQueue_DefaultWorkers(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+}
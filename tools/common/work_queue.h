@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_WORK_QUEUE_H__
+#define TOOLS_WORK_QUEUE_H__
+
+#include <stddef.h>
+
+// Function that runs one job on one of the worker threads
+typedef void (*WorkQueue_JobFn)(void *arg, int worker, size_t job);
+
+// Runs jobs 0 to count - 1 on a number of worker threads, and waits for all of
+// them to finish.
+//
+// The jobs are dealt round robin to the workers, in the order given by `order`
+// (or in numerical order if it's NULL), so the biggest jobs should go first.
+// Every worker runs its own jobs from the front of its queue. When its queue is
+// empty it steals jobs from the back of the queues of the other workers.
+//
+// If `steals` isn't NULL it gets the number of jobs stolen by each worker.
+// Returns 0 on success, -1 if the threads can't be created.
+int WorkQueue_Run(size_t count, const size_t *order, int workers,
+                  WorkQueue_JobFn run, void *arg, size_t *steals);
+
+// Returns the number of CPUs available
+int WorkQueue_DefaultWorkers(void);
+
+#endif // TOOLS_WORK_QUEUE_H__
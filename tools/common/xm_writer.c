@@ -0,0 +1,299 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xm_writer.h"
+
+// same as in module_file.c
+#define PADDING             4096
+
+typedef struct {
+    u8 *Data;
+    size_t Size;
+    size_t Capacity;
+    int Failed;
+} Buffer;
+
+static u8 *Reserve(Buffer *b, size_t size)
+{
+    if (b->Size + size > b->Capacity)
+    {
+        size_t capacity = (b->Capacity > 0) ? b->Capacity * 2 : 65536;
+        while (capacity < b->Size + size)
+            capacity *= 2;
+
+        u8 *data = realloc(b->Data, capacity);
+        if (data == NULL)
+        {
+            b->Failed = 1;
+            return NULL;
+        }
+
+        b->Data = data;
+        b->Capacity = capacity;
+    }
+
+    u8 *p = &b->Data[b->Size];
+    memset(p, 0, size);
+    b->Size += size;
+    return p;
+}
+
+static void Put8(Buffer *b, u8 value)
+{
+    u8 *p = Reserve(b, 1);
+    if (p != NULL)
+        p[0] = value;
+}
+
+static void Put16(Buffer *b, u16 value)
+{
+    u8 *p = Reserve(b, 2);
+    if (p != NULL)
+    {
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+    }
+}
+
+static void Put32(Buffer *b, u32 value)
+{
+    Put16(b, value & 0xFFFF);
+    Put16(b, value >> 16);
+}
+
+static void PutBytes(Buffer *b, const void *data, size_t size)
+{
+    u8 *p = Reserve(b, size);
+    if ((p != NULL) && (data != NULL))
+        memcpy(p, data, size);
+}
+
+void XmSong_Init(XmSong *song, u8 channels)
+{
+    memset(song, 0, sizeof(XmSong));
+
+    song->Channels = channels;
+    song->Tempo = 6;
+    song->BPM = 125;
+}
+
+int XmSong_AddPattern(XmSong *song, u16 rows)
+{
+    if ((song->NumberofPatterns >= 256) || (rows < 1) || (rows > 256))
+        return -1;
+
+    XmCell *cells = calloc((size_t)rows * song->Channels, sizeof(XmCell));
+    if (cells == NULL)
+        return -1;
+
+    int pattern = song->NumberofPatterns++;
+    song->Pattern[pattern] = cells;
+    song->PatternRows[pattern] = rows;
+
+    return pattern;
+}
+
+XmCell *XmSong_Cell(XmSong *song, int pattern, int row, int channel)
+{
+    return &song->Pattern[pattern][row * song->Channels + channel];
+}
+
+static void PutPattern(Buffer *b, const XmSong *song, int pattern)
+{
+    Put32(b, 9);
+    Put8(b, 0);
+    Put16(b, song->PatternRows[pattern]);
+
+    size_t sizepos = b->Size;
+    Put16(b, 0);
+
+    size_t start = b->Size;
+    u32 cells = song->PatternRows[pattern] * song->Channels;
+
+    for (u32 i = 0; i < cells; i++)
+    {
+        const XmCell *cell = &song->Pattern[pattern][i];
+        u8 fields[5] = { cell->Note, cell->Instrument, cell->Volume,
+                         cell->EffectType, cell->EffectParam };
+
+        // always packed, only the fields that aren't zero
+        u8 mask = 0x80;
+        for (int j = 0; j < 5; j++)
+        {
+            if (fields[j] != 0)
+                mask |= 1 << j;
+        }
+
+        Put8(b, mask);
+        for (int j = 0; j < 5; j++)
+        {
+            if (fields[j] != 0)
+                Put8(b, fields[j]);
+        }
+    }
+
+    if (!b->Failed)
+    {
+        size_t size = b->Size - start;
+        b->Data[sizepos] = size & 0xFF;
+        b->Data[sizepos + 1] = size >> 8;
+    }
+}
+
+static void PutEnvelopePoints(Buffer *b, const XmEnvelope *env)
+{
+    for (int i = 0; i < 12; i++)
+    {
+        Put16(b, env->X[i]);
+        Put16(b, env->Y[i]);
+    }
+}
+
+static void PutInstrument(Buffer *b, const XmInstrument *instr)
+{
+    int hassample = (instr->SampleData != NULL) && (instr->SampleLength > 0);
+    int width = (instr->SampleType & XM_SAMPLE_16BIT) ? 2 : 1;
+
+    // 1st part of the header
+    Put32(b, hassample ? 263 : 29);
+    Reserve(b, 22);
+    Put8(b, 0);
+    Put16(b, hassample ? 1 : 0);
+
+    if (!hassample)
+        return;
+
+    // 2nd part of the header
+    Put32(b, 40);
+    Reserve(b, 96);             // all the notes use sample 0
+    PutEnvelopePoints(b, &instr->VolumeEnvelope);
+    PutEnvelopePoints(b, &instr->PanningEnvelope);
+    Put8(b, instr->VolumeEnvelope.Points);
+    Put8(b, instr->PanningEnvelope.Points);
+    Put8(b, instr->VolumeEnvelope.Sustain);
+    Put8(b, instr->VolumeEnvelope.LoopStart);
+    Put8(b, instr->VolumeEnvelope.LoopEnd);
+    Put8(b, instr->PanningEnvelope.Sustain);
+    Put8(b, instr->PanningEnvelope.LoopStart);
+    Put8(b, instr->PanningEnvelope.LoopEnd);
+    Put8(b, instr->VolumeEnvelope.Type);
+    Put8(b, instr->PanningEnvelope.Type);
+    Put8(b, instr->VibratoType);
+    Put8(b, instr->VibratoSweep);
+    Put8(b, instr->VibratoDepth);
+    Put8(b, instr->VibratoRate);
+    Put16(b, instr->VolumeFadeout);
+    Reserve(b, 22);
+
+    // sample header
+    Put32(b, instr->SampleLength * width);
+    Put32(b, instr->LoopStart * width);
+    Put32(b, instr->LoopLength * width);
+    Put8(b, instr->Volume);
+    Put8(b, (u8)instr->FineTune);
+    Put8(b, instr->SampleType);
+    Put8(b, instr->Panning);
+    Put8(b, (u8)instr->RelativeNote);
+    Put8(b, 0);
+    Reserve(b, 22);
+
+    // sample data, delta encoded
+    if (width == 1)
+    {
+        const s8 *data = instr->SampleData;
+        s8 old = 0;
+        for (u32 i = 0; i < instr->SampleLength; i++)
+        {
+            Put8(b, (u8)(data[i] - old));
+            old = data[i];
+        }
+    }
+    else
+    {
+        const s16 *data = instr->SampleData;
+        s16 old = 0;
+        for (u32 i = 0; i < instr->SampleLength; i++)
+        {
+            Put16(b, (u16)(data[i] - old));
+            old = data[i];
+        }
+    }
+}
+
+void *XmSong_Build(const XmSong *song, size_t *size)
+{
+    Buffer b = { 0 };
+
+    PutBytes(&b, "Extended Module: ", 17);
+    PutBytes(&b, song->Name, strnlen(song->Name, 20));
+    Reserve(&b, 20 - strnlen(song->Name, 20));
+    Put8(&b, 0x1A);
+    PutBytes(&b, "libXM7 XmSong      ", 20);
+    Put16(&b, 0x104);
+    Put32(&b, 276);
+    Put16(&b, song->SongLength);
+    Put16(&b, song->RestartPosition);
+    Put16(&b, song->Channels);
+    Put16(&b, song->NumberofPatterns);
+    Put16(&b, song->NumberofInstruments);
+    Put16(&b, song->AmigaFrequencies ? 0 : 1);
+    Put16(&b, song->Tempo);
+    Put16(&b, song->BPM);
+    PutBytes(&b, song->Order, 256);
+
+    for (int i = 0; i < song->NumberofPatterns; i++)
+        PutPattern(&b, song, i);
+
+    for (int i = 0; i < song->NumberofInstruments; i++)
+        PutInstrument(&b, &song->Instrument[i]);
+
+    size_t filesize = b.Size;
+    Reserve(&b, PADDING);
+
+    if (b.Failed)
+    {
+        free(b.Data);
+        return NULL;
+    }
+
+    *size = filesize;
+    return b.Data;
+}
+
+int XmSong_Save(const XmSong *song, const char *path)
+{
+    size_t size;
+    void *data = XmSong_Build(song, &size);
+    if (data == NULL)
+        return -1;
+
+    int ret = -1;
+
+    FILE *f = fopen(path, "wb");
+    if (f != NULL)
+    {
+        if (fwrite(data, 1, size, f) == size)
+            ret = 0;
+        if (fclose(f) != 0)
+            ret = -1;
+    }
+
+    free(data);
+    return ret;
+}
+
+void XmSong_Free(XmSong *song)
+{
+    for (int i = 0; i < song->NumberofPatterns; i++)
+    {
+        free(song->Pattern[i]);
+        song->Pattern[i] = NULL;
+    }
+
+    song->NumberofPatterns = 0;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+#ifndef TOOLS_XM_WRITER_H__
+#define TOOLS_XM_WRITER_H__
+
+#include <stddef.h>
+
+#include <libxm7.h>
+
+// Builds XM files from scratch, to create modules that exercise specific parts
+// of the engine.
+
+// XM effect numbers of the effects with letters
+#define XM_EFFECT_G         16
+#define XM_EFFECT_H         17
+#define XM_EFFECT_K         20
+#define XM_EFFECT_L         21
+#define XM_EFFECT_P         25
+#define XM_EFFECT_R         27
+#define XM_EFFECT_T         29
+#define XM_EFFECT_X         33
+
+#define XM_NOTE_OFF         97
+
+// Bits of XmEnvelope.Type
+#define XM_ENVELOPE_ON      0x01
+#define XM_ENVELOPE_SUSTAIN 0x02
+#define XM_ENVELOPE_LOOP    0x04
+
+// Bits of XmInstrument.SampleType
+#define XM_SAMPLE_FORWARD   0x01
+#define XM_SAMPLE_PINGPONG  0x02
+#define XM_SAMPLE_16BIT     0x10
+
+typedef struct {
+    u8 Note;                // 1..96, XM_NOTE_OFF, or 0 for no note
+    u8 Instrument;          // 1..128, or 0
+    u8 Volume;              // volume column
+    u8 EffectType;
+    u8 EffectParam;
+} XmCell;
+
+typedef struct {
+    u8 Points;
+    u16 X[12];
+    u16 Y[12];
+    u8 Sustain;
+    u8 LoopStart;
+    u8 LoopEnd;
+    u8 Type;
+} XmEnvelope;
+
+// An instrument with a single sample, used for all the notes
+typedef struct {
+    XmEnvelope VolumeEnvelope;
+    XmEnvelope PanningEnvelope;
+    u16 VolumeFadeout;
+    u8 VibratoType;
+    u8 VibratoSweep;
+    u8 VibratoDepth;
+    u8 VibratoRate;
+
+    const void *SampleData; // 8 or 16 bit PCM (not delta encoded)
+    u32 SampleLength;       // all of these are in samples, not bytes
+    u32 LoopStart;
+    u32 LoopLength;
+    u8 SampleType;
+    u8 Volume;              // 0..64
+    s8 FineTune;
+    u8 Panning;
+    s8 RelativeNote;
+} XmInstrument;
+
+typedef struct {
+    char Name[20];
+    u8 Channels;
+    u8 AmigaFrequencies;    // 1 to use the Amiga frequency table
+    u16 Tempo;
+    u16 BPM;
+    u16 SongLength;
+    u16 RestartPosition;
+    u8 Order[256];
+
+    u16 NumberofPatterns;
+    u16 PatternRows[256];
+    XmCell *Pattern[256];   // PatternRows * Channels cells, row by row
+
+    u16 NumberofInstruments;
+    XmInstrument Instrument[128];
+} XmSong;
+
+// Empty song with the given number of channels, speed 6 at 125 BPM
+void XmSong_Init(XmSong *song, u8 channels);
+
+// Adds an empty pattern and returns its number, or -1 on error
+int XmSong_AddPattern(XmSong *song, u16 rows);
+
+// Cell of a pattern
+XmCell *XmSong_Cell(XmSong *song, int pattern, int row, int channel);
+
+// Builds the XM file. The returned buffer has to be freed with free(). Like
+// the buffers of ModuleFile_Load(), it has some zeroed padding at the end.
+void *XmSong_Build(const XmSong *song, size_t *size);
+
+// Builds the XM file and saves it. Returns 0 on success.
+int XmSong_Save(const XmSong *song, const char *path);
+
+// Frees the patterns
+void XmSong_Free(XmSong *song);
+
+#endif // TOOLS_XM_WRITER_H__
@@ -0,0 +1,317 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Renders (or just plays, to check them) all the modules of a directory using
+// all the CPU cores. Every worker thread has its own engine and sound unit.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/file_list.h"
+#include "common/module_file.h"
+#include "common/render.h"
+#include "common/wav_file.h"
+#include "common/work_queue.h"
+
+// longest timer period the engine can program (BPM 32)
+#define MAX_TICK_PERIOD     (1963710 / (32 * 24))
+
+typedef struct {
+    int Error;                  // libXM7 error code, -1 for I/O errors
+    int Ended;                  // the song looped back before the time limit
+    double Seconds;             // length of the audio
+    s16 Peak;
+    unsigned long long Ns;      // time spent on this file
+} Result;
+
+typedef struct {
+    FileList Files;
+    Result *Results;
+
+    const char *OutDir;
+    u32 Rate;
+    unsigned long MaxSeconds;
+
+    // one for each worker
+    Renderer **Renderers;
+    s16 **Buffers;
+    u32 BufferFrames;
+} Batch;
+
+static char *OutputPath(const char *outdir, const char *inpath)
+{
+    const char *name = strrchr(inpath, '/');
+    name = (name != NULL) ? name + 1 : inpath;
+
+    size_t len = strlen(outdir) + strlen(name) + 6;
+    char *path = malloc(len);
+    if (path != NULL)
+        snprintf(path, len, "%s/%s.wav", outdir, name);
+
+    return path;
+}
+
+static void RenderJob(void *arg, int worker, size_t job)
+{
+    Batch *b = arg;
+    Result *res = &b->Results[job];
+    const char *inpath = b->Files.Path[job];
+
+    unsigned long long start = TimeNowNs();
+
+    ModuleFile mf;
+    res->Error = ModuleFile_Load(&mf, inpath);
+    if (res->Error != 0)
+    {
+        ModuleFile_Free(&mf);
+        res->Ns = TimeNowNs() - start;
+        return;
+    }
+
+    WavFile wav;
+    int writing = 0;
+
+    if (b->OutDir != NULL)
+    {
+        char *outpath = OutputPath(b->OutDir, inpath);
+        if ((outpath == NULL) || (WavFile_Open(&wav, outpath, b->Rate) != 0))
+            res->Error = -1;
+        else
+            writing = 1;
+        free(outpath);
+    }
+
+    Renderer *r = b->Renderers[worker];
+    s16 *buffer = b->Buffers[worker];
+
+    Renderer_Start(r, &mf.Module, b->Rate);
+
+    while ((res->Error == 0) && (r->Frames < (unsigned long long)b->MaxSeconds * b->Rate))
+    {
+        u32 frames = Renderer_Tick(r);
+        if (frames == 0)
+            break;
+
+        XM7_SoundUnit_Mix(&r->Unit, buffer, frames);
+
+        for (u32 i = 0; i < frames * 2; i++)
+        {
+            s16 v = (buffer[i] < 0) ? -(buffer[i] + 1) : buffer[i];
+            if (v > res->Peak)
+                res->Peak = v;
+        }
+
+        if (writing && (WavFile_Write(&wav, buffer, frames) != 0))
+            res->Error = -1;
+    }
+
+    res->Ended = r->Ended;
+    res->Seconds = (double)r->Frames / b->Rate;
+
+    Renderer_Stop(r);
+
+    if (writing && (WavFile_Close(&wav) != 0))
+        res->Error = -1;
+
+    ModuleFile_Free(&mf);
+
+    res->Ns = TimeNowNs() - start;
+}
+
+typedef struct {
+    size_t Size;
+    size_t Index;
+} SortEntry;
+
+static int CompareSizeDescending(const void *a, const void *b)
+{
+    size_t sa = ((const SortEntry *)a)->Size;
+    size_t sb = ((const SortEntry *)b)->Size;
+
+    return (sa < sb) - (sa > sb);
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] directory|module...\n"
+           "\n"
+           "  -j workers    Number of worker threads (default: number of CPUs)\n"
+           "  -o directory  Write a WAV file for each module in this directory\n"
+           "                (by default the modules are rendered but not saved)\n"
+           "  -r rate       Sample rate of the output (default: 32768)\n"
+           "  -t seconds    Maximum length of each render (default: 1800)\n"
+           "  -q            Don't print one line per module\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    Batch b = { 0 };
+    int workers = WorkQueue_DefaultWorkers();
+    unsigned long rate = 32768;
+    int quiet = 0;
+    int opt;
+
+    b.MaxSeconds = 1800;
+
+    while ((opt = getopt(argc, argv, "j:o:r:t:q")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                workers = atoi(optarg);
+                break;
+            case 'o':
+                b.OutDir = optarg;
+                break;
+            case 'r':
+                rate = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                b.MaxSeconds = strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind >= argc) || (workers < 1) || (rate < 1000) || (rate > 384000))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    b.Rate = rate;
+
+    FileList_Init(&b.Files);
+    for (int i = optind; i < argc; i++)
+    {
+        if (FileList_Add(&b.Files, argv[i]) != 0)
+        {
+            printf("%s: can't read\n", argv[i]);
+            FileList_Free(&b.Files);
+            return 1;
+        }
+    }
+
+    size_t count = b.Files.Count;
+
+    b.BufferFrames = (u64)MAX_TICK_PERIOD * 1024 * rate / XM7_BUS_CLOCK + 1;
+    b.Results = calloc(count + 1, sizeof(Result));
+    b.Renderers = calloc(workers, sizeof(Renderer *));
+    b.Buffers = calloc(workers, sizeof(s16 *));
+    size_t *order = malloc((count + 1) * sizeof(size_t));
+    size_t *steals = calloc(workers, sizeof(size_t));
+
+    int failed = (b.Results == NULL) || (b.Renderers == NULL) || (b.Buffers == NULL) ||
+                 (order == NULL) || (steals == NULL);
+
+    for (int w = 0; !failed && (w < workers); w++)
+    {
+        b.Renderers[w] = malloc(sizeof(Renderer));
+        b.Buffers[w] = malloc(b.BufferFrames * 4);
+        if ((b.Renderers[w] == NULL) || (b.Buffers[w] == NULL))
+            failed = 1;
+    }
+
+    if (failed)
+    {
+        printf("Not enough memory\n");
+        return 1;
+    }
+
+    // the biggest modules go first, so that there's nothing big left at the end
+    SortEntry *sorted = malloc((count + 1) * sizeof(SortEntry));
+    if (sorted == NULL)
+    {
+        printf("Not enough memory\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        sorted[i].Size = b.Files.Size[i];
+        sorted[i].Index = i;
+    }
+    qsort(sorted, count, sizeof(SortEntry), CompareSizeDescending);
+
+    for (size_t i = 0; i < count; i++)
+        order[i] = sorted[i].Index;
+    free(sorted);
+
+    unsigned long long start = TimeNowNs();
+
+    if (WorkQueue_Run(count, order, workers, RenderJob, &b, steals) != 0)
+    {
+        printf("Can't create worker threads\n");
+        return 1;
+    }
+
+    unsigned long long elapsed = TimeNowNs() - start;
+
+    size_t errors = 0;
+    size_t unended = 0;
+    double audio = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Result *res = &b.Results[i];
+
+        if (res->Error != 0)
+        {
+            errors++;
+            printf("%s: error %d\n", b.Files.Path[i], res->Error);
+            continue;
+        }
+
+        if (!res->Ended)
+            unended++;
+
+        audio += res->Seconds;
+
+        if (!quiet)
+        {
+            printf("%s: %.2f s%s, peak %d, %.3f s\n", b.Files.Path[i], res->Seconds,
+                   res->Ended ? "" : " (time limit)", res->Peak, res->Ns / 1e9);
+        }
+    }
+
+    size_t stolen = 0;
+    for (int w = 0; w < workers; w++)
+        stolen += steals[w];
+
+    double seconds = elapsed / 1e9;
+
+    printf("\n");
+    printf("Files:      %zu (%zu errors, %zu stopped at the time limit)\n",
+           count, errors, unended);
+    printf("Workers:    %d (%zu jobs stolen)\n", workers, stolen);
+    printf("Wall time:  %.3f s\n", seconds);
+    printf("Audio:      %.2f s\n", audio);
+    printf("Throughput: %.2f files/s, %.1f audio-s/s\n",
+           count / seconds, audio / seconds);
+
+    for (int w = 0; w < workers; w++)
+    {
+        free(b.Renderers[w]);
+        free(b.Buffers[w]);
+    }
+    free(b.Renderers);
+    free(b.Buffers);
+    free(b.Results);
+    free(order);
+    free(steals);
+    FileList_Free(&b.Files);
+
+    return (errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Microbenchmarks of the tick handler of the engine.
+//
+// Each scenario is a small module built on the fly that keeps a few channels
+// busy with a single effect (or feature) all the time. The module is played
+// with the null backend, once with the linear frequency table and once with
+// the Amiga one, and the tool reports the time per tick and the number of
+// divisions by a variable per tick. The ARM7 has no divide instruction, so on
+// the DS each one of those divisions is a call to a slow software routine.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+#include "common/xm_writer.h"
+
+#define ROWS                64
+#define SAMPLE_LENGTH       1024
+
+// ticks played before measuring anything
+#define WARMUP_TICKS        1000
+
+#define INSTR_PLAIN         1
+#define INSTR_ENVELOPES     2
+
+typedef struct {
+    const char *Name;
+    u8 Channels;
+    // fills one cell of the pattern
+    void (*Fill)(XmCell *cell, int row, int channel);
+} Scenario;
+
+// a note on the first row of every 16 (on every channel, each one a bit
+// higher than the one before) and the given effect on all the rows
+static void Note16(XmCell *cell, int row, int channel, u8 instrument)
+{
+    if ((row % 16) == 0)
+    {
+        cell->Note = 49 + channel;  // C-4 and up
+        cell->Instrument = instrument;
+    }
+}
+
+static void FillIdle(XmCell *cell, int row, int channel)
+{
+    if (row == 0)
+    {
+        cell->Note = 49 + channel;
+        cell->Instrument = INSTR_PLAIN;
+    }
+}
+
+static void FillNotes(XmCell *cell, int row, int channel)
+{
+    cell->Note = 37 + ((row + channel) % 24);
+    cell->Instrument = INSTR_PLAIN;
+}
+
+static void FillArpeggio(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = 0x0;
+    cell->EffectParam = 0x37;
+}
+
+static void FillPortaUp(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = 0x1;
+    cell->EffectParam = 0x04;
+}
+
+static void FillPortaDown(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = 0x2;
+    cell->EffectParam = 0x04;
+}
+
+static void FillTonePorta(XmCell *cell, int row, int channel)
+{
+    // start a note, then keep sliding between two notes an octave apart
+    if (row == 0)
+    {
+        cell->Note = 49 + channel;
+        cell->Instrument = INSTR_PLAIN;
+        return;
+    }
+
+    if ((row % 8) == 0)
+        cell->Note = ((row % 16) == 0) ? 49 + channel : 61 + channel;
+
+    cell->EffectType = 0x3;
+    cell->EffectParam = 0x10;
+}
+
+static void FillVibrato(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = 0x4;
+    cell->EffectParam = 0x8F;
+}
+
+static void FillTremolo(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = 0x7;
+    cell->EffectParam = 0x8F;
+}
+
+static void FillEnvelopes(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_ENVELOPES);
+
+    // release the notes, so the fadeout runs too
+    if ((row % 16) == 12)
+        cell->Note = XM_NOTE_OFF;
+}
+
+static void FillRetrigRxy(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = XM_EFFECT_R;
+    cell->EffectParam = 0x11;       // volume -1, every tick
+}
+
+static void FillRetrigE9x(XmCell *cell, int row, int channel)
+{
+    Note16(cell, row, channel, INSTR_PLAIN);
+    cell->EffectType = 0xE;
+    cell->EffectParam = 0x92;       // every 2 ticks
+}
+
+static void FillBusy(XmCell *cell, int row, int channel)
+{
+    static const u8 effects[8][2] = {
+        { 0x0, 0x37 },              // arpeggio
+        { 0x1, 0x02 },              // portamento up
+        { 0x4, 0x8F },              // vibrato
+        { 0x7, 0x8F },              // tremolo
+        { 0xA, 0x01 },              // volume slide
+        { XM_EFFECT_R, 0x13 },      // retrigger with volume slide
+        { XM_EFFECT_P, 0x10 },      // panning slide
+        { 0x6, 0x01 },              // vibrato and volume slide
+    };
+
+    cell->Note = 37 + ((row + channel) % 24);
+    cell->Instrument = INSTR_ENVELOPES;
+    cell->Volume = 0x40;            // set volume to 0x30
+    cell->EffectType = effects[(row + channel) % 8][0];
+    cell->EffectParam = effects[(row + channel) % 8][1];
+}
+
+static const Scenario Scenarios[] = {
+    { "idle",        4, FillIdle },
+    { "notes",       4, FillNotes },
+    { "arpeggio",    4, FillArpeggio },
+    { "porta-up",    4, FillPortaUp },
+    { "porta-down",  4, FillPortaDown },
+    { "tone-porta",  4, FillTonePorta },
+    { "vibrato",     4, FillVibrato },
+    { "tremolo",     4, FillTremolo },
+    { "envelopes",   4, FillEnvelopes },
+    { "retrig-Rxy",  4, FillRetrigRxy },
+    { "retrig-E9x",  4, FillRetrigE9x },
+    { "busy-16",    16, FillBusy },
+};
+
+#define NUM_SCENARIOS       (sizeof(Scenarios) / sizeof(Scenarios[0]))
+
+static s8 SampleData[SAMPLE_LENGTH];
+
+static void SetupInstruments(XmSong *song)
+{
+    // a sawtooth, looped
+    for (int i = 0; i < SAMPLE_LENGTH; i++)
+        SampleData[i] = (s8)((i * 4) & 0xFF);
+
+    XmInstrument *instr = &song->Instrument[INSTR_PLAIN - 1];
+    instr->SampleData = SampleData;
+    instr->SampleLength = SAMPLE_LENGTH;
+    instr->LoopStart = 0;
+    instr->LoopLength = SAMPLE_LENGTH;
+    instr->SampleType = XM_SAMPLE_FORWARD;
+    instr->Volume = 64;
+    instr->Panning = 0x80;
+
+    // the same sample, with all the envelope features and autovibrato
+    song->Instrument[INSTR_ENVELOPES - 1] = *instr;
+    instr = &song->Instrument[INSTR_ENVELOPES - 1];
+
+    XmEnvelope *vol = &instr->VolumeEnvelope;
+    XmEnvelope *pan = &instr->PanningEnvelope;
+
+    vol->Points = 12;
+    pan->Points = 12;
+    for (int i = 0; i < 12; i++)
+    {
+        vol->X[i] = i * 5;
+        vol->Y[i] = (i & 1) ? 16 : 64;
+        pan->X[i] = i * 7;
+        pan->Y[i] = (i & 1) ? 8 : 56;
+    }
+
+    vol->Sustain = 5;
+    vol->LoopStart = 6;
+    vol->LoopEnd = 11;
+    vol->Type = XM_ENVELOPE_ON | XM_ENVELOPE_SUSTAIN | XM_ENVELOPE_LOOP;
+
+    pan->LoopStart = 0;
+    pan->LoopEnd = 11;
+    pan->Type = XM_ENVELOPE_ON | XM_ENVELOPE_LOOP;
+
+    instr->VolumeFadeout = 0x100;
+    instr->VibratoType = 0;
+    instr->VibratoSweep = 0;
+    instr->VibratoDepth = 8;
+    instr->VibratoRate = 16;
+
+    song->NumberofInstruments = 2;
+}
+
+static XmSong *CreateScenarioSong(const Scenario *sc, int amiga)
+{
+    XmSong *song = malloc(sizeof(XmSong));
+    if (song == NULL)
+        return NULL;
+
+    XmSong_Init(song, sc->Channels);
+    snprintf(song->Name, sizeof(song->Name), "%s", sc->Name);
+    song->AmigaFrequencies = amiga;
+    song->SongLength = 1;
+
+    SetupInstruments(song);
+
+    int pattern = XmSong_AddPattern(song, ROWS);
+    if (pattern < 0)
+    {
+        free(song);
+        return NULL;
+    }
+
+    for (int row = 0; row < ROWS; row++)
+    {
+        for (int chn = 0; chn < sc->Channels; chn++)
+            sc->Fill(XmSong_Cell(song, pattern, row, chn), row, chn);
+    }
+
+    return song;
+}
+
+static void DeleteScenarioSong(XmSong *song)
+{
+    XmSong_Free(song);
+    free(song);
+}
+
+typedef struct {
+    double NsPerTick;
+    unsigned long long SlowNs;      // 99th percentile
+    double DivisionsPerTick;
+    u32 MaxDivisions;
+} Result;
+
+static int CompareTimes(const void *a, const void *b)
+{
+    unsigned long long ta = *(const unsigned long long *)a;
+    unsigned long long tb = *(const unsigned long long *)b;
+
+    return (ta > tb) - (ta < tb);
+}
+
+static int RunScenario(const Scenario *sc, int amiga, u32 ticks, Result *res)
+{
+    XmSong *song = CreateScenarioSong(sc, amiga);
+    if (song == NULL)
+        return -1;
+
+    size_t size;
+    void *data = XmSong_Build(song, &size);
+    DeleteScenarioSong(song);
+    if (data == NULL)
+        return -1;
+
+    ModuleFile mf;
+    memset(&mf, 0, sizeof(mf));
+    int ret = ModuleFile_LoadData(&mf, data, size);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", sc->Name, ret);
+        ModuleFile_Free(&mf);
+        return -1;
+    }
+
+    XM7_NullBackend_Type nb;
+    XM7_NullBackend_Init(&nb);
+    XM7_SetBackend(&nb.Backend);
+
+    XM7_Initialize();
+    XM7_SetTimerMode(XM7_TIMER_MODE_EXTERNAL);
+    XM7_PlayModule(&mf.Module);
+
+    XM7_AdvanceTicks(WARMUP_TICKS);
+
+    // the mean, without the cost of reading the clock on every tick
+    unsigned long long start = TimeNowNs();
+    XM7_AdvanceTicks(ticks);
+    res->NsPerTick = (double)(TimeNowNs() - start) / ticks;
+
+    // the slow ticks, and the divisions. The very slowest ticks are the ones
+    // interrupted by the OS, so they aren't very useful.
+    unsigned long long *times = malloc(ticks * sizeof(unsigned long long));
+    if (times == NULL)
+    {
+        XM7_StopModule();
+        ModuleFile_Free(&mf);
+        return -1;
+    }
+
+    u32 divisions = 0;
+    res->MaxDivisions = 0;
+
+    for (u32 i = 0; i < ticks; i++)
+    {
+        u32 d = XM7_GetDivisionCount();
+        unsigned long long t = TimeNowNs();
+
+        XM7_Tick();
+
+        times[i] = TimeNowNs() - t;
+        d = XM7_GetDivisionCount() - d;
+
+        if (d > res->MaxDivisions)
+            res->MaxDivisions = d;
+        divisions += d;
+    }
+
+    res->DivisionsPerTick = (double)divisions / ticks;
+
+    qsort(times, ticks, sizeof(unsigned long long), CompareTimes);
+    res->SlowNs = times[(u64)ticks * 99 / 100];
+    free(times);
+
+    XM7_StopModule();
+    ModuleFile_Free(&mf);
+
+    return 0;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] [scenario...]\n"
+           "\n"
+           "  -n ticks      Ticks measured in each run (default: 100000)\n"
+           "  -w directory  Also save the module of each scenario there\n"
+           "\n"
+           "Scenarios:",
+           name);
+
+    for (size_t i = 0; i < NUM_SCENARIOS; i++)
+        printf(" %s", Scenarios[i].Name);
+    printf("\n");
+}
+
+static int SaveScenario(const Scenario *sc, int amiga, const char *dir)
+{
+    XmSong *song = CreateScenarioSong(sc, amiga);
+    if (song == NULL)
+        return -1;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s-%s.xm", dir, sc->Name, amiga ? "amiga" : "linear");
+
+    int ret = XmSong_Save(song, path);
+    if (ret != 0)
+        printf("%s: can't write file\n", path);
+
+    DeleteScenarioSong(song);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long ticks = 100000;
+    const char *savedir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                ticks = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                savedir = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (ticks < 1)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    // check the names before running anything
+    for (int i = optind; i < argc; i++)
+    {
+        size_t j;
+        for (j = 0; j < NUM_SCENARIOS; j++)
+        {
+            if (strcmp(argv[i], Scenarios[j].Name) == 0)
+                break;
+        }
+
+        if (j == NUM_SCENARIOS)
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%-12s %4s | %10s %10s %9s %8s | %10s %10s %9s %8s\n", "", "",
+           "linear", "", "", "", "amiga", "", "", "");
+    printf("%-12s %4s | %10s %10s %9s %8s | %10s %10s %9s %8s\n", "scenario", "chn",
+           "ns/tick", "p99 ns", "div/tick", "max div",
+           "ns/tick", "p99 ns", "div/tick", "max div");
+
+    int failed = 0;
+
+    for (size_t i = 0; i < NUM_SCENARIOS; i++)
+    {
+        const Scenario *sc = &Scenarios[i];
+
+        int selected = (optind == argc);
+        for (int j = optind; j < argc; j++)
+        {
+            if (strcmp(argv[j], sc->Name) == 0)
+                selected = 1;
+        }
+
+        if (!selected)
+            continue;
+
+        Result res[2];
+        if ((RunScenario(sc, 0, ticks, &res[0]) != 0) ||
+            (RunScenario(sc, 1, ticks, &res[1]) != 0))
+        {
+            failed = 1;
+            continue;
+        }
+
+        printf("%-12s %4u | %10.1f %10llu %9.2f %8u | %10.1f %10llu %9.2f %8u\n",
+               sc->Name, sc->Channels,
+               res[0].NsPerTick, res[0].SlowNs, res[0].DivisionsPerTick, res[0].MaxDivisions,
+               res[1].NsPerTick, res[1].SlowNs, res[1].DivisionsPerTick, res[1].MaxDivisions);
+
+        if (savedir != NULL)
+        {
+            if ((SaveScenario(sc, 0, savedir) != 0) || (SaveScenario(sc, 1, savedir) != 0))
+                failed = 1;
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Plays a set of modules with the null backend and reports which effects and
+// volume column commands run most often, using the effect counters of the
+// engine. It's meant to find out which effects a soundtrack really depends on.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+
+#define MAX_ROWS    (XM7_EFFECT_TYPES + 16 + 16)
+
+typedef struct {
+    char Name[48];
+    unsigned long long Count;
+} Row;
+
+static const char *EffectName[XM7_EFFECT_TYPES] = {
+    "0xy arpeggio", "1xx portamento up", "2xx portamento down",
+    "3xx tone portamento", "4xy vibrato", "5xy tone portamento + volume slide",
+    "6xy vibrato + volume slide", "7xy tremolo", "8xx set panning",
+    "9xx sample offset", "Axy volume slide", "Bxx position jump",
+    "Cxx set volume", "Dxx pattern break", NULL, "Fxx set speed/BPM",
+    "Gxx set global volume", "Hxy global volume slide", NULL, NULL,
+    "Kxx key off", "Lxx set envelope position", NULL, NULL, NULL,
+    "Pxy panning slide", NULL, "Rxy multi retrig", NULL, "Txy tremor", NULL,
+    NULL, NULL, "Xxy extra fine portamento", NULL, NULL
+};
+
+static const char *ExtendedEffectName[16] = {
+    "E0x", "E1x fine portamento up", "E2x fine portamento down",
+    "E3x glissando control", "E4x vibrato control", "E5x set finetune",
+    "E6x pattern loop", "E7x tremolo control", "E8x set panning",
+    "E9x retrig note", "EAx fine volume slide up", "EBx fine volume slide down",
+    "ECx note cut", "EDx note delay", "EEx pattern delay", "EFx"
+};
+
+static const char *VolumeColumnName[16] = {
+    "vol 0x", "vol set volume", "vol set volume", "vol set volume",
+    "vol set volume", "vol set volume", "vol volume slide down",
+    "vol volume slide up", "vol fine volume down", "vol fine volume up",
+    "vol vibrato speed", "vol vibrato", "vol set panning",
+    "vol panning slide left", "vol panning slide right", "vol tone portamento"
+};
+
+static int CompareRows(const void *a, const void *b)
+{
+    const Row *ra = a;
+    const Row *rb = b;
+
+    if (ra->Count != rb->Count)
+        return (ra->Count < rb->Count) ? 1 : -1;
+
+    return strcmp(ra->Name, rb->Name);
+}
+
+static void AddRow(Row *rows, int *count, const char *name, unsigned long long n)
+{
+    if (n == 0)
+        return;
+
+    // the volume column has 5 commands that set the volume
+    for (int i = 0; i < *count; i++)
+    {
+        if (strcmp(rows[i].Name, name) == 0)
+        {
+            rows[i].Count += n;
+            return;
+        }
+    }
+
+    snprintf(rows[*count].Name, sizeof(rows[*count].Name), "%s", name);
+    rows[*count].Count = n;
+    (*count)++;
+}
+
+static void PrintStats(const char *title, unsigned long long ticks, unsigned long long freq,
+                       unsigned long long envelopes, const unsigned long long *effects,
+                       const unsigned long long *extended, const unsigned long long *volume)
+{
+    Row rows[MAX_ROWS];
+    int count = 0;
+    char name[48];
+
+    for (int i = 0; i < XM7_EFFECT_TYPES; i++)
+    {
+        // Exy effects are listed one by one
+        if (i == 0xe)
+            continue;
+
+        if (EffectName[i] == NULL)
+        {
+            snprintf(name, sizeof(name), "%cxx", (i < 10) ? '0' + i : 'A' + i - 10);
+            AddRow(rows, &count, name, effects[i]);
+        }
+        else
+        {
+            AddRow(rows, &count, EffectName[i], effects[i]);
+        }
+    }
+
+    for (int i = 0; i < 16; i++)
+        AddRow(rows, &count, ExtendedEffectName[i], extended[i]);
+
+    for (int i = 1; i < 16; i++)
+        AddRow(rows, &count, VolumeColumnName[i], volume[i]);
+
+    qsort(rows, count, sizeof(Row), CompareRows);
+
+    unsigned long long total = 0;
+    for (int i = 0; i < count; i++)
+        total += rows[i].Count;
+
+    printf("%s: %llu ticks, %llu effect runs (%.2f/tick), %.2f frequency and "
+           "%.2f envelope calculations/tick\n", title, ticks, total,
+           ticks ? (double)total / ticks : 0.0,
+           ticks ? (double)freq / ticks : 0.0,
+           ticks ? (double)envelopes / ticks : 0.0);
+
+    for (int i = 0; i < count; i++)
+    {
+        printf("  %-36s %12llu %6.2f%%\n", rows[i].Name, rows[i].Count,
+               100.0 * rows[i].Count / total);
+    }
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] module.xm|module.mod...\n"
+           "\n"
+           "  -t ticks      Number of ticks to play of each module\n"
+           "                (default: 10000)\n"
+           "  -v            Also print the counters of each module\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long ticks = 10000;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                ticks = strtoul(optarg, NULL, 0);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    XM7_NullBackend_Type nb;
+    XM7_NullBackend_Init(&nb);
+    XM7_SetBackend(&nb.Backend);
+
+    XM7_Initialize();
+    XM7_SetTimerMode(XM7_TIMER_MODE_EXTERNAL);
+
+    XM7_EffectStats_Type stats = { 0 };
+    XM7_SetEffectStats(&stats);
+
+    unsigned long long totalticks = 0, freq = 0, envelopes = 0;
+    unsigned long long effects[XM7_EFFECT_TYPES] = { 0 };
+    unsigned long long extended[16] = { 0 };
+    unsigned long long volume[16] = { 0 };
+    int modules = 0;
+    int failed = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        ModuleFile mf;
+        int ret = ModuleFile_Load(&mf, argv[i]);
+        if (ret != 0)
+        {
+            printf("%s: can't load module (error %d)\n", argv[i], ret);
+            ModuleFile_Free(&mf);
+            failed = 1;
+            continue;
+        }
+
+        XM7_ResetEffectStats(&stats);
+
+        XM7_PlayModule(&mf.Module);
+        XM7_AdvanceTicks(ticks);
+        XM7_StopModule();
+
+        XM7_EffectStats_Type snapshot;
+        XM7_SnapshotEffectStats(&stats, &snapshot);
+
+        totalticks += snapshot.Ticks;
+        freq += snapshot.FreqCalculations;
+        envelopes += snapshot.EnvelopeCalculations;
+        for (int j = 0; j < XM7_EFFECT_TYPES; j++)
+            effects[j] += snapshot.Effects[j];
+        for (int j = 0; j < 16; j++)
+        {
+            extended[j] += snapshot.ExtendedEffects[j];
+            volume[j] += snapshot.VolumeColumn[j];
+        }
+
+        if (verbose)
+        {
+            unsigned long long e[XM7_EFFECT_TYPES], x[16], v[16];
+            for (int j = 0; j < XM7_EFFECT_TYPES; j++)
+                e[j] = snapshot.Effects[j];
+            for (int j = 0; j < 16; j++)
+            {
+                x[j] = snapshot.ExtendedEffects[j];
+                v[j] = snapshot.VolumeColumn[j];
+            }
+
+            PrintStats(argv[i], snapshot.Ticks, snapshot.FreqCalculations,
+                       snapshot.EnvelopeCalculations, e, x, v);
+        }
+
+        ModuleFile_Free(&mf);
+        modules++;
+    }
+
+    XM7_SetEffectStats(NULL);
+
+    char title[32];
+    snprintf(title, sizeof(title), "%d modules", modules);
+    PrintStats(title, totalticks, freq, envelopes, effects, extended, volume);
+
+    return failed;
+}
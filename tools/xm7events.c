@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Plays a module with the null backend and prints the events recorded by the
+// tracepoints of the engine: notes, sample changes, envelope states, jumps,
+// loops and BPM changes. The ring buffer is drained while the module plays,
+// the same way the ARM9 would do it on the DS.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+
+static const char *EventName[7] = {
+    "NOTE", "SAMPLE", "ENVELOPE", "JUMP", "LOOP", "RESTART", "BPM"
+};
+
+static const char *EnvelopeState[4] = {
+    "off", "attack", "sustain", "release"
+};
+
+static void PrintRecord(const XM7_TracepointRecord_Type *rec)
+{
+    const char *name = (rec->Event < 7) ? EventName[rec->Event] : "?";
+
+    printf("%8u ", rec->Tick);
+    if (rec->Channel == XM7_TRACE_NO_CHANNEL)
+        printf("  - ");
+    else
+        printf("%3u ", rec->Channel);
+    printf("%-8s ", name);
+
+    switch (rec->Event)
+    {
+        case XM7_TRACEPOINT_NOTE:
+            printf("note %u instrument %u freq %u\n", rec->A & 0xFF, rec->A >> 8, rec->B);
+            break;
+        case XM7_TRACEPOINT_SAMPLE:
+            printf("note %u instrument %u loop %u\n", rec->A & 0xFF, rec->A >> 8, rec->B);
+            break;
+        case XM7_TRACEPOINT_ENVELOPE:
+            printf("%s %s point %u\n", (rec->A >> 8) ? "panning" : "volume",
+                   EnvelopeState[rec->A & 3], rec->B);
+            break;
+        case XM7_TRACEPOINT_JUMP:
+            printf("position %u row %u\n", rec->A, rec->B);
+            break;
+        case XM7_TRACEPOINT_LOOP:
+            printf("row %u count %u\n", rec->A, rec->B);
+            break;
+        case XM7_TRACEPOINT_RESTART:
+            printf("position %u\n", rec->A);
+            break;
+        case XM7_TRACEPOINT_BPM:
+            printf("%u timer %u\n", rec->A, rec->B);
+            break;
+        default:
+            printf("%u %u\n", rec->A, rec->B);
+            break;
+    }
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] module.xm|module.mod\n"
+           "\n"
+           "  -d ticks      Drain the ring buffer every this many ticks\n"
+           "                (default: 1)\n"
+           "  -n records    Size of the ring buffer, a power of two\n"
+           "                (default: 1024)\n"
+           "  -t ticks      Number of ticks to play (default: 10000)\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long drain = 1;
+    unsigned long capacity = 1024;
+    unsigned long ticks = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                drain = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                capacity = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                ticks = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind != argc - 1) || (drain < 1) || (capacity < 1)
+        || ((capacity & (capacity - 1)) != 0))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    const char *inpath = argv[optind];
+
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, inpath);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", inpath, ret);
+        ModuleFile_Free(&mf);
+        return 1;
+    }
+
+    XM7_TracepointRecord_Type *ring = malloc(capacity * sizeof(XM7_TracepointRecord_Type));
+    XM7_TracepointRecord_Type *records = malloc(capacity * sizeof(XM7_TracepointRecord_Type));
+    if ((ring == NULL) || (records == NULL))
+    {
+        printf("Not enough memory\n");
+        free(records);
+        free(ring);
+        ModuleFile_Free(&mf);
+        return 1;
+    }
+
+    XM7_Tracepoints_Type tp = { 0 };
+    tp.Records = ring;
+    tp.Capacity = capacity;
+
+    XM7_NullBackend_Type nb;
+    XM7_NullBackend_Init(&nb);
+    XM7_SetBackend(&nb.Backend);
+
+    XM7_Initialize();
+    XM7_SetTimerMode(XM7_TIMER_MODE_EXTERNAL);
+    XM7_SetTracepoints(&tp);
+    XM7_PlayModule(&mf.Module);
+
+    u32 next = 0;
+    unsigned long events = 0;
+    unsigned long lost = 0;
+
+    for (unsigned long done = 0; done < ticks; )
+    {
+        unsigned long n = (ticks - done < drain) ? ticks - done : drain;
+        XM7_AdvanceTicks(n);
+        done += n;
+
+        u32 count, skipped;
+        while ((count = XM7_ReadTracepoints(&tp, &next, records, capacity, &skipped)) > 0
+               || (skipped > 0))
+        {
+            if (skipped > 0)
+                printf("(%u events lost)\n", skipped);
+
+            for (u32 i = 0; i < count; i++)
+                PrintRecord(&records[i]);
+
+            events += count;
+            lost += skipped;
+        }
+    }
+
+    XM7_StopModule();
+    XM7_SetTracepoints(NULL);
+
+    printf("%s: %lu ticks, %lu events, %lu lost\n", inpath, ticks, events, lost);
+
+    free(records);
+    free(ring);
+    ModuleFile_Free(&mf);
+    return 0;
+}
@@ -0,0 +1,415 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Generates XM modules that are as hard as possible on the engine or on the
+// loader, to measure the worst case instead of the average of real songs.
+// They are valid XMs (any tracker can open them), but they don't sound good.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+
+#include "common/xm_writer.h"
+
+typedef struct {
+    const char *Name;
+    const char *Description;
+    int (*Build)(XmSong *song);
+} Case;
+
+// a simple generator, so the modules are the same on every run
+static u32 RandomState;
+
+static u32 Random(u32 range)
+{
+    RandomState = RandomState * 1103515245 + 12345;
+    return (RandomState >> 16) % range;
+}
+
+static s8 Sample8[4096];
+static s16 Sample16[4096];
+
+static void CreateSamples(void)
+{
+    // a sawtooth with some noise, so the delta encoding has some work to do
+    RandomState = 1;
+    for (int i = 0; i < 4096; i++)
+    {
+        Sample8[i] = (s8)(((i * 3) & 0xFF) ^ Random(8));
+        Sample16[i] = (s16)(((i * 3) & 0xFF) << 8) ^ Random(2048);
+    }
+}
+
+static void SetSample(XmInstrument *instr, int is16bit, u32 length, u8 looptype)
+{
+    instr->SampleData = is16bit ? (const void *)Sample16 : (const void *)Sample8;
+    instr->SampleLength = length;
+    instr->SampleType = looptype | (is16bit ? XM_SAMPLE_16BIT : 0);
+    instr->LoopStart = (looptype != 0) ? length / 4 : 0;
+    instr->LoopLength = (looptype != 0) ? length - length / 4 : 0;
+    instr->Volume = 64;
+    instr->Panning = 0x80;
+}
+
+// 12 points, a sustain point and a loop on both envelopes, fadeout and
+// autovibrato
+static void SetEnvelopes(XmInstrument *instr, int seed)
+{
+    XmEnvelope *vol = &instr->VolumeEnvelope;
+    XmEnvelope *pan = &instr->PanningEnvelope;
+
+    vol->Points = 12;
+    pan->Points = 12;
+
+    for (int i = 0; i < 12; i++)
+    {
+        // points close to each other, so the envelopes keep moving
+        vol->X[i] = i * (2 + seed % 3);
+        vol->Y[i] = (i & 1) ? 8 + seed % 16 : 64;
+        pan->X[i] = i * (3 + seed % 2);
+        pan->Y[i] = (i & 1) ? 0 : 64;
+    }
+
+    vol->Sustain = 3;
+    vol->LoopStart = 4;
+    vol->LoopEnd = 11;
+    vol->Type = XM_ENVELOPE_ON | XM_ENVELOPE_SUSTAIN | XM_ENVELOPE_LOOP;
+
+    pan->Sustain = 2;
+    pan->LoopStart = 2;
+    pan->LoopEnd = 11;
+    pan->Type = XM_ENVELOPE_ON | XM_ENVELOPE_SUSTAIN | XM_ENVELOPE_LOOP;
+
+    instr->VolumeFadeout = 0x80;
+    instr->VibratoType = seed % 4;
+    instr->VibratoSweep = 0;
+    instr->VibratoDepth = 15;
+    instr->VibratoRate = 32;
+}
+
+static void AddInstruments(XmSong *song, int count, int envelopes)
+{
+    for (int i = 0; i < count; i++)
+    {
+        XmInstrument *instr = &song->Instrument[i];
+
+        SetSample(instr, i & 1, 1024, (i & 2) ? XM_SAMPLE_PINGPONG : XM_SAMPLE_FORWARD);
+        if (envelopes)
+            SetEnvelopes(instr, i);
+    }
+
+    song->NumberofInstruments = count;
+}
+
+static void SetOrders(XmSong *song)
+{
+    song->SongLength = song->NumberofPatterns;
+    for (int i = 0; i < song->NumberofPatterns; i++)
+        song->Order[i] = i;
+}
+
+// effects that do something on every tick, with their parameters
+static const u8 TickEffects[][2] = {
+    { 0x0, 0x47 },              // arpeggio
+    { 0x1, 0x08 },              // portamento up
+    { 0x2, 0x08 },              // portamento down
+    { 0x3, 0x20 },              // portamento to note
+    { 0x4, 0xCF },              // vibrato
+    { 0x5, 0x11 },              // portamento to note and volume slide
+    { 0x6, 0x11 },              // vibrato and volume slide
+    { 0x7, 0xCF },              // tremolo
+    { 0xA, 0x21 },              // volume slide
+    { 0xE, 0x91 },              // retrigger every tick
+    { XM_EFFECT_H, 0x01 },      // global volume slide
+    { XM_EFFECT_P, 0x21 },      // panning slide
+    { XM_EFFECT_R, 0x11 },      // retrigger every tick with volume slide
+    { XM_EFFECT_T, 0x11 },      // tremor
+};
+
+#define NUM_TICK_EFFECTS    (sizeof(TickEffects) / sizeof(TickEffects[0]))
+
+// volume column effects that work on every tick
+static u8 RandomVolumeEffect(void)
+{
+    static const u8 effects[] = { 0x61, 0x71, 0xB8, 0xD1, 0xE1, 0xF8 };
+
+    return effects[Random(sizeof(effects))];
+}
+
+// a note, an instrument, a volume column effect and an effect on every cell
+static int FillBusy(XmSong *song, int patterns, int instruments, const u8 (*effects)[2],
+                    int numeffects)
+{
+    for (int p = 0; p < patterns; p++)
+    {
+        int pattern = XmSong_AddPattern(song, 64);
+        if (pattern < 0)
+            return -1;
+
+        for (int row = 0; row < 64; row++)
+        {
+            for (int chn = 0; chn < song->Channels; chn++)
+            {
+                XmCell *cell = XmSong_Cell(song, pattern, row, chn);
+                int effect = Random(numeffects);
+
+                cell->Note = 13 + Random(72);
+                cell->Instrument = 1 + Random(instruments);
+                cell->Volume = RandomVolumeEffect();
+                cell->EffectType = effects[effect][0];
+                cell->EffectParam = effects[effect][1];
+            }
+        }
+    }
+
+    SetOrders(song);
+    return 0;
+}
+
+static int BuildBusyRows(XmSong *song)
+{
+    AddInstruments(song, 16, 0);
+    return FillBusy(song, 8, 16, TickEffects, NUM_TICK_EFFECTS);
+}
+
+static int BuildEnvelopes(XmSong *song)
+{
+    AddInstruments(song, 32, 1);
+
+    for (int p = 0; p < 4; p++)
+    {
+        int pattern = XmSong_AddPattern(song, 64);
+        if (pattern < 0)
+            return -1;
+
+        for (int row = 0; row < 64; row++)
+        {
+            for (int chn = 0; chn < song->Channels; chn++)
+            {
+                XmCell *cell = XmSong_Cell(song, pattern, row, chn);
+
+                // notes and key offs, on different rows for each channel, so
+                // the envelopes go through the sustain, the loops and the
+                // fadeout all the time
+                int phase = (row + chn) % 8;
+                if (phase == 0)
+                {
+                    cell->Note = 13 + Random(72);
+                    cell->Instrument = 1 + Random(32);
+                }
+                else if (phase == 5)
+                {
+                    cell->Note = XM_NOTE_OFF;
+                }
+                else if (phase == 3)
+                {
+                    // jump inside the envelopes
+                    cell->EffectType = XM_EFFECT_L;
+                    cell->EffectParam = Random(24);
+                }
+            }
+        }
+    }
+
+    SetOrders(song);
+    return 0;
+}
+
+static int BuildTempo1(XmSong *song)
+{
+    // every tick is the first tick of a row
+    song->Tempo = 1;
+    song->BPM = 255;
+
+    AddInstruments(song, 16, 1);
+    return FillBusy(song, 8, 16, TickEffects, NUM_TICK_EFFECTS);
+}
+
+static int BuildRetrig(XmSong *song)
+{
+    static const u8 effects[][2] = {
+        { XM_EFFECT_R, 0x11 },
+        { XM_EFFECT_R, 0x81 },
+        { XM_EFFECT_R, 0xF1 },
+        { 0xE, 0x91 },
+    };
+
+    song->Tempo = 31;
+    AddInstruments(song, 16, 1);
+    return FillBusy(song, 4, 16, effects, 4);
+}
+
+static int BuildAmigaPorta(XmSong *song)
+{
+    static const u8 effects[][2] = {
+        { 0x1, 0x10 },
+        { 0x2, 0x10 },
+        { 0x3, 0x40 },
+        { 0x5, 0x11 },
+        { 0xE, 0x1F },              // fine portamentos
+        { 0xE, 0x2F },
+        { XM_EFFECT_X, 0x1F },      // extra fine portamentos
+        { XM_EFFECT_X, 0x2F },
+    };
+
+    song->AmigaFrequencies = 1;
+    AddInstruments(song, 16, 0);
+    return FillBusy(song, 8, 16, effects, 8);
+}
+
+static int BuildWorst(XmSong *song)
+{
+    // 2 ticks per row: a row every other tick, and every tick effects between
+    song->Tempo = 2;
+    song->BPM = 255;
+    song->AmigaFrequencies = 1;
+
+    AddInstruments(song, 64, 1);
+    return FillBusy(song, 16, 64, TickEffects, NUM_TICK_EFFECTS);
+}
+
+static int BuildLoader(XmSong *song)
+{
+    // the biggest number of patterns and rows, without empty cells, and many
+    // 16 bit samples with ping-pong loops
+    AddInstruments(song, 128, 1);
+    for (int i = 0; i < 128; i++)
+        SetSample(&song->Instrument[i], 1, 4096, XM_SAMPLE_PINGPONG);
+
+    for (int p = 0; p < 256; p++)
+    {
+        int pattern = XmSong_AddPattern(song, 256);
+        if (pattern < 0)
+            return -1;
+
+        for (int row = 0; row < 256; row++)
+        {
+            for (int chn = 0; chn < song->Channels; chn++)
+            {
+                XmCell *cell = XmSong_Cell(song, pattern, row, chn);
+                int effect = Random(NUM_TICK_EFFECTS);
+
+                cell->Note = 1 + Random(96);
+                cell->Instrument = 1 + Random(128);
+                cell->Volume = RandomVolumeEffect();
+                cell->EffectType = TickEffects[effect][0];
+                cell->EffectParam = TickEffects[effect][1];
+            }
+        }
+    }
+
+    SetOrders(song);
+    return 0;
+}
+
+static const Case Cases[] = {
+    { "busy-rows", "16 channels, a note, a volume effect and an effect on every cell", BuildBusyRows },
+    { "envelopes", "12 point envelopes with sustain and loops on all the instruments", BuildEnvelopes },
+    { "tempo1", "speed 1 at 255 BPM, a row on every tick", BuildTempo1 },
+    { "retrig", "Rxy and E9x retriggers on every tick", BuildRetrig },
+    { "amiga-porta", "Amiga frequencies with portamentos everywhere", BuildAmigaPorta },
+    { "worst", "all of the above together", BuildWorst },
+    { "loader", "256 full patterns of 256 rows and 128 instruments with ping-pong loops", BuildLoader },
+};
+
+#define NUM_CASES           (sizeof(Cases) / sizeof(Cases[0]))
+
+static int Generate(const Case *c, const char *dir)
+{
+    XmSong *song = malloc(sizeof(XmSong));
+    if (song == NULL)
+        return -1;
+
+    XmSong_Init(song, 16);
+    snprintf(song->Name, sizeof(song->Name), "%s", c->Name);
+
+    // the same modules on every run
+    RandomState = 1;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.xm", dir, c->Name);
+
+    int ret = c->Build(song);
+    if (ret == 0)
+        ret = XmSong_Save(song, path);
+
+    if (ret == 0)
+        printf("%s: %s\n", path, c->Description);
+    else
+        printf("%s: can't create module\n", path);
+
+    XmSong_Free(song);
+    free(song);
+
+    return ret;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] [module...]\n"
+           "\n"
+           "  -o directory  Where to save the modules (default: current directory)\n"
+           "\n"
+           "Modules (default: all of them):\n",
+           name);
+
+    for (size_t i = 0; i < NUM_CASES; i++)
+        printf("  %-12s  %s\n", Cases[i].Name, Cases[i].Description);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = ".";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                dir = optarg;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    int selected[NUM_CASES];
+    for (size_t i = 0; i < NUM_CASES; i++)
+        selected[i] = (optind == argc);
+
+    for (int i = optind; i < argc; i++)
+    {
+        size_t j;
+        for (j = 0; j < NUM_CASES; j++)
+        {
+            if (strcmp(argv[i], Cases[j].Name) == 0)
+                break;
+        }
+
+        if (j == NUM_CASES)
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+
+        selected[j] = 1;
+    }
+
+    CreateSamples();
+
+    int failed = 0;
+
+    for (size_t i = 0; i < NUM_CASES; i++)
+    {
+        if (selected[i] && (Generate(&Cases[i], dir) != 0))
+            failed = 1;
+    }
+
+    return failed;
+}
@@ -0,0 +1,547 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Conformance checks of the engine against golden traces.
+//
+// For every tick, the state of the sound registers of all channels after the
+// tick (frequency, volume, panning, sample and loop) is saved in a golden file.
+// Later, after changing the engine, the same modules can be checked against the
+// golden files, and any difference is reported with the order position, row
+// and tick where it happened. Sample addresses are saved as an instrument and
+// sample number plus an offset, so they don't depend on where the samples are
+// allocated.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/file_list.h"
+#include "common/module_file.h"
+#include "common/render.h"
+
+#define GOLDEN_MAGIC        "XM7GOLD"
+#define GOLDEN_VERSION      1
+
+// sample number for the silence sample, and for addresses that aren't inside
+// any sample of the module
+#define SAMPLE_SILENCE      0x0000
+#define SAMPLE_UNKNOWN      0xFFFF
+
+// the mismatches of a module that get printed
+#define MAX_REPORTED        10
+
+typedef struct {
+    u32 Cnt;
+    u32 Len;
+    u32 Offset;             // from the start of the sample
+    u16 Tmr;
+    u16 Pnt;
+    u16 Sample;             // (instrument << 8) | sample, 1-based instrument
+} ChannelState;
+
+#define CHANNEL_STATE_SIZE  18
+
+typedef struct {
+    u8 Order;
+    u8 Row;
+    u8 Tick;
+    ChannelState Channel[16];   // DS hardware channels
+} TickState;
+
+static void Put16(u8 *p, u16 value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static void Put32(u8 *p, u32 value)
+{
+    Put16(p, value & 0xFFFF);
+    Put16(p + 2, value >> 16);
+}
+
+static u16 Get16(const u8 *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static u32 Get32(const u8 *p)
+{
+    return Get16(p) | ((u32)Get16(p + 2) << 16);
+}
+
+static void IdentifySample(const XM7_ModuleManager_Type *module, const void *data,
+                           u16 *sample, u32 *offset)
+{
+    const u8 *sad = data;
+
+    *sample = SAMPLE_UNKNOWN;
+    *offset = 0;
+
+    if (sad == (const u8 *)&module->Silence)
+    {
+        *sample = SAMPLE_SILENCE;
+        return;
+    }
+
+    // the closest sample that starts before the address
+    for (int i = 0; i < module->NumberofInstruments; i++)
+    {
+        const XM7_Instrument_Type *instr = module->Instrument[i];
+        if (instr == NULL)
+            continue;
+
+        for (int j = 0; j < instr->NumberofSamples; j++)
+        {
+            const XM7_Sample_Type *smp = instr->Sample[j];
+            if ((smp == NULL) || (smp->SampleData == NULL))
+                continue;
+
+            const u8 *start = (const u8 *)smp->SampleData;
+            if ((start <= sad) && ((*sample == SAMPLE_UNKNOWN) || ((u32)(sad - start) < *offset)))
+            {
+                *sample = ((i + 1) << 8) | j;
+                *offset = sad - start;
+            }
+        }
+    }
+}
+
+static void CaptureState(const XM7_ModuleManager_Type *module, const XM7_SoundUnit_Type *su,
+                         TickState *ts)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        const XM7_SoundUnitChannel_Type *ch = &su->Channel[i];
+        ChannelState *cs = &ts->Channel[i];
+
+        // nothing is mixed, so the channel registers are exactly what the
+        // engine wrote (a sample change waits in the Next fields)
+        const void *data = ch->HasNextSample ? ch->NextData : ch->Data;
+
+        cs->Cnt = ch->Cnt;
+        cs->Tmr = ch->Timer;
+        cs->Pnt = ch->HasNextSample ? ch->NextLoopStart : ch->LoopStart;
+        cs->Len = ch->HasNextSample ? ch->NextLength : ch->Length;
+
+        if (data != NULL)
+            IdentifySample(module, data, &cs->Sample, &cs->Offset);
+        else
+            cs->Sample = SAMPLE_SILENCE, cs->Offset = 0;
+    }
+}
+
+// Plays the module and calls the callback after every tick. It stops at the
+// end of the song or after `maxticks` ticks.
+typedef int (*TickFn)(void *arg, unsigned long index, const TickState *ts);
+
+static int PlayModule(XM7_ModuleManager_Type *module, unsigned long maxticks,
+                      TickFn fn, void *arg)
+{
+    Renderer *r = malloc(sizeof(Renderer));
+    if (r == NULL)
+        return -1;
+
+    int ret = 0;
+    TickState ts;
+
+    Renderer_Start(r, module, 32768);
+
+    while ((ret == 0) && (r->Ticks < maxticks))
+    {
+        ts.Order = module->CurrentSongPosition;
+        ts.Row = module->CurrentLine;
+        ts.Tick = module->CurrentTick;
+
+        if (Renderer_Tick(r) == 0)
+            break;
+
+        CaptureState(module, &r->Unit, &ts);
+        ret = fn(arg, r->Ticks - 1, &ts);
+    }
+
+    Renderer_Stop(r);
+    free(r);
+
+    return ret;
+}
+
+// Golden files: a header ("XM7GOLD", version, number of ticks) and, for each
+// tick, the order, row and tick, a mask of the channels that have changed since
+// the previous tick, and the state of those channels. All little endian.
+
+typedef struct {
+    FILE *File;
+    u32 Ticks;
+    TickState Last;
+} GoldenWriter;
+
+static int WriteGoldenTick(void *arg, unsigned long index, const TickState *ts)
+{
+    GoldenWriter *gw = arg;
+    u8 buffer[5 + 16 * CHANNEL_STATE_SIZE];
+    u16 mask = 0;
+    size_t size = 5;
+
+    for (int i = 0; i < 16; i++)
+    {
+        const ChannelState *cs = &ts->Channel[i];
+
+        if ((index > 0) && (memcmp(cs, &gw->Last.Channel[i], sizeof(ChannelState)) == 0))
+            continue;
+
+        mask |= 1 << i;
+
+        u8 *p = &buffer[size];
+        Put32(p, cs->Cnt);
+        Put32(p + 4, cs->Len);
+        Put32(p + 8, cs->Offset);
+        Put16(p + 12, cs->Tmr);
+        Put16(p + 14, cs->Pnt);
+        Put16(p + 16, cs->Sample);
+        size += CHANNEL_STATE_SIZE;
+    }
+
+    buffer[0] = ts->Order;
+    buffer[1] = ts->Row;
+    buffer[2] = ts->Tick;
+    Put16(&buffer[3], mask);
+
+    gw->Last = *ts;
+    gw->Ticks++;
+
+    return (fwrite(buffer, size, 1, gw->File) == 1) ? 0 : -1;
+}
+
+static int WriteGoldenHeader(GoldenWriter *gw)
+{
+    u8 header[12];
+
+    memcpy(header, GOLDEN_MAGIC, 7);
+    header[7] = GOLDEN_VERSION;
+    Put32(&header[8], gw->Ticks);
+
+    if (fseek(gw->File, 0, SEEK_SET) != 0)
+        return -1;
+
+    return (fwrite(header, sizeof(header), 1, gw->File) == 1) ? 0 : -1;
+}
+
+typedef struct {
+    FILE *File;
+    u32 Ticks;
+    u32 Read;
+    TickState Golden;
+
+    const char *Name;
+    const XM7_ModuleManager_Type *Module;
+    unsigned long Mismatches;
+} GoldenChecker;
+
+static int ReadGoldenTick(GoldenChecker *gc)
+{
+    u8 buffer[5 + 16 * CHANNEL_STATE_SIZE];
+
+    if (fread(buffer, 5, 1, gc->File) != 1)
+        return -1;
+
+    gc->Golden.Order = buffer[0];
+    gc->Golden.Row = buffer[1];
+    gc->Golden.Tick = buffer[2];
+    u16 mask = Get16(&buffer[3]);
+
+    for (int i = 0; i < 16; i++)
+    {
+        if ((mask & (1 << i)) == 0)
+            continue;
+
+        if (fread(buffer, CHANNEL_STATE_SIZE, 1, gc->File) != 1)
+            return -1;
+
+        ChannelState *cs = &gc->Golden.Channel[i];
+        cs->Cnt = Get32(&buffer[0]);
+        cs->Len = Get32(&buffer[4]);
+        cs->Offset = Get32(&buffer[8]);
+        cs->Tmr = Get16(&buffer[12]);
+        cs->Pnt = Get16(&buffer[14]);
+        cs->Sample = Get16(&buffer[16]);
+    }
+
+    gc->Read++;
+    return 0;
+}
+
+static void ReportMismatch(GoldenChecker *gc, unsigned long index, const TickState *ts,
+                           int hwchannel, const char *what, u32 expected, u32 found)
+{
+    gc->Mismatches++;
+    if (gc->Mismatches > MAX_REPORTED)
+        return;
+
+    // the engine uses hardware channels starting from the last one
+    printf("%s: order %u row %u tick %u (tick #%lu) channel %d: %s is 0x%X, expected 0x%X\n",
+           gc->Name, ts->Order, ts->Row, ts->Tick, index + 1, 15 - hwchannel, what,
+           found, expected);
+}
+
+static int CheckGoldenTick(void *arg, unsigned long index, const TickState *ts)
+{
+    GoldenChecker *gc = arg;
+
+    if (gc->Read >= gc->Ticks)
+    {
+        gc->Mismatches++;
+        printf("%s: the song is longer than the golden trace (%u ticks)\n", gc->Name, gc->Ticks);
+        return -1;
+    }
+
+    if (ReadGoldenTick(gc) != 0)
+    {
+        printf("%s: truncated golden trace\n", gc->Name);
+        return -1;
+    }
+
+    const TickState *gs = &gc->Golden;
+
+    if ((gs->Order != ts->Order) || (gs->Row != ts->Row) || (gs->Tick != ts->Tick))
+    {
+        gc->Mismatches++;
+        printf("%s: tick #%lu is at order %u row %u tick %u, expected order %u row %u tick %u\n",
+               gc->Name, index + 1, ts->Order, ts->Row, ts->Tick, gs->Order, gs->Row, gs->Tick);
+
+        // everything after this is going to be different
+        return -1;
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        const ChannelState *e = &gs->Channel[i];
+        const ChannelState *f = &ts->Channel[i];
+
+        if ((e->Cnt & SOUNDXCNT_ENABLE) != (f->Cnt & SOUNDXCNT_ENABLE))
+            ReportMismatch(gc, index, ts, i, "enable", e->Cnt >> 31, f->Cnt >> 31);
+        if (e->Tmr != f->Tmr)
+            ReportMismatch(gc, index, ts, i, "frequency (timer)", e->Tmr, f->Tmr);
+        if ((e->Cnt & 0x7F) != (f->Cnt & 0x7F))
+            ReportMismatch(gc, index, ts, i, "volume", e->Cnt & 0x7F, f->Cnt & 0x7F);
+        if (((e->Cnt >> 16) & 0x7F) != ((f->Cnt >> 16) & 0x7F))
+            ReportMismatch(gc, index, ts, i, "panning", (e->Cnt >> 16) & 0x7F, (f->Cnt >> 16) & 0x7F);
+        if ((e->Cnt & ~0x807F007F) != (f->Cnt & ~0x807F007F))
+            ReportMismatch(gc, index, ts, i, "format/loop mode", e->Cnt & ~0x807F007F, f->Cnt & ~0x807F007F);
+        if (e->Sample != f->Sample)
+            ReportMismatch(gc, index, ts, i, "sample (instrument << 8 | sample)", e->Sample, f->Sample);
+        else if (e->Offset != f->Offset)
+            ReportMismatch(gc, index, ts, i, "sample offset", e->Offset, f->Offset);
+        if (e->Pnt != f->Pnt)
+            ReportMismatch(gc, index, ts, i, "loop start (PNT)", e->Pnt, f->Pnt);
+        if (e->Len != f->Len)
+            ReportMismatch(gc, index, ts, i, "loop length (LEN)", e->Len, f->Len);
+    }
+
+    return 0;
+}
+
+static char *GoldenPath(const char *dir, const char *modpath)
+{
+    const char *name = modpath;
+
+    if (dir != NULL)
+    {
+        name = strrchr(modpath, '/');
+        name = (name != NULL) ? name + 1 : modpath;
+    }
+
+    size_t len = (dir != NULL ? strlen(dir) + 1 : 0) + strlen(name) + 8;
+    char *path = malloc(len);
+    if (path != NULL)
+    {
+        if (dir != NULL)
+            snprintf(path, len, "%s/%s.golden", dir, name);
+        else
+            snprintf(path, len, "%s.golden", name);
+    }
+
+    return path;
+}
+
+static int Generate(const char *modpath, const char *goldpath, unsigned long maxticks)
+{
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, modpath);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", modpath, ret);
+        ModuleFile_Free(&mf);
+        return -1;
+    }
+
+    GoldenWriter gw = { 0 };
+    gw.File = fopen(goldpath, "wb");
+
+    if ((gw.File == NULL) || (WriteGoldenHeader(&gw) != 0) ||
+        (PlayModule(&mf.Module, maxticks, WriteGoldenTick, &gw) != 0) ||
+        (WriteGoldenHeader(&gw) != 0))
+        ret = -1;
+
+    if ((gw.File != NULL) && (fclose(gw.File) != 0))
+        ret = -1;
+
+    if (ret == 0)
+        printf("%s: %u ticks\n", goldpath, gw.Ticks);
+    else
+        printf("%s: can't write golden trace\n", goldpath);
+
+    ModuleFile_Free(&mf);
+    return ret;
+}
+
+static int Check(const char *modpath, const char *goldpath, unsigned long maxticks)
+{
+    GoldenChecker gc = { 0 };
+    gc.Name = modpath;
+
+    gc.File = fopen(goldpath, "rb");
+    u8 header[12];
+    if ((gc.File == NULL) || (fread(header, sizeof(header), 1, gc.File) != 1) ||
+        (memcmp(header, GOLDEN_MAGIC, 7) != 0) || (header[7] != GOLDEN_VERSION))
+    {
+        printf("%s: can't read golden trace %s\n", modpath, goldpath);
+        if (gc.File != NULL)
+            fclose(gc.File);
+        return -1;
+    }
+    gc.Ticks = Get32(&header[8]);
+
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, modpath);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", modpath, ret);
+        ModuleFile_Free(&mf);
+        fclose(gc.File);
+        return -1;
+    }
+
+    gc.Module = &mf.Module;
+    PlayModule(&mf.Module, maxticks, CheckGoldenTick, &gc);
+
+    // the golden trace may have been generated with a higher tick limit
+    if ((gc.Read < gc.Ticks) && (gc.Mismatches == 0) && (gc.Read < maxticks))
+    {
+        gc.Mismatches++;
+        printf("%s: the song ended after %u ticks, expected %u\n", modpath, gc.Read, gc.Ticks);
+    }
+
+    if (gc.Mismatches > MAX_REPORTED)
+        printf("%s: ... and %lu more\n", modpath, gc.Mismatches - MAX_REPORTED);
+
+    if (gc.Mismatches == 0)
+        printf("%s: OK, %u ticks\n", modpath, gc.Read);
+
+    fclose(gc.File);
+    ModuleFile_Free(&mf);
+
+    return (gc.Mismatches == 0) ? 0 : -1;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s generate|check [options] directory|module...\n"
+           "\n"
+           "generate: play the modules and save their golden traces\n"
+           "check:    play the modules and compare them with their golden traces\n"
+           "\n"
+           "  -d directory  Directory of the golden traces (default: next to\n"
+           "                each module, as module.xm.golden)\n"
+           "  -n ticks      Maximum number of ticks of each module (default:\n"
+           "                until the song ends, up to 100000)\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    int generate;
+    if (strcmp(argv[1], "generate") == 0)
+        generate = 1;
+    else if (strcmp(argv[1], "check") == 0)
+        generate = 0;
+    else
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    const char *golddir = NULL;
+    unsigned long maxticks = 100000;
+    int opt;
+
+    optind = 2;
+    while ((opt = getopt(argc, argv, "d:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                golddir = optarg;
+                break;
+            case 'n':
+                maxticks = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    FileList files;
+    FileList_Init(&files);
+    for (int i = optind; i < argc; i++)
+    {
+        if (FileList_Add(&files, argv[i]) != 0)
+        {
+            printf("%s: can't read\n", argv[i]);
+            FileList_Free(&files);
+            return 1;
+        }
+    }
+
+    size_t failed = 0;
+
+    for (size_t i = 0; i < files.Count; i++)
+    {
+        char *goldpath = GoldenPath(golddir, files.Path[i]);
+        if (goldpath == NULL)
+        {
+            failed++;
+            continue;
+        }
+
+        int ret = generate ? Generate(files.Path[i], goldpath, maxticks)
+                           : Check(files.Path[i], goldpath, maxticks);
+        if (ret != 0)
+            failed++;
+
+        free(goldpath);
+    }
+
+    printf("\n%zu modules, %zu %s\n", files.Count, failed, generate ? "errors" : "failed");
+
+    FileList_Free(&files);
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,587 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Measures the speed of the loaders (XM7_LoadXM() and XM7_LoadMOD(), or
+// XM7_LoadXMArena() and XM7_LoadMODArena() with -a, or XM7_LoadXMStream() and
+// XM7_LoadMODStream() with -s, or XM7_LoadMODResident() for the MODs with -r).
+//
+// Each module is read into RAM once and then loaded and unloaded several
+// times. The fastest load is reported, with the time of each phase of the
+// loader, the number of allocations, and the heap used by the module. The
+// results are printed as CSV (or as JSON lines), one module per line, and a
+// summary is printed to stderr. With -b the speed is compared with a CSV file
+// saved from a previous run, to see what a change to the loaders gained.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/file_list.h"
+#include "common/module_file.h"
+
+static const char *PhaseNames[XM7_LOAD_PHASE_COUNT] = {
+    "headers", "patterns", "periods", "samples", "pingpong"
+};
+
+typedef struct {
+    int Error;
+    int IsMOD;
+    unsigned long long BestNs;
+    XM7_LoaderStats_Type Stats;     // of the fastest load
+    long long HeapBytes;            // -1 if it can't be measured
+} LoadResult;
+
+#ifdef __GLIBC__
+// size of a heap block, including the size field that precedes it
+static long long BlockSize(void *ptr)
+{
+    return malloc_usable_size(ptr) + sizeof(size_t);
+}
+#endif
+
+// Bytes of heap used by a module, including the allocator overhead, or -1 if
+// it can't be measured
+static long long ModuleHeapBytes(const XM7_ModuleManager_Type *module)
+{
+#ifdef __GLIBC__
+    if (module->Arena != NULL)
+        return BlockSize(module->Arena);
+
+    long long bytes = 0;
+
+    for (int i = 0; i < module->NumberofPatterns; i++)
+        bytes += BlockSize(module->Pattern[i]);
+
+    for (int i = 0; i < module->NumberofInstruments; i++)
+    {
+        XM7_Instrument_Type *instr = module->Instrument[i];
+        if (instr == NULL)
+            continue;
+
+        bytes += BlockSize(instr);
+
+        for (int j = 0; j < instr->NumberofSamples; j++)
+        {
+            bytes += BlockSize(instr->Sample[j]);
+
+            // the samples played from a resident file aren't allocated
+            const u8 *data = (const u8 *)instr->Sample[j]->SampleData;
+            const u8 *file = module->File;
+            if ((file == NULL) || (data < file) || (data >= file + module->FileSize))
+                bytes += BlockSize(instr->Sample[j]->SampleData);
+        }
+    }
+
+    return bytes;
+#else
+    (void)module;
+    return -1;
+#endif
+}
+
+// Loads a module (as XM or MOD) into a single arena allocated by the loader
+static int LoadModuleArena(XM7_ModuleManager_Type *module, const void *data)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    int ret = XM7_LoadXMArena(module, data, NULL, 0);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+        ret = XM7_LoadMODArena(module, data, NULL, 0);
+
+    return ret;
+}
+
+// A file in RAM read through XM7_Stream_Type
+typedef struct {
+    const u8 *Data;
+    size_t Size;
+    size_t Position;
+} MemoryStream;
+
+static u32 MemoryStreamRead(void *buffer, u32 size, void *user)
+{
+    MemoryStream *ms = user;
+
+    if (size > ms->Size - ms->Position)
+        size = ms->Size - ms->Position;
+
+    memcpy(buffer, ms->Data + ms->Position, size);
+    ms->Position += size;
+    return size;
+}
+
+static int MemoryStreamSeek(u32 offset, void *user)
+{
+    MemoryStream *ms = user;
+
+    if (offset > ms->Size - ms->Position)
+        return -1;
+
+    ms->Position += offset;
+    return 0;
+}
+
+// Loads a module (as XM or MOD) through a stream
+static int LoadModuleStream(XM7_ModuleManager_Type *module, const void *data, size_t size)
+{
+    MemoryStream ms = { data, size, 0 };
+    XM7_Stream_Type stream = { MemoryStreamRead, MemoryStreamSeek, &ms };
+
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    int ret = XM7_LoadXMStream(module, &stream);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+    {
+        ms.Position = 0;
+        ret = XM7_LoadMODStream(module, &stream);
+    }
+
+    return ret;
+}
+
+// Loads a module, playing the samples from the file if it's a MOD
+static int LoadModuleResident(XM7_ModuleManager_Type *module, const void *data)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    int ret = XM7_LoadXM(module, data);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+        ret = XM7_LoadMODResident(module, data);
+
+    return ret;
+}
+
+typedef enum {
+    LOAD_RAM,
+    LOAD_ARENA,
+    LOAD_STREAM,
+    LOAD_RESIDENT
+} LoadMode;
+
+static int LoadModule(XM7_ModuleManager_Type *module, const void *data, size_t size, LoadMode mode)
+{
+    switch (mode)
+    {
+        case LOAD_ARENA:
+            return LoadModuleArena(module, data);
+        case LOAD_STREAM:
+            return LoadModuleStream(module, data, size);
+        case LOAD_RESIDENT:
+            return LoadModuleResident(module, data);
+        default:
+            return ModuleFile_LoadModule(module, data);
+    }
+}
+
+static void BenchmarkModule(const void *data, size_t size, int repeats, LoadMode mode,
+                            LoadResult *res)
+{
+    memset(res, 0, sizeof(LoadResult));
+    res->HeapBytes = -1;
+
+    XM7_ModuleManager_Type *module = malloc(sizeof(XM7_ModuleManager_Type));
+    if (module == NULL)
+    {
+        res->Error = -1;
+        return;
+    }
+
+    for (int i = 0; i < repeats; i++)
+    {
+        XM7_LoaderStats_Type stats = { 0 };
+
+        XM7_SetLoaderStats(&stats);
+        unsigned long long start = TimeNowNs();
+        int ret = LoadModule(module, data, size, mode);
+        unsigned long long elapsed = TimeNowNs() - start;
+        XM7_SetLoaderStats(NULL);
+
+        // the loader doesn't free anything while it loads a module, so the
+        // heap used by the module is also the peak
+        long long heap = (ret == 0) ? ModuleHeapBytes(module) : -1;
+
+        res->IsMOD = (module->TrackerName[0] == '*');
+        ModuleFile_UnloadModule(module);
+
+        if (ret != 0)
+        {
+            res->Error = ret;
+            break;
+        }
+
+        if ((i == 0) || (elapsed < res->BestNs))
+        {
+            res->BestNs = elapsed;
+            res->Stats = stats;
+            res->HeapBytes = heap;
+        }
+    }
+
+    free(module);
+}
+
+static void PrintHeader(int json)
+{
+    if (json)
+        return;
+
+    printf("file,format,bytes,error,best_ns,mb_per_s,allocations,allocated_bytes,heap_bytes");
+    for (int i = 0; i < XM7_LOAD_PHASE_COUNT; i++)
+        printf(",%s_ns", PhaseNames[i]);
+    printf("\n");
+}
+
+static void PrintResult(int json, const char *path, size_t size, const LoadResult *res)
+{
+    double mbs = (res->BestNs > 0) ? (size / 1e6) / (res->BestNs / 1e9) : 0;
+
+    if (json)
+    {
+        printf("{\"file\":\"");
+        for (const char *c = path; *c != '\0'; c++)
+        {
+            if ((*c == '"') || (*c == '\\'))
+                putchar('\\');
+            putchar(*c);
+        }
+        printf("\",\"format\":\"%s\",\"bytes\":%zu,\"error\":%d,\"best_ns\":%llu,"
+               "\"mb_per_s\":%.2f,\"allocations\":%u,\"allocated_bytes\":%llu,"
+               "\"heap_bytes\":%lld,\"phases_ns\":{",
+               res->IsMOD ? "mod" : "xm", size, res->Error, res->BestNs, mbs,
+               res->Stats.Allocations, (unsigned long long)res->Stats.AllocatedBytes,
+               res->HeapBytes);
+        for (int i = 0; i < XM7_LOAD_PHASE_COUNT; i++)
+        {
+            printf("%s\"%s\":%llu", (i > 0) ? "," : "", PhaseNames[i],
+                   (unsigned long long)res->Stats.PhaseNs[i]);
+        }
+        printf("}}\n");
+    }
+    else
+    {
+        // paths with commas or quotes are quoted
+        if (strpbrk(path, ",\"\n") != NULL)
+        {
+            putchar('"');
+            for (const char *c = path; *c != '\0'; c++)
+            {
+                if (*c == '"')
+                    putchar('"');
+                putchar(*c);
+            }
+            putchar('"');
+        }
+        else
+        {
+            printf("%s", path);
+        }
+
+        printf(",%s,%zu,%d,%llu,%.2f,%u,%llu,%lld", res->IsMOD ? "mod" : "xm", size,
+               res->Error, res->BestNs, mbs, res->Stats.Allocations,
+               (unsigned long long)res->Stats.AllocatedBytes, res->HeapBytes);
+        for (int i = 0; i < XM7_LOAD_PHASE_COUNT; i++)
+            printf(",%llu", (unsigned long long)res->Stats.PhaseNs[i]);
+        printf("\n");
+    }
+}
+
+// Speed of the modules of a previous run, read from its CSV output
+typedef struct {
+    char **Path;
+    unsigned long long *Bytes;
+    unsigned long long *BestNs;
+    size_t Count;
+} Baseline;
+
+// Reads a field of a CSV line (quoted or not) into `field`, returns the start
+// of the next field, or NULL if there are no more fields
+static const char *ReadField(const char *line, char *field, size_t size)
+{
+    size_t len = 0;
+    int quoted = (*line == '"');
+
+    if (quoted)
+        line++;
+
+    while ((*line != '\0') && (*line != '\n'))
+    {
+        if (quoted && (*line == '"'))
+        {
+            if (line[1] != '"')
+            {
+                quoted = 0;
+                line++;
+                continue;
+            }
+            line++;
+        }
+        else if (!quoted && (*line == ','))
+        {
+            break;
+        }
+
+        if (len + 1 < size)
+            field[len++] = *line;
+        line++;
+    }
+
+    field[len] = '\0';
+    return (*line == ',') ? line + 1 : NULL;
+}
+
+static int Baseline_Load(Baseline *base, const char *path)
+{
+    memset(base, 0, sizeof(Baseline));
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        // file,format,bytes,error,best_ns,...
+        char fields[5][1024];
+        const char *next = line;
+        int n = 0;
+
+        while ((next != NULL) && (n < 5))
+            next = ReadField(next, fields[n++], sizeof(fields[0]));
+
+        // the header, and the modules that failed, are skipped
+        if ((n < 5) || (strcmp(fields[0], "file") == 0) || (atoi(fields[3]) != 0))
+            continue;
+
+        char **newpath = realloc(base->Path, (base->Count + 1) * sizeof(char *));
+        unsigned long long *newbytes = realloc(base->Bytes, (base->Count + 1) * sizeof(unsigned long long));
+        unsigned long long *newns = realloc(base->BestNs, (base->Count + 1) * sizeof(unsigned long long));
+
+        if (newpath != NULL)
+            base->Path = newpath;
+        if (newbytes != NULL)
+            base->Bytes = newbytes;
+        if (newns != NULL)
+            base->BestNs = newns;
+
+        char *copy = strdup(fields[0]);
+        if ((newpath == NULL) || (newbytes == NULL) || (newns == NULL) || (copy == NULL))
+        {
+            free(copy);
+            fclose(f);
+            return -1;
+        }
+
+        base->Path[base->Count] = copy;
+        base->Bytes[base->Count] = strtoull(fields[2], NULL, 10);
+        base->BestNs[base->Count] = strtoull(fields[4], NULL, 10);
+        base->Count++;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+// Index of a module in the baseline, or -1 if it isn't there
+static long Baseline_Find(const Baseline *base, const char *path)
+{
+    for (size_t i = 0; i < base->Count; i++)
+    {
+        if (strcmp(base->Path[i], path) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void Baseline_Free(Baseline *base)
+{
+    for (size_t i = 0; i < base->Count; i++)
+        free(base->Path[i]);
+
+    free(base->Path);
+    free(base->Bytes);
+    free(base->BestNs);
+}
+
+static double MBPerSecond(unsigned long long bytes, unsigned long long ns)
+{
+    return (ns > 0) ? (bytes / 1e6) / (ns / 1e9) : 0;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] directory|module...\n"
+           "\n"
+           "  -a            Load each module into a single arena\n"
+           "  -b file.csv   Compare the speed with the CSV output of a\n"
+           "                previous run\n"
+           "  -f csv|json   Output format (default: csv)\n"
+           "  -n loads      Loads of each module, the fastest one is reported\n"
+           "                (default: 5)\n"
+           "  -r            Play the samples of the MODs from the file\n"
+           "  -s            Load each module through a stream\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    int repeats = 5;
+    int json = 0;
+    LoadMode mode = LOAD_RAM;
+    const char *baselinepath = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ab:f:n:rs")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a':
+                mode = LOAD_ARENA;
+                break;
+            case 'b':
+                baselinepath = optarg;
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0)
+                    json = 1;
+                else if (strcmp(optarg, "csv") == 0)
+                    json = 0;
+                else
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'n':
+                repeats = atoi(optarg);
+                break;
+            case 'r':
+                mode = LOAD_RESIDENT;
+                break;
+            case 's':
+                mode = LOAD_STREAM;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind >= argc) || (repeats < 1))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    Baseline base = { 0 };
+    if ((baselinepath != NULL) && (Baseline_Load(&base, baselinepath) != 0))
+    {
+        fprintf(stderr, "%s: can't read\n", baselinepath);
+        Baseline_Free(&base);
+        return 1;
+    }
+
+    FileList files;
+    FileList_Init(&files);
+    for (int i = optind; i < argc; i++)
+    {
+        if (FileList_Add(&files, argv[i]) != 0)
+        {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            FileList_Free(&files);
+            Baseline_Free(&base);
+            return 1;
+        }
+    }
+
+    PrintHeader(json);
+
+    size_t failed = 0;
+    unsigned long long totalbytes = 0;
+    unsigned long long totalns = 0;
+    unsigned long long totalallocs = 0;
+    unsigned long long phasens[XM7_LOAD_PHASE_COUNT] = { 0 };
+
+    // the modules found in the baseline, to compare the totals
+    unsigned long long basebytes = 0, basens = 0, comparedns = 0;
+
+    for (size_t i = 0; i < files.Count; i++)
+    {
+        size_t size;
+        void *data = ModuleFile_ReadData(files.Path[i], &size);
+        if (data == NULL)
+        {
+            fprintf(stderr, "%s: can't read\n", files.Path[i]);
+            failed++;
+            continue;
+        }
+
+        LoadResult res;
+        BenchmarkModule(data, size, repeats, mode, &res);
+        free(data);
+
+        PrintResult(json, files.Path[i], size, &res);
+
+        if (res.Error != 0)
+        {
+            failed++;
+            continue;
+        }
+
+        long b = Baseline_Find(&base, files.Path[i]);
+        if (b >= 0)
+        {
+            double before = MBPerSecond(base.Bytes[b], base.BestNs[b]);
+            double after = MBPerSecond(size, res.BestNs);
+
+            fprintf(stderr, "%s: %.2f -> %.2f MB/s (%.2fx)\n", files.Path[i], before, after,
+                    (before > 0) ? after / before : 0);
+
+            basebytes += base.Bytes[b];
+            basens += base.BestNs[b];
+            comparedns += res.BestNs;
+        }
+
+        totalbytes += size;
+        totalns += res.BestNs;
+        totalallocs += res.Stats.Allocations;
+        for (int j = 0; j < XM7_LOAD_PHASE_COUNT; j++)
+            phasens[j] += res.Stats.PhaseNs[j];
+    }
+
+    size_t loaded = files.Count - failed;
+
+    fprintf(stderr, "%zu modules, %zu failed, %.2f MB in %.3f ms: %.2f MB/s, %.1f allocations per load\n",
+            files.Count, failed, totalbytes / 1e6, totalns / 1e6,
+            (totalns > 0) ? (totalbytes / 1e6) / (totalns / 1e9) : 0,
+            (loaded > 0) ? (double)totalallocs / loaded : 0);
+
+    for (int i = 0; i < XM7_LOAD_PHASE_COUNT; i++)
+    {
+        fprintf(stderr, "  %-9s %6.1f%%\n", PhaseNames[i],
+                (totalns > 0) ? 100.0 * phasens[i] / totalns : 0);
+    }
+
+    if (baselinepath != NULL)
+    {
+        // only the modules that are in both runs
+        double before = MBPerSecond(basebytes, basens);
+        double after = MBPerSecond(basebytes, comparedns);
+
+        fprintf(stderr, "baseline: %.2f -> %.2f MB/s (%.2fx)\n", before, after,
+                (before > 0) ? after / before : 0);
+    }
+
+    FileList_Free(&files);
+    Baseline_Free(&base);
+    return (failed > 0) ? 1 : 0;
+}
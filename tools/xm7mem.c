@@ -0,0 +1,527 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Reports how much memory modules need once they're loaded, using
+// XM7_GetMemoryUsage(), and which instruments and patterns are the largest.
+// With -c the modules are loaded through an allocator installed with
+// XM7_SetAllocator() that counts the blocks of each category, and that checks
+// that the unload frees all of them. With -i the modules are loaded in place,
+// keeping the sample data in the buffer of the file. With -b or -p only a part
+// of each module is loaded, with XM7_LoadXMSelection(). With -s the samples
+// loaded in place and into an arena are compared with the ones loaded by
+// XM7_LoadXM(), including the unrolled ping-pong loops.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+
+#include "common/file_list.h"
+#include "common/module_file.h"
+
+typedef struct {
+    int Index;
+    u32 Bytes;
+} Item;
+
+static const char *CategoryNames[XM7_ALLOC_CATEGORIES] = {
+    "patterns", "instruments", "sample headers", "sample data", "arena", "file"
+};
+
+// blocks and bytes currently allocated for each category
+typedef struct {
+    u32 Blocks[XM7_ALLOC_CATEGORIES];
+    u32 Bytes[XM7_ALLOC_CATEGORIES];
+} Counters;
+
+static void *CountingAllocate(u32 size, XM7_AllocCategories category, void *user)
+{
+    Counters *counters = user;
+
+    // the size is kept in front of the block, which must stay aligned to 8
+    u64 *block = malloc(sizeof(u64) + size);
+    if (block == NULL)
+        return NULL;
+
+    block[0] = size;
+    counters->Blocks[category]++;
+    counters->Bytes[category] += size;
+
+    return block + 1;
+}
+
+static void CountingFree(void *ptr, XM7_AllocCategories category, void *user)
+{
+    Counters *counters = user;
+    u64 *block = (u64 *)ptr - 1;
+
+    counters->Blocks[category]--;
+    counters->Bytes[category] -= block[0];
+
+    free(block);
+}
+
+static void ReportCounters(const Counters *counters)
+{
+    printf("  allocator:\n");
+    for (int i = 0; i < XM7_ALLOC_CATEGORIES; i++)
+    {
+        if (counters->Blocks[i] > 0)
+        {
+            printf("    %-18s %10u in %u blocks\n", CategoryNames[i], counters->Bytes[i],
+                   counters->Blocks[i]);
+        }
+    }
+}
+
+static int CompareItems(const void *a, const void *b)
+{
+    const Item *ia = a;
+    const Item *ib = b;
+
+    // biggest first, then by number
+    if (ia->Bytes != ib->Bytes)
+        return (ia->Bytes < ib->Bytes) ? 1 : -1;
+
+    return ia->Index - ib->Index;
+}
+
+static void PrintCategory(const char *name, u32 bytes, u32 total)
+{
+    printf("  %-20s %10u  %5.1f%%\n", name, bytes, (total > 0) ? 100.0 * bytes / total : 0);
+}
+
+static void PrintInstrumentName(const XM7_Instrument_Type *instr)
+{
+    char name[23];
+
+    memcpy(name, instr->Name, 22);
+    name[22] = '\0';
+
+    // names are padded with spaces or zeros
+    for (int i = 21; (i >= 0) && ((name[i] == ' ') || (name[i] == '\0')); i--)
+        name[i] = '\0';
+
+    for (int i = 0; name[i] != '\0'; i++)
+    {
+        if ((name[i] < 0x20) || (name[i] > 0x7E))
+            name[i] = '.';
+    }
+
+    printf(" \"%s\"", name);
+}
+
+static void ReportModule(const char *path, size_t filesize, const XM7_ModuleManager_Type *module,
+                         int top)
+{
+    XM7_MemoryUsage_Type usage;
+    XM7_GetMemoryUsage(module, &usage);
+
+    printf("%s: %u bytes in %u allocations (file: %zu bytes, module manager: %zu bytes)\n",
+           path, usage.Total, usage.Allocations, filesize, sizeof(XM7_ModuleManager_Type));
+
+    PrintCategory("patterns", usage.Patterns, usage.Total);
+    PrintCategory("instruments", usage.Instruments, usage.Total);
+    PrintCategory("sample headers", usage.SampleHeaders, usage.Total);
+    PrintCategory("sample data", usage.SampleData, usage.Total);
+    PrintCategory("  ping-pong unroll", usage.PingPongUnroll, usage.Total);
+    if (module->File != NULL)
+        PrintCategory("rest of the file", usage.File, usage.Total);
+    PrintCategory("allocator overhead", usage.AllocatorOverhead, usage.Total);
+
+    if (top <= 0)
+        return;
+
+    Item items[256];
+    int count = 0;
+
+    for (int i = 0; i < module->NumberofInstruments; i++)
+    {
+        u32 bytes = XM7_GetInstrumentMemoryUsage(module, i);
+        if (bytes > 0)
+            items[count++] = (Item){ i, bytes };
+    }
+
+    qsort(items, count, sizeof(Item), CompareItems);
+
+    printf("  largest instruments:\n");
+    for (int i = 0; (i < count) && (i < top); i++)
+    {
+        printf("    %3d %10u  %5.1f%%", items[i].Index + 1, items[i].Bytes,
+               (usage.Total > 0) ? 100.0 * items[i].Bytes / usage.Total : 0);
+        PrintInstrumentName(module->Instrument[items[i].Index]);
+        printf("\n");
+    }
+
+    count = 0;
+    for (int i = 0; i < module->NumberofPatterns; i++)
+        items[count++] = (Item){ i, XM7_GetPatternMemoryUsage(module, i) };
+
+    qsort(items, count, sizeof(Item), CompareItems);
+
+    printf("  largest patterns:\n");
+    for (int i = 0; (i < count) && (i < top); i++)
+    {
+        printf("    %3d %10u  %5.1f%%  %u rows\n", items[i].Index, items[i].Bytes,
+               (usage.Total > 0) ? 100.0 * items[i].Bytes / usage.Total : 0,
+               module->PatternLength[items[i].Index]);
+    }
+}
+
+// reads a file and loads it in place, with the file buffer allocated the way
+// the module will free it
+static int LoadInPlace(ModuleFile *mf, const char *path, const XM7_Allocator_Type *allocator)
+{
+    memset(mf, 0, sizeof(ModuleFile));
+
+    size_t size;
+    void *data = ModuleFile_ReadData(path, &size);
+    if (data == NULL)
+        return -1;
+
+    // keep the zeroed padding at the end, for truncated files
+    size_t buffersize = size + 4096;
+
+    if (allocator != NULL)
+    {
+        void *copy = allocator->Allocate(buffersize, XM7_ALLOC_FILE, allocator->User);
+        if (copy != NULL)
+            memcpy(copy, data, buffersize);
+        free(data);
+
+        if (copy == NULL)
+            return -1;
+        data = copy;
+    }
+
+    mf->Size = size;
+    int ret = ModuleFile_LoadModuleInPlace(&mf->Module, data, buffersize);
+
+    // the buffer is still ours only if the module couldn't take it
+    if (mf->Module.File == NULL)
+    {
+        if (allocator != NULL)
+            allocator->Free(data, XM7_ALLOC_FILE, allocator->User);
+        else
+            free(data);
+    }
+
+    return ret;
+}
+
+// reads a file and loads the selected parts of the module
+static int LoadSelection(ModuleFile *mf, const char *path, const XM7_Selection_Type *selection)
+{
+    memset(mf, 0, sizeof(ModuleFile));
+
+    mf->Data = ModuleFile_ReadData(path, &mf->Size);
+    if (mf->Data == NULL)
+        return -1;
+
+    return ModuleFile_LoadModuleSelection(&mf->Module, mf->Data, selection);
+}
+
+// loads a module into an arena of the caller filled with junk, so samples that
+// the loader doesn't write can be spotted
+static int LoadArena(XM7_ModuleManager_Type *module, const void *data, void **arena)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+    *arena = NULL;
+
+    u32 size;
+    int ismod = 0;
+    int ret = XM7_GetArenaSizeXM(data, &size);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+    {
+        ismod = 1;
+        ret = XM7_GetArenaSizeMOD(data, &size);
+    }
+    if (ret != 0)
+        return ret;
+
+    *arena = malloc(size);
+    if (*arena == NULL)
+        return XM7_ERR_NOT_ENOUGH_MEMORY;
+    memset(*arena, 0xA5, size);
+
+    if (ismod)
+        return XM7_LoadMODArena(module, data, *arena, size);
+
+    return XM7_LoadXMArena(module, data, *arena, size);
+}
+
+// compares the samples of a module with the ones of the same module loaded by
+// XM7_LoadXM(), returns the number of samples that differ
+static int CompareSamples(const char *path, const char *how, const XM7_ModuleManager_Type *ref,
+                          const XM7_ModuleManager_Type *module)
+{
+    int diffs = 0;
+
+    for (int i = 0; i < ref->NumberofInstruments; i++)
+    {
+        const XM7_Instrument_Type *refinstr = ref->Instrument[i];
+        const XM7_Instrument_Type *instr = module->Instrument[i];
+        if ((refinstr == NULL) || (instr == NULL))
+        {
+            if (refinstr != instr)
+            {
+                printf("%s: %s: instrument %d is missing\n", path, how, i + 1);
+                diffs++;
+            }
+            continue;
+        }
+
+        for (int j = 0; j < refinstr->NumberofSamples; j++)
+        {
+            const XM7_Sample_Type *refsmp = refinstr->Sample[j];
+            const XM7_Sample_Type *smp = instr->Sample[j];
+
+            // the whole sample, with the loop copied backward if it's ping-pong
+            u32 bytes = refsmp->Length;
+            if (refsmp->Flags & 0x10)
+                bytes &= ~1;
+
+            if ((smp->Length != refsmp->Length) || (smp->LoopStart != refsmp->LoopStart) ||
+                (smp->LoopLength != refsmp->LoopLength) || (smp->Flags != refsmp->Flags) ||
+                ((bytes > 0) && (memcmp(smp->SampleData, refsmp->SampleData, bytes) != 0)))
+            {
+                printf("%s: %s: sample %d of instrument %d differs\n", path, how, j, i + 1);
+                diffs++;
+            }
+        }
+    }
+
+    return diffs;
+}
+
+// loads a module in place and into an arena and compares the samples with the
+// ones loaded by XM7_LoadXM(). Returns the number of errors
+static int CheckSamples(const char *path)
+{
+    ModuleFile ref;
+    int ret = ModuleFile_Load(&ref, path);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", path, ret);
+        ModuleFile_Free(&ref);
+        return 1;
+    }
+
+    int diffs = 0;
+
+    ModuleFile mf;
+    ret = LoadInPlace(&mf, path, NULL);
+    if (ret != 0)
+    {
+        printf("%s: can't load module in place (error %d)\n", path, ret);
+        diffs++;
+    }
+    else
+    {
+        diffs += CompareSamples(path, "in place", &ref.Module, &mf.Module);
+    }
+    ModuleFile_Free(&mf);
+
+    XM7_ModuleManager_Type module;
+    void *arena;
+    ret = LoadArena(&module, ref.Data, &arena);
+    if (ret != 0)
+    {
+        printf("%s: can't load module into an arena (error %d)\n", path, ret);
+        diffs++;
+    }
+    else
+    {
+        diffs += CompareSamples(path, "arena", &ref.Module, &module);
+    }
+    ModuleFile_UnloadModule(&module);
+    free(arena);
+
+    if (diffs == 0)
+        printf("%s: samples match\n", path);
+
+    ModuleFile_Free(&ref);
+    return diffs;
+}
+
+// parses a list of positions like "0,4-7" into a selection. Returns 0 if OK
+static int ParsePositions(XM7_Selection_Type *selection, const char *list)
+{
+    selection->Mode = XM7_SELECT_POSITIONS;
+
+    while (*list != '\0')
+    {
+        char *end;
+        unsigned long first = strtoul(list, &end, 0);
+        unsigned long last = first;
+
+        if (end == list)
+            return -1;
+
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtoul(list, &end, 0);
+            if (end == list)
+                return -1;
+        }
+
+        if ((first > last) || (last > 255))
+            return -1;
+
+        for (unsigned long i = first; i <= last; i++)
+            selection->Positions[i >> 3] |= 1 << (i & 7);
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+
+        list = end;
+    }
+
+    return 0;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] directory|module...\n"
+           "\n"
+           "  -b            Load only the instruments, as a bank of sounds\n"
+           "  -c            Count the blocks allocated for each category\n"
+           "  -i            Load the modules in place, in the file buffer\n"
+           "  -p positions  Load only what can be played from these positions\n"
+           "                of the order list (like 0,4-7)\n"
+           "  -s            Check that the samples loaded in place and into an\n"
+           "                arena are the same as the ones of XM7_LoadXM()\n"
+           "  -t count      Number of largest instruments and patterns to show\n"
+           "                (default: 5, 0 to show none)\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    int top = 5;
+    int count = 0;
+    int inplace = 0;
+    int select = 0;
+    int samples = 0;
+    XM7_Selection_Type selection = { 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bcip:st:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                selection.Mode = XM7_SELECT_INSTRUMENTS;
+                select = 1;
+                break;
+            case 'p':
+                if (ParsePositions(&selection, optarg) != 0)
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                select = 1;
+                break;
+            case 'c':
+                count = 1;
+                break;
+            case 'i':
+                inplace = 1;
+                break;
+            case 's':
+                samples = 1;
+                break;
+            case 't':
+                top = atoi(optarg);
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind >= argc) || (select && inplace))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    FileList files;
+    FileList_Init(&files);
+    for (int i = optind; i < argc; i++)
+    {
+        if (FileList_Add(&files, argv[i]) != 0)
+        {
+            printf("%s: can't read\n", argv[i]);
+            FileList_Free(&files);
+            return 1;
+        }
+    }
+
+    size_t failed = 0;
+
+    if (samples)
+    {
+        for (size_t i = 0; i < files.Count; i++)
+        {
+            if (CheckSamples(files.Path[i]) != 0)
+                failed++;
+        }
+
+        FileList_Free(&files);
+        return (failed > 0) ? 1 : 0;
+    }
+
+    Counters counters = { 0 };
+    XM7_Allocator_Type allocator = { CountingAllocate, CountingFree, &counters };
+    if (count)
+        XM7_SetAllocator(&allocator);
+
+    for (size_t i = 0; i < files.Count; i++)
+    {
+        ModuleFile mf;
+        int ret;
+        if (inplace)
+            ret = LoadInPlace(&mf, files.Path[i], count ? &allocator : NULL);
+        else if (select)
+            ret = LoadSelection(&mf, files.Path[i], &selection);
+        else
+            ret = ModuleFile_Load(&mf, files.Path[i]);
+        if (ret != 0)
+        {
+            printf("%s: can't load module (error %d)\n", files.Path[i], ret);
+            failed++;
+        }
+        else
+        {
+            ReportModule(files.Path[i], mf.Size, &mf.Module, top);
+            if (count)
+                ReportCounters(&counters);
+        }
+
+        ModuleFile_Free(&mf);
+
+        for (int j = 0; count && (j < XM7_ALLOC_CATEGORIES); j++)
+        {
+            if (counters.Blocks[j] > 0)
+            {
+                printf("%s: %u blocks of %s not freed\n", files.Path[i], counters.Blocks[j],
+                       CategoryNames[j]);
+                memset(&counters, 0, sizeof(counters));
+                failed++;
+                break;
+            }
+        }
+    }
+
+    XM7_SetAllocator(NULL);
+
+    FileList_Free(&files);
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Plays modules with the null backend and the overrun control of the engine
+// enabled, and reports how many ticks went over the budget and which
+// degradation levels were used. With -f each degradation level is forced in
+// turn, to see how much work each one of them saves.
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+
+typedef struct {
+    unsigned long long Ns;
+    unsigned long Divisions;
+} Cost;
+
+static Cost Play(XM7_ModuleManager_Type *module, XM7_OverrunControl_Type *control,
+                 unsigned long ticks)
+{
+    Cost cost;
+
+    XM7_SetOverrunControl(control);
+    XM7_PlayModule(module);
+
+    u32 divisions = XM7_GetDivisionCount();
+    unsigned long long start = TimeNowNs();
+
+    XM7_AdvanceTicks(ticks);
+
+    cost.Ns = TimeNowNs() - start;
+    cost.Divisions = XM7_GetDivisionCount() - divisions;
+
+    XM7_StopModule();
+    XM7_SetOverrunControl(NULL);
+
+    return cost;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] module.xm|module.mod...\n"
+           "\n"
+           "  -b budget     Part of the tick period the ticks may use, in 1/256\n"
+           "                units (default: 256)\n"
+           "  -f            Force each degradation level and show its cost\n"
+           "  -l level      Highest degradation level allowed, 0 to 3\n"
+           "                (default: 3)\n"
+           "  -s scale      Multiply the tick times by this factor, to emulate\n"
+           "                a slower CPU (default: 1)\n"
+           "  -t ticks      Number of ticks to play of each module\n"
+           "                (default: 10000)\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long budget = 256;
+    unsigned long maxlevel = XM7_DEGRADE_CULL_SILENT;
+    unsigned long ticks = 10000;
+    unsigned long scale = 1;
+    int force = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:fl:s:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                budget = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                force = 1;
+                break;
+            case 'l':
+                maxlevel = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                scale = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                ticks = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind >= argc) || (budget < 1) || (budget > 256) || (ticks < 1)
+        || (maxlevel > XM7_DEGRADE_CULL_SILENT))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    XM7_NullBackend_Type nb;
+    XM7_NullBackend_Init(&nb);
+    XM7_SetBackend(&nb.Backend);
+
+    XM7_Initialize();
+    XM7_SetTimerMode(XM7_TIMER_MODE_EXTERNAL);
+
+    int failed = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        ModuleFile mf;
+        int ret = ModuleFile_Load(&mf, argv[i]);
+        if (ret != 0)
+        {
+            printf("%s: can't load module (error %d)\n", argv[i], ret);
+            ModuleFile_Free(&mf);
+            failed = 1;
+            continue;
+        }
+
+        XM7_OverrunControl_Type control = { 0 };
+        control.Budget = budget;
+        control.MaxLevel = maxlevel;
+
+        XM7_SetOverrunTimeScale(scale);
+        Cost cost = Play(&mf.Module, &control, ticks);
+
+        printf("%s: %u ticks, %u overruns, %u over budget, %u level changes, "
+               "worst tick %.1f%% of its period\n", argv[i], control.Ticks,
+               control.Overruns, control.OverBudget, control.LevelChanges,
+               control.WorstPeriod ? 100.0 * control.WorstTime / control.WorstPeriod : 0.0);
+        printf("  ticks at level 0/1/2/3: %u/%u/%u/%u, %.1f ns/tick, %.2f div/tick\n",
+               control.TicksAtLevel[0], control.TicksAtLevel[1],
+               control.TicksAtLevel[2], control.TicksAtLevel[3],
+               (double)cost.Ns / ticks, (double)cost.Divisions / ticks);
+
+        for (int level = 0; force && (level <= XM7_DEGRADE_CULL_SILENT); level++)
+        {
+            // every tick is over budget, so the engine reaches the level right
+            // away and stays there
+            XM7_OverrunControl_Type forced = { 0 };
+            forced.Budget = 1;
+            forced.MaxLevel = level;
+
+            XM7_SetOverrunTimeScale(UINT32_MAX);
+            cost = Play(&mf.Module, &forced, ticks);
+
+            printf("  forced level %d: %.1f ns/tick, %.2f div/tick\n", level,
+                   (double)cost.Ns / ticks, (double)cost.Divisions / ticks);
+        }
+
+        ModuleFile_Free(&mf);
+    }
+
+    return failed;
+}
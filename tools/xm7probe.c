@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Lists modules with XM7_ProbeXM() and XM7_ProbeMOD(), the way a music menu
+// would do it: only the headers are read, nothing is loaded, and the memory
+// each module would need is shown next to its name.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libxm7.h>
+
+#include "common/file_list.h"
+#include "common/module_file.h"
+
+static int Probe(const void *data, XM7_ModuleInfo_Type *info)
+{
+    int ret = XM7_ProbeXM(data, info);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+        ret = XM7_ProbeMOD(data, info);
+
+    return ret;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] directory|module...\n"
+           "\n"
+           "  -c            Load each module too, and check that the memory it\n"
+           "                uses is the one reported\n"
+           "  -v            Print the memory used by each kind of data\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    int check = 0;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cv")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                check = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    FileList files;
+    FileList_Init(&files);
+    for (int i = optind; i < argc; i++)
+    {
+        if (FileList_Add(&files, argv[i]) != 0)
+        {
+            printf("%s: can't read\n", argv[i]);
+            FileList_Free(&files);
+            return 1;
+        }
+    }
+
+    size_t failed = 0;
+    unsigned long long total = 0;
+
+    for (size_t i = 0; i < files.Count; i++)
+    {
+        size_t size;
+        void *data = ModuleFile_ReadData(files.Path[i], &size);
+        if (data == NULL)
+        {
+            printf("%s: can't read\n", files.Path[i]);
+            failed++;
+            continue;
+        }
+
+        XM7_ModuleInfo_Type info;
+
+        unsigned long long start = TimeNowNs();
+        int ret = Probe(data, &info);
+        unsigned long long elapsed = TimeNowNs() - start;
+        total += elapsed;
+
+        if (ret != 0)
+        {
+            printf("%s: not a supported module (error %d)\n", files.Path[i], ret);
+            failed++;
+            free(data);
+            continue;
+        }
+
+        printf("%s: \"%s\" (%s, \"%s\")\n", files.Path[i], info.ModuleName,
+               info.IsMOD ? "MOD" : "XM", info.TrackerName);
+        printf("  %u channels, %u patterns, %u positions (restart %u), "
+               "%u instruments, %u samples\n", info.NumberofChannels,
+               info.NumberofPatterns, info.ModuleLength, info.RestartPoint,
+               info.NumberofInstruments, info.NumberofSamples);
+        printf("  tempo %u, BPM %u, %s frequencies\n", info.DefaultTempo,
+               info.DefaultBPM, info.FreqTable ? "linear" : "Amiga");
+        printf("  memory %u bytes in %u blocks, arena %u bytes, reads %u of %zu "
+               "bytes (%.1f us)\n", info.Memory.Total, info.Memory.Allocations,
+               info.ArenaSize, info.FileSize, size, elapsed / 1e3);
+
+        if (verbose)
+        {
+            printf("  patterns %u, instruments %u, sample headers %u, sample data %u "
+                   "(ping-pong %u), overhead %u\n", info.Memory.Patterns,
+                   info.Memory.Instruments, info.Memory.SampleHeaders,
+                   info.Memory.SampleData, info.Memory.PingPongUnroll,
+                   info.Memory.AllocatorOverhead);
+        }
+
+        if (check)
+        {
+            XM7_ModuleManager_Type module;
+            XM7_MemoryUsage_Type usage;
+
+            ret = ModuleFile_LoadModule(&module, data);
+            XM7_GetMemoryUsage(&module, &usage);
+            ModuleFile_UnloadModule(&module);
+
+            if (ret != 0)
+            {
+                printf("  can't load module (error %d)\n", ret);
+                failed++;
+            }
+            else if ((usage.Total != info.Memory.Total) ||
+                     (usage.Allocations != info.Memory.Allocations))
+            {
+                printf("  loaded module uses %u bytes in %u blocks\n", usage.Total,
+                       usage.Allocations);
+                failed++;
+            }
+        }
+
+        free(data);
+    }
+
+    printf("%zu modules probed in %.3f ms, %zu failed\n", files.Count, total / 1e6, failed);
+
+    FileList_Free(&files);
+    return (failed > 0) ? 1 : 0;
+}
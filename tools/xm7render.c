@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Renders a module to a WAV file, as fast as possible, using the emulated DS
+// sound unit. The render stops when the song ends or loops back. Long songs can
+// be split and rendered on several threads.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+#include "common/render.h"
+#include "common/split_render.h"
+#include "common/wav_file.h"
+
+// longest timer period the engine can program (BPM 32)
+#define MAX_TICK_PERIOD     (1963710 / (32 * 24))
+
+// how the render ended
+typedef struct {
+    int Ended;
+    u8 EndPosition;
+    u8 EndLine;
+} RenderEnd;
+
+static int RenderSerial(const char *inpath, WavFile *wav, u32 rate,
+                        unsigned long maxseconds, RenderEnd *end)
+{
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, inpath);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", inpath, ret);
+        ModuleFile_Free(&mf);
+        return -1;
+    }
+
+    u32 maxframes = (u64)MAX_TICK_PERIOD * 1024 * rate / XM7_BUS_CLOCK + 1;
+    s16 *buffer = malloc(maxframes * 4);
+
+    Renderer *r = malloc(sizeof(Renderer));
+
+    if ((buffer == NULL) || (r == NULL))
+    {
+        printf("Not enough memory\n");
+        free(r);
+        free(buffer);
+        ModuleFile_Free(&mf);
+        return -1;
+    }
+
+    Renderer_Start(r, &mf.Module, rate);
+
+    while (r->Frames < (unsigned long long)maxseconds * rate)
+    {
+        u32 frames = Renderer_Tick(r);
+        if (frames == 0)
+            break;
+
+        XM7_SoundUnit_Mix(&r->Unit, buffer, frames);
+
+        if (WavFile_Write(wav, buffer, frames) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    Renderer_Stop(r);
+
+    end->Ended = r->Ended;
+    end->EndPosition = r->EndPosition;
+    end->EndLine = r->EndLine;
+
+    free(r);
+    free(buffer);
+    ModuleFile_Free(&mf);
+
+    return ret;
+}
+
+static int RenderSplit(const char *inpath, WavFile *wav, u32 rate,
+                       unsigned long maxseconds, int workers, RenderEnd *end)
+{
+    SplitRender sr;
+    int ret = SplitRender_Run(&sr, inpath, rate, maxseconds, workers);
+    if (ret != 0)
+    {
+        printf("%s: can't render module (error %d)\n", inpath, ret);
+        SplitRender_Free(&sr);
+        return -1;
+    }
+
+    printf("%s: %d segments, %.3f s of pre-roll in total\n", inpath,
+           sr.Segments, sr.PrerollNs / 1e9);
+
+    // the frame count can be bigger than what fits in an u32
+    for (unsigned long long done = 0; (ret == 0) && (done < sr.Frames); )
+    {
+        u32 frames = (sr.Frames - done > 65536) ? 65536 : sr.Frames - done;
+        ret = WavFile_Write(wav, sr.Samples + done * 2, frames);
+        done += frames;
+    }
+
+    end->Ended = sr.Ended;
+    end->EndPosition = sr.EndPosition;
+    end->EndLine = sr.EndLine;
+
+    SplitRender_Free(&sr);
+
+    return ret;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] module.xm|module.mod\n"
+           "\n"
+           "  -j workers    Split the song and render it on this many threads\n"
+           "                (default: 1)\n"
+           "  -o file.wav   Output file (default: the module name + .wav)\n"
+           "  -r rate       Sample rate of the output (default: 32768)\n"
+           "  -t seconds    Maximum length of the render (default: 1800)\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *outpath = NULL;
+    unsigned long rate = 32768;
+    unsigned long maxseconds = 1800;
+    int workers = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:o:r:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                workers = atoi(optarg);
+                break;
+            case 'o':
+                outpath = optarg;
+                break;
+            case 'r':
+                rate = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                maxseconds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if ((optind != argc - 1) || (workers < 1) || (rate < 1000) || (rate > 384000))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    const char *inpath = argv[optind];
+
+    char *defaultpath = NULL;
+    if (outpath == NULL)
+    {
+        defaultpath = malloc(strlen(inpath) + 5);
+        if (defaultpath == NULL)
+            return 1;
+        sprintf(defaultpath, "%s.wav", inpath);
+        outpath = defaultpath;
+    }
+
+    WavFile wav;
+    if (WavFile_Open(&wav, outpath, rate) != 0)
+    {
+        printf("%s: can't create file\n", outpath);
+        free(defaultpath);
+        return 1;
+    }
+
+    unsigned long long start = TimeNowNs();
+
+    RenderEnd end = { 0 };
+    int failed;
+
+    if (workers > 1)
+        failed = RenderSplit(inpath, &wav, rate, maxseconds, workers, &end) != 0;
+    else
+        failed = RenderSerial(inpath, &wav, rate, maxseconds, &end) != 0;
+
+    if (WavFile_Close(&wav) != 0)
+        failed = 1;
+
+    unsigned long long elapsed = TimeNowNs() - start;
+
+    double seconds = (double)wav.Frames / rate;
+
+    if (failed)
+        printf("%s: render failed\n", outpath);
+    else if (end.Ended)
+        printf("%s: %.2f s, song looped back to position %u row %u\n", outpath,
+               seconds, end.EndPosition, end.EndLine);
+    else
+        printf("%s: %.2f s, stopped at the time limit\n", outpath, seconds);
+
+    printf("%s: rendered in %.3f s, %.1fx real time\n", outpath,
+           elapsed / 1e9, seconds / (elapsed / 1e9));
+
+    free(defaultpath);
+
+    return failed;
+}
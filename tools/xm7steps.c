@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Loads modules a piece at a time with XM7_LoadStep(), the way a game would do
+// it between frames, and reports how many steps are needed and how long the
+// longest one takes, compared with loading the whole module at once.
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+
+#include "common/file_list.h"
+#include "common/module_file.h"
+
+static int LoadStart(XM7_Loader_Type *loader, XM7_ModuleManager_Type *module, const void *data)
+{
+    memset(module, 0, sizeof(XM7_ModuleManager_Type));
+
+    int ret = XM7_LoadXMStart(loader, module, data);
+    if (ret == XM7_ERR_NOT_A_VALID_MODULE)
+        ret = XM7_LoadMODStart(loader, module, data);
+
+    return ret;
+}
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s [options] directory|module...\n"
+           "\n"
+           "  -b bytes      Bytes of the file to load in each step\n"
+           "                (default: 4096)\n"
+           "  -p            Print the progress after each step\n",
+           name);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long budget = 4096;
+    int progress = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:p")) != -1)
+    {
+        switch (opt)
+        {
+            case 'b':
+                budget = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                progress = 1;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    FileList files;
+    FileList_Init(&files);
+    for (int i = optind; i < argc; i++)
+    {
+        if (FileList_Add(&files, argv[i]) != 0)
+        {
+            printf("%s: can't read\n", argv[i]);
+            FileList_Free(&files);
+            return 1;
+        }
+    }
+
+    size_t failed = 0;
+
+    for (size_t i = 0; i < files.Count; i++)
+    {
+        size_t size;
+        void *data = ModuleFile_ReadData(files.Path[i], &size);
+        if (data == NULL)
+        {
+            printf("%s: can't read\n", files.Path[i]);
+            failed++;
+            continue;
+        }
+
+        XM7_ModuleManager_Type module;
+
+        // the whole module at once, to compare
+        unsigned long long start = TimeNowNs();
+        int ret = ModuleFile_LoadModule(&module, data);
+        unsigned long long once = TimeNowNs() - start;
+        ModuleFile_UnloadModule(&module);
+
+        XM7_Loader_Type loader;
+        unsigned long steps = 0;
+        unsigned long long total = 0, longest = 0;
+
+        if (ret != 0)
+        {
+            printf("%s: can't load module (error %d)\n", files.Path[i], ret);
+            failed++;
+            free(data);
+            continue;
+        }
+
+        start = TimeNowNs();
+        ret = LoadStart(&loader, &module, data);
+        longest = total = TimeNowNs() - start;
+
+        while ((ret == 0) && (loader.Done < loader.Total))
+        {
+            start = TimeNowNs();
+            ret = XM7_LoadStep(&loader, budget);
+            unsigned long long elapsed = TimeNowNs() - start;
+
+            steps++;
+            total += elapsed;
+            if (elapsed > longest)
+                longest = elapsed;
+
+            if (progress)
+            {
+                printf("  step %lu: %u/%u bytes (%.1f%%), %.1f us\n", steps, loader.Done,
+                       loader.Total, 100.0 * loader.Done / loader.Total, elapsed / 1e3);
+            }
+        }
+
+        if (ret != 0)
+        {
+            printf("%s: can't load module (error %d)\n", files.Path[i], ret);
+            failed++;
+        }
+        else
+        {
+            printf("%s: %lu steps, longest %.1f us, total %.3f ms (at once: %.3f ms)\n",
+                   files.Path[i], steps, longest / 1e3, total / 1e6, once / 1e6);
+        }
+
+        // it's unloaded after errors too, like a game giving up the load
+        XM7_UnloadXM(&module);
+        free(data);
+    }
+
+    FileList_Free(&files);
+    return (failed > 0) ? 1 : 0;
+}
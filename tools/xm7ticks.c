@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Plays a module with the null backend and reports the time spent by the
+// sequencer on each tick. The ticks are driven with XM7_AdvanceTicks(), so
+// the engine doesn't need any timer. The handler statistics of the engine give
+// the spread of the tick times, split between row ticks and the other ticks.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s module.xm|module.mod [ticks]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned long ticks = (argc > 2) ? strtoul(argv[2], NULL, 0) : 100000;
+
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, argv[1]);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", argv[1], ret);
+        ModuleFile_Free(&mf);
+        return 1;
+    }
+
+    XM7_NullBackend_Type nb;
+    XM7_NullBackend_Init(&nb);
+    XM7_SetBackend(&nb.Backend);
+
+    XM7_Initialize();
+    XM7_SetTimerMode(XM7_TIMER_MODE_EXTERNAL);
+
+    XM7_HandlerStats_Type stats = { 0 };
+    XM7_SetHandlerStats(&stats);
+
+    XM7_PlayModule(&mf.Module);
+
+    unsigned long long start = TimeNowNs();
+
+    XM7_AdvanceTicks(ticks);
+
+    unsigned long long elapsed = TimeNowNs() - start;
+
+    XM7_StopModule();
+    XM7_SetHandlerStats(NULL);
+
+    printf("%s: %lu ticks, %.1f ns/tick\n", argv[1], ticks, (double)elapsed / ticks);
+
+    if (stats.Ticks == 0)
+    {
+        ModuleFile_Free(&mf);
+        return 0;
+    }
+
+    u32 midrowticks = stats.Ticks - stats.RowTicks;
+
+    printf("  all:     min %u ns, mean %.1f ns, max %u ns\n", stats.Min,
+           (double)stats.Total / stats.Ticks, stats.Max);
+    printf("  row:     %u ticks, mean %.1f ns, max %u ns\n", stats.RowTicks,
+           stats.RowTicks ? (double)stats.RowTotal / stats.RowTicks : 0.0,
+           stats.RowMax);
+    printf("  mid-row: %u ticks, mean %.1f ns, max %u ns\n", midrowticks,
+           midrowticks ? (double)stats.MidRowTotal / midrowticks : 0.0,
+           stats.MidRowMax);
+
+    for (int i = 0; i < XM7_HANDLER_HISTOGRAM_BUCKETS; i++)
+    {
+        if (stats.Histogram[i] == 0)
+            continue;
+
+        printf("  %10llu - %10llu ns: %u\n", 1ULL << i, (2ULL << i) - 1,
+               stats.Histogram[i]);
+    }
+
+    ModuleFile_Free(&mf);
+    return 0;
+}
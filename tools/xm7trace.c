@@ -0,0 +1,490 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (c) 2018 sverx
+
+// Records the register writes of a module in a trace file, shows statistics
+// about the writes of a trace, and replays traces.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxm7.h>
+#include <libxm7_host.h>
+
+#include "common/module_file.h"
+#include "common/render.h"
+#include "common/trace_file.h"
+
+// a tick writes a few registers of each channel, this is plenty
+#define TRACE_BUFFER_RECORDS    4096
+
+// longest timer period the engine can program (BPM 32)
+#define MAX_TICK_PERIOD     (1963710 / (32 * 24))
+
+#define TRACE_REGISTERS     (XM7_TRACE_REG_SADHIGH + 1)
+
+static const char *RegisterName[TRACE_REGISTERS] = {
+    "CNT", "SAD", "TMR", "PNT", "LEN", "VOL", "PAN", "TIMER0", "SADHIGH"
+};
+
+static void Usage(const char *name)
+{
+    printf("Usage: %s record module.xm|module.mod out.trace [ticks]\n"
+           "       %s stats in.trace\n"
+           "       %s print in.trace\n"
+           "       %s verify module.xm|module.mod\n"
+           "\n"
+           "record: play the module until it ends (or for a number of ticks) and\n"
+           "        save all the register writes.\n"
+           "stats:  show the number of writes per tick, register and channel, and\n"
+           "        how many of them don't change the value of the register.\n"
+           "print:  replay the trace and print the operations it results in.\n"
+           "verify: render the module, then replay its trace on another sound\n"
+           "        unit, and check that the output is the same.\n",
+           name, name, name, name);
+}
+
+// Plays the module with tracing enabled. Every tick the records are handed to
+// the callback and the trace buffer is emptied. If `out` isn't NULL the audio
+// is mixed there.
+typedef int (*RecordFn)(void *arg, const XM7_TraceRecord_Type *records, u32 count);
+
+static int PlayTraced(XM7_ModuleManager_Type *module, unsigned long maxticks,
+                      RecordFn fn, void *arg, s16 **out, unsigned long long *frames)
+{
+    Renderer *r = malloc(sizeof(Renderer));
+    XM7_TraceRecord_Type *records = malloc(TRACE_BUFFER_RECORDS * sizeof(XM7_TraceRecord_Type));
+    s16 *audio = NULL;
+    size_t capacity = 0;
+
+    if ((r == NULL) || (records == NULL))
+    {
+        free(r);
+        free(records);
+        return -1;
+    }
+
+    XM7_Trace_Type trace = {
+        .Records = records,
+        .Capacity = TRACE_BUFFER_RECORDS,
+    };
+
+    int ret = 0;
+
+    XM7_SetTrace(&trace);
+    Renderer_Start(r, module, 32768);
+
+    while (1)
+    {
+        u32 n = (maxticks > 0) && (r->Ticks >= maxticks) ? 0 : Renderer_Tick(r);
+
+        // the records of this tick (or of XM7_StopModule())
+        if (n == 0)
+            Renderer_Stop(r);
+
+        if (fn(arg, records, trace.Position) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        trace.Position = 0;
+
+        if (n == 0)
+            break;
+
+        if (out != NULL)
+        {
+            if ((r->Frames + 1) * 2 > capacity)
+            {
+                capacity = (capacity + n * 2) * 2;
+                s16 *newaudio = realloc(audio, capacity * sizeof(s16));
+                if (newaudio == NULL)
+                {
+                    Renderer_Stop(r);
+                    ret = -1;
+                    break;
+                }
+                audio = newaudio;
+            }
+
+            XM7_SoundUnit_Mix(&r->Unit, audio + (r->Frames - n) * 2, n);
+        }
+    }
+
+    XM7_SetTrace(NULL);
+
+    if (out != NULL)
+        *out = audio;
+    if (frames != NULL)
+        *frames = r->Frames;
+
+    free(records);
+    free(r);
+
+    return ret;
+}
+
+static int WriteRecords(void *arg, const XM7_TraceRecord_Type *records, u32 count)
+{
+    return TraceWriter_Write(arg, records, count);
+}
+
+static int Record(const char *inpath, const char *outpath, unsigned long maxticks)
+{
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, inpath);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", inpath, ret);
+        ModuleFile_Free(&mf);
+        return 1;
+    }
+
+    TraceWriter tw;
+    if (TraceWriter_Open(&tw, outpath) != 0)
+    {
+        printf("%s: can't create file\n", outpath);
+        ModuleFile_Free(&mf);
+        return 1;
+    }
+
+    ret = PlayTraced(&mf.Module, maxticks, WriteRecords, &tw, NULL, NULL);
+
+    if (TraceWriter_Close(&tw) != 0)
+        ret = -1;
+
+    if (ret == 0)
+        printf("%s: %u records\n", outpath, tw.Count);
+    else
+        printf("%s: error writing file\n", outpath);
+
+    ModuleFile_Free(&mf);
+    return (ret == 0) ? 0 : 1;
+}
+
+static int Stats(const char *path)
+{
+    XM7_TraceRecord_Type *records;
+    u32 count;
+
+    if (TraceFile_Read(path, &records, &count) != 0)
+    {
+        printf("%s: can't read trace\n", path);
+        return 1;
+    }
+
+    unsigned long perreg[TRACE_REGISTERS] = { 0 };
+    unsigned long redundant[TRACE_REGISTERS] = { 0 };
+    unsigned long perchannel[16] = { 0 };
+    unsigned long ticks = 0;
+    unsigned long maxpertick = 0;
+    unsigned long pertick = 0;
+    u32 lasttick = 0;
+
+    // last value written to each register of each channel
+    u32 shadow[16][TRACE_REGISTERS] = { { 0 } };
+    u8 written[16][TRACE_REGISTERS] = { { 0 } };
+
+    for (u32 i = 0; i < count; i++)
+    {
+        const XM7_TraceRecord_Type *rec = &records[i];
+
+        if ((i == 0) || (rec->Tick != lasttick))
+        {
+            pertick = 0;
+            lasttick = rec->Tick;
+        }
+
+        pertick++;
+        if (pertick > maxpertick)
+            maxpertick = pertick;
+
+        if (rec->Register >= TRACE_REGISTERS)
+            continue;
+
+        perreg[rec->Register]++;
+
+        if (rec->Channel > 15)
+            continue;
+
+        perchannel[rec->Channel]++;
+
+        if (written[rec->Channel][rec->Register] &&
+            (shadow[rec->Channel][rec->Register] == rec->Value))
+            redundant[rec->Register]++;
+
+        shadow[rec->Channel][rec->Register] = rec->Value;
+        written[rec->Channel][rec->Register] = 1;
+    }
+
+    // ticks without writes don't have records, but they count
+    if (count > 0)
+        ticks = records[count - 1].Tick - records[0].Tick + 1;
+
+    unsigned long totalredundant = 0;
+    for (int i = 0; i < TRACE_REGISTERS; i++)
+        totalredundant += redundant[i];
+
+    printf("%s: %u writes in %lu ticks (%.2f per tick, max %lu)\n", path, count,
+           ticks, (ticks > 0) ? (double)count / ticks : 0, maxpertick);
+    printf("%lu writes (%.1f%%) don't change the value of the register\n",
+           totalredundant, (count > 0) ? totalredundant * 100.0 / count : 0);
+
+    printf("\nRegister   Writes  Same value\n");
+    for (int i = 0; i < TRACE_REGISTERS; i++)
+        printf("%-8s %8lu %11lu\n", RegisterName[i], perreg[i], redundant[i]);
+
+    printf("\nChannel    Writes\n");
+    for (int i = 0; i < 16; i++)
+    {
+        if (perchannel[i] > 0)
+            printf("%7d %9lu\n", i, perchannel[i]);
+    }
+
+    free(records);
+    return 0;
+}
+
+// Backend that prints the operations it receives
+
+static u32 PrintTick;
+
+static void PrintStopSound(void *context, u8 channel)
+{
+    (void)context;
+    printf("%8u  ch %2u  stop\n", PrintTick, channel);
+}
+
+static void PrintStartSound(void *context, u8 channel, u32 cnt, const void *sad,
+                            u16 tmr, u16 pnt, u32 len)
+{
+    (void)context;
+    (void)sad;
+    printf("%8u  ch %2u  start cnt=%08X tmr=%04X pnt=%u len=%u\n", PrintTick,
+           channel, cnt, tmr, pnt, len);
+}
+
+static void PrintSetVolumeandPanning(void *context, u8 channel, u8 vol, u8 pan)
+{
+    (void)context;
+    printf("%8u  ch %2u  vol=%u pan=%u\n", PrintTick, channel, vol, pan);
+}
+
+static void PrintPitchSound(void *context, u8 channel, u16 tmr)
+{
+    (void)context;
+    printf("%8u  ch %2u  tmr=%04X\n", PrintTick, channel, tmr);
+}
+
+static void PrintChangeSample(void *context, u8 channel, const void *sad, u16 pnt, u32 len)
+{
+    (void)context;
+    (void)sad;
+    printf("%8u  ch %2u  change sample pnt=%u len=%u\n", PrintTick, channel, pnt, len);
+}
+
+static void PrintSetTimer(void *context, u16 period, void (*handler)(void))
+{
+    (void)context;
+    (void)handler;
+    printf("%8u  timer 0 period=%u\n", PrintTick, period);
+}
+
+static const void *PrintResolveAddress(void *context, u64 address, u32 size)
+{
+    // the printing backend doesn't read samples
+    (void)context;
+    (void)size;
+    return (const void *)(uintptr_t)address;
+}
+
+static int Print(const char *path)
+{
+    XM7_TraceRecord_Type *records;
+    u32 count;
+
+    if (TraceFile_Read(path, &records, &count) != 0)
+    {
+        printf("%s: can't read trace\n", path);
+        return 1;
+    }
+
+    XM7_Backend_Type backend = {
+        .Context = NULL,
+        .StopSound = PrintStopSound,
+        .StartSound = PrintStartSound,
+        .SetVolumeandPanning = PrintSetVolumeandPanning,
+        .PitchSound = PrintPitchSound,
+        .ChangeSample = PrintChangeSample,
+        .SetTimer = PrintSetTimer,
+    };
+
+    XM7_TraceReplay_Type rp;
+    XM7_TraceReplay_Init(&rp, &backend, records, count);
+    rp.ResolveAddress = PrintResolveAddress;
+
+    // the operations of each tick are printed with the tick number they belong to
+    while (rp.Next < rp.Count)
+    {
+        PrintTick = (rp.Next == 0) ? 1 : rp.Tick + 1;
+        if (XM7_TraceReplay_Tick(&rp) == 0)
+            break;
+    }
+
+    XM7_TraceReplay_Free(&rp);
+    free(records);
+    return 0;
+}
+
+// Verification: the trace is kept in RAM and replayed on another sound unit
+
+typedef struct {
+    XM7_TraceRecord_Type *Records;
+    u32 Count;
+    u32 Capacity;
+} TraceBuffer;
+
+static int KeepRecords(void *arg, const XM7_TraceRecord_Type *records, u32 count)
+{
+    TraceBuffer *tb = arg;
+
+    if (tb->Count + count > tb->Capacity)
+    {
+        u32 capacity = (tb->Capacity + count) * 2;
+        XM7_TraceRecord_Type *newrecords = realloc(tb->Records, capacity * sizeof(XM7_TraceRecord_Type));
+        if (newrecords == NULL)
+            return -1;
+        tb->Records = newrecords;
+        tb->Capacity = capacity;
+    }
+
+    memcpy(&tb->Records[tb->Count], records, count * sizeof(XM7_TraceRecord_Type));
+    tb->Count += count;
+    return 0;
+}
+
+typedef struct {
+    const XM7_ModuleManager_Type *Module;
+    u32 Unresolved;         // addresses that aren't in any sample
+} VerifyContext;
+
+static const void *VerifyResolveAddress(void *context, u64 address, u32 size)
+{
+    VerifyContext *vc = context;
+    const XM7_ModuleManager_Type *module = vc->Module;
+
+    // the trace has the whole address, so it's looked up comparing pointers
+    // like xm7golden does. The channel reads `size` bytes from there, which
+    // must all be in the sample.
+    const u8 *sad = (const u8 *)(uintptr_t)address;
+
+    if ((sad == (const u8 *)&module->Silence) && (size <= sizeof(module->Silence)))
+        return sad;
+
+    for (int i = 0; i < module->NumberofInstruments; i++)
+    {
+        const XM7_Instrument_Type *instr = module->Instrument[i];
+        if (instr == NULL)
+            continue;
+
+        for (int j = 0; j < instr->NumberofSamples; j++)
+        {
+            const XM7_Sample_Type *smp = instr->Sample[j];
+            if ((smp == NULL) || (smp->SampleData == NULL))
+                continue;
+
+            const u8 *start = (const u8 *)smp->SampleData;
+            if ((sad >= start) && (sad < start + smp->Length) &&
+                (size <= (u32)(start + smp->Length - sad)))
+                return sad;
+        }
+    }
+
+    vc->Unresolved++;
+    return NULL;
+}
+
+static int Verify(const char *inpath)
+{
+    ModuleFile mf;
+    int ret = ModuleFile_Load(&mf, inpath);
+    if (ret != 0)
+    {
+        printf("%s: can't load module (error %d)\n", inpath, ret);
+        ModuleFile_Free(&mf);
+        return 1;
+    }
+
+    TraceBuffer tb = { 0 };
+    s16 *audio = NULL;
+    unsigned long long frames = 0;
+
+    if (PlayTraced(&mf.Module, 0, KeepRecords, &tb, &audio, &frames) != 0)
+    {
+        printf("Not enough memory\n");
+        return 1;
+    }
+
+    XM7_SoundUnit_Type su;
+    XM7_SoundUnit_Init(&su, 32768);
+
+    XM7_TraceReplay_Type rp;
+    XM7_TraceReplay_Init(&rp, &su.Backend, tb.Records, tb.Count);
+    VerifyContext vc = { &mf.Module, 0 };
+    rp.ResolveAddress = VerifyResolveAddress;
+    rp.ResolveContext = &vc;
+
+    u32 maxframes = (u64)MAX_TICK_PERIOD * 1024 * 32768 / XM7_BUS_CLOCK + 1;
+    s16 *buffer = malloc(maxframes * 4);
+    unsigned long long done = 0;
+    unsigned long long mismatch = 0;
+
+    while ((buffer != NULL) && (XM7_TraceReplay_Tick(&rp) != 0))
+    {
+        u32 n = XM7_SoundUnit_TickFrames(&su);
+        if ((n == 0) || (done + n > frames))
+            break;
+
+        XM7_SoundUnit_Mix(&su, buffer, n);
+        if (memcmp(buffer, audio + done * 2, n * 4) != 0)
+            mismatch++;
+
+        done += n;
+    }
+
+    ret = ((done == frames) && (mismatch == 0) && (vc.Unresolved == 0)) ? 0 : 1;
+
+    if (ret == 0)
+        printf("%s: OK, %u records, %llu frames replayed identically\n", inpath, tb.Count, done);
+    else
+        printf("%s: FAILED, %llu of %llu frames replayed, %llu ticks differ, %u sample "
+               "addresses not resolved\n", inpath, done, frames, mismatch, vc.Unresolved);
+
+    XM7_TraceReplay_Free(&rp);
+    free(buffer);
+    free(audio);
+    free(tb.Records);
+    ModuleFile_Free(&mf);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc >= 4) && (strcmp(argv[1], "record") == 0))
+    {
+        unsigned long maxticks = (argc > 4) ? strtoul(argv[4], NULL, 0) : 0;
+        return Record(argv[2], argv[3], maxticks);
+    }
+    if ((argc == 3) && (strcmp(argv[1], "stats") == 0))
+        return Stats(argv[2]);
+    if ((argc == 3) && (strcmp(argv[1], "print") == 0))
+        return Print(argv[2]);
+    if ((argc == 3) && (strcmp(argv[1], "verify") == 0))
+        return Verify(argv[2]);
+
+    Usage(argv[0]);
+    return 1;
+}